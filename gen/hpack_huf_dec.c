@@ -32,8 +32,14 @@ static const struct hph tbl[] = {
 
 static const struct hph *eos = &tbl[256];
 
-static void dec_generate(const struct hph *, const struct hph *, uint32_t,
-    int, int, const char *);
+/* NB: decoding tables are referred to by index, to keep pointers out of
+ * the decoding state of a codec. Index zero means a character was found.
+ */
+static char dec_names[32][sizeof "hph_decX_pfxYYYY"];
+static unsigned dec_cnt;
+
+static unsigned dec_generate(const struct hph *, const struct hph *,
+    uint32_t, int, int, const char *);
 
 static int
 dec_rndpow2(int i, int rnd)
@@ -82,7 +88,7 @@ dec_make_hit(const struct hph *hph, struct hph_dec *dec, unsigned n,
 
 	dec[n].len = (uint8_t)(hph->len - oct * 8);
 	dec[n].chr = hph->chr;
-	(void)snprintf(dec[n].nxt, sizeof dec->nxt, "NULL");
+	(void)snprintf(dec[n].nxt, sizeof dec->nxt, "0");
 	return (1);
 }
 
@@ -92,6 +98,7 @@ dec_make_misses(const struct hph *hph, struct hph_dec *dec, int n, int oct)
 	const struct hph *max;
 	char buf[sizeof "_pfxXXXX"];
 	uint32_t msk, sub_msk;
+	unsigned idx;
 	int sz, msk_len, sub_tbl, bits, ref;
 
 	sz = dec_rndpow2(n, +1);
@@ -109,14 +116,13 @@ dec_make_misses(const struct hph *hph, struct hph_dec *dec, int n, int oct)
 
 		if (oct == 4) {
 			dec[n].len = 0;
-			(void)sprintf(dec[n].nxt, "NULL");
+			(void)sprintf(dec[n].nxt, "0");
 			break;
 		}
 		else {
 			assert(oct < 4);
 			(void)sprintf(buf, "_pfx");
 			dec_pfxcat(buf, ref, bits - 1);
-			(void)sprintf(dec[n].nxt, "&hph_dec%c%s", '0' + oct, buf);
 		}
 
 		if (n == 0xff) {
@@ -145,7 +151,8 @@ dec_make_misses(const struct hph *hph, struct hph_dec *dec, int n, int oct)
 		}
 
 		assert(max > hph);
-		dec_generate(hph, max, msk, msk_len, oct, buf);
+		idx = dec_generate(hph, max, msk, msk_len, oct, buf);
+		(void)sprintf(dec[n].nxt, "%u", idx);
 		hph = max;
 
 		ref++;
@@ -157,7 +164,7 @@ dec_make_misses(const struct hph *hph, struct hph_dec *dec, int n, int oct)
 	return ((unsigned)sz);
 }
 
-static void
+static unsigned
 dec_generate(const struct hph *hph, const struct hph *max, uint32_t msk,
     int msk_len, int oct, const char *pfx)
 {
@@ -198,11 +205,17 @@ dec_generate(const struct hph *hph, const struct hph *max, uint32_t msk,
 	OUT("");
 	GEN("static const struct hph_dec hph_dec%d%s = {%u, hph_oct%d%s};",
 	    oct, pfx, len, oct, pfx);
+
+	dec_cnt++;
+	assert(dec_cnt < 32);
+	(void)sprintf(dec_names[dec_cnt], "hph_dec%d%s", oct, pfx);
+	return (dec_cnt);
 }
 
 int
 main(void)
 {
+	unsigned n, root;
 
 	GEN_HDR();
 	OUT("struct hph_oct;");
@@ -215,10 +228,19 @@ main(void)
 	OUT("struct hph_oct {");
 	OUT("\tuint8_t\t\t\tlen;");
 	OUT("\tchar\t\t\tchr;");
-	OUT("\tconst struct hph_dec\t*nxt;");
+	OUT("\tuint8_t\t\t\tnxt;");
 	OUT("};");
 
-	dec_generate(tbl, eos, 0x00000000, 8, 0, "");
+	root = dec_generate(tbl, eos, 0x00000000, 8, 0, "");
+
+	OUT("");
+	OUT("static const struct hph_dec * const hph_dec_tbl[] = {");
+	OUT("\tNULL,");
+	for (n = 1; n <= dec_cnt; n++)
+		GEN("\t&%s,", dec_names[n]);
+	OUT("};");
+	OUT("");
+	GEN("#define HPH_DEC0\t%u", root);
 
 	return (0);
 }
@@ -63,7 +63,7 @@ main(void)
 	OUT("static const struct hpt_field hpack_static_hdr[] = {");
 	fld = static_tbl;
 	while (fld->nam != NULL) {
-		GEN("\t{ \"%s\", \"%s\", %zu, %zu, %zu },",
+		GEN("\t{ \"%s\", \"%s\", %zu, %zu, %zu, 0, 0 },",
 		    fld->nam, fld->val, strlen(fld->nam), strlen(fld->val),
 		    fld->idx);
 		fld++;
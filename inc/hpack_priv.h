@@ -13,6 +13,26 @@
 #define HPACK_LIMIT(hp) \
 	(((hp)->sz.lim >= 0 ? (size_t)(hp)->sz.lim : (hp)->sz.max))
 
+/* NB: for shared objects with optional lock and unlock callbacks */
+#define HPACK_LOCK(obj)					\
+	do {						\
+		if ((obj)->lock != NULL)		\
+			(obj)->lock((obj)->priv);	\
+	} while (0)
+
+#define HPACK_UNLOCK(obj)				\
+	do {						\
+		if ((obj)->unlock != NULL)		\
+			(obj)->unlock((obj)->priv);	\
+	} while (0)
+
+/* NB: for flags read outside of the lock when atomics are available */
+#ifdef HAVE_ATOMIC_BUILTINS
+#  define HPACK_ATOMIC_LOAD(ptr)	__atomic_load_n(ptr, __ATOMIC_RELAXED)
+#  define HPACK_ATOMIC_STORE(ptr, val)	\
+	__atomic_store_n(ptr, val, __ATOMIC_RELAXED)
+#endif
+
 #define CALL(func, ...)					\
 	do {						\
 		if ((func)(__VA_ARGS__) != 0)		\
@@ -34,6 +54,12 @@
 #endif
 
 #define HPD_FLG_MON	0x01
+#define HPE_FLG_ENC	0x02 /* survives a defunct magic */
+#define HPD_FLG_LZY	0x04
+#define HPD_FLG_HUF	0x08
+#define HPE_FLG_ADP	0x10
+#define HPE_FLG_LKA	0x20
+#define HPE_FLG_GOV	0x40 /* limit lowered by the governor */
 
 #define HPT_FLG_STATIC	0x01
 #define HPT_FLG_DYNAMIC	0x02
@@ -66,23 +92,59 @@ struct hpt_field {
 	uint16_t	nam_sz;
 	uint16_t	val_sz;
 	uint16_t	idx;
+	uint16_t	nam_huf; /* Huffman-coded length, or zero */
+	uint16_t	val_huf;
 };
 
+/* NB: An entry only physically stores its header followed by its name and
+ * value with their null terminators. The header is not aligned and must be
+ * copied before use. Eviction decisions still rely on the RFC 7541 section
+ * 4.1 accounting of 32 octets per entry, so a table physically uses fewer
+ * octets than its size.
+ *
+ * When the name is also found in the static table, a zero nam_sz means
+ * that only its static index is stored in a single octet, in place of the
+ * name and its null terminator.
+ */
 struct hpt_entry {
-	uint32_t	magic;
-#define HPT_ENTRY_MAGIC	0xe4582b39
-	uint32_t	align; /* fill a hole on 64-bit systems */
-	uint64_t	pre_sz;
+	uint16_t	pre_sz; /* physical size of the previous entry */
 	uint16_t	nam_sz;
 	uint16_t	val_sz;
-	uint16_t	pad[5];
-	/* NB: The last two bytes are never written nor read. They are here
-	 * only to guarantee that this struct size is exactly 32 bytes, the
-	 * per-entry overhead defined in RFC 7541 section 4.1.
-	 */
-	uint16_t	unused;
 };
 
+/* NB: A decoder may store its strings Huffman-coded, in which case the
+ * header is followed by the decoded lengths and the entry's nam_sz and
+ * val_sz hold the stored lengths. A string is only stored Huffman-coded
+ * when it gets shorter, and otherwise it is stored with its terminator.
+ */
+struct hpt_huffman {
+	uint16_t	nam_sz;
+	uint16_t	val_sz;
+};
+
+/* NB: A codec sharing an intern pool stores references to the pool's
+ * strings instead of the strings themselves, after the header. A static
+ * name is still stored as its index, and the entry's nam_sz and val_sz
+ * keep the lengths of the strings.
+ */
+struct hpx_string {
+	uint32_t		magic;
+#define HPX_STRING_MAGIC	0x2b8f41d7
+	uint32_t		hash;
+	struct hpx_string	*nxt;
+	size_t			ref; /* atomic, or guarded by the pool's lock */
+	size_t			len;
+	char			str[];
+};
+
+#define HPX_HASH_INIT		0x811c9dc5 /* 32-bit FNV-1a offset basis */
+
+#define HPT_HEADERSZ	sizeof(struct hpt_entry)
+#define HPT_HUFFMANSZ	sizeof(struct hpt_huffman)
+#define HPT_HANDLESZ	sizeof(struct hpx_string *)
+#define HPT_ENTRYSZ(nam_sz, val_sz) \
+	(HPT_HEADERSZ + (nam_sz) + (val_sz) + 2) /* account for 2 null bytes */
+
 #define HPACK_CTX_CAN_UPD (unsigned)1
 #define HPACK_CTX_TOO_BIG (unsigned)2
 
@@ -130,8 +192,11 @@ struct hpack_size {
 	 * the cap field to be applied when the next header list is encoded.
 	 */
 	ssize_t			cap;
-	/* NB: len is the current length of the dynamic table. */
+	/* NB: len is the current length of the dynamic table, as accounted
+	 * by RFC 7541, and use is the space it physically occupies.
+	 */
 	size_t			len;
+	size_t			use;
 	/* NB: When the size is updated out of band by the decoder, it must be
 	 * signalled by the encoder in an HPACK block. However, this change is
 	 * deferred until the encoder acknowledges the change happening out of
@@ -154,11 +219,10 @@ struct hpack_int_state {
 };
 
 struct hpack_str_state {
-	const struct hph_dec	*dec;
-	const struct hph_oct	*oct;
 	uint16_t		len;
 	uint16_t		bits;
 	uint8_t			blen;
+	uint8_t			nod; /* Huffman decoding table index */
 };
 
 struct hpack_state {
@@ -176,6 +240,64 @@ struct hpack_state {
 	} stt;
 };
 
+/* NB: A lazy decoder allocates its dynamic table separately, since the
+ * table may grow in the middle of a block while the codec must stay where
+ * it is. It trades the single allocation for a smaller memory footprint.
+ */
+struct hpack_lazy {
+	struct hpt_entry	*tbl;
+	unsigned		low; /* consecutive blocks with a low usage */
+};
+
+/* NB: Strings of a Huffman-coded table are decoded in place when they are
+ * decoded in a header list. Otherwise they are decoded in a scratch buffer
+ * valid until the next call with the codec.
+ */
+struct hpack_huffman {
+	char			*buf;
+	size_t			len;
+};
+
+/* NB: An adaptive encoder collects statistics over a window of header
+ * lists before moving its target limit. It goes up when entries were
+ * evicted while the table saved at least one octet per octet of limit,
+ * and down when it saved less than a quarter of that. The target is then
+ * applied like a limit when the next header list is encoded.
+ */
+struct hpack_adaptive {
+	size_t			lim; /* target limit, or zero */
+	size_t			fld; /* encoded fields */
+	size_t			hit; /* fields referencing the dynamic table */
+	size_t			sav; /* octets not encoded thanks to hits */
+	size_t			evi; /* evicted entries */
+	unsigned		blk; /* header lists */
+};
+
+#define HPE_ADP_WINDOW	32
+#define HPE_ADP_MIN	256
+#define HPE_ADP_HIT	4 /* at least one field in 4 to grow */
+
+#define HPE_LKA_WINDOW	64 /* fields looked ahead */
+#define HPE_LKA_STEP	32 /* fields between two windows */
+
+/* NB: The heat of a dynamic entry counts its references since it was
+ * inserted. Entries are numbered in insertion order with seq, and their
+ * heat is kept in a ring of slots. In a table holding more entries than
+ * slots, entries share slots and their heat is overestimated.
+ */
+#define HPE_HOT_SLOTS	256 /* power of two */
+#define HPE_HOT_MIN	2 /* references of a hot entry */
+#define HPE_HOT_TAIL	4 /* refresh in the last 1/n of the limit */
+
+struct hpack_heat {
+	uint32_t		seq; /* inserted entries */
+	uint8_t			pnd; /* heat of the next entry */
+	uint8_t			cnt[HPE_HOT_SLOTS];
+};
+
+#define HPE_HOT_SLOT(hot, idx) \
+	(hot)->cnt[((hot)->seq - (uint32_t)(idx)) & (HPE_HOT_SLOTS - 1)]
+
 struct hpack {
 	uint32_t		magic;
 #define ENCODER_MAGIC		0x8ab1fb4c
@@ -186,10 +308,32 @@ struct hpack {
 	struct hpack_size	sz;
 	struct hpack_state	state;
 	size_t			cnt; /* number of entries in the table */
+	struct hpack_lazy	lzy;
+	struct hpack_huffman	huf;
+	struct hpack_intern	*itn; /* shared strings */
+	struct hpack_governor	*gov; /* shared memory budget */
+	ssize_t			gvl; /* limit before the governor lowered it */
+	struct hpack_adaptive	adp;
+	struct hpack_admission	*adm; /* auto-index admission */
+	struct hpn_learner	*lrn; /* learner of a shared profile */
+	struct hpack_heat	*hot; /* dynamic entries references */
+	/* NB: The context is only meaningful during a call, and between the
+	 * calls of a cut block. It is set up by every entry point, so that
+	 * an idle codec holds no pointer to itself and may be moved around
+	 * without any fixup.
+	 *
+	 * The other pointers reference memory outside of the codec. The lzy,
+	 * huf, adm, hot and lrn features require a memory manager, only itn
+	 * and gov are available to a codec built in the caller's memory, and
+	 * they tie it to the process owning the pool or the governor.
+	 */
 	struct hpack_ctx	ctx;
 	struct hpt_entry	tbl[];
 };
 
+#define HPT_TABLE(hp) \
+	((hp)->lzy.tbl != NULL ? (hp)->lzy.tbl : (hp)->tbl)
+
 typedef int hpack_validate_f(HPACK_CTX, const char *, size_t);
 
 /**********************************************************************
@@ -201,6 +345,7 @@ void HPC_notify(HPACK_CTX, enum hpack_event_e, const void *, size_t);
 int  HPD_putc(HPACK_CTX, char);
 int  HPD_puts(HPACK_CTX, const char *, size_t);
 int  HPD_cat(HPACK_CTX, const char *, size_t);
+int  HPD_expand(HPACK_CTX, const char *, size_t, size_t);
 void HPD_notify(HPACK_CTX);
 
 void HPE_putb(HPACK_CTX, uint8_t);
@@ -208,10 +353,13 @@ void HPE_bcat(HPACK_CTX, const void *, size_t);
 void HPE_send(HPACK_CTX);
 
 int  HPI_decode(HPACK_CTX, enum hpi_prefix_e, uint16_t *);
+int  HPI_load(HPACK_CTX, uint16_t *);
 void HPI_encode(HPACK_CTX, enum hpi_prefix_e, enum hpi_pattern_e, uint16_t);
 
 int    HPH_decode(HPACK_CTX, size_t);
+int    HPH_expand(const void *, size_t, char *, size_t);
 void   HPH_encode(HPACK_CTX, const char *);
+void   HPH_pack(const char *, void *);
 size_t HPH_size(const char *);
 
 hpack_validate_f HPV_token;
@@ -219,8 +367,39 @@ hpack_validate_f HPV_value;
 
 void HPT_adjust(HPACK_CTX, size_t);
 int  HPT_field(HPACK_CTX, size_t, struct hpt_field *);
-void HPT_foreach(HPACK_CTX, int);
+int  HPT_foreach(HPACK_CTX, int);
 int  HPT_search(HPACK_CTX, struct hpt_field *);
+size_t HPT_tail(struct hpack *, size_t);
 int  HPT_decode(HPACK_CTX, size_t);
 int  HPT_decode_name(HPACK_CTX);
-void HPT_index(HPACK_CTX);
+int  HPT_index(HPACK_CTX);
+int  HPT_realloc(struct hpack *, size_t);
+void HPT_shrink(struct hpack *);
+void HPT_save(HPACK_CTX, unsigned);
+int  HPT_restore(HPACK_CTX, size_t);
+int  HPT_expand(struct hpack *, struct hpt_field *);
+void HPT_release(struct hpack *);
+void HPT_clear(struct hpack *);
+
+uint32_t HPX_hash(uint32_t, const char *, size_t);
+struct hpx_string * HPX_acquire(struct hpack_intern *, const char *, size_t);
+void HPX_release(struct hpack_intern *, struct hpx_string *);
+int  HPX_valid(const struct hpack_intern *);
+
+int  HPA_admit(struct hpack_admission *, const char *, const char *);
+struct hpack_admission * HPA_new(const struct hpack_alloc *);
+void HPA_clear(struct hpack_admission *);
+void HPA_free(const struct hpack_alloc *, struct hpack_admission *);
+
+void HPG_account(struct hpack_governor *, size_t, size_t);
+void HPG_attach(struct hpack_governor *, size_t);
+void HPG_detach(struct hpack_governor *, size_t);
+int  HPG_share(struct hpack_governor *, size_t *);
+int  HPG_valid(const struct hpack_governor *);
+
+struct hpn_learner *HPN_attach(struct hpack_profile *);
+void HPN_detach(struct hpn_learner *);
+void HPN_merge(struct hpn_learner *);
+void HPN_block(struct hpn_learner *);
+void HPN_advise(struct hpn_learner *, struct hpack_field *, int);
+int  HPN_valid(const struct hpack_profile *);
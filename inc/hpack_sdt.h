@@ -0,0 +1,22 @@
+/*-
+ * License: BSD-2-Clause
+ * (c) 2026 Dridi Boukelmoune <dridi.boukelmoune@gmail.com>
+ *
+ * Statically defined tracing probes (USDT)
+ *
+ * The probes are only emitted with --enable-usdt, otherwise they compile to
+ * nothing and their arguments are never evaluated.
+ */
+
+#ifdef HAVE_USDT
+#  include <sys/sdt.h>
+#  define PROBE1(nam, a)		DTRACE_PROBE1(cashpack, nam, a)
+#  define PROBE2(nam, a, b)		DTRACE_PROBE2(cashpack, nam, a, b)
+#  define PROBE3(nam, a, b, c)		DTRACE_PROBE3(cashpack, nam, a, b, c)
+#  define PROBE4(nam, a, b, c, d)	DTRACE_PROBE4(cashpack, nam, a, b, c, d)
+#else
+#  define PROBE1(nam, a)		do { } while (0)
+#  define PROBE2(nam, a, b)		do { } while (0)
+#  define PROBE3(nam, a, b, c)		do { } while (0)
+#  define PROBE4(nam, a, b, c, d)	do { } while (0)
+#endif
@@ -17,6 +17,7 @@
 #include "hpack.h"
 #include "hpack_assert.h"
 #include "hpack_priv.h"
+#include "hpack_sdt.h"
 
 #define FUNC_PTR(f)	(const void *)(const uint8_t *)&(f)
 #define HPACK_FLG(f)	((unsigned)HPACK_FLG_##f)
@@ -58,10 +59,52 @@ static const struct hpack_alloc hpack_libc_alloc = {
 
 const struct hpack_alloc *hpack_default_alloc = &hpack_libc_alloc;
 
+/* NB: codecs constructed in place never call the memory manager */
+static const struct hpack_alloc hpack_null_alloc = {
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+/* NB: the strictest alignment among struct hpack members */
+struct hpack_align {
+	char			c;
+	union {
+		uint64_t	u;
+		size_t		sz;
+		void		*ptr;
+		hpack_malloc_f	*fn;
+	}			mbr;
+};
+
+#define HPACK_ALIGN	offsetof(struct hpack_align, mbr)
+
 /**********************************************************************
  * Memory management
  */
 
+static void
+hpack_init(struct hpack *hp, uint32_t magic, uint32_t flg, size_t mem,
+    size_t max, const struct hpack_alloc *ha)
+{
+
+	assert(mem >= max || magic == ENCODER_MAGIC || flg & HPD_FLG_LZY);
+
+	(void)memset(hp, 0, sizeof *hp);
+	hp->magic = magic;
+	hp->flg = flg;
+	if (magic == ENCODER_MAGIC)
+		hp->flg |= HPE_FLG_ENC;
+	(void)memcpy(&hp->alloc, ha, sizeof *ha);
+	hp->sz.mem = mem;
+	hp->sz.max = max;
+	hp->sz.lim = -1;
+	hp->sz.cap = -1;
+	hp->sz.nxt = -1;
+	hp->sz.min = -1;
+}
+
 static struct hpack *
 hpack_new(uint32_t magic, size_t mem, size_t max,
     const struct hpack_alloc *ha)
@@ -72,22 +115,11 @@ hpack_new(uint32_t magic, size_t mem, size_t max,
 	    mem > UINT16_MAX)
 		return (NULL);
 
-	assert(mem >= max || magic == ENCODER_MAGIC);
-
 	hp = ha->malloc(sizeof *hp + mem, ha->priv);
 	if (hp == NULL)
 		return (NULL);
 
-	(void)memset(hp, 0, sizeof *hp);
-	hp->magic = magic;
-	hp->ctx.hp = hp;
-	(void)memcpy(&hp->alloc, ha, sizeof *ha);
-	hp->sz.mem = mem;
-	hp->sz.max = max;
-	hp->sz.lim = -1;
-	hp->sz.cap = -1;
-	hp->sz.nxt = -1;
-	hp->sz.min = -1;
+	hpack_init(hp, magic, 0, mem, max, ha);
 	return (hp);
 }
 
@@ -122,6 +154,36 @@ hpack_decoder(size_t max, ssize_t rsz, const struct hpack_alloc *ha)
 	return (hpack_new(DECODER_MAGIC, mem, max, ha));
 }
 
+static struct hpack *
+hpack_new_lazy(size_t mem, size_t max, const struct hpack_alloc *ha)
+{
+	struct hpack *hp;
+
+	if (ha == NULL || ha->malloc == NULL || ha->realloc == NULL ||
+	    max > UINT16_MAX)
+		return (NULL);
+
+	hp = ha->malloc(sizeof *hp, ha->priv);
+	if (hp == NULL)
+		return (NULL);
+
+	hpack_init(hp, DECODER_MAGIC, HPD_FLG_LZY, 0, max, ha);
+	if (mem > max)
+		mem = max;
+	if (mem > 0 && HPT_realloc(hp, mem) != 0) {
+		hpack_free(&hp);
+		return (NULL);
+	}
+	return (hp);
+}
+
+struct hpack *
+hpack_decoder_lazy(size_t max, ssize_t rsz, const struct hpack_alloc *ha)
+{
+
+	return (hpack_new_lazy(rsz > 0 ? (size_t)rsz : 0, max, ha));
+}
+
 struct hpack *
 hpack_monitor(size_t max, ssize_t rsz, const struct hpack_alloc *ha)
 {
@@ -133,14 +195,228 @@ hpack_monitor(size_t max, ssize_t rsz, const struct hpack_alloc *ha)
 	return (hp);
 }
 
+enum hpack_result_e
+hpack_compress(struct hpack *hp)
+{
+
+	if (hp == NULL || hp->magic != DECODER_MAGIC ||
+	    hp->alloc.malloc == NULL || hp->itn != NULL)
+		return (HPACK_RES_ARG);
+
+	if (hp->ctx.res != HPACK_RES_OK) {
+		assert(hp->ctx.res == HPACK_RES_BLK);
+		return (HPACK_RES_BSY);
+	}
+
+	/* NB: entries are only compressed when they are inserted */
+	if (hp->cnt > 0)
+		return (HPACK_RES_ARG);
+
+	hp->flg |= HPD_FLG_HUF;
+	return (HPACK_RES_OK);
+}
+
+enum hpack_result_e
+hpack_adapt(struct hpack *hp)
+{
+
+	if (hp == NULL || hp->magic != ENCODER_MAGIC)
+		return (HPACK_RES_ARG);
+
+	if (hp->ctx.res != HPACK_RES_OK) {
+		assert(hp->ctx.res == HPACK_RES_BLK);
+		return (HPACK_RES_BSY);
+	}
+
+	hp->flg |= HPE_FLG_ADP;
+	return (HPACK_RES_OK);
+}
+
+enum hpack_result_e
+hpack_lookahead(struct hpack *hp)
+{
+
+	if (hp == NULL || hp->magic != ENCODER_MAGIC)
+		return (HPACK_RES_ARG);
+
+	if (hp->ctx.res != HPACK_RES_OK) {
+		assert(hp->ctx.res == HPACK_RES_BLK);
+		return (HPACK_RES_BSY);
+	}
+
+	hp->flg |= HPE_FLG_LKA;
+	return (HPACK_RES_OK);
+}
+
+enum hpack_result_e
+hpack_admit(struct hpack *hp)
+{
+
+	if (hp == NULL || hp->magic != ENCODER_MAGIC ||
+	    hp->alloc.malloc == NULL)
+		return (HPACK_RES_ARG);
+
+	if (hp->ctx.res != HPACK_RES_OK) {
+		assert(hp->ctx.res == HPACK_RES_BLK);
+		return (HPACK_RES_BSY);
+	}
+
+	if (hp->adm == NULL)
+		hp->adm = HPA_new(&hp->alloc);
+	if (hp->adm == NULL)
+		return (HPACK_RES_OOM);
+	return (HPACK_RES_OK);
+}
+
+enum hpack_result_e
+hpack_refresh(struct hpack *hp)
+{
+
+	if (hp == NULL || hp->magic != ENCODER_MAGIC ||
+	    hp->alloc.malloc == NULL)
+		return (HPACK_RES_ARG);
+
+	if (hp->ctx.res != HPACK_RES_OK) {
+		assert(hp->ctx.res == HPACK_RES_BLK);
+		return (HPACK_RES_BSY);
+	}
+
+	if (hp->hot != NULL)
+		return (HPACK_RES_OK);
+
+	hp->hot = hp->alloc.malloc(sizeof *hp->hot, hp->alloc.priv);
+	if (hp->hot == NULL)
+		return (HPACK_RES_OOM);
+	(void)memset(hp->hot, 0, sizeof *hp->hot);
+	return (HPACK_RES_OK);
+}
+
+enum hpack_result_e
+hpack_share(struct hpack *hp, struct hpack_intern *itn)
+{
+
+	if (hp == NULL || !HPX_valid(itn))
+		return (HPACK_RES_ARG);
+	if (hp->magic != DECODER_MAGIC && hp->magic != ENCODER_MAGIC)
+		return (HPACK_RES_ARG);
+	if (hp->flg & HPD_FLG_HUF)
+		return (HPACK_RES_ARG);
+
+	if (hp->ctx.res != HPACK_RES_OK) {
+		assert(hp->ctx.res == HPACK_RES_BLK);
+		return (HPACK_RES_BSY);
+	}
+
+	/* NB: entries only reference the pool they were inserted with */
+	if (hp->cnt > 0)
+		return (HPACK_RES_ARG);
+
+	hp->itn = itn;
+	return (HPACK_RES_OK);
+}
+
+enum hpack_result_e
+hpack_govern(struct hpack *hp, struct hpack_governor *gov)
+{
+
+	if (hp == NULL || !HPG_valid(gov))
+		return (HPACK_RES_ARG);
+	if (hp->magic != DECODER_MAGIC && hp->magic != ENCODER_MAGIC)
+		return (HPACK_RES_ARG);
+	if (hp->gov != NULL)
+		return (HPACK_RES_ARG);
+
+	if (hp->ctx.res != HPACK_RES_OK) {
+		assert(hp->ctx.res == HPACK_RES_BLK);
+		return (HPACK_RES_BSY);
+	}
+
+	HPG_attach(gov, hp->sz.mem);
+	hp->gov = gov;
+	return (HPACK_RES_OK);
+}
+
+static size_t
+hpack_govern_target(const struct hpack *hp)
+{
+
+	assert(hp->flg & HPE_FLG_GOV);
+	if (hp->gvl >= 0 && (size_t)hp->gvl < hp->sz.max)
+		return ((size_t)hp->gvl);
+	return (hp->sz.max);
+}
+
+enum hpack_result_e
+hpack_learn(struct hpack *hp, struct hpack_profile *prf)
+{
+
+	if (hp == NULL || hp->magic != ENCODER_MAGIC || !HPN_valid(prf))
+		return (HPACK_RES_ARG);
+	if (hp->alloc.malloc == NULL || hp->lrn != NULL)
+		return (HPACK_RES_ARG);
+
+	if (hp->ctx.res != HPACK_RES_OK) {
+		assert(hp->ctx.res == HPACK_RES_BLK);
+		return (HPACK_RES_BSY);
+	}
+
+	hp->lrn = HPN_attach(prf);
+	if (hp->lrn == NULL)
+		return (HPACK_RES_OOM);
+	return (HPACK_RES_OK);
+}
+
+size_t
+hpack_sizeof(size_t max)
+{
+
+	if (max > UINT16_MAX)
+		return (0);
+	return (sizeof(struct hpack) + max);
+}
+
+static struct hpack *
+hpack_place(uint32_t magic, void *mem, size_t len, size_t max)
+{
+	struct hpack *hp;
+	size_t tbl;
+
+	if (mem == NULL || max > UINT16_MAX || len < hpack_sizeof(max))
+		return (NULL);
+	if ((uintptr_t)mem % HPACK_ALIGN != 0)
+		return (NULL);
+
+	tbl = len - sizeof *hp;
+	if (tbl > UINT16_MAX)
+		tbl = UINT16_MAX;
+
+	hp = mem;
+	hpack_init(hp, magic, 0, tbl, max, &hpack_null_alloc);
+	return (hp);
+}
+
+struct hpack *
+hpack_decoder_init(void *mem, size_t len, size_t max)
+{
+
+	return (hpack_place(DECODER_MAGIC, mem, len, max));
+}
+
+struct hpack *
+hpack_encoder_init(void *mem, size_t len, size_t max)
+{
+
+	return (hpack_place(ENCODER_MAGIC, mem, len, max));
+}
+
 static enum hpack_result_e
 hpack_realloc(struct hpack **hpp, size_t mem)
 {
 	struct hpack *hp;
 
 	hp = *hpp;
-	if (mem <= hp->sz.mem)
-		return (HPACK_RES_OK);
+	if (mem <= hp->sz.mem || hp->flg & HPD_FLG_LZY)
+		return (HPACK_RES_OK); /* lazy tables grow on demand */
 
 	assert(hp->sz.len <= mem);
 	if (hp->alloc.realloc == NULL)
@@ -150,14 +426,14 @@ hpack_realloc(struct hpack **hpp, size_t mem)
 	if (hp == NULL)
 		return (HPACK_RES_OOM);
 
-	hp->ctx.hp = hp;
+	HPG_account(hp->gov, hp->sz.mem, mem);
 	hp->sz.mem = mem;
 	*hpp = hp;
 	return (HPACK_RES_OK);
 }
 
-enum hpack_result_e
-hpack_resize(struct hpack **hpp, size_t len)
+static enum hpack_result_e
+hpack_resize_codec(struct hpack **hpp, size_t len)
 {
 	struct hpack *hp;
 	enum hpack_result_e res;
@@ -181,16 +457,23 @@ hpack_resize(struct hpack **hpp, size_t len)
 	mem = len;
 
 	if (hp->magic == ENCODER_MAGIC) {
-		if (hp->sz.lim >= 0) {
-			assert(hp->sz.lim == hp->sz.cap);
+		/* NB: an applied limit above the new maximum has no effect,
+		 * whether it was chosen by the user, the adaptive policy or
+		 * the governor, and must not outlive the smaller maximum. A
+		 * pending limit is checked when the update is encoded.
+		 */
+		if (hp->sz.lim > (ssize_t)len)
+			hp->sz.lim = -1;
+
+		if (hp->sz.cap >= 0) {
+			assert((size_t)hp->sz.cap <= max);
+			mem = (size_t)hp->sz.cap;
+		}
+		else if (hp->sz.lim >= 0) {
 			assert((size_t)hp->sz.lim <= hp->sz.mem);
 			assert((size_t)hp->sz.lim >= hp->sz.len);
 			mem = (size_t)hp->sz.lim;
 		}
-		else if (hp->sz.cap >= 0) {
-			assert((size_t)hp->sz.cap <= max);
-			mem = (size_t)hp->sz.cap;
-		}
 	}
 
 	if (mem > max) {
@@ -222,6 +505,16 @@ hpack_resize(struct hpack **hpp, size_t len)
 	return (HPACK_RES_OK);
 }
 
+enum hpack_result_e
+hpack_resize(struct hpack **hpp, size_t len)
+{
+	enum hpack_result_e res;
+
+	res = hpack_resize_codec(hpp, len);
+	PROBE3(resize, hpp != NULL ? *hpp : NULL, len, res);
+	return (res);
+}
+
 enum hpack_result_e
 hpack_limit(struct hpack **hpp, size_t len)
 {
@@ -244,10 +537,8 @@ hpack_limit(struct hpack **hpp, size_t len)
 	if (len > UINT16_MAX)
 		return (HPACK_RES_LEN); /* the codec is NOT defunct */
 
-	mem = hp->sz.mem;
-	if (len >= hp->sz.max && mem < hp->sz.max)
-		mem = hp->sz.max;
-
+	/* NB: a trimmed table may need to grow back */
+	mem = len < hp->sz.max ? len : hp->sz.max;
 	res = hpack_realloc(&hp, mem);
 	if (res < 0) {
 		assert(*hpp == hp);
@@ -258,6 +549,8 @@ hpack_limit(struct hpack **hpp, size_t len)
 
 	*hpp = hp;
 	hp->sz.cap = (ssize_t)len;
+	hp->adp.lim = 0; /* the policy starts over from here */
+	hp->flg &= ~HPE_FLG_GOV;
 	return (HPACK_RES_OK);
 }
 
@@ -265,7 +558,8 @@ enum hpack_result_e
 hpack_trim(struct hpack **hpp)
 {
 	struct hpack *hp;
-	size_t max;
+	enum hpack_result_e res;
+	size_t max, tgt, shr;
 
 	if (hpp == NULL)
 		return (HPACK_RES_ARG);
@@ -282,15 +576,46 @@ hpack_trim(struct hpack **hpp)
 	}
 
 	assert(hp->sz.lim <= (ssize_t) hp->sz.max);
+	HPT_release(hp);
+	if (hp->flg & HPD_FLG_LZY) {
+		if (HPT_realloc(hp, hp->sz.use) != 0)
+			return (HPACK_RES_OOM); /* the codec is NOT defunct */
+		return (HPACK_RES_OK);
+	}
+
 	if (hp->magic == ENCODER_MAGIC)
 		max = HPACK_LIMIT(hp);
 	else
 		max = hp->sz.max;
 
+	/* NB: an adaptive encoder's memory follows its target, and so does
+	 * the memory of an encoder no longer under the governor's pressure.
+	 */
+	tgt = 0;
+	if (hp->flg & HPE_FLG_ADP) {
+		tgt = hp->adp.lim;
+		if (hp->gov != NULL && HPG_share(hp->gov, &shr) && tgt > shr)
+			tgt = shr;
+	}
+	else if (hp->flg & HPE_FLG_GOV && !HPG_share(hp->gov, &shr))
+		tgt = hpack_govern_target(hp);
+	if (tgt > max) {
+		max = tgt;
+		if (max > hp->sz.max)
+			max = hp->sz.max;
+		if (max > hp->sz.mem) {
+			res = hpack_realloc(&hp, max);
+			if (res != HPACK_RES_OK)
+				return (res); /* the codec is NOT defunct */
+			*hpp = hp;
+		}
+	}
+
 	if (hp->sz.mem > max) {
 		hp = hp->alloc.realloc(hp, sizeof *hp + max, hp->alloc.priv);
 		if (hp == NULL)
 			return (HPACK_RES_OOM); /* the codec is NOT defunct */
+		HPG_account(hp->gov, hp->sz.mem, max);
 		hp->sz.mem = max;
 		*hpp = hp;
 	}
@@ -298,6 +623,71 @@ hpack_trim(struct hpack **hpp)
 	return (HPACK_RES_OK);
 }
 
+enum hpack_result_e
+hpack_reset(struct hpack **hpp, size_t max)
+{
+	struct hpack_alloc ha;
+	struct hpack_lazy lzy;
+	struct hpack_admission *adm;
+	struct hpn_learner *lrn;
+	struct hpack_heat *hot;
+	struct hpack_intern *itn;
+	struct hpack_governor *gov;
+	struct hpack *hp;
+	enum hpack_result_e res;
+	uint32_t magic, flg;
+
+	if (hpp == NULL)
+		return (HPACK_RES_ARG);
+
+	hp = *hpp;
+	if (hp == NULL)
+		return (HPACK_RES_ARG);
+	if (hp->magic != DECODER_MAGIC && hp->magic != ENCODER_MAGIC &&
+	    hp->magic != DEFUNCT_MAGIC)
+		return (HPACK_RES_ARG);
+
+	/* NB: the codec is left untouched when the reset fails */
+	if (max > UINT16_MAX)
+		return (HPACK_RES_LEN);
+
+	if (max > hp->sz.mem) {
+		if (hp->alloc.realloc == NULL)
+			return (HPACK_RES_LEN);
+		res = hpack_realloc(&hp, max);
+		if (res != HPACK_RES_OK)
+			return (res);
+		*hpp = hp;
+	}
+
+	magic = (hp->flg & HPE_FLG_ENC) ? ENCODER_MAGIC : DECODER_MAGIC;
+	flg = hp->flg & (HPD_FLG_MON | HPD_FLG_LZY | HPD_FLG_HUF |
+	    HPE_FLG_ADP | HPE_FLG_LKA);
+	HPT_release(hp);
+	HPT_clear(hp);
+	(void)memcpy(&ha, &hp->alloc, sizeof ha);
+	(void)memcpy(&lzy, &hp->lzy, sizeof lzy);
+	itn = hp->itn;
+	gov = hp->gov;
+	adm = hp->adm;
+	lrn = hp->lrn;
+	hot = hp->hot;
+	hpack_init(hp, magic, flg, hp->sz.mem, max, &ha);
+	hp->lzy.tbl = lzy.tbl;
+	hp->itn = itn;
+	hp->gov = gov;
+	hp->adm = adm;
+	hp->lrn = lrn;
+	hp->hot = hot;
+	if (lrn != NULL)
+		HPN_merge(lrn);
+	if (adm != NULL)
+		HPA_clear(adm);
+	if (hot != NULL)
+		(void)memset(hot, 0, sizeof *hot);
+	return (HPACK_RES_OK);
+}
+
 void
 hpack_free(struct hpack **hpp)
 {
@@ -316,10 +706,278 @@ hpack_free(struct hpack **hpp)
 		return;
 
 	hp->magic = 0;
+	HPT_release(hp);
+	HPT_clear(hp);
+	if (hp->gov != NULL)
+		HPG_detach(hp->gov, hp->sz.mem);
+	HPA_free(&hp->alloc, hp->adm);
+	HPN_detach(hp->lrn);
+	if (hp->alloc.free != NULL && hp->hot != NULL)
+		hp->alloc.free(hp->hot, hp->alloc.priv);
+	if (hp->alloc.free != NULL && hp->lzy.tbl != NULL)
+		hp->alloc.free(hp->lzy.tbl, hp->alloc.priv);
 	if (hp->alloc.free != NULL)
 		hp->alloc.free(hp, hp->alloc.priv);
 }
 
+/**********************************************************************
+ * Hibernation
+ */
+
+#define HPACK_SAV_LIM	0x01
+#define HPACK_SAV_CAP	0x02
+#define HPACK_SAV_NXT	0x04
+#define HPACK_SAV_MIN	0x08
+#define HPACK_SAV_HUF	0x10
+#define HPACK_SAV_ADP	0x20
+#define HPACK_SAV_ADM	0x40
+#define HPACK_SAV_HOT	0x80
+#define HPACK_SAV_LKA	0x100
+#define HPACK_SAV_MSK	0x1ff
+
+static const uint8_t hpack_sav_magic[] = { 'h', 'p', 'k', 1 };
+
+/* NB: the magic is followed by the kind of codec and two flags octets */
+#define HPACK_SAV_HDR	(sizeof hpack_sav_magic + 3)
+
+static void
+hpack_save_size(HPACK_CTX, size_t val)
+{
+
+	assert(val <= UINT16_MAX);
+	HPI_encode(ctx, HPACK_PFX_STR, HPACK_PAT_STR, (uint16_t)val);
+}
+
+static void
+hpack_save_opt(HPACK_CTX, ssize_t val)
+{
+
+	if (val >= 0)
+		hpack_save_size(ctx, (size_t)val);
+}
+
+enum hpack_result_e
+hpack_save(struct hpack *hp, hpack_event_f cb, void *priv, unsigned huf)
+{
+	struct hpack_encoding enc;
+	struct hpack_ctx *ctx;
+	uint8_t hdr[HPACK_SAV_HDR], buf[256];
+	unsigned flg;
+
+	if (hp == NULL || cb == NULL)
+		return (HPACK_RES_ARG);
+	if (hp->magic != DECODER_MAGIC && hp->magic != ENCODER_MAGIC)
+		return (HPACK_RES_ARG);
+
+	if (hp->ctx.res != HPACK_RES_OK) {
+		assert(hp->ctx.res == HPACK_RES_BLK);
+		return (HPACK_RES_BSY);
+	}
+
+	(void)memcpy(hdr, hpack_sav_magic, sizeof hpack_sav_magic);
+	if (hp->magic == ENCODER_MAGIC)
+		hdr[4] = 'e';
+	else if (hp->flg & HPD_FLG_MON)
+		hdr[4] = 'm';
+	else if (hp->flg & HPD_FLG_LZY)
+		hdr[4] = 'l';
+	else
+		hdr[4] = 'd';
+
+	flg = 0;
+	if (hp->sz.lim >= 0)
+		flg |= HPACK_SAV_LIM;
+	if (hp->sz.cap >= 0)
+		flg |= HPACK_SAV_CAP;
+	if (hp->sz.nxt >= 0)
+		flg |= HPACK_SAV_NXT;
+	if (hp->sz.min >= 0)
+		flg |= HPACK_SAV_MIN;
+	if (hp->flg & HPD_FLG_HUF)
+		flg |= HPACK_SAV_HUF;
+	if (hp->flg & HPE_FLG_ADP)
+		flg |= HPACK_SAV_ADP;
+	if (hp->adm != NULL)
+		flg |= HPACK_SAV_ADM;
+	if (hp->hot != NULL)
+		flg |= HPACK_SAV_HOT;
+	if (hp->flg & HPE_FLG_LKA)
+		flg |= HPACK_SAV_LKA;
+	hdr[5] = flg & 0xff;
+	hdr[6] = flg >> 8;
+
+	(void)memset(&enc, 0, sizeof enc);
+	enc.buf = buf;
+	enc.buf_len = sizeof buf;
+
+	ctx = &hp->ctx;
+	(void)memset(ctx, 0, sizeof *ctx);
+	ctx->hp = hp;
+	ctx->arg.enc = &enc;
+	ctx->ptr.cur = buf;
+	ctx->cb = cb;
+	ctx->priv = priv;
+
+	HPE_bcat(ctx, hdr, sizeof hdr);
+	hpack_save_size(ctx, hp->sz.mem);
+	hpack_save_size(ctx, hp->sz.max);
+	hpack_save_opt(ctx, hp->sz.lim);
+	hpack_save_opt(ctx, hp->sz.cap);
+	hpack_save_opt(ctx, hp->sz.nxt);
+	hpack_save_opt(ctx, hp->sz.min);
+	hpack_save_size(ctx, hp->cnt);
+	hpack_save_size(ctx, hp->sz.len);
+	HPT_save(ctx, huf);
+	HPE_send(ctx);
+
+	(void)memset(ctx, 0, sizeof *ctx);
+	return (HPACK_RES_OK);
+}
+
+static int
+hpack_restore_opt(HPACK_CTX, unsigned flg, unsigned msk, ssize_t *val)
+{
+	uint16_t u;
+
+	if (flg & msk) {
+		CALL(HPI_load, ctx, &u);
+		*val = u;
+	}
+	return (0);
+}
+
+static int
+hpack_restore_size(HPACK_CTX, struct hpack_size *sz, uint16_t *cnt,
+    unsigned flg)
+{
+	uint16_t u;
+
+	CALL(HPI_load, ctx, &u);
+	sz->mem = u;
+	CALL(HPI_load, ctx, &u);
+	sz->max = u;
+	CALL(hpack_restore_opt, ctx, flg, HPACK_SAV_LIM, &sz->lim);
+	CALL(hpack_restore_opt, ctx, flg, HPACK_SAV_CAP, &sz->cap);
+	CALL(hpack_restore_opt, ctx, flg, HPACK_SAV_NXT, &sz->nxt);
+	CALL(hpack_restore_opt, ctx, flg, HPACK_SAV_MIN, &sz->min);
+	CALL(HPI_load, ctx, cnt);
+	CALL(HPI_load, ctx, &u);
+	sz->len = u;
+	return (0);
+}
+
+struct hpack *
+hpack_restore(const void *buf, size_t len, const struct hpack_alloc *ha)
+{
+	struct hpack tmp, *hp;
+	struct hpack_size sz;
+	struct hpack_ctx *ctx;
+	const uint8_t *hdr;
+	uint32_t magic;
+	uint16_t cnt;
+	unsigned flg;
+
+	if (buf == NULL || len < HPACK_SAV_HDR)
+		return (NULL);
+
+	hdr = buf;
+	if (memcmp(hdr, hpack_sav_magic, sizeof hpack_sav_magic))
+		return (NULL);
+
+	switch (hdr[4]) {
+	case 'e':
+		magic = ENCODER_MAGIC;
+		break;
+	case 'd':
+	case 'l':
+	case 'm':
+		magic = DECODER_MAGIC;
+		break;
+	default:
+		return (NULL);
+	}
+
+	flg = hdr[5] | (unsigned)hdr[6] << 8;
+	if (flg & ~HPACK_SAV_MSK)
+		return (NULL);
+
+	/* NB: the sizes are parsed before the allocation, using a codec
+	 * on the stack only for the integer decoding state.
+	 */
+	(void)memset(&tmp, 0, sizeof tmp);
+	(void)memset(&sz, 0, sizeof sz);
+	sz.lim = -1;
+	sz.cap = -1;
+	sz.nxt = -1;
+	sz.min = -1;
+
+	ctx = &tmp.ctx;
+	ctx->hp = &tmp;
+	ctx->ptr.blk = hdr + HPACK_SAV_HDR;
+	ctx->ptr_len = len - HPACK_SAV_HDR;
+	if (hpack_restore_size(ctx, &sz, &cnt, flg) != 0)
+		return (NULL);
+
+	/* NB: only accept states a codec can reach by itself */
+	if (magic == DECODER_MAGIC && sz.cap >= 0)
+		return (NULL);
+	if (magic == DECODER_MAGIC && hdr[4] != 'l' && sz.mem < sz.max)
+		return (NULL);
+	if (sz.lim >= 0 && ((size_t)sz.lim > sz.max ||
+	    (magic == ENCODER_MAGIC && (size_t)sz.lim > sz.mem)))
+		return (NULL);
+	if ((sz.nxt < 0) != (sz.min < 0) || sz.min > sz.nxt)
+		return (NULL);
+	if ((cnt == 0) != (sz.len == 0))
+		return (NULL);
+	if (magic == ENCODER_MAGIC && flg & HPACK_SAV_HUF)
+		return (NULL);
+	if (magic == DECODER_MAGIC && flg & (HPACK_SAV_ADP | HPACK_SAV_ADM |
+	    HPACK_SAV_HOT | HPACK_SAV_LKA))
+		return (NULL);
+
+	if (hdr[4] == 'l')
+		hp = hpack_new_lazy(sz.mem, sz.max, ha);
+	else
+		hp = hpack_new(magic, sz.mem, sz.max, ha);
+	if (hp == NULL)
+		return (NULL);
+
+	if (hdr[4] == 'm')
+		hp->flg |= HPD_FLG_MON;
+	if (flg & HPACK_SAV_HUF)
+		hp->flg |= HPD_FLG_HUF;
+	if (flg & HPACK_SAV_ADP)
+		hp->flg |= HPE_FLG_ADP;
+	if (flg & HPACK_SAV_LKA)
+		hp->flg |= HPE_FLG_LKA;
+	hp->sz.lim = sz.lim;
+	hp->sz.cap = sz.cap;
+	hp->sz.nxt = sz.nxt;
+	hp->sz.min = sz.min;
+
+	ctx = &hp->ctx;
+	ctx->hp = hp;
+	ctx->ptr.blk = tmp.ctx.ptr.blk;
+	ctx->ptr_len = tmp.ctx.ptr_len;
+	if (HPT_restore(ctx, cnt) != 0 || ctx->ptr_len != 0 ||
+	    hp->sz.len != sz.len) {
+		hpack_free(&hp);
+		return (NULL);
+	}
+
+	(void)memset(&hp->state, 0, sizeof hp->state);
+	(void)memset(ctx, 0, sizeof *ctx);
+
+	/* NB: the admission statistics and the heat start over */
+	if (flg & HPACK_SAV_ADM && hpack_admit(hp) != HPACK_RES_OK)
+		hpack_free(&hp);
+	if (hp != NULL && flg & HPACK_SAV_HOT &&
+	    hpack_refresh(hp) != HPACK_RES_OK)
+		hpack_free(&hp);
+	return (hp);
+}
+
 /**********************************************************************
  * Tables probing
  */
@@ -357,7 +1015,10 @@ hpack_foreach(struct hpack *hp, hpack_event_f cb, void *priv, int flg)
 	ctx->cb = cb;
 	ctx->priv = priv;
 
-	HPT_foreach(ctx, flg);
+	if (HPT_foreach(ctx, flg) != 0) {
+		(void)memset(ctx, 0, sizeof *ctx);
+		return (HPACK_RES_OOM);
+	}
 	return (HPACK_RES_OK);
 }
 
@@ -390,6 +1051,7 @@ hpack_search(struct hpack *hp, uint16_t *idx, const char *nam, const char *val)
 	hf.val = (val != NULL) ? val : "";
 	hf.idx = 0;
 
+	hp->ctx.hp = hp;
 	retval = HPT_search(&hp->ctx, &hf);
 	*idx = hf.idx;
 	if (retval == HPACK_RES_OK && val == NULL)
@@ -410,8 +1072,11 @@ hpack_entry(struct hpack *hp, size_t idx, const char **nam, const char **val)
 	if (idx == 0 || idx > HPACK_STATIC + hp->cnt)
 		return (HPACK_RES_IDX);
 
+	hp->ctx.hp = hp;
 	retval = HPT_field(&hp->ctx, idx, &hf);
 	assert(retval == HPACK_RES_OK);
+	if (HPT_expand(hp, &hf) != 0)
+		return (HPACK_RES_OOM);
 	*nam = hf.nam;
 	*val = hf.val;
 	return (retval);
@@ -551,6 +1216,7 @@ hpack_dump(const struct hpack *hp, hpack_dump_f *dump, void *priv)
 	dump(priv, "\t\t.lim = %zd\n", hp->sz.lim);
 	dump(priv, "\t\t.cap = %zd\n", hp->sz.cap);
 	dump(priv, "\t\t.len = %zu\n", hp->sz.len);
+	dump(priv, "\t\t.use = %zu\n", hp->sz.use);
 	dump(priv, "\t\t.nxt = %zd\n", hp->sz.nxt);
 	dump(priv, "\t\t.min = %zd\n", hp->sz.min);
 	dump(priv, "\t}\n");
@@ -561,9 +1227,23 @@ hpack_dump(const struct hpack *hp, hpack_dump_f *dump, void *priv)
 	/* XXX: do when bored */
 	dump(priv, "\t}\n");
 	dump(priv, "\t.cnt = %zu\n", hp->cnt);
+	dump(priv, "\t.itn = %p\n", (void *)hp->itn);
+	dump(priv, "\t.gov = %p\n", (void *)hp->gov);
+	dump(priv, "\t.gvl = %zd\n", hp->gvl);
+	dump(priv, "\t.adm = %p\n", (void *)hp->adm);
+	dump(priv, "\t.lrn = %p\n", (void *)hp->lrn);
+	dump(priv, "\t.hot = %p\n", (void *)hp->hot);
+	dump(priv, "\t.adp = {\n");
+	dump(priv, "\t\t.lim = %zu\n", hp->adp.lim);
+	dump(priv, "\t\t.fld = %zu\n", hp->adp.fld);
+	dump(priv, "\t\t.hit = %zu\n", hp->adp.hit);
+	dump(priv, "\t\t.sav = %zu\n", hp->adp.sav);
+	dump(priv, "\t\t.evi = %zu\n", hp->adp.evi);
+	dump(priv, "\t\t.blk = %u\n", hp->adp.blk);
+	dump(priv, "\t}\n");
 
-	dump(priv, "\t.tbl = %p <<EOF\n", (const void *)hp->tbl);
-	hpack_hexdump(hp->tbl, hp->sz.len, dump, priv);
+	dump(priv, "\t.tbl = %p <<EOF\n", (const void *)HPT_TABLE(hp));
+	hpack_hexdump(HPT_TABLE(hp), hp->sz.use, dump, priv);
 	dump(priv, "\tEOF\n");
 	dump(priv, "}\n");
 }
@@ -618,8 +1298,7 @@ hpack_decode_string(HPACK_CTX, enum hpack_event_e evt)
 		hs->stp++;
 
 		if (huf) {
-			hs->stt.str.dec = NULL;
-			hs->stt.str.oct = NULL;
+			hs->stt.str.nod = 0;
 			hs->stt.str.blen = 0;
 			hs->stt.str.bits = 0;
 		}
@@ -721,7 +1400,7 @@ hpack_decode_dynamic(HPACK_CTX)
 		hpack_decoder_field(ctx, 0);
 	}
 	CALL(hpack_decode_field, ctx);
-	HPT_index(ctx);
+	CALL(HPT_index, ctx);
 	return (0);
 }
 
@@ -790,8 +1469,9 @@ hpack_check_buffer(struct hpack_ctx *ctx, const struct hpack_decoding *dec)
 	return (dec_buf + dec->buf_len == ctx->buf + ctx->buf_len);
 }
 
-enum hpack_result_e
-hpack_decode(struct hpack *hp, const struct hpack_decoding *dec)
+static enum hpack_result_e
+hpack_decode_block(struct hpack *hp, const struct hpack_decoding *dec,
+    size_t *cnt)
 {
 	struct hpack_ctx *ctx;
 	int retval;
@@ -803,7 +1483,7 @@ hpack_decode(struct hpack *hp, const struct hpack_decoding *dec)
 
 	retval = -1;
 	ctx = &hp->ctx;
-	assert(ctx->hp == hp);
+	ctx->hp = hp;
 
 	if (ctx->res == HPACK_RES_BLK) {
 		assert(ctx->buf != NULL);
@@ -855,14 +1535,30 @@ hpack_decode(struct hpack *hp, const struct hpack_decoding *dec)
 			return (ctx->res);
 		}
 		(void)memset(&ctx->fld, 0, sizeof ctx->fld);
+		(*cnt)++;
 	}
 
 	assert(ctx->res == HPACK_RES_OK || ctx->res == HPACK_RES_BLK);
+	if (hp->flg & HPD_FLG_LZY && ctx->res == HPACK_RES_OK)
+		HPT_shrink(hp);
 	if (ctx->flg & HPACK_CTX_TOO_BIG && ctx->res == HPACK_RES_OK)
 		return (HPACK_RES_SKP);
 	return (ctx->res);
 }
 
+enum hpack_result_e
+hpack_decode(struct hpack *hp, const struct hpack_decoding *dec)
+{
+	enum hpack_result_e res;
+	size_t cnt;
+
+	cnt = 0;
+	PROBE2(decode_entry, hp, dec != NULL ? dec->blk_len : 0);
+	res = hpack_decode_block(hp, dec, &cnt);
+	PROBE4(decode_return, hp, cnt, hp != NULL ? hp->sz.len : 0, res);
+	return (res);
+}
+
 static void
 hpack_assert_cb(enum hpack_event_e evt, const char *buf, size_t len, void *priv)
 {
@@ -922,7 +1618,7 @@ hpack_decode_fields(struct hpack *hp, const struct hpack_decoding *dec,
 		return (HPACK_RES_ARG);
 
 	ctx = &hp->ctx;
-	assert(ctx->hp == hp);
+	ctx->hp = hp;
 	if (nam == NULL && ctx->res != HPACK_RES_OK &&
 	    ctx->res != HPACK_RES_BLK) {
 		hp->magic = DEFUNCT_MAGIC;
@@ -1020,6 +1716,24 @@ hpack_encode_string(HPACK_CTX, HPACK_FLD, enum hpack_event_e evt)
 	return (0);
 }
 
+static void
+hpack_adapt_hit(HPACK_CTX, uint16_t idx, unsigned val)
+{
+	struct hpack_adaptive *adp;
+	struct hpt_field hf;
+
+	if (!(ctx->hp->flg & HPE_FLG_ADP) || idx <= HPACK_STATIC)
+		return;
+
+	(void)HPT_field(ctx, idx, &hf);
+	assert(ctx->res == HPACK_RES_BLK);
+	adp = &ctx->hp->adp;
+	adp->hit++;
+	adp->sav += hf.nam_sz;
+	if (val)
+		adp->sav += hf.val_sz;
+}
+
 static int
 hpack_encode_field(HPACK_CTX, HPACK_FLD, enum hpi_pattern_e pat,
     enum hpi_prefix_e pfx)
@@ -1030,6 +1744,7 @@ hpack_encode_field(HPACK_CTX, HPACK_FLD, enum hpi_pattern_e pat,
 		idx = fld->nam_idx;
 		EXPECT(ctx, IDX, idx > 0 &&
 		    idx <= ctx->hp->cnt + HPACK_STATIC);
+		hpack_adapt_hit(ctx, idx, 0);
 	}
 	else
 		idx = 0;
@@ -1048,6 +1763,7 @@ hpack_encode_indexed(HPACK_CTX, HPACK_FLD)
 
 	EXPECT(ctx, IDX, fld->idx > 0 &&
 	    fld->idx <= ctx->hp->cnt + HPACK_STATIC);
+	hpack_adapt_hit(ctx, fld->idx, 1);
 
 	HPI_encode(ctx, HPACK_PFX_IDX, HPACK_PAT_IDX, fld->idx);
 	return (0);
@@ -1071,7 +1787,7 @@ hpack_encode_dynamic(HPACK_CTX, HPACK_FLD)
 	}
 	ctx->fld.val = fld->val;
 	ctx->fld.val_sz = strlen(fld->val);
-	HPT_index(ctx);
+	CALL(HPT_index, ctx);
 
 	return (0);
 }
@@ -1153,6 +1869,44 @@ hpack_encode_update(HPACK_CTX, ssize_t lim)
 	return (0);
 }
 
+/* NB: A hot entry close to eviction is inserted again, with its name
+ * indexed, instead of being referenced. This emulates an LRU eviction
+ * policy on top of the FIFO dynamic table, at the expense of the value
+ * being sent as a literal once more. The new entry inherits half of the
+ * heat of the old one, so that an entry that stopped being referenced
+ * eventually falls off the table.
+ */
+static void
+hpack_refresh_hit(HPACK_CTX, struct hpack_field *fld)
+{
+	struct hpack *hp;
+	uint8_t *cnt;
+	size_t idx, lim, avl;
+
+	hp = ctx->hp;
+	assert(fld->flg & HPACK_FLG_TYP_IDX);
+	assert(fld->idx > HPACK_STATIC);
+
+	idx = fld->idx - HPACK_STATIC;
+	cnt = &HPE_HOT_SLOT(hp->hot, idx);
+	if (*cnt < UINT8_MAX)
+		(*cnt)++;
+	if (*cnt < HPE_HOT_MIN)
+		return;
+
+	/* NB: octets that can be inserted before the entry is evicted */
+	lim = HPACK_LIMIT(hp);
+	avl = lim > hp->sz.len ? lim - hp->sz.len : 0;
+	if (avl + HPT_tail(hp, idx) >= lim / HPE_HOT_TAIL)
+		return;
+
+	hp->hot->pnd = *cnt / 2;
+	fld->flg &= ~HPACK_FLG(TYP_MSK);
+	fld->flg |= HPACK_FLG_TYP_DYN | HPACK_FLG_NAM_IDX;
+	fld->nam_idx = fld->idx;
+	fld->idx = 0;
+}
+
 static int
 hpack_auto_index(HPACK_CTX, struct hpack_field *fld)
 {
@@ -1183,11 +1937,288 @@ hpack_auto_index(HPACK_CTX, struct hpack_field *fld)
 	else if (res != HPACK_RES_IDX)
 		WRONG("Unexpected result");
 
+	/* NB: the shared profile may advise against the insertion of a name
+	 * whose values rarely repeat, and pick Huffman coding.
+	 */
+	if (ctx->hp->lrn != NULL && val != NULL)
+		HPN_advise(ctx->hp->lrn, fld, res == HPACK_RES_OK);
+
+	/* NB: a field line that didn't earn its admission is downgraded to
+	 * a literal, keeping its name index if any.
+	 */
+	if (ctx->hp->adm != NULL && val != NULL &&
+	    !HPA_admit(ctx->hp->adm, fld->nam, val) &&
+	    fld->flg & HPACK_FLG_TYP_DYN) {
+		fld->flg &= ~HPACK_FLG(TYP_MSK);
+		fld->flg |= HPACK_FLG_TYP_LIT;
+	}
+
+	if (ctx->hp->hot != NULL && res == HPACK_RES_OK &&
+	    idx > HPACK_STATIC)
+		hpack_refresh_hit(ctx, fld);
+
 	return (0);
 }
 
-enum hpack_result_e
-hpack_encode(struct hpack *hp, const struct hpack_encoding *enc)
+static void
+hpack_adapt_limit(struct hpack *hp)
+{
+	size_t lim, cur, shr;
+
+	if (hp->adp.lim == 0)
+		return;
+
+	/* NB: the table only grows past its memory once trimmed, and never
+	 * past its governed share under pressure.
+	 */
+	lim = hp->adp.lim;
+	if (lim > hp->sz.max)
+		lim = hp->sz.max;
+	if (lim > hp->sz.mem)
+		lim = hp->sz.mem;
+	if (hp->gov != NULL && HPG_share(hp->gov, &shr) && lim > shr)
+		lim = shr;
+
+	cur = hp->sz.cap >= 0 ? (size_t)hp->sz.cap : HPACK_LIMIT(hp);
+	if (lim != cur)
+		hp->sz.cap = (ssize_t)lim;
+}
+
+static void
+hpack_adapt_window(struct hpack *hp)
+{
+	struct hpack_adaptive *adp;
+	size_t lim;
+
+	adp = &hp->adp;
+	if (++adp->blk < HPE_ADP_WINDOW)
+		return;
+
+	lim = HPACK_LIMIT(hp);
+	if (adp->evi > 0 && adp->sav >= lim && lim < hp->sz.max &&
+	    adp->hit * HPE_ADP_HIT >= adp->fld) {
+		lim *= 2;
+		if (lim < HPE_ADP_MIN)
+			lim = HPE_ADP_MIN;
+		if (lim > hp->sz.max)
+			lim = hp->sz.max;
+		adp->lim = lim;
+	}
+	else if (adp->sav < lim / 4 && lim > HPE_ADP_MIN) {
+		lim /= 2;
+		if (lim < HPE_ADP_MIN)
+			lim = HPE_ADP_MIN;
+		adp->lim = lim;
+	}
+
+	PROBE4(adapt, hp, adp->hit, adp->sav, adp->lim);
+	adp->fld = 0;
+	adp->hit = 0;
+	adp->sav = 0;
+	adp->evi = 0;
+	adp->blk = 0;
+}
+
+/* NB: Fields are encoded one at a time, and the insertion of a field may
+ * evict an entry that a later field of the same header list references.
+ * Before a window of fields is encoded, insertions are simulated and an
+ * automatic insertion is downgraded to a literal when it would evict an
+ * entry referenced later in the window, unless the field itself appears
+ * again in the window. An entry is evicted once the table grows past its
+ * limit by more than the octets of the entries older than itself.
+ */
+static size_t
+hpack_lookahead_size(HPACK_CTX, const struct hpack_field *fld)
+{
+	struct hpt_field hf;
+	size_t nam_sz;
+
+	if (fld->val == NULL)
+		return (0);
+
+	if (fld->flg & HPACK_FLG_NAM_IDX) {
+		if (fld->nam_idx == 0 ||
+		    fld->nam_idx > ctx->hp->cnt + HPACK_STATIC)
+			return (0);
+		(void)HPT_field(ctx, fld->nam_idx, &hf);
+		nam_sz = hf.nam_sz;
+	}
+	else if (fld->nam != NULL)
+		nam_sz = strlen(fld->nam);
+	else
+		return (0);
+
+	return (HPACK_OVERHEAD + nam_sz + strlen(fld->val));
+}
+
+static size_t
+hpack_lookahead_integer(size_t val, unsigned pfx)
+{
+	size_t len, max;
+
+	max = (1U << pfx) - 1;
+	if (val < max)
+		return (1);
+	val -= max;
+	for (len = 2; val >= 0x80; len++)
+		val >>= 7;
+	return (len);
+}
+
+/* NB: octets of a field line sent as a literal without Huffman coding */
+static size_t
+hpack_lookahead_literal(const struct hpack_field *fld)
+{
+	size_t nam, val;
+
+	nam = strlen(fld->nam);
+	val = strlen(fld->val);
+	return (1 + hpack_lookahead_integer(nam, 7) + nam +
+	    hpack_lookahead_integer(val, 7) + val);
+}
+
+/* NB: Every later occurrence of a field inserted in the dynamic table is
+ * sent as an index instead of a literal. There are fewer insertions than
+ * fields in a window, so that index fits in one octet.
+ */
+static size_t
+hpack_lookahead_benefit(const struct hpack_field *fld, size_t cnt)
+{
+	const struct hpack_field *nxt;
+	size_t i, sav;
+
+	sav = 0;
+	for (i = 1, nxt = fld + 1; i < cnt; i++, nxt++) {
+		if (!(nxt->flg & HPACK_FLG_AUT_IDX) || nxt->nam == NULL ||
+		    nxt->val == NULL)
+			continue;
+		if (!strcmp(fld->nam, nxt->nam) &&
+		    !strcmp(fld->val, nxt->val))
+			sav += hpack_lookahead_literal(nxt) - 1;
+	}
+	return (sav);
+}
+
+/* NB: The window is a heuristic that only downgrades insertions. An
+ * insertion is weighed against the entries it would evict before a later
+ * field references them: what such a field would cost as a literal instead
+ * of an index, compared to what the inserted field saves when it appears
+ * again in the window. An index chosen by the caller can't be re-sent as a
+ * literal, so its eviction is never worth it.
+ */
+static void
+hpack_lookahead_window(HPACK_CTX, struct hpack_field *fld, size_t cnt)
+{
+	size_t sz[HPE_LKA_WINDOW], old[HPE_LKA_WINDOW], sav[HPE_LKA_WINDOW];
+	uint8_t ref[HPE_LKA_WINDOW], aut[HPE_LKA_WINDOW];
+	struct hpack *hp;
+	size_t i, j, lim, len, ins, cost;
+	uint16_t idx;
+	int res;
+
+	hp = ctx->hp;
+	assert(cnt <= HPE_LKA_WINDOW);
+	lim = HPACK_LIMIT(hp);
+	len = hp->sz.len;
+
+	for (i = 0; i < cnt; i++) {
+		sz[i] = 0;
+		ref[i] = 0;
+		aut[i] = 0;
+		idx = 0;
+		res = HPACK_RES_IDX;
+
+		if (fld[i].flg & HPACK_FLG_TYP_IDX) {
+			idx = fld[i].idx;
+			res = HPACK_RES_OK;
+		}
+		else if (fld[i].flg & HPACK_FLG_AUT_IDX &&
+		    !(fld[i].flg & HPACK_FLG_NAM_IDX) &&
+		    !(fld[i].flg & HPACK_FLG_TYP_NVR) &&
+		    fld[i].nam != NULL && fld[i].val != NULL) {
+			res = hpack_search(hp, &idx, fld[i].nam, fld[i].val);
+			aut[i] = 1;
+		}
+
+		if (res != HPACK_RES_OK) {
+			if (fld[i].flg & HPACK_FLG_TYP_DYN)
+				sz[i] = hpack_lookahead_size(ctx, &fld[i]);
+		}
+		else if (idx > HPACK_STATIC && idx <= hp->cnt + HPACK_STATIC) {
+			ref[i] = 1;
+			old[i] = HPT_tail(hp, idx - HPACK_STATIC);
+			sav[i] = SIZE_MAX;
+			if (aut[i])
+				sav[i] = hpack_lookahead_literal(&fld[i]) -
+				    hpack_lookahead_integer(idx, 7);
+		}
+	}
+
+	ins = 0;
+	for (i = 0; i < cnt; i++) {
+		if (sz[i] == 0)
+			continue;
+		if (aut[i]) {
+			cost = 0;
+			for (j = i + 1; j < cnt; j++) {
+				if (ref[j] && len + ins <= lim + old[j] &&
+				    len + ins + sz[i] > lim + old[j])
+					cost = cost > SIZE_MAX - sav[j] ?
+					    SIZE_MAX : cost + sav[j];
+			}
+			if (cost > hpack_lookahead_benefit(&fld[i], cnt - i)) {
+				fld[i].flg &= ~HPACK_FLG(TYP_MSK);
+				fld[i].flg |= HPACK_FLG_TYP_LIT;
+				continue;
+			}
+		}
+		ins += sz[i];
+	}
+}
+
+static void
+hpack_govern_limit(struct hpack *hp)
+{
+	size_t lim, shr, tgt;
+
+	assert(hp->gov != NULL);
+	lim = hp->sz.cap >= 0 ? (size_t)hp->sz.cap : HPACK_LIMIT(hp);
+
+	/* NB: the lower limit is sent as a regular table update */
+	if (HPG_share(hp->gov, &shr)) {
+		if (shr >= lim)
+			return;
+		if (!(hp->flg & HPE_FLG_GOV)) {
+			hp->gvl = hp->sz.cap >= 0 ? hp->sz.cap : hp->sz.lim;
+			hp->flg |= HPE_FLG_GOV;
+		}
+		hp->sz.cap = (ssize_t)shr;
+		return;
+	}
+
+	if (!(hp->flg & HPE_FLG_GOV))
+		return;
+
+	/* NB: the adaptive policy raises its own limit */
+	if (hp->flg & HPE_FLG_ADP) {
+		hp->flg &= ~HPE_FLG_GOV;
+		return;
+	}
+
+	/* NB: back under budget, the previous limit is restored as far as
+	 * the memory allows, the rest once the encoder is trimmed.
+	 */
+	tgt = hpack_govern_target(hp);
+	if (tgt <= hp->sz.mem)
+		hp->flg &= ~HPE_FLG_GOV;
+	else
+		tgt = hp->sz.mem;
+	if (tgt > lim)
+		hp->sz.cap = (ssize_t)tgt;
+}
+
+static enum hpack_result_e
+hpack_encode_block(struct hpack *hp, const struct hpack_encoding *enc)
 {
 	struct hpack_field *fld;
 	struct hpack_ctx *ctx;
@@ -1200,12 +2231,9 @@ hpack_encode(struct hpack *hp, const struct hpack_encoding *enc)
 		return (HPACK_RES_ARG);
 
 	ctx = &hp->ctx;
-	assert(ctx->hp == hp);
+	ctx->hp = hp;
 
-	if (ctx->res == HPACK_RES_BLK) {
-		assert(ctx->hp == hp);
-	}
-	else {
+	if (ctx->res != HPACK_RES_BLK) {
 		assert(ctx->res == HPACK_RES_OK);
 		ctx->flg = HPACK_CTX_CAN_UPD;
 		ctx->res = HPACK_RES_BLK;
@@ -1229,13 +2257,25 @@ hpack_encode(struct hpack *hp, const struct hpack_encoding *enc)
 		assert((ctx->flg & HPACK_CTX_CAN_UPD) == 0);
 	}
 
+	if (ctx->flg & HPACK_CTX_CAN_UPD && hp->flg & HPE_FLG_ADP)
+		hpack_adapt_limit(hp);
+	if (ctx->flg & HPACK_CTX_CAN_UPD && hp->gov != NULL)
+		hpack_govern_limit(hp);
+
 	if (ctx->flg & HPACK_CTX_CAN_UPD && ctx->hp->sz.cap >= 0) {
-		assert(ctx->hp->sz.lim == -1);
 		if ((size_t)ctx->hp->sz.cap < ctx->hp->sz.max) {
 			retval = hpack_encode_update(ctx, hp->sz.cap);
 			assert(retval == 0);
 			hp->sz.cap = -1;
 		}
+		else if (hp->sz.lim >= 0) {
+			/* NB: lift a limit already applied */
+			hp->sz.cap = (ssize_t)hp->sz.max;
+			retval = hpack_encode_update(ctx, hp->sz.cap);
+			assert(retval == 0);
+			hp->sz.lim = -1;
+			hp->sz.cap = -1;
+		}
 	}
 
 	ctx->flg &= ~HPACK_CTX_CAN_UPD;
@@ -1243,6 +2283,10 @@ hpack_encode(struct hpack *hp, const struct hpack_encoding *enc)
 	fld = enc->fld;
 
 	while (cnt > 0) {
+		if (hp->flg & HPE_FLG_LKA &&
+		    (enc->fld_cnt - cnt) % HPE_LKA_STEP == 0)
+			hpack_lookahead_window(ctx, fld,
+			    cnt < HPE_LKA_WINDOW ? cnt : HPE_LKA_WINDOW);
 		if (fld->flg & HPACK_FLG_AUT_IDX) {
 			retval = hpack_auto_index(ctx, fld);
 			if (retval == HPACK_RES_ARG)
@@ -1250,6 +2294,8 @@ hpack_encode(struct hpack *hp, const struct hpack_encoding *enc)
 			assert(retval == 0);
 		}
 		HPC_notify(ctx, HPACK_EVT_FIELD, NULL, 0);
+		if (hp->flg & HPE_FLG_ADP)
+			hp->adp.fld++;
 		switch (fld->flg & HPACK_FLG_TYP_MSK) {
 #define HPACK_ENCODE(l, U)					\
 		case HPACK_FLG_TYP_##U:				\
@@ -1277,12 +2323,28 @@ hpack_encode(struct hpack *hp, const struct hpack_encoding *enc)
 	HPE_send(ctx);
 
 	assert(ctx->res == HPACK_RES_BLK);
+	if (!enc->cut && hp->flg & HPE_FLG_ADP)
+		hpack_adapt_window(hp);
+	if (!enc->cut && hp->lrn != NULL)
+		HPN_block(hp->lrn);
 	if (!enc->cut)
 		ctx->res = HPACK_RES_OK;
 
 	return (ctx->res);
 }
 
+enum hpack_result_e
+hpack_encode(struct hpack *hp, const struct hpack_encoding *enc)
+{
+	enum hpack_result_e res;
+
+	PROBE2(encode_entry, hp, enc != NULL ? enc->fld_cnt : 0);
+	res = hpack_encode_block(hp, enc);
+	PROBE4(encode_return, hp, enc != NULL ? enc->fld_cnt : 0,
+	    hp != NULL ? hp->sz.len : 0, res);
+	return (res);
+}
+
 enum hpack_result_e
 hpack_clean_field(struct hpack_field *fld)
 {
@@ -0,0 +1,152 @@
+/*-
+ * License: BSD-2-Clause
+ * (c) 2026 Dridi Boukelmoune <dridi.boukelmoune@gmail.com>
+ *
+ * HPACK: Header Compression for HTTP/2 (RFC 7541)
+ *
+ * Admission policy for automatically indexed fields.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hpack.h"
+#include "hpack_assert.h"
+#include "hpack_priv.h"
+
+#define HPA_ROWS	4
+#define HPA_BITS	6
+#define HPA_COLS	(1 << HPA_BITS)
+#define HPA_AGE		1024 /* observations before counters are halved */
+#define HPA_NAME	2 /* repeated values before a name is trusted */
+
+/* NB: A count-min sketch with saturating counters. Field lines and names
+ * are counted in the same sketch with different hash seeds. A name counts
+ * how many times one of its values was seen again, telling names with
+ * stable values like user-agent from names with unique values like a
+ * request id.
+ */
+struct hpack_admission {
+	uint32_t	magic;
+#define ADMISSION_MAGIC	0x1d3a6c55
+	unsigned	obs;
+	uint8_t		cnt[HPA_ROWS][HPA_COLS];
+};
+
+/**********************************************************************
+ * Count-min sketch
+ */
+
+static unsigned
+hpa_count(const struct hpack_admission *adm, uint32_t hash)
+{
+	unsigned u, min;
+
+	min = UINT8_MAX;
+	for (u = 0; u < HPA_ROWS; u++) {
+		if (adm->cnt[u][hash % HPA_COLS] < min)
+			min = adm->cnt[u][hash % HPA_COLS];
+		hash >>= HPA_BITS;
+	}
+	return (min);
+}
+
+static void
+hpa_increment(struct hpack_admission *adm, uint32_t hash)
+{
+	unsigned u;
+
+	for (u = 0; u < HPA_ROWS; u++) {
+		if (adm->cnt[u][hash % HPA_COLS] < UINT8_MAX)
+			adm->cnt[u][hash % HPA_COLS]++;
+		hash >>= HPA_BITS;
+	}
+}
+
+static void
+hpa_age(struct hpack_admission *adm)
+{
+	unsigned u, v;
+
+	if (++adm->obs < HPA_AGE)
+		return;
+
+	for (u = 0; u < HPA_ROWS; u++)
+		for (v = 0; v < HPA_COLS; v++)
+			adm->cnt[u][v] >>= 1;
+	adm->obs = 0;
+}
+
+/**********************************************************************
+ * Admission
+ */
+
+int
+HPA_admit(struct hpack_admission *adm, const char *nam, const char *val)
+{
+	uint32_t nam_hash, fld_hash;
+	unsigned fld_cnt, nam_cnt;
+
+	assert(adm != NULL);
+	assert(adm->magic == ADMISSION_MAGIC);
+	assert(nam != NULL);
+	assert(val != NULL);
+
+	nam_hash = HPX_hash(HPX_HASH_INIT, nam, strlen(nam));
+	fld_hash = HPX_hash(nam_hash ^ 0x3a, val, strlen(val));
+
+	fld_cnt = hpa_count(adm, fld_hash);
+	nam_cnt = hpa_count(adm, nam_hash);
+
+	hpa_increment(adm, fld_hash);
+	if (fld_cnt > 0)
+		hpa_increment(adm, nam_hash);
+	hpa_age(adm);
+
+	return (fld_cnt > 0 || nam_cnt >= HPA_NAME);
+}
+
+struct hpack_admission *
+HPA_new(const struct hpack_alloc *ha)
+{
+	struct hpack_admission *adm;
+
+	assert(ha != NULL);
+	assert(ha->malloc != NULL);
+
+	adm = ha->malloc(sizeof *adm, ha->priv);
+	if (adm == NULL)
+		return (NULL);
+
+	(void)memset(adm, 0, sizeof *adm);
+	adm->magic = ADMISSION_MAGIC;
+	return (adm);
+}
+
+void
+HPA_clear(struct hpack_admission *adm)
+{
+
+	assert(adm != NULL);
+	assert(adm->magic == ADMISSION_MAGIC);
+	(void)memset(adm->cnt, 0, sizeof adm->cnt);
+	adm->obs = 0;
+}
+
+void
+HPA_free(const struct hpack_alloc *ha, struct hpack_admission *adm)
+{
+
+	assert(ha != NULL);
+	if (adm == NULL)
+		return;
+
+	assert(adm->magic == ADMISSION_MAGIC);
+	adm->magic = 0;
+	if (ha->free != NULL)
+		ha->free(adm, ha->priv);
+}
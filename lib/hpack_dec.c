@@ -91,6 +91,21 @@ HPD_cat(HPACK_CTX, const char *str, size_t len)
 	return (0);
 }
 
+int
+HPD_expand(HPACK_CTX, const char *str, size_t len, size_t sz)
+{
+	int retval;
+
+	/* NB: strings are only stored Huffman-coded once validated */
+	CALL(hpd_skip, ctx, sz + 1);
+	retval = HPH_expand(str, len, ctx->buf, sz);
+	assert(retval == 0);
+	(void)retval;
+	ctx->buf += sz + 1;
+	ctx->buf_len -= sz + 1;
+	return (0);
+}
+
 void
 HPD_notify(HPACK_CTX)
 {
@@ -32,9 +32,11 @@ HPE_putb(HPACK_CTX, uint8_t b)
 void
 HPE_bcat(HPACK_CTX, const void *buf, size_t len)
 {
+	const uint8_t *ptr;
 	size_t sz;
 
 	assert(buf != NULL);
+	ptr = buf;
 
 	while (len > 0) {
 		assert(ctx->arg.enc->buf_len > ctx->ptr_len);
@@ -42,9 +44,10 @@ HPE_bcat(HPACK_CTX, const void *buf, size_t len)
 		if (sz > len)
 			sz = len;
 
-		(void)memcpy(ctx->ptr.cur, buf, sz);
+		(void)memcpy(ctx->ptr.cur, ptr, sz);
 		ctx->ptr.cur += sz;
 		ctx->ptr_len += sz;
+		ptr += sz;
 		len -= sz;
 
 		if (ctx->ptr_len == ctx->arg.enc->buf_len)
@@ -0,0 +1,184 @@
+/*-
+ * License: BSD-2-Clause
+ * (c) 2026 Dridi Boukelmoune <dridi.boukelmoune@gmail.com>
+ *
+ * HPACK: Header Compression for HTTP/2 (RFC 7541)
+ *
+ * Memory governor for the dynamic tables of many HPACK codecs.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hpack.h"
+#include "hpack_assert.h"
+#include "hpack_priv.h"
+
+struct hpack_governor {
+	uint32_t		magic;
+#define GOVERNOR_MAGIC		0x5a0c6e27
+	struct hpack_alloc	alloc;
+	hpack_lock_f		*lock;
+	hpack_lock_f		*unlock;
+	void			*priv;
+	size_t			bgt; /* budget */
+	size_t			mem; /* sum of the codecs' sz.mem */
+	size_t			cnt; /* governed codecs */
+	unsigned		prs; /* pressure, mem > bgt */
+};
+
+/**********************************************************************
+ * Accounting
+ */
+
+static void
+hpg_pressure(struct hpack_governor *gov)
+{
+
+#ifdef HAVE_ATOMIC_BUILTINS
+	HPACK_ATOMIC_STORE(&gov->prs, gov->mem > gov->bgt);
+#else
+	gov->prs = gov->mem > gov->bgt;
+#endif
+}
+
+void
+HPG_account(struct hpack_governor *gov, size_t old, size_t mem)
+{
+
+	if (gov == NULL || old == mem)
+		return;
+
+	assert(gov->magic == GOVERNOR_MAGIC);
+	HPACK_LOCK(gov);
+	assert(gov->mem >= old);
+	gov->mem -= old;
+	gov->mem += mem;
+	hpg_pressure(gov);
+	HPACK_UNLOCK(gov);
+}
+
+void
+HPG_attach(struct hpack_governor *gov, size_t mem)
+{
+
+	assert(gov != NULL);
+	assert(gov->magic == GOVERNOR_MAGIC);
+
+	HPACK_LOCK(gov);
+	gov->mem += mem;
+	gov->cnt++;
+	hpg_pressure(gov);
+	HPACK_UNLOCK(gov);
+}
+
+void
+HPG_detach(struct hpack_governor *gov, size_t mem)
+{
+
+	assert(gov != NULL);
+	assert(gov->magic == GOVERNOR_MAGIC);
+
+	HPACK_LOCK(gov);
+	assert(gov->mem >= mem);
+	assert(gov->cnt > 0);
+	gov->mem -= mem;
+	gov->cnt--;
+	hpg_pressure(gov);
+	HPACK_UNLOCK(gov);
+}
+
+/* NB: Under pressure, every codec is entitled to an equal share of the
+ * budget. Decoders can't lower the limit chosen by their peer, so only
+ * encoders may be asked to give up the octets above their share.
+ *
+ * This is called for every header list of governed encoders, so with
+ * atomics the lock is only taken under pressure. The pressure flag is read
+ * without it: a stale value only delays the decision until the next header
+ * list. Without atomics, the flag is always read under the lock.
+ */
+int
+HPG_share(struct hpack_governor *gov, size_t *shr)
+{
+	int retval;
+
+	assert(gov != NULL);
+	assert(gov->magic == GOVERNOR_MAGIC);
+	assert(shr != NULL);
+
+#ifdef HAVE_ATOMIC_BUILTINS
+	if (!HPACK_ATOMIC_LOAD(&gov->prs))
+		return (0);
+#endif
+
+	HPACK_LOCK(gov);
+	assert(gov->cnt > 0);
+	retval = gov->prs;
+	if (retval)
+		*shr = gov->bgt / gov->cnt;
+	HPACK_UNLOCK(gov);
+
+	return (retval);
+}
+
+int
+HPG_valid(const struct hpack_governor *gov)
+{
+
+	return (gov != NULL && gov->magic == GOVERNOR_MAGIC);
+}
+
+/**********************************************************************
+ * Governor management
+ */
+
+struct hpack_governor *
+hpack_governor_new(const struct hpack_alloc *ha, size_t bgt,
+    hpack_lock_f *lock, hpack_lock_f *unlock, void *priv)
+{
+	struct hpack_governor *gov;
+
+	if (ha == NULL || ha->malloc == NULL)
+		return (NULL);
+	if ((lock == NULL) != (unlock == NULL))
+		return (NULL);
+
+	gov = ha->malloc(sizeof *gov, ha->priv);
+	if (gov == NULL)
+		return (NULL);
+
+	(void)memset(gov, 0, sizeof *gov);
+	gov->magic = GOVERNOR_MAGIC;
+	(void)memcpy(&gov->alloc, ha, sizeof *ha);
+	gov->lock = lock;
+	gov->unlock = unlock;
+	gov->priv = priv;
+	gov->bgt = bgt;
+	return (gov);
+}
+
+void
+hpack_governor_free(struct hpack_governor **govp)
+{
+	struct hpack_governor *gov;
+
+	if (govp == NULL)
+		return;
+
+	gov = *govp;
+	if (gov == NULL)
+		return;
+
+	*govp = NULL;
+	if (gov->magic != GOVERNOR_MAGIC)
+		return;
+
+	assert(gov->cnt == 0);
+	gov->magic = 0;
+	if (gov->alloc.free != NULL)
+		gov->alloc.free(gov, gov->alloc.priv);
+}
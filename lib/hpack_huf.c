@@ -15,6 +15,7 @@
 
 #include "hpack.h"
 #include "hpack_priv.h"
+#include "hpack_sdt.h"
 #include "hpack_huf_dec.h"
 #include "hpack_huf_enc.h"
 
@@ -22,37 +23,68 @@
  * Decode
  */
 
+/* NB: a lookup consumes at most 15 bits, and the shortest code is 5 bits */
+#define HPH_LOOKUP_MAX	3
+
 static int
-hph_decode_lookup(HPACK_CTX, int *eos)
+hph_decode_lookup(struct hpack_str_state *str, int *eos, char *chr,
+    size_t *cnt)
 {
-	struct hpack_state *hs;
+	const struct hph_dec *dec;
+	const struct hph_oct *oct;
 	uint8_t cod;
 
-	hs = &ctx->hp->state;
+	assert(str->blen >= 8);
+	assert(str->nod > 0);
+	assert(str->nod <= HPH_DEC0);
+	dec = hph_dec_tbl[str->nod];
+	oct = dec->oct;
+	*cnt = 0;
 
-	assert(hs->stt.str.blen >= 8);
-	while (hs->stt.str.blen >= hs->stt.str.oct->len) {
-		cod = (hs->stt.str.bits >> (16 - hs->stt.str.dec->len)) &
-		    0xff;
+	while (str->blen >= oct->len) {
+		cod = (str->bits >> (16 - dec->len)) & 0xff;
 
 		/* premature EOS */
-		EXPECT(ctx, HUF, hs->stt.str.oct[cod].len > 0);
+		if (oct[cod].len == 0)
+			return (-1);
 
-		if (hs->stt.str.blen < hs->stt.str.oct[cod].len)
+		if (str->blen < oct[cod].len)
 			break; /* more bits needed */
 
 		*eos = 1;
-		hs->stt.str.dec = hs->stt.str.oct[cod].nxt;
-		if (hs->stt.str.dec == NULL) {
-			CALL(HPD_putc, ctx, hs->stt.str.oct[cod].chr);
-			hs->stt.str.dec = &hph_dec0;
+		str->nod = oct[cod].nxt;
+		if (str->nod == 0) {
+			assert(*cnt < HPH_LOOKUP_MAX);
+			chr[(*cnt)++] = oct[cod].chr;
+			str->nod = HPH_DEC0;
 			*eos = 0;
 		}
 
-		hs->stt.str.blen -= hs->stt.str.oct[cod].len;
-		hs->stt.str.bits <<= hs->stt.str.oct[cod].len;
-		hs->stt.str.oct = hs->stt.str.dec->oct;
+		str->blen -= oct[cod].len;
+		str->bits <<= oct[cod].len;
+		dec = hph_dec_tbl[str->nod];
+		oct = dec->oct;
+	}
+	return (0);
+}
+
+static int
+hph_decode_padding(const struct hpack_str_state *str, int eos)
+{
+
+	if (eos)
+		return (-1); /* spurious EOS */
+
+	if (str->blen > 0) {
+		assert(str->blen < 8);
+		if (str->bits != (uint16_t)(0xffff << (16 - str->blen)))
+			return (-1);
+	}
+	else {
+		/* no padding */
+		assert(str->bits == 0);
 	}
+
 	return (0);
 }
 
@@ -60,15 +92,17 @@ int
 HPH_decode(HPACK_CTX, size_t len)
 {
 	struct hpack_state *hs;
+	char chr[HPH_LOOKUP_MAX];
+	size_t cnt, i;
 	int eos;
 
 	hs = &ctx->hp->state;
 	eos = 0;
 
-	if (hs->stt.str.dec == NULL) {
-		hs->stt.str.dec = &hph_dec0;
-		hs->stt.str.oct = hph_oct0;
-	}
+	PROBE3(huffman_decode, ctx->hp, len, ctx->ptr_len);
+
+	if (hs->stt.str.nod == 0)
+		hs->stt.str.nod = HPH_DEC0;
 
 	if (len > ctx->ptr_len)
 		len = ctx->ptr_len;
@@ -83,24 +117,51 @@ HPH_decode(HPACK_CTX, size_t len)
 		ctx->ptr_len--;
 		len--;
 
-		CALL(hph_decode_lookup, ctx, &eos);
+		EXPECT(ctx, HUF, !hph_decode_lookup(&hs->stt.str, &eos, chr,
+		    &cnt));
+		for (i = 0; i < cnt; i++)
+			CALL(HPD_putc, ctx, chr[i]);
 	}
 
-	EXPECT(ctx, HUF, eos == 0); /* spurious EOS */
+	EXPECT(ctx, HUF, !hph_decode_padding(&hs->stt.str, eos));
+	CALL(HPD_putc, ctx, '\0');
 
-	if (hs->stt.str.blen > 0) {
-		/* check padding */
-		assert(hs->stt.str.blen < 8);
-		EXPECT(ctx, HUF, hs->stt.str.bits ==
-		    (uint16_t)(0xffff << (16 - hs->stt.str.blen)));
-	}
-	else {
-		/* no padding */
-		assert(hs->stt.str.bits == 0);
+	return (0);
+}
+
+int
+HPH_expand(const void *buf, size_t len, char *str, size_t sz)
+{
+	struct hpack_str_state tmp;
+	const uint8_t *ptr;
+	char chr[HPH_LOOKUP_MAX];
+	size_t cnt, i;
+	int eos;
+
+	(void)memset(&tmp, 0, sizeof tmp);
+	tmp.nod = HPH_DEC0;
+	ptr = buf;
+	eos = 0;
+
+	while (len > 0) {
+		tmp.bits |= *ptr << (8 - tmp.blen);
+		tmp.blen += 8;
+		ptr++;
+		len--;
+
+		if (hph_decode_lookup(&tmp, &eos, chr, &cnt))
+			return (-1);
+		if (cnt > sz)
+			return (-1);
+		for (i = 0; i < cnt; i++)
+			*str++ = chr[i];
+		sz -= cnt;
 	}
 
-	CALL(HPD_putc, ctx, '\0');
+	if (sz > 0 || hph_decode_padding(&tmp, eos))
+		return (-1);
 
+	*str = '\0';
 	return (0);
 }
 
@@ -136,6 +197,39 @@ HPH_encode(HPACK_CTX, const char *str)
 	}
 }
 
+void
+HPH_pack(const char *str, void *buf)
+{
+	uint64_t bits;
+	uint8_t *ptr, c;
+	size_t sz;
+
+	bits = 0;
+	sz = 0;
+	ptr = buf;
+
+	while (*str != '\0') {
+		c = (uint8_t)*str;
+		bits = (bits << hph_enc[c].len) | hph_enc[c].cod;
+		sz += hph_enc[c].len;
+
+		while (sz >= 8) {
+			sz -= 8;
+			*ptr++ = (uint8_t)(bits >> sz);
+		}
+
+		str++;
+	}
+
+	assert(sz < 8);
+	if (sz > 0) {
+		sz = 8 - sz; /* padding bits */
+		bits <<= sz;
+		bits |= (1 << sz) - 1;
+		*ptr = (uint8_t)bits;
+	}
+}
+
 size_t
 HPH_size(const char *str)
 {
@@ -98,3 +98,16 @@ HPI_encode(HPACK_CTX, enum hpi_prefix_e pfx, enum hpi_pattern_e pat,
 
 	HPE_putb(ctx, (uint8_t)val);
 }
+
+int
+HPI_load(HPACK_CTX, uint16_t *val)
+{
+
+	/* NB: a saved codec is loaded at once, there is no block to resume
+	 * and integers never use the Huffman bit of their prefix.
+	 */
+	EXPECT(ctx, BUF, ctx->ptr_len > 0);
+	EXPECT(ctx, INT, (*ctx->ptr.blk & HPACK_PAT_HUF) == 0);
+	CALL(HPI_decode, ctx, HPACK_PFX_STR, val);
+	return (0);
+}
@@ -0,0 +1,291 @@
+/*-
+ * License: BSD-2-Clause
+ * (c) 2026 Dridi Boukelmoune <dridi.boukelmoune@gmail.com>
+ *
+ * HPACK: Header Compression for HTTP/2 (RFC 7541)
+ *
+ * Intern pool for the strings of dynamic tables shared by HPACK codecs.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hpack.h"
+#include "hpack_assert.h"
+#include "hpack_priv.h"
+
+#define HPX_BUCKETS	64
+
+struct hpack_intern {
+	uint32_t		magic;
+#define INTERN_MAGIC		0x6d1e35b3
+	struct hpack_alloc	alloc;
+	hpack_lock_f		*lock;
+	hpack_lock_f		*unlock;
+	void			*priv;
+	struct hpx_string	**bkt;
+	size_t			bkt_len; /* power of two */
+	size_t			cnt; /* distinct strings */
+};
+
+/**********************************************************************
+ * Hash table
+ */
+
+/* NB: 32-bit FNV-1a, continuing from a previous hash or HPX_HASH_INIT */
+uint32_t
+HPX_hash(uint32_t hash, const char *str, size_t len)
+{
+
+	while (len-- > 0) {
+		hash ^= (uint8_t)*str++;
+		hash *= 0x01000193;
+	}
+	return (hash);
+}
+
+static int
+hpx_rehash(struct hpack_intern *itn)
+{
+	struct hpx_string **bkt, *hs;
+	size_t len, i, u;
+
+	len = itn->bkt_len > 0 ? itn->bkt_len * 2 : HPX_BUCKETS;
+	bkt = itn->alloc.malloc(len * sizeof *bkt, itn->alloc.priv);
+	if (bkt == NULL)
+		return (-1);
+
+	for (u = 0; u < len; u++)
+		bkt[u] = NULL;
+
+	for (i = 0; i < itn->bkt_len; i++) {
+		while (itn->bkt[i] != NULL) {
+			hs = itn->bkt[i];
+			itn->bkt[i] = hs->nxt;
+			u = hs->hash & (len - 1);
+			hs->nxt = bkt[u];
+			bkt[u] = hs;
+		}
+	}
+
+	if (itn->bkt != NULL)
+		itn->alloc.free(itn->bkt, itn->alloc.priv);
+	itn->bkt = bkt;
+	itn->bkt_len = len;
+	return (0);
+}
+
+static struct hpx_string *
+hpx_insert(struct hpack_intern *itn, const char *str, size_t len,
+    uint32_t hash)
+{
+	struct hpx_string *hs;
+	size_t u;
+
+	/* NB: a failed rehash only makes the buckets more crowded */
+	if (itn->cnt >= itn->bkt_len && hpx_rehash(itn) != 0 &&
+	    itn->bkt_len == 0)
+		return (NULL);
+
+	hs = itn->alloc.malloc(sizeof *hs + len + 1, itn->alloc.priv);
+	if (hs == NULL)
+		return (NULL);
+
+	hs->magic = HPX_STRING_MAGIC;
+	hs->hash = hash;
+	hs->ref = 1;
+	hs->len = len;
+	(void)memcpy(hs->str, str, len);
+	hs->str[len] = '\0';
+
+	u = hash & (itn->bkt_len - 1);
+	hs->nxt = itn->bkt[u];
+	itn->bkt[u] = hs;
+	itn->cnt++;
+	return (hs);
+}
+
+/**********************************************************************
+ * References
+ */
+
+/* NB: With atomic builtins, references are taken and released without the
+ * lock. The lock only guards the hash table: looking a string up, inserting
+ * a new one, and removing one when its last reference is released. A string
+ * whose count dropped to zero is about to be removed by the codec releasing
+ * it, so a lookup ignores it and may insert a new copy of the string.
+ *
+ * Without atomic builtins, the counts are guarded by the lock too.
+ */
+
+#ifdef HAVE_ATOMIC_BUILTINS
+#  define HPX_ATOMIC	1
+#else
+#  define HPX_ATOMIC	0
+#endif
+
+static int
+hpx_ref(struct hpx_string *hs)
+{
+#ifdef HAVE_ATOMIC_BUILTINS
+	size_t ref;
+
+	ref = __atomic_load_n(&hs->ref, __ATOMIC_RELAXED);
+	do {
+		if (ref == 0)
+			return (0);
+	} while (!__atomic_compare_exchange_n(&hs->ref, &ref, ref + 1, 1,
+	    __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	return (1);
+#else
+	if (hs->ref == 0)
+		return (0);
+	hs->ref++;
+	return (1);
+#endif
+}
+
+static size_t
+hpx_unref(struct hpx_string *hs)
+{
+
+#ifdef HAVE_ATOMIC_BUILTINS
+	return (__atomic_sub_fetch(&hs->ref, 1, __ATOMIC_ACQ_REL));
+#else
+	assert(hs->ref > 0);
+	return (--hs->ref);
+#endif
+}
+
+struct hpx_string *
+HPX_acquire(struct hpack_intern *itn, const char *str, size_t len)
+{
+	struct hpx_string *hs;
+	uint32_t hash;
+
+	assert(itn != NULL);
+	assert(itn->magic == INTERN_MAGIC);
+	assert(str != NULL);
+
+	hash = HPX_hash(HPX_HASH_INIT, str, len);
+	hs = NULL;
+
+	HPACK_LOCK(itn);
+	if (itn->bkt_len > 0)
+		hs = itn->bkt[hash & (itn->bkt_len - 1)];
+	while (hs != NULL) {
+		assert(hs->magic == HPX_STRING_MAGIC);
+		if (hs->hash == hash && hs->len == len &&
+		    !memcmp(hs->str, str, len) && hpx_ref(hs))
+			break;
+		hs = hs->nxt;
+	}
+	if (hs == NULL)
+		hs = hpx_insert(itn, str, len, hash);
+	HPACK_UNLOCK(itn);
+
+	return (hs);
+}
+
+void
+HPX_release(struct hpack_intern *itn, struct hpx_string *hs)
+{
+	struct hpx_string **prv;
+
+	assert(itn != NULL);
+	assert(itn->magic == INTERN_MAGIC);
+	assert(hs != NULL);
+	assert(hs->magic == HPX_STRING_MAGIC);
+
+	if (HPX_ATOMIC) {
+		if (hpx_unref(hs) > 0)
+			return;
+		HPACK_LOCK(itn);
+	}
+	else {
+		HPACK_LOCK(itn);
+		if (hpx_unref(hs) > 0) {
+			HPACK_UNLOCK(itn);
+			return;
+		}
+	}
+
+	prv = &itn->bkt[hs->hash & (itn->bkt_len - 1)];
+	while (*prv != hs) {
+		assert(*prv != NULL);
+		prv = &(*prv)->nxt;
+	}
+	*prv = hs->nxt;
+	itn->cnt--;
+
+	hs->magic = 0;
+	itn->alloc.free(hs, itn->alloc.priv);
+	HPACK_UNLOCK(itn);
+}
+
+/**********************************************************************
+ * Pool management
+ */
+
+struct hpack_intern *
+hpack_intern_new(const struct hpack_alloc *ha, hpack_lock_f *lock,
+    hpack_lock_f *unlock, void *priv)
+{
+	struct hpack_intern *itn;
+
+	if (ha == NULL || ha->malloc == NULL || ha->free == NULL)
+		return (NULL);
+	if ((lock == NULL) != (unlock == NULL))
+		return (NULL);
+
+	itn = ha->malloc(sizeof *itn, ha->priv);
+	if (itn == NULL)
+		return (NULL);
+
+	(void)memset(itn, 0, sizeof *itn);
+	itn->magic = INTERN_MAGIC;
+	(void)memcpy(&itn->alloc, ha, sizeof *ha);
+	itn->lock = lock;
+	itn->unlock = unlock;
+	itn->priv = priv;
+	return (itn);
+}
+
+int
+HPX_valid(const struct hpack_intern *itn)
+{
+
+	return (itn != NULL && itn->magic == INTERN_MAGIC);
+}
+
+void
+hpack_intern_free(struct hpack_intern **itnp)
+{
+	struct hpack_intern *itn;
+	size_t u;
+
+	if (itnp == NULL)
+		return;
+
+	itn = *itnp;
+	if (itn == NULL)
+		return;
+
+	*itnp = NULL;
+	if (itn->magic != INTERN_MAGIC)
+		return;
+
+	/* NB: strings are removed with their last reference */
+	assert(itn->cnt == 0);
+	for (u = 0; u < itn->bkt_len; u++)
+		assert(itn->bkt[u] == NULL);
+
+	itn->magic = 0;
+	if (itn->bkt != NULL)
+		itn->alloc.free(itn->bkt, itn->alloc.priv);
+	itn->alloc.free(itn, itn->alloc.priv);
+}
@@ -0,0 +1,309 @@
+/*-
+ * License: BSD-2-Clause
+ * (c) 2026 Dridi Boukelmoune <dridi.boukelmoune@gmail.com>
+ *
+ * HPACK: Header Compression for HTTP/2 (RFC 7541)
+ *
+ * Pool allocator for HPACK codecs.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hpack.h"
+#include "hpack_assert.h"
+#include "hpack_priv.h"
+
+#define HPL_BUCKETS	5
+#define HPL_DIRECT	HPL_BUCKETS
+#define HPL_SLAB	(256 * 1024)
+
+/* NB: codecs allocate their dynamic table along with the struct hpack, the
+ * smaller buckets serve the other allocations made with the memory manager
+ * of the pool.
+ */
+static const size_t hpl_sizes[HPL_BUCKETS] = {
+	256,
+	1024,
+	sizeof(struct hpack) + 4096,
+	sizeof(struct hpack) + 16384,
+	sizeof(struct hpack) + UINT16_MAX,
+};
+
+union hpl_align {
+	long double	ld;
+	double		d;
+	uint64_t	u;
+	void		*p;
+};
+
+union hpl_block {
+	struct {
+		uint32_t	magic;
+#define HPL_BLOCK_MAGIC	0x3be1d06c
+		uint32_t	bkt;
+		size_t		len; /* payload */
+		union hpl_block	*nxt; /* free list */
+	} hdr;
+	union hpl_align	align;
+};
+
+union hpl_slab {
+	struct {
+		union hpl_slab	*nxt;
+	} hdr;
+	union hpl_align	align;
+};
+
+struct hpl_bucket {
+	size_t			len; /* payload */
+	size_t			stride;
+	union hpl_block		*free;
+};
+
+struct hpack_pool {
+	uint32_t		magic;
+#define POOL_MAGIC		0x9f2c7a51
+	struct hpack_alloc	alloc; /* handed over to codecs */
+	struct hpack_alloc	back;
+	size_t			slab;
+	union hpl_slab		*slabs;
+	struct hpl_bucket	bkt[HPL_BUCKETS];
+};
+
+#define HPL_PAYLOAD(blk)	((void *)((blk) + 1))
+#define HPL_HEADER(ptr)		((union hpl_block *)(ptr) - 1)
+
+/**********************************************************************
+ * Buckets
+ */
+
+static unsigned
+hpl_bucket(const struct hpack_pool *pool, size_t len)
+{
+	unsigned u;
+
+	for (u = 0; u < HPL_BUCKETS; u++)
+		if (len <= pool->bkt[u].len)
+			return (u);
+	return (HPL_DIRECT);
+}
+
+static int
+hpl_refill(struct hpack_pool *pool, struct hpl_bucket *bkt, unsigned u)
+{
+	union hpl_slab *slab;
+	union hpl_block *blk;
+	size_t cnt;
+	uint8_t *ptr;
+
+	cnt = 1;
+	if (pool->slab > sizeof *slab + bkt->stride)
+		cnt = (pool->slab - sizeof *slab) / bkt->stride;
+
+	slab = pool->back.malloc(sizeof *slab + cnt * bkt->stride,
+	    pool->back.priv);
+	if (slab == NULL)
+		return (-1);
+
+	slab->hdr.nxt = pool->slabs;
+	pool->slabs = slab;
+
+	ptr = (uint8_t *)(slab + 1);
+	while (cnt-- > 0) {
+		blk = (union hpl_block *)(void *)(ptr + cnt * bkt->stride);
+		blk->hdr.magic = HPL_BLOCK_MAGIC;
+		blk->hdr.bkt = u;
+		blk->hdr.len = bkt->len;
+		blk->hdr.nxt = bkt->free;
+		bkt->free = blk;
+	}
+
+	return (0);
+}
+
+/**********************************************************************
+ * Memory management
+ */
+
+static void *
+hpack_pool_malloc(size_t len, void *priv)
+{
+	struct hpack_pool *pool;
+	struct hpl_bucket *bkt;
+	union hpl_block *blk;
+	unsigned u;
+
+	pool = priv;
+	assert(pool != NULL);
+	assert(pool->magic == POOL_MAGIC);
+
+	u = hpl_bucket(pool, len);
+	if (u == HPL_DIRECT) {
+		blk = pool->back.malloc(sizeof *blk + len, pool->back.priv);
+		if (blk == NULL)
+			return (NULL);
+		blk->hdr.magic = HPL_BLOCK_MAGIC;
+		blk->hdr.bkt = HPL_DIRECT;
+		blk->hdr.len = len;
+		blk->hdr.nxt = NULL;
+		return (HPL_PAYLOAD(blk));
+	}
+
+	bkt = &pool->bkt[u];
+	if (bkt->free == NULL && hpl_refill(pool, bkt, u) != 0)
+		return (NULL);
+
+	blk = bkt->free;
+	assert(blk->hdr.magic == HPL_BLOCK_MAGIC);
+	assert(blk->hdr.bkt == u);
+	bkt->free = blk->hdr.nxt;
+	blk->hdr.nxt = NULL;
+	return (HPL_PAYLOAD(blk));
+}
+
+static void
+hpack_pool_release(void *ptr, void *priv)
+{
+	struct hpack_pool *pool;
+	struct hpl_bucket *bkt;
+	union hpl_block *blk;
+
+	pool = priv;
+	assert(pool != NULL);
+	assert(pool->magic == POOL_MAGIC);
+
+	if (ptr == NULL)
+		return;
+
+	blk = HPL_HEADER(ptr);
+	assert(blk->hdr.magic == HPL_BLOCK_MAGIC);
+
+	if (blk->hdr.bkt == HPL_DIRECT) {
+		blk->hdr.magic = 0;
+		if (pool->back.free != NULL)
+			pool->back.free(blk, pool->back.priv);
+		return;
+	}
+
+	assert(blk->hdr.bkt < HPL_BUCKETS);
+	assert(blk->hdr.nxt == NULL);
+	bkt = &pool->bkt[blk->hdr.bkt];
+	blk->hdr.nxt = bkt->free;
+	bkt->free = blk;
+}
+
+static void *
+hpack_pool_realloc(void *ptr, size_t len, void *priv)
+{
+	struct hpack_pool *pool;
+	union hpl_block *blk;
+	void *mem;
+
+	pool = priv;
+	assert(pool != NULL);
+	assert(pool->magic == POOL_MAGIC);
+
+	if (ptr == NULL)
+		return (hpack_pool_malloc(len, priv));
+
+	blk = HPL_HEADER(ptr);
+	assert(blk->hdr.magic == HPL_BLOCK_MAGIC);
+
+	/* NB: a block only moves when it would change buckets, either to
+	 * grow the table or when a trim frees a bucket's worth of memory.
+	 */
+	if (hpl_bucket(pool, len) == blk->hdr.bkt && len <= blk->hdr.len)
+		return (ptr);
+
+	mem = hpack_pool_malloc(len, priv);
+	if (mem == NULL)
+		return (NULL);
+
+	(void)memcpy(mem, ptr, len < blk->hdr.len ? len : blk->hdr.len);
+	hpack_pool_release(ptr, priv);
+	return (mem);
+}
+
+/**********************************************************************
+ * Pool management
+ */
+
+struct hpack_pool *
+hpack_pool_new(const struct hpack_alloc *ha, size_t slab)
+{
+	struct hpack_pool *pool;
+	struct hpl_bucket *bkt;
+	size_t len;
+	unsigned u;
+
+	if (ha == NULL || ha->malloc == NULL)
+		return (NULL);
+
+	pool = ha->malloc(sizeof *pool, ha->priv);
+	if (pool == NULL)
+		return (NULL);
+
+	(void)memset(pool, 0, sizeof *pool);
+	pool->magic = POOL_MAGIC;
+	pool->alloc.malloc = hpack_pool_malloc;
+	pool->alloc.realloc = hpack_pool_realloc;
+	pool->alloc.free = hpack_pool_release;
+	pool->alloc.priv = pool;
+	(void)memcpy(&pool->back, ha, sizeof *ha);
+	pool->slab = slab > 0 ? slab : HPL_SLAB;
+
+	for (u = 0; u < HPL_BUCKETS; u++) {
+		bkt = &pool->bkt[u];
+		bkt->len = hpl_sizes[u];
+		assert(u == 0 || bkt->len > hpl_sizes[u - 1]);
+		len = bkt->len + sizeof(union hpl_block) - 1;
+		len -= len % sizeof(union hpl_block);
+		bkt->stride = sizeof(union hpl_block) + len;
+	}
+
+	return (pool);
+}
+
+const struct hpack_alloc *
+hpack_pool_alloc(const struct hpack_pool *pool)
+{
+
+	if (pool == NULL || pool->magic != POOL_MAGIC)
+		return (NULL);
+	return (&pool->alloc);
+}
+
+void
+hpack_pool_free(struct hpack_pool **poolp)
+{
+	struct hpack_pool *pool;
+	union hpl_slab *slab;
+
+	if (poolp == NULL)
+		return;
+
+	pool = *poolp;
+	if (pool == NULL)
+		return;
+
+	*poolp = NULL;
+	if (pool->magic != POOL_MAGIC)
+		return;
+
+	pool->magic = 0;
+	if (pool->back.free == NULL)
+		return;
+
+	while (pool->slabs != NULL) {
+		slab = pool->slabs;
+		pool->slabs = slab->hdr.nxt;
+		pool->back.free(slab, pool->back.priv);
+	}
+
+	pool->back.free(pool, pool->back.priv);
+}
@@ -0,0 +1,582 @@
+/*-
+ * License: BSD-2-Clause
+ * (c) 2026 Dridi Boukelmoune <dridi.boukelmoune@gmail.com>
+ *
+ * HPACK: Header Compression for HTTP/2 (RFC 7541)
+ *
+ * Indexing profile learned from the fields of many HPACK encoders.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hpack.h"
+#include "hpack_assert.h"
+#include "hpack_priv.h"
+
+#define HPN_BUCKETS	256
+#define HPN_NAMES	1024 /* names learned at most */
+#define HPN_NAMESZ	256 /* longest name learned */
+#define HPN_MIN		16 /* observations before giving advice */
+#define HPN_RATIO	4 /* insertions per hit worth indexing */
+#define HPN_SAMPLE	16 /* one observation out of n is explored */
+#define HPN_DECAY	65536 /* observations before counters are halved */
+#define HPN_CHUNK	16 /* names copied per lock when saved */
+#define HPN_SLOTS	64 /* names observed by an encoder between merges */
+#define HPN_BATCH	16 /* header lists observed between merges */
+
+static const char hpn_magic[] = "hpf 1\n";
+
+/* NB: Every observation counts a field line, that is either found in the
+ * dynamic table (hit) or meant to be inserted (ins). A name with too few
+ * hits per insertion is not worth indexing. Some observations are sampled
+ * to compare the length of values with their Huffman-coded length.
+ */
+struct hpn_count {
+	uint32_t		obs;
+	uint32_t		ins;
+	uint32_t		hit;
+	uint32_t		raw; /* sampled octets */
+	uint32_t		huf; /* sampled Huffman-coded octets */
+};
+
+struct hpn_name {
+	uint32_t		magic;
+#define HPN_NAME_MAGIC		0x7c3e11a9
+	uint32_t		hash;
+	struct hpn_name		*nxt;
+	struct hpn_count	cnt;
+	size_t			len;
+	size_t			huf; /* Huffman-coded length of the name */
+	char			nam[];
+};
+
+struct hpack_profile {
+	uint32_t		magic;
+#define PROFILE_MAGIC		0x4f09b2d3
+	struct hpack_alloc	alloc;
+	hpack_lock_f		*lock;
+	hpack_lock_f		*unlock;
+	void			*priv;
+	struct hpn_name		*bkt[HPN_BUCKETS];
+	size_t			cnt;
+	size_t			lrn; /* learning encoders */
+};
+
+/* NB: An encoder observes fields in its own slots, and only takes the lock
+ * of the profile to find a name it has not observed yet, and to merge its
+ * observations every few header lists. A slot keeps a snapshot of the
+ * counters of the profile taken at the last merge, so that advice is given
+ * from the observations of all the encoders as of the last merge, and from
+ * the recent ones of the encoder itself.
+ *
+ * A slot without a name is a name the profile could not learn. Such slots
+ * only compare the hash and length of names, so a collision only means that
+ * a name goes without advice until the next merge.
+ */
+struct hpn_slot {
+	struct hpn_name		*hn;
+	uint32_t		hash;
+	size_t			len;
+	struct hpn_count	snp; /* profile counters at the last merge */
+	struct hpn_count	loc; /* observations since the last merge */
+	unsigned		use;
+};
+
+struct hpn_learner {
+	uint32_t		magic;
+#define HPN_LEARNER_MAGIC	0x2d6af1c8
+	struct hpack_profile	*prf;
+	unsigned		blk; /* header lists since the last merge */
+	unsigned		cnt; /* slots in use */
+	struct hpn_slot		slt[HPN_SLOTS];
+};
+
+/**********************************************************************
+ * Names
+ */
+
+static struct hpn_name *
+hpn_lookup(struct hpack_profile *prf, const char *nam, size_t len,
+    uint32_t hash)
+{
+	struct hpn_name *hn;
+
+	hn = prf->bkt[hash % HPN_BUCKETS];
+	while (hn != NULL) {
+		assert(hn->magic == HPN_NAME_MAGIC);
+		if (hn->hash == hash && hn->len == len &&
+		    !memcmp(hn->nam, nam, len))
+			return (hn);
+		hn = hn->nxt;
+	}
+
+	if (prf->cnt >= HPN_NAMES || len > HPN_NAMESZ)
+		return (NULL);
+
+	hn = prf->alloc.malloc(sizeof *hn + len + 1, prf->alloc.priv);
+	if (hn == NULL)
+		return (NULL);
+
+	(void)memset(hn, 0, sizeof *hn);
+	hn->magic = HPN_NAME_MAGIC;
+	hn->hash = hash;
+	hn->len = len;
+	(void)memcpy(hn->nam, nam, len);
+	hn->nam[len] = '\0';
+	hn->huf = HPH_size(hn->nam);
+	hn->nxt = prf->bkt[hash % HPN_BUCKETS];
+	prf->bkt[hash % HPN_BUCKETS] = hn;
+	prf->cnt++;
+	return (hn);
+}
+
+static uint32_t
+hpn_add(uint32_t a, uint32_t b)
+{
+
+	return (a > UINT32_MAX - b ? UINT32_MAX : a + b);
+}
+
+static void
+hpn_merge(struct hpn_name *hn, const struct hpn_count *cnt)
+{
+
+	hn->cnt.obs = hpn_add(hn->cnt.obs, cnt->obs);
+	hn->cnt.ins = hpn_add(hn->cnt.ins, cnt->ins);
+	hn->cnt.hit = hpn_add(hn->cnt.hit, cnt->hit);
+	hn->cnt.raw = hpn_add(hn->cnt.raw, cnt->raw);
+	hn->cnt.huf = hpn_add(hn->cnt.huf, cnt->huf);
+	while (hn->cnt.obs >= HPN_DECAY) {
+		hn->cnt.obs >>= 1;
+		hn->cnt.ins >>= 1;
+		hn->cnt.hit >>= 1;
+		hn->cnt.raw >>= 1;
+		hn->cnt.huf >>= 1;
+	}
+}
+
+/**********************************************************************
+ * Learners
+ */
+
+struct hpn_learner *
+HPN_attach(struct hpack_profile *prf)
+{
+	struct hpn_learner *lrn;
+
+	assert(prf != NULL);
+	assert(prf->magic == PROFILE_MAGIC);
+
+	lrn = prf->alloc.malloc(sizeof *lrn, prf->alloc.priv);
+	if (lrn == NULL)
+		return (NULL);
+
+	(void)memset(lrn, 0, sizeof *lrn);
+	lrn->magic = HPN_LEARNER_MAGIC;
+	lrn->prf = prf;
+
+	HPACK_LOCK(prf);
+	prf->lrn++;
+	HPACK_UNLOCK(prf);
+	return (lrn);
+}
+
+void
+HPN_merge(struct hpn_learner *lrn)
+{
+	struct hpack_profile *prf;
+	struct hpn_slot *slt;
+	unsigned u;
+
+	assert(lrn != NULL);
+	assert(lrn->magic == HPN_LEARNER_MAGIC);
+	prf = lrn->prf;
+
+	lrn->blk = 0;
+	if (lrn->cnt == 0)
+		return;
+
+	HPACK_LOCK(prf);
+	for (u = 0; u < HPN_SLOTS; u++) {
+		slt = &lrn->slt[u];
+		if (slt->hn == NULL)
+			continue;
+		hpn_merge(slt->hn, &slt->loc);
+		slt->snp = slt->hn->cnt;
+		(void)memset(&slt->loc, 0, sizeof slt->loc);
+	}
+	HPACK_UNLOCK(prf);
+}
+
+void
+HPN_block(struct hpn_learner *lrn)
+{
+
+	assert(lrn != NULL);
+	assert(lrn->magic == HPN_LEARNER_MAGIC);
+
+	if (++lrn->blk == HPN_BATCH)
+		HPN_merge(lrn);
+}
+
+void
+HPN_detach(struct hpn_learner *lrn)
+{
+	struct hpack_profile *prf;
+
+	if (lrn == NULL)
+		return;
+
+	assert(lrn->magic == HPN_LEARNER_MAGIC);
+	prf = lrn->prf;
+
+	HPN_merge(lrn);
+	HPACK_LOCK(prf);
+	assert(prf->lrn > 0);
+	prf->lrn--;
+	HPACK_UNLOCK(prf);
+
+	lrn->magic = 0;
+	prf->alloc.free(lrn, prf->alloc.priv);
+}
+
+static struct hpn_slot *
+hpn_slot(struct hpn_learner *lrn, const char *nam, size_t len)
+{
+	struct hpack_profile *prf;
+	struct hpn_slot *slt;
+	uint32_t hash;
+	unsigned u;
+
+	hash = HPX_hash(HPX_HASH_INIT, nam, len);
+	u = hash % HPN_SLOTS;
+	while (lrn->slt[u].use) {
+		slt = &lrn->slt[u];
+		if (slt->hash == hash && slt->len == len && (slt->hn == NULL ||
+		    !memcmp(slt->hn->nam, nam, len)))
+			return (slt);
+		u = (u + 1) % HPN_SLOTS;
+	}
+
+	/* NB: a learner full of names starts over after a merge */
+	if (lrn->cnt == HPN_SLOTS * 3 / 4) {
+		HPN_merge(lrn);
+		(void)memset(lrn->slt, 0, sizeof lrn->slt);
+		lrn->cnt = 0;
+		u = hash % HPN_SLOTS;
+	}
+
+	slt = &lrn->slt[u];
+	assert(!slt->use);
+	slt->use = 1;
+	slt->hash = hash;
+	slt->len = len;
+	lrn->cnt++;
+
+	prf = lrn->prf;
+	HPACK_LOCK(prf);
+	slt->hn = hpn_lookup(prf, nam, len, hash);
+	if (slt->hn != NULL)
+		slt->snp = slt->hn->cnt;
+	HPACK_UNLOCK(prf);
+	return (slt);
+}
+
+/**********************************************************************
+ * Advice
+ */
+
+#define HPN_SUM(slt, fld) ((uint64_t)(slt)->snp.fld + (slt)->loc.fld)
+
+void
+HPN_advise(struct hpn_learner *lrn, struct hpack_field *fld, int hit)
+{
+	struct hpn_slot *slt;
+	unsigned smp;
+
+	assert(lrn != NULL);
+	assert(lrn->magic == HPN_LEARNER_MAGIC);
+	assert(fld != NULL);
+	assert(fld->nam != NULL);
+	assert(fld->val != NULL);
+
+	slt = hpn_slot(lrn, fld->nam, strlen(fld->nam));
+	if (slt->hn == NULL)
+		return;
+
+	slt->loc.obs++;
+	smp = HPN_SUM(slt, obs) % HPN_SAMPLE == 1;
+
+	if (hit) {
+		slt->loc.hit++;
+		return;
+	}
+
+	if (fld->flg & HPACK_FLG_TYP_DYN) {
+		if (HPN_SUM(slt, obs) > HPN_MIN && !smp &&
+		    HPN_SUM(slt, hit) * HPN_RATIO < HPN_SUM(slt, ins)) {
+			fld->flg &= ~(unsigned)HPACK_FLG_TYP_MSK;
+			fld->flg |= (unsigned)HPACK_FLG_TYP_LIT;
+		}
+		else
+			slt->loc.ins++;
+	}
+
+	if (smp) {
+		slt->loc.raw += strlen(fld->val);
+		slt->loc.huf += HPH_size(fld->val);
+	}
+	if (HPN_SUM(slt, huf) < HPN_SUM(slt, raw))
+		fld->flg |= (unsigned)HPACK_FLG_VAL_HUF;
+	if (~fld->flg & HPACK_FLG_NAM_IDX && slt->hn->huf < slt->hn->len)
+		fld->flg |= (unsigned)HPACK_FLG_NAM_HUF;
+}
+
+int
+HPN_valid(const struct hpack_profile *prf)
+{
+
+	return (prf != NULL && prf->magic == PROFILE_MAGIC);
+}
+
+/**********************************************************************
+ * Export
+ */
+
+struct hpn_line {
+	const char	*nam;
+	size_t		len;
+	struct hpn_count cnt;
+};
+
+/* NB: Names are never removed from a profile, and new names are inserted
+ * at the head of their bucket. The walk can therefore resume from the last
+ * name copied, and the callback runs without the lock held, so it may use
+ * an encoder learning from the same profile.
+ */
+static size_t
+hpn_copy(struct hpack_profile *prf, size_t *bkt, struct hpn_name **hnp,
+    struct hpn_line *hl)
+{
+	struct hpn_name *hn;
+	size_t n;
+
+	n = 0;
+	hn = *hnp;
+	HPACK_LOCK(prf);
+	while (n < HPN_CHUNK && *bkt < HPN_BUCKETS) {
+		hn = hn == NULL ? prf->bkt[*bkt] : hn->nxt;
+		if (hn == NULL) {
+			(*bkt)++;
+			continue;
+		}
+		assert(hn->magic == HPN_NAME_MAGIC);
+		hl[n].nam = hn->nam;
+		hl[n].len = hn->len;
+		hl[n].cnt = hn->cnt;
+		n++;
+	}
+	HPACK_UNLOCK(prf);
+	*hnp = hn;
+	return (n);
+}
+
+enum hpack_result_e
+hpack_profile_save(struct hpack_profile *prf, hpack_event_f cb, void *priv)
+{
+	struct hpack_encoding enc;
+	struct hpack_ctx ctx;
+	struct hpn_line hl[HPN_CHUNK];
+	struct hpn_name *hn;
+	char buf[256], num[64];
+	size_t bkt, n, u;
+	int len;
+
+	if (!HPN_valid(prf) || cb == NULL)
+		return (HPACK_RES_ARG);
+
+	(void)memset(&enc, 0, sizeof enc);
+	enc.buf = buf;
+	enc.buf_len = sizeof buf;
+
+	(void)memset(&ctx, 0, sizeof ctx);
+	ctx.arg.enc = &enc;
+	ctx.ptr.cur = (uint8_t *)buf;
+	ctx.cb = cb;
+	ctx.priv = priv;
+
+	HPE_bcat(&ctx, hpn_magic, sizeof hpn_magic - 1);
+	bkt = 0;
+	hn = NULL;
+	while (bkt < HPN_BUCKETS) {
+		n = hpn_copy(prf, &bkt, &hn, hl);
+		for (u = 0; u < n; u++) {
+			len = snprintf(num, sizeof num,
+			    " %u %u %u %u %u\n", hl[u].cnt.obs, hl[u].cnt.ins,
+			    hl[u].cnt.hit, hl[u].cnt.raw, hl[u].cnt.huf);
+			assert(len > 0 && (size_t)len < sizeof num);
+			HPE_bcat(&ctx, hl[u].nam, hl[u].len);
+			HPE_bcat(&ctx, num, (size_t)len);
+		}
+	}
+	HPE_send(&ctx);
+
+	return (HPACK_RES_OK);
+}
+
+/**********************************************************************
+ * Import
+ */
+
+static const char *
+hpn_parse(const char *ptr, const char *end, struct hpn_line *hl)
+{
+	uint32_t cnt[5];
+	uint64_t n;
+	unsigned u;
+
+	hl->nam = ptr;
+	while (ptr < end && *ptr > ' ' && *ptr < 0x7f)
+		ptr++;
+	hl->len = (size_t)(ptr - hl->nam);
+	if (hl->len == 0 || hl->len > HPN_NAMESZ)
+		return (NULL);
+
+	for (u = 0; u < 5; u++) {
+		if (ptr == end || *ptr != ' ')
+			return (NULL);
+		ptr++;
+		if (ptr == end || *ptr < '0' || *ptr > '9')
+			return (NULL);
+		n = 0;
+		while (ptr < end && *ptr >= '0' && *ptr <= '9') {
+			n = n * 10 + (uint64_t)(*ptr - '0');
+			if (n > UINT32_MAX)
+				return (NULL);
+			ptr++;
+		}
+		cnt[u] = (uint32_t)n;
+	}
+
+	if (ptr == end || *ptr != '\n')
+		return (NULL);
+
+	hl->cnt.obs = cnt[0];
+	hl->cnt.ins = cnt[1];
+	hl->cnt.hit = cnt[2];
+	hl->cnt.raw = cnt[3];
+	hl->cnt.huf = cnt[4];
+	return (ptr + 1);
+}
+
+enum hpack_result_e
+hpack_profile_load(struct hpack_profile *prf, const void *buf, size_t len)
+{
+	struct hpn_line hl;
+	struct hpn_name *hn;
+	const char *ptr, *end;
+	enum hpack_result_e res;
+
+	if (!HPN_valid(prf) || buf == NULL)
+		return (HPACK_RES_ARG);
+
+	ptr = buf;
+	end = ptr + len;
+	if (len < sizeof hpn_magic - 1 ||
+	    memcmp(ptr, hpn_magic, sizeof hpn_magic - 1))
+		return (HPACK_RES_ARG);
+	ptr += sizeof hpn_magic - 1;
+
+	/* NB: check everything before changing anything */
+	while (ptr < end) {
+		ptr = hpn_parse(ptr, end, &hl);
+		if (ptr == NULL)
+			return (HPACK_RES_ARG);
+	}
+
+	res = HPACK_RES_OK;
+	ptr = (const char *)buf + sizeof hpn_magic - 1;
+
+	HPACK_LOCK(prf);
+	while (ptr < end) {
+		ptr = hpn_parse(ptr, end, &hl);
+		assert(ptr != NULL);
+		hn = hpn_lookup(prf, hl.nam, hl.len,
+		    HPX_hash(HPX_HASH_INIT, hl.nam, hl.len));
+		if (hn == NULL) {
+			if (prf->cnt < HPN_NAMES)
+				res = HPACK_RES_OOM;
+			continue;
+		}
+		hpn_merge(hn, &hl.cnt);
+	}
+	HPACK_UNLOCK(prf);
+
+	return (res);
+}
+
+/**********************************************************************
+ * Profile management
+ */
+
+struct hpack_profile *
+hpack_profile_new(const struct hpack_alloc *ha, hpack_lock_f *lock,
+    hpack_lock_f *unlock, void *priv)
+{
+	struct hpack_profile *prf;
+
+	if (ha == NULL || ha->malloc == NULL || ha->free == NULL)
+		return (NULL);
+	if ((lock == NULL) != (unlock == NULL))
+		return (NULL);
+
+	prf = ha->malloc(sizeof *prf, ha->priv);
+	if (prf == NULL)
+		return (NULL);
+
+	(void)memset(prf, 0, sizeof *prf);
+	prf->magic = PROFILE_MAGIC;
+	(void)memcpy(&prf->alloc, ha, sizeof *ha);
+	prf->lock = lock;
+	prf->unlock = unlock;
+	prf->priv = priv;
+	return (prf);
+}
+
+void
+hpack_profile_free(struct hpack_profile **prfp)
+{
+	struct hpack_profile *prf;
+	struct hpn_name *hn;
+	size_t u;
+
+	if (prfp == NULL)
+		return;
+
+	prf = *prfp;
+	if (prf == NULL)
+		return;
+
+	*prfp = NULL;
+	if (prf->magic != PROFILE_MAGIC)
+		return;
+
+	assert(prf->lrn == 0);
+	prf->magic = 0;
+	for (u = 0; u < HPN_BUCKETS; u++) {
+		while (prf->bkt[u] != NULL) {
+			hn = prf->bkt[u];
+			prf->bkt[u] = hn->nxt;
+			hn->magic = 0;
+			prf->alloc.free(hn, prf->alloc.priv);
+		}
+	}
+
+	prf->alloc.free(prf, prf->alloc.priv);
+}
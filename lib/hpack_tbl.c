@@ -15,9 +15,20 @@
 #include "hpack.h"
 #include "hpack_assert.h"
 #include "hpack_priv.h"
+#include "hpack_sdt.h"
 #include "hpack_static_hdr.h"
 
-#define HPT_HEADERSZ (HPACK_OVERHEAD - 2) /* account for 2 null bytes */
+#define HPT_LAZY_MIN	256 /* smallest lazy table allocation */
+#define HPT_LAZY_LOW	64 /* blocks with a low usage before a shrink */
+
+struct hpt_layout {
+	uint8_t			sta; /* static name index */
+	uint16_t		nam_len; /* stored lengths */
+	uint16_t		val_len;
+	size_t			len; /* physical entry size */
+	struct hpx_string	*nam_str; /* interned strings */
+	struct hpx_string	*val_str;
+};
 
 #define MOVE(he, mv)	(void *)(uintptr_t)((uintptr_t)(he) + (uintptr_t)(mv))
 #define JUMP(he, mv)	MOVE(he, HPT_HEADERSZ + (mv))
@@ -54,27 +65,214 @@ const char *hpack_unknown_value = hpt_unknown_value;
  * Tables lookups
  */
 
+static size_t
+hpt_string_size(size_t len, size_t sz)
+{
+
+	assert(len <= sz);
+	return (len < sz ? len : len + 1);
+}
+
+static size_t
+hpt_read(const struct hpack *hp, const struct hpt_entry *he,
+    struct hpt_entry *tmp, struct hpt_field *hf)
+{
+	const struct hpt_field *sta;
+	struct hpt_huffman huf;
+	struct hpx_string *hs;
+	const uint8_t *ptr;
+
+	(void)memcpy(tmp, he, HPT_HEADERSZ);
+	ptr = MOVE(he, HPT_HEADERSZ);
+
+	if (hp->flg & HPD_FLG_HUF) {
+		(void)memcpy(&huf, ptr, HPT_HUFFMANSZ);
+		ptr += HPT_HUFFMANSZ;
+	}
+	else {
+		huf.nam_sz = tmp->nam_sz;
+		huf.val_sz = tmp->val_sz;
+	}
+
+	if (tmp->nam_sz == 0) {
+		/* NB: a static name is stored as its index */
+		assert(*ptr > 0);
+		assert(*ptr <= HPACK_STATIC);
+		sta = &hpt_static[*ptr - 1];
+		hf->nam = sta->nam;
+		hf->nam_sz = sta->nam_sz;
+		hf->nam_huf = 0;
+		hf->idx = *ptr;
+		ptr++;
+	}
+	else if (hp->itn != NULL) {
+		(void)memcpy(&hs, ptr, HPT_HANDLESZ);
+		assert(hs->magic == HPX_STRING_MAGIC);
+		assert(hs->len == tmp->nam_sz);
+		hf->nam = hs->str;
+		hf->nam_sz = tmp->nam_sz;
+		hf->nam_huf = 0;
+		hf->idx = 0;
+		ptr += HPT_HANDLESZ;
+	}
+	else {
+		hf->nam = (const char *)ptr;
+		hf->nam_sz = huf.nam_sz;
+		hf->nam_huf = tmp->nam_sz < huf.nam_sz ? tmp->nam_sz : 0;
+		hf->idx = 0;
+		ptr += hpt_string_size(tmp->nam_sz, huf.nam_sz);
+	}
+
+	if (hp->itn != NULL) {
+		(void)memcpy(&hs, ptr, HPT_HANDLESZ);
+		assert(hs->magic == HPX_STRING_MAGIC);
+		assert(hs->len == tmp->val_sz);
+		hf->val = hs->str;
+		hf->val_sz = tmp->val_sz;
+		hf->val_huf = 0;
+		ptr += HPT_HANDLESZ;
+		return (DIFF(he, ptr));
+	}
+
+	hf->val = (const char *)ptr;
+	hf->val_sz = huf.val_sz;
+	hf->val_huf = tmp->val_sz < huf.val_sz ? tmp->val_sz : 0;
+	ptr += hpt_string_size(tmp->val_sz, huf.val_sz);
+
+	return (DIFF(he, ptr));
+}
+
+static size_t
+hpt_unref(const struct hpack *hp, const struct hpt_entry *he)
+{
+	struct hpt_entry tmp;
+	struct hpx_string *hs;
+	const uint8_t *ptr;
+
+	assert(hp->itn != NULL);
+	(void)memcpy(&tmp, he, HPT_HEADERSZ);
+	ptr = MOVE(he, HPT_HEADERSZ);
+
+	if (tmp.nam_sz == 0)
+		ptr++;
+	else {
+		(void)memcpy(&hs, ptr, HPT_HANDLESZ);
+		HPX_release(hp->itn, hs);
+		ptr += HPT_HANDLESZ;
+	}
+
+	(void)memcpy(&hs, ptr, HPT_HANDLESZ);
+	HPX_release(hp->itn, hs);
+	ptr += HPT_HANDLESZ;
+	return (DIFF(he, ptr));
+}
+
+static int
+hpt_scratch(struct hpack *hp, size_t len)
+{
+	char *buf;
+
+	if (len <= hp->huf.len)
+		return (0);
+
+	if (hp->huf.buf != NULL && hp->alloc.realloc != NULL)
+		buf = hp->alloc.realloc(hp->huf.buf, len, hp->alloc.priv);
+	else {
+		buf = hp->alloc.malloc(len, hp->alloc.priv);
+		if (buf != NULL)
+			HPT_release(hp);
+	}
+
+	if (buf == NULL)
+		return (-1);
+
+	hp->huf.buf = buf;
+	hp->huf.len = len;
+	return (0);
+}
+
+int
+HPT_expand(struct hpack *hp, struct hpt_field *hf)
+{
+	char *buf;
+	int retval;
+
+	if (hf->nam_huf == 0 && hf->val_huf == 0)
+		return (0);
+
+	assert(hp->flg & HPD_FLG_HUF);
+	if (hpt_scratch(hp, hf->nam_sz + hf->val_sz + 2) != 0)
+		return (-1);
+
+	buf = hp->huf.buf;
+	if (hf->nam_huf > 0) {
+		retval = HPH_expand(hf->nam, hf->nam_huf, buf, hf->nam_sz);
+		assert(retval == 0);
+		(void)retval;
+		hf->nam = buf;
+		hf->nam_huf = 0;
+	}
+
+	buf += hf->nam_sz + 1;
+	if (hf->val_huf > 0) {
+		retval = HPH_expand(hf->val, hf->val_huf, buf, hf->val_sz);
+		assert(retval == 0);
+		(void)retval;
+		hf->val = buf;
+		hf->val_huf = 0;
+	}
+
+	return (0);
+}
+
+void
+HPT_clear(struct hpack *hp)
+{
+	const struct hpt_entry *he;
+	size_t i;
+
+	if (hp->itn != NULL) {
+		he = HPT_TABLE(hp);
+		for (i = 0; i < hp->cnt; i++)
+			he = MOVE(he, hpt_unref(hp, he));
+		assert(DIFF(HPT_TABLE(hp), he) == hp->sz.use);
+	}
+
+	hp->cnt = 0;
+	hp->sz.len = 0;
+	hp->sz.use = 0;
+}
+
+void
+HPT_release(struct hpack *hp)
+{
+
+	if (hp->huf.buf != NULL && hp->alloc.free != NULL)
+		hp->alloc.free(hp->huf.buf, hp->alloc.priv);
+	hp->huf.buf = NULL;
+	hp->huf.len = 0;
+}
+
 static struct hpt_entry *
 hpt_dynamic(struct hpack *hp, size_t idx)
 {
 	struct hpt_entry *he, tmp;
-	size_t off;
+	struct hpt_field hf;
+	size_t off, sz;
 
-	he = hp->tbl;
+	he = HPT_TABLE(hp);
 	off = 0;
 
 	assert(idx > 0);
 	assert(idx <= hp->cnt);
 
 	while (1) {
-		(void)memcpy(&tmp, he, HPT_HEADERSZ);
-		assert(tmp.magic == HPT_ENTRY_MAGIC);
+		sz = hpt_read(hp, he, &tmp, &hf);
 		assert(tmp.pre_sz == off);
-		assert(tmp.nam_sz > 0);
 		if (--idx == 0)
 			return (he);
-		off = HPACK_OVERHEAD + tmp.nam_sz + tmp.val_sz;
-		he = MOVE(he, off);
+		he = MOVE(he, sz);
+		off = sz;
 	}
 }
 
@@ -100,22 +298,19 @@ HPT_field(HPACK_CTX, size_t idx, struct hpt_field *hf)
 	he = hpt_dynamic(ctx->hp, idx);
 	assert(he != NULL);
 	assert(hf != NULL);
-	(void)memcpy(&tmp, he, HPT_HEADERSZ);
-	hf->nam_sz = tmp.nam_sz;
-	hf->val_sz = tmp.val_sz;
-	hf->nam = JUMP(he, 0);
-	hf->val = JUMP(he, tmp.nam_sz + 1);
+	(void)hpt_read(ctx->hp, he, &tmp, hf);
 	hf->idx = idx;
 	return (0);
 }
 
-void
+int
 HPT_foreach(HPACK_CTX, int flg)
 {
 	const struct hpt_entry *he, *tbl;
 	const struct hpt_field *hf;
+	struct hpt_field fld;
 	struct hpt_entry tmp;
-	size_t i, off;
+	size_t i, off, sz;
 
 	if (flg & HPT_FLG_STATIC)
 		for (i = 0, hf = hpt_static; i < HPACK_STATIC; i++, hf++) {
@@ -125,26 +320,27 @@ HPT_foreach(HPACK_CTX, int flg)
 		}
 
 	if (~flg & HPT_FLG_DYNAMIC)
-		return;
+		return (0);
 
 	off = 0;
-	tbl = ctx->hp->tbl;
+	tbl = HPT_TABLE(ctx->hp);
 	he = tbl;
 	for (i = 0; i < ctx->hp->cnt; i++) {
-		assert(DIFF(tbl, he) < ctx->hp->sz.len);
-		(void)memcpy(&tmp, he, HPT_HEADERSZ);
-		assert(tmp.magic == HPT_ENTRY_MAGIC);
+		assert(DIFF(tbl, he) < ctx->hp->sz.use);
+		sz = hpt_read(ctx->hp, he, &tmp, &fld);
 		assert(tmp.pre_sz == off);
-		assert(tmp.nam_sz > 0);
-		off = HPACK_OVERHEAD + tmp.nam_sz + tmp.val_sz;
-		HPC_notify(ctx, HPACK_EVT_FIELD, NULL, off);
-		HPC_notify(ctx, HPACK_EVT_NAME, JUMP(he, 0), tmp.nam_sz);
-		HPC_notify(ctx, HPACK_EVT_VALUE, JUMP(he, tmp.nam_sz + 1),
-		    tmp.val_sz);
-		he = MOVE(he, off);
+		if (HPT_expand(ctx->hp, &fld) != 0)
+			return (-1);
+		HPC_notify(ctx, HPACK_EVT_FIELD, NULL,
+		    HPACK_OVERHEAD + fld.nam_sz + fld.val_sz);
+		HPC_notify(ctx, HPACK_EVT_NAME, fld.nam, fld.nam_sz);
+		HPC_notify(ctx, HPACK_EVT_VALUE, fld.val, fld.val_sz);
+		he = MOVE(he, sz);
+		off = sz;
 	}
 
-	assert(DIFF(tbl, he) == ctx->hp->sz.len);
+	assert(DIFF(tbl, he) == ctx->hp->sz.use);
+	return (0);
 }
 
 static int
@@ -192,13 +388,64 @@ hpt_bsearch(struct hpt_field *key)
 	return (key->idx ? HPACK_RES_NAM : HPACK_RES_IDX);
 }
 
+static uint8_t
+hpt_static_first(size_t idx)
+{
+	const struct hpt_field *hf;
+
+	assert(idx > 0);
+	assert(idx <= HPACK_STATIC);
+
+	/* NB: names shared by several static entries are always referenced
+	 * by the lowest index, so that comparing references is enough.
+	 */
+	hf = &hpt_static[idx - 1];
+	while (idx > 1 && hf[-1].nam_sz == hf->nam_sz &&
+	    !strcmp(hf[-1].nam, hf->nam)) {
+		hf--;
+		idx--;
+	}
+	return ((uint8_t)idx);
+}
+
+static uint8_t
+hpt_static_name(const char *nam, size_t nam_sz)
+{
+	const struct hpt_field *tbl;
+	ssize_t min, max, pos;
+	int cmp;
+
+	tbl = hpack_static_hdr;
+	min = 0;
+	max = HPACK_STATIC - 1;
+
+	while (min <= max) {
+		pos = (min + max) / 2;
+		assert(pos < HPACK_STATIC);
+		if (nam_sz != tbl[pos].nam_sz)
+			cmp = nam_sz < tbl[pos].nam_sz ? -1 : 1;
+		else
+			cmp = memcmp(nam, tbl[pos].nam, nam_sz);
+		if (cmp == 0)
+			return (hpt_static_first(tbl[pos].idx));
+		if (cmp < 0)
+			max = pos - 1;
+		else
+			min = pos + 1;
+	}
+
+	return (0);
+}
+
 int
 HPT_search(HPACK_CTX, struct hpt_field *hf)
 {
 	const struct hpt_entry *he, *tbl;
 	struct hpt_entry tmp;
+	struct hpt_field fld;
 	uint16_t i, nam_idx;
-	size_t off;
+	size_t off, sz;
+	uint8_t sta;
 	int retval;
 
 	assert(ctx != NULL);
@@ -220,33 +467,63 @@ HPT_search(HPACK_CTX, struct hpt_field *hf)
 		WRONG("Unreachable");
 	}
 
+	sta = nam_idx > 0 ? hpt_static_first(nam_idx) : 0;
 	off = 0;
-	tbl = ctx->hp->tbl;
+	tbl = HPT_TABLE(ctx->hp);
 	he = tbl;
 	for (i = 0; i < ctx->hp->cnt; i++) {
-		assert(DIFF(tbl, he) < ctx->hp->sz.len);
-		(void)memcpy(&tmp, he, HPT_HEADERSZ);
-		assert(tmp.magic == HPT_ENTRY_MAGIC);
+		assert(DIFF(tbl, he) < ctx->hp->sz.use);
+		sz = hpt_read(ctx->hp, he, &tmp, &fld);
 		assert(tmp.pre_sz == off);
-		assert(tmp.nam_sz > 0);
-		off = HPACK_OVERHEAD + tmp.nam_sz + tmp.val_sz;
-		if (!strcmp(hf->nam, JUMP(he, 0))) {
-			nam_idx = i + HPACK_STATIC + 1;
-			if (!strcmp(hf->val, JUMP(he, tmp.nam_sz + 1))) {
-				hf->idx = nam_idx;
-				return (0);
-			}
+		he = MOVE(he, sz);
+		off = sz;
+
+		/* NB: static names are compared by index */
+		if (fld.idx > 0 ? fld.idx != sta :
+		    sta > 0 || fld.nam_sz != hf->nam_sz)
+			continue;
+		if (HPT_expand(ctx->hp, &fld) != 0)
+			return (HPACK_RES_OOM);
+		if (fld.idx == 0 && strcmp(hf->nam, fld.nam))
+			continue;
+
+		nam_idx = i + HPACK_STATIC + 1;
+		if (fld.val_sz == hf->val_sz && !strcmp(hf->val, fld.val)) {
+			hf->idx = nam_idx;
+			return (0);
 		}
-		he = MOVE(he, off);
 	}
 
-	assert(DIFF(tbl, he) == ctx->hp->sz.len);
+	assert(DIFF(tbl, he) == ctx->hp->sz.use);
 	hf->idx = nam_idx;
 	if (nam_idx > 0)
 		return (HPACK_RES_NAM);
 	return (HPACK_RES_IDX);
 }
 
+size_t
+HPT_tail(struct hpack *hp, size_t idx)
+{
+	const struct hpt_entry *he;
+	struct hpt_entry tmp;
+	struct hpt_field hf;
+	size_t len, sz;
+
+	assert(idx > 0);
+	assert(idx <= hp->cnt);
+
+	/* NB: what remains once the entry and newer ones are accounted for */
+	len = hp->sz.len;
+	he = HPT_TABLE(hp);
+	while (idx-- > 0) {
+		sz = hpt_read(hp, he, &tmp, &hf);
+		len -= HPACK_OVERHEAD + hf.nam_sz + hf.val_sz;
+		he = MOVE(he, sz);
+	}
+
+	return (len);
+}
+
 /**********************************************************************
  * Resize
  */
@@ -257,6 +534,7 @@ HPT_adjust(struct hpack_ctx *ctx, size_t len)
 	struct hpack *hp;
 	struct hpt_entry *he;
 	struct hpt_entry tmp;
+	struct hpt_field hf;
 	size_t sz, lim, n;
 
 	hp = ctx->hp;
@@ -271,10 +549,10 @@ HPT_adjust(struct hpack_ctx *ctx, size_t len)
 
 	n = 0;
 	while (hp->cnt > 0 && len > lim) {
-		(void)memcpy(&tmp, he, HPT_HEADERSZ);
-		assert(tmp.magic == HPT_ENTRY_MAGIC);
-		assert(tmp.nam_sz > 0);
-		sz = HPACK_OVERHEAD + tmp.nam_sz + tmp.val_sz;
+		hp->sz.use -= hpt_read(hp, he, &tmp, &hf);
+		if (hp->itn != NULL)
+			(void)hpt_unref(hp, he);
+		sz = HPACK_OVERHEAD + hf.nam_sz + hf.val_sz;
 		len -= sz;
 		hp->sz.len -= sz;
 		hp->cnt--;
@@ -282,19 +560,51 @@ HPT_adjust(struct hpack_ctx *ctx, size_t len)
 		n++;
 	}
 
-	if (n > 0)
+	if (n > 0) {
+		PROBE3(evict, hp, n, hp->sz.len);
 		HPC_notify(ctx, HPACK_EVT_EVICT, NULL, n);
+		if (hp->flg & HPE_FLG_ADP)
+			hp->adp.evi += n;
+	}
 
 	if (hp->cnt == 0)
-		assert(hp->sz.len == 0);
+		assert(hp->sz.len == 0 && hp->sz.use == 0);
 	else
-		assert(hp->sz.len > 0);
+		assert(hp->sz.len > 0 && hp->sz.use > 0);
 }
 
 /**********************************************************************
  * Insert
  */
 
+static int
+hpt_grow(HPACK_CTX, size_t len)
+{
+	struct hpack *hp;
+	size_t mem, lim;
+
+	hp = ctx->hp;
+	assert(hp->flg & HPD_FLG_LZY);
+
+	if (len <= hp->sz.mem)
+		return (0);
+
+	lim = HPACK_LIMIT(hp);
+	assert(len <= lim);
+
+	mem = hp->sz.mem * 2;
+	if (mem < HPT_LAZY_MIN)
+		mem = HPT_LAZY_MIN;
+	if (mem < len)
+		mem = len;
+	if (mem > lim)
+		mem = lim;
+
+	EXPECT(ctx, OOM, HPT_realloc(hp, mem) == 0);
+	hp->lzy.low = 0;
+	return (0);
+}
+
 static unsigned
 hpt_fit(HPACK_CTX, size_t len)
 {
@@ -320,9 +630,9 @@ hpt_overlap(const struct hpack *hp, const char *buf, size_t len)
 {
 	uintptr_t bgn, end, pos;
 
-	bgn = (uintptr_t)hp->tbl;
+	bgn = (uintptr_t)HPT_TABLE(hp);
 	pos = (uintptr_t)buf;
-	end = bgn + hp->sz.len;
+	end = bgn + hp->sz.use;
 
 	if (pos >= bgn && pos < end) {
 		pos += len;
@@ -335,21 +645,34 @@ hpt_overlap(const struct hpack *hp, const char *buf, size_t len)
 	return (0);
 }
 
+static void
+hpt_reverse(char *buf, size_t len)
+{
+	size_t i;
+	char c;
+
+	for (i = 0; i < len / 2; i++) {
+		c = buf[i];
+		buf[i] = buf[len - i - 1];
+		buf[len - i - 1] = c;
+	}
+}
+
 static void
 hpt_move_evicted(HPACK_CTX, const char *nam, size_t nam_sz, size_t len)
 {
 	struct hpack *hp;
-	char tmp[64], *nam_ptr;
-	void *tbl_ptr;
-	size_t sz, mv;
+	char *tbl;
+	size_t off, used;
 
 	hp = ctx->hp;
 	assert(hp->magic == ENCODER_MAGIC);
 
-	tbl_ptr = hp->tbl;
-	nam_ptr = JUMP(hp->tbl, 0);
+	tbl = (char *)HPT_TABLE(hp);
+	used = hp->sz.use;
+	off = DIFF(tbl, nam);
 	nam_sz++; /* null character */
-	mv = 0;
+	assert(len > HPT_HEADERSZ + nam_sz);
 
 	/* NB: from RFC 7541 section 4.4.
 	 * A new entry can reference the name of an entry in the dynamic table
@@ -358,29 +681,157 @@ hpt_move_evicted(HPACK_CTX, const char *nam, size_t nam_sz, size_t len)
 	 * referenced name if the referenced entry is evicted from the dynamic
 	 * table prior to inserting the new entry.
 	 */
-	while (nam_sz > 0) {
-		sz = nam_sz < sizeof tmp ? nam_sz : sizeof tmp;
-		mv += sz;
+	if (off < used) {
+		assert(off + nam_sz <= used);
+		(void)memmove(tbl + len, tbl, used);
+		(void)memmove(tbl + HPT_HEADERSZ, tbl + len + off, nam_sz);
+		return;
+	}
 
-		(void)memcpy(tmp, nam, sz);
-		(void)memmove(MOVE(tbl_ptr, sz), tbl_ptr, hp->sz.len);
-		(void)memcpy(nam_ptr, tmp, sz);
+	/* NB: The evicted name is rotated in place ahead of the remaining
+	 * entries, before they move out of the way of the new entry.
+	 */
+	(void)memmove(tbl + used, tbl + off, nam_sz);
+	hpt_reverse(tbl, used);
+	hpt_reverse(tbl + used, nam_sz);
+	hpt_reverse(tbl, used + nam_sz);
+	(void)memmove(tbl + len, tbl + nam_sz, used);
+	(void)memmove(tbl + HPT_HEADERSZ, tbl, nam_sz);
+}
 
-		len -= sz;
-		nam += sz;
-		nam_sz -= sz;
-		tbl_ptr = MOVE(tbl_ptr, sz);
+static void
+hpt_layout(const struct hpack *hp, const char *nam, size_t nam_sz,
+    const char *val, size_t val_sz, struct hpt_layout *hl)
+{
+	size_t len;
+
+	hl->sta = hpt_static_name(nam, nam_sz);
+	hl->nam_len = hl->sta > 0 ? 0 : (uint16_t)nam_sz;
+	hl->val_len = (uint16_t)val_sz;
+	hl->len = HPT_HEADERSZ;
+	hl->nam_str = NULL;
+	hl->val_str = NULL;
+
+	if (hp->itn != NULL) {
+		hl->len += hl->sta > 0 ? 1 : HPT_HANDLESZ;
+		hl->len += HPT_HANDLESZ;
+		return;
 	}
 
-	assert(len > HPT_HEADERSZ);
-	(void)memmove(MOVE(tbl_ptr, len), tbl_ptr, hp->sz.len);
+	if (hp->flg & HPD_FLG_HUF) {
+		len = HPH_size(nam);
+		if (hl->sta == 0 && len < nam_sz)
+			hl->nam_len = (uint16_t)len;
+		len = HPH_size(val);
+		if (len < val_sz)
+			hl->val_len = (uint16_t)len;
+		hl->len += HPT_HUFFMANSZ;
+	}
+
+	hl->len += hl->sta > 0 ? 1 : hpt_string_size(hl->nam_len, nam_sz);
+	hl->len += hpt_string_size(hl->val_len, val_sz);
 }
 
-void
+static size_t
+hpt_write_string(uint8_t *ptr, const char *str, size_t len, size_t sz)
+{
+
+	if (len < sz) {
+		HPH_pack(str, ptr);
+		return (len);
+	}
+
+	/* NB: a string restored in place may already be there */
+	assert(len == sz);
+	if (str != NULL)
+		(void)memmove(ptr, str, sz + 1);
+	return (sz + 1);
+}
+
+static void
+hpt_write(const struct hpack *hp, void *he, size_t pre,
+    const struct hpt_layout *hl, const char *nam, size_t nam_sz,
+    const char *val, size_t val_sz)
+{
+	struct hpt_entry tmp;
+	struct hpt_huffman huf;
+	uint8_t *ptr;
+
+	(void)memset(&tmp, 0, sizeof tmp);
+	tmp.pre_sz = (uint16_t)pre;
+	tmp.nam_sz = hl->nam_len;
+	tmp.val_sz = hl->val_len;
+	(void)memcpy(he, &tmp, HPT_HEADERSZ);
+	ptr = MOVE(he, HPT_HEADERSZ);
+
+	if (hp->flg & HPD_FLG_HUF) {
+		huf.nam_sz = (uint16_t)nam_sz;
+		huf.val_sz = (uint16_t)val_sz;
+		(void)memcpy(ptr, &huf, HPT_HUFFMANSZ);
+		ptr += HPT_HUFFMANSZ;
+	}
+
+	if (hl->sta > 0)
+		*ptr++ = hl->sta;
+	else if (hp->itn != NULL) {
+		assert(hl->nam_str != NULL);
+		(void)memcpy(ptr, &hl->nam_str, HPT_HANDLESZ);
+		ptr += HPT_HANDLESZ;
+	}
+	else
+		ptr += hpt_write_string(ptr, nam, hl->nam_len, nam_sz);
+
+	if (hp->itn != NULL) {
+		assert(hl->val_str != NULL);
+		(void)memcpy(ptr, &hl->val_str, HPT_HANDLESZ);
+		ptr += HPT_HANDLESZ;
+	}
+	else
+		ptr += hpt_write_string(ptr, val, hl->val_len, val_sz);
+	assert(DIFF(he, ptr) == hl->len);
+}
+
+static int
+hpt_intern(HPACK_CTX, struct hpt_layout *hl, const char *nam, size_t nam_sz,
+    const char *val, size_t val_sz)
+{
+	struct hpack *hp;
+
+	hp = ctx->hp;
+	if (hp->itn == NULL)
+		return (0);
+
+	/* NB: references are taken before evictions, an evicted entry may
+	 * hold the same strings.
+	 */
+	if (hl->sta == 0) {
+		hl->nam_str = HPX_acquire(hp->itn, nam, nam_sz);
+		EXPECT(ctx, OOM, hl->nam_str != NULL);
+	}
+
+	hl->val_str = HPX_acquire(hp->itn, val, val_sz);
+	if (hl->val_str == NULL && hl->nam_str != NULL)
+		HPX_release(hp->itn, hl->nam_str);
+	EXPECT(ctx, OOM, hl->val_str != NULL);
+	return (0);
+}
+
+static void
+hpt_unintern(const struct hpack *hp, const struct hpt_layout *hl)
+{
+
+	if (hl->nam_str != NULL)
+		HPX_release(hp->itn, hl->nam_str);
+	if (hl->val_str != NULL)
+		HPX_release(hp->itn, hl->val_str);
+}
+
+int
 HPT_index(HPACK_CTX)
 {
 	struct hpack *hp;
-	void *nam_ptr, *val_ptr;
+	struct hpt_entry *tbl;
+	struct hpt_layout hl;
 	size_t len, nam_sz, val_sz;
 	unsigned ovl;
 
@@ -395,41 +846,124 @@ HPT_index(HPACK_CTX)
 	assert(ctx->fld.nam[nam_sz] == '\0');
 	assert(ctx->fld.val[val_sz] == '\0');
 
+	/* NB: a static name is not copied, only its index is stored */
 	hp = ctx->hp;
-	ovl = hpt_overlap(hp, ctx->fld.nam, nam_sz);
+	hpt_layout(hp, ctx->fld.nam, nam_sz, ctx->fld.val, val_sz, &hl);
+	ovl = hl.sta == 0 && hpt_overlap(hp, ctx->fld.nam, nam_sz);
 	assert(!hpt_overlap(hp, ctx->fld.val, val_sz));
 
 	len = HPACK_OVERHEAD + nam_sz + val_sz;
-	if (!hpt_fit(ctx, len))
-		return;
+	CALL(hpt_intern, ctx, &hl, ctx->fld.nam, nam_sz, ctx->fld.val, val_sz);
+	if (!hpt_fit(ctx, len)) {
+		hpt_unintern(hp, &hl);
+		return (0);
+	}
 
-	nam_ptr = JUMP(hp->tbl, 0);
-	val_ptr = JUMP(hp->tbl, nam_sz + 1);
-	hp->tbl->pre_sz = len;
+	/* NB: only decoders are lazy or Huffman-coded, and their fields
+	 * never overlap. Neither do interned strings.
+	 */
+	if (hp->flg & (HPD_FLG_LZY|HPD_FLG_HUF) || hp->itn != NULL)
+		assert(!ovl);
+	if (hp->flg & HPD_FLG_LZY && hpt_grow(ctx, hp->sz.use + hl.len) != 0) {
+		hpt_unintern(hp, &hl);
+		return (-1);
+	}
+
+	tbl = HPT_TABLE(hp);
+	assert(hp->sz.use + hl.len <= hp->sz.mem);
+	tbl->pre_sz = (uint16_t)hl.len;
 
 	if (ovl)
-		hpt_move_evicted(ctx, ctx->fld.nam, nam_sz, len);
+		hpt_move_evicted(ctx, ctx->fld.nam, nam_sz, hl.len);
 	else if (hp->cnt > 0)
-		(void)memmove(MOVE(hp->tbl, len), hp->tbl, hp->sz.len);
-
-	if (!ovl)
-		(void)memcpy(nam_ptr, ctx->fld.nam, nam_sz + 1);
-	(void)memcpy(val_ptr, ctx->fld.val, val_sz + 1);
+		(void)memmove(MOVE(tbl, hl.len), tbl, hp->sz.use);
 
-	hp->tbl->magic = HPT_ENTRY_MAGIC;
-	hp->tbl->pre_sz = 0;
-	hp->tbl->nam_sz = (uint16_t)nam_sz;
-	hp->tbl->val_sz = (uint16_t)val_sz;
+	hpt_write(hp, tbl, 0, &hl, ovl ? NULL : ctx->fld.nam, nam_sz,
+	    ctx->fld.val, val_sz);
 	hp->sz.len += len;
+	hp->sz.use += hl.len;
 	hp->cnt++;
 
+	if (hp->hot != NULL) {
+		hp->hot->seq++;
+		HPE_HOT_SLOT(hp->hot, 1) = hp->hot->pnd;
+		hp->hot->pnd = 0;
+	}
+
+	PROBE4(index, hp, len, hp->sz.len, hp->cnt);
 	HPC_notify(ctx, HPACK_EVT_INDEX, NULL, len);
+	return (0);
+}
+
+/**********************************************************************
+ * Lazy tables
+ */
+
+int
+HPT_realloc(struct hpack *hp, size_t mem)
+{
+	struct hpt_entry *tbl;
+
+	assert(hp->flg & HPD_FLG_LZY);
+	assert(hp->alloc.realloc != NULL);
+	assert(hp->sz.use <= mem);
+	assert(mem <= UINT16_MAX);
+
+	if (mem == 0) {
+		if (hp->alloc.free != NULL)
+			hp->alloc.free(hp->lzy.tbl, hp->alloc.priv);
+		tbl = NULL;
+	}
+	else if (hp->lzy.tbl == NULL)
+		tbl = hp->alloc.malloc(mem, hp->alloc.priv);
+	else
+		tbl = hp->alloc.realloc(hp->lzy.tbl, mem, hp->alloc.priv);
+
+	if (tbl == NULL && mem > 0)
+		return (-1);
+
+	hp->lzy.tbl = tbl;
+	HPG_account(hp->gov, hp->sz.mem, mem);
+	hp->sz.mem = mem;
+	return (0);
+}
+
+void
+HPT_shrink(struct hpack *hp)
+{
+	size_t mem;
+
+	assert(hp->flg & HPD_FLG_LZY);
+
+	if (hp->sz.mem <= HPT_LAZY_MIN || hp->sz.use > hp->sz.mem / 4) {
+		hp->lzy.low = 0;
+		return;
+	}
+
+	if (++hp->lzy.low < HPT_LAZY_LOW)
+		return;
+
+	/* NB: keep room to grow back before the next reallocation */
+	mem = hp->sz.mem / 2;
+	if (mem < HPT_LAZY_MIN)
+		mem = HPT_LAZY_MIN;
+	(void)HPT_realloc(hp, mem);
+	hp->lzy.low = 0;
 }
 
 /**********************************************************************
  * Decode
  */
 
+static int
+hpt_decode_string(HPACK_CTX, const char *str, size_t len, size_t cod)
+{
+
+	if (cod > 0)
+		return (HPD_expand(ctx, str, cod, len));
+	return (HPD_puts(ctx, str, len));
+}
+
 int
 HPT_decode(HPACK_CTX, size_t idx)
 {
@@ -444,11 +978,11 @@ HPT_decode(HPACK_CTX, size_t idx)
 
 	ctx->fld.nam = ctx->buf;
 	ctx->fld.nam_sz = hf.nam_sz;
-	CALL(HPD_puts, ctx, hf.nam, hf.nam_sz);
+	CALL(hpt_decode_string, ctx, hf.nam, hf.nam_sz, hf.nam_huf);
 
 	ctx->fld.val = ctx->buf;
 	ctx->fld.val_sz = hf.val_sz;
-	CALL(HPD_puts, ctx, hf.val, hf.val_sz);
+	CALL(hpt_decode_string, ctx, hf.val, hf.val_sz, hf.val_huf);
 
 	HPD_notify(ctx);
 	return (0);
@@ -467,5 +1001,169 @@ HPT_decode_name(HPACK_CTX)
 	assert(hf.nam_sz > 0);
 
 	ctx->fld.nam_sz = hf.nam_sz;
-	return (HPD_puts(ctx, hf.nam, hf.nam_sz));
+	return (hpt_decode_string(ctx, hf.nam, hf.nam_sz, hf.nam_huf));
+}
+
+/**********************************************************************
+ * Serialization
+ */
+
+static void
+hpt_save_string(HPACK_CTX, const char *str, size_t len, size_t cod,
+    unsigned huf)
+{
+	size_t sz;
+
+	assert(len <= UINT16_MAX);
+
+	/* NB: Huffman-coded strings are saved as is */
+	if (cod > 0) {
+		HPI_encode(ctx, HPACK_PFX_HUF, HPACK_PAT_HUF, (uint16_t)cod);
+		HPE_bcat(ctx, str, cod);
+		return;
+	}
+
+	if (huf) {
+		sz = HPH_size(str);
+		if (sz < len) {
+			HPI_encode(ctx, HPACK_PFX_HUF, HPACK_PAT_HUF,
+			    (uint16_t)sz);
+			HPH_encode(ctx, str);
+			return;
+		}
+	}
+
+	HPI_encode(ctx, HPACK_PFX_STR, HPACK_PAT_STR, (uint16_t)len);
+	HPE_bcat(ctx, str, len);
+}
+
+void
+HPT_save(HPACK_CTX, unsigned huf)
+{
+	const struct hpt_entry *he;
+	struct hpt_entry tmp;
+	struct hpt_field hf;
+	size_t i, sz;
+
+	he = HPT_TABLE(ctx->hp);
+	for (i = 0; i < ctx->hp->cnt; i++) {
+		sz = hpt_read(ctx->hp, he, &tmp, &hf);
+		HPI_encode(ctx, HPACK_PFX_STR, HPACK_PAT_STR, hf.nam_sz);
+		HPI_encode(ctx, HPACK_PFX_STR, HPACK_PAT_STR, hf.val_sz);
+		hpt_save_string(ctx, hf.nam, hf.nam_sz, hf.nam_huf, huf);
+		hpt_save_string(ctx, hf.val, hf.val_sz, hf.val_huf, huf);
+		he = MOVE(he, sz);
+	}
+
+	assert(DIFF(HPT_TABLE(ctx->hp), he) == ctx->hp->sz.use);
+}
+
+static int
+hpt_restore_string(HPACK_CTX, char *str, size_t len)
+{
+	struct hpack_decoding dec;
+	struct hpack_state *hs;
+	uint16_t sz;
+	uint8_t huf;
+
+	EXPECT(ctx, BUF, ctx->ptr_len > 0);
+	huf = *ctx->ptr.blk & HPACK_PAT_HUF;
+	CALL(HPI_decode, ctx, HPACK_PFX_STR, &sz);
+
+	if (huf) {
+		/* NB: decode in place, the field must fill the table space
+		 * reserved for the string and overflows fail with BIG.
+		 */
+		(void)memset(&dec, 0, sizeof dec);
+		dec.buf = str;
+		dec.buf_len = len + 1;
+		ctx->arg.dec = &dec;
+		ctx->buf = str;
+		ctx->buf_len = len + 1;
+		ctx->fld.nam = str;
+		ctx->fld.val = NULL;
+
+		hs = &ctx->hp->state;
+		hs->magic = HUF_STATE_MAGIC;
+		hs->stt.str.nod = 0;
+		hs->stt.str.len = sz;
+		hs->stt.str.bits = 0;
+		hs->stt.str.blen = 0;
+		CALL(HPH_decode, ctx, sz);
+		EXPECT(ctx, LEN, ctx->buf_len == 0);
+	}
+	else {
+		EXPECT(ctx, LEN, sz == len);
+		EXPECT(ctx, BUF, ctx->ptr_len >= len);
+		(void)memcpy(str, ctx->ptr.blk, len);
+		str[len] = '\0';
+		ctx->ptr.blk += len;
+		ctx->ptr_len -= len;
+	}
+
+	assert(str[len] == '\0');
+	EXPECT(ctx, CHR, memchr(str, '\0', len) == NULL);
+	return (0);
+}
+
+int
+HPT_restore(HPACK_CTX, size_t cnt)
+{
+	struct hpack *hp;
+	struct hpt_layout hl;
+	char *nam, *val;
+	size_t len, pre;
+	uint16_t nam_sz, val_sz;
+
+	hp = ctx->hp;
+	assert(hp->itn == NULL);
+	assert(hp->cnt == 0);
+	assert(hp->sz.len == 0);
+	assert(hp->sz.use == 0);
+
+	pre = 0;
+	while (cnt-- > 0) {
+		CALL(HPI_load, ctx, &nam_sz);
+		CALL(HPI_load, ctx, &val_sz);
+		EXPECT(ctx, LEN, nam_sz > 0);
+
+		len = HPACK_OVERHEAD + nam_sz + val_sz;
+		EXPECT(ctx, LEN, hp->sz.len + len <= HPACK_LIMIT(hp));
+
+		/* NB: strings are restored in place, or in the scratch buffer
+		 * when they need to be Huffman-coded again. There must be room
+		 * for them before they turn out to be stored shorter.
+		 */
+		if (hp->flg & HPD_FLG_HUF) {
+			EXPECT(ctx, OOM,
+			    hpt_scratch(hp, nam_sz + val_sz + 2) == 0);
+			nam = hp->huf.buf;
+		}
+		else {
+			if (hp->flg & HPD_FLG_LZY)
+				CALL(hpt_grow, ctx, hp->sz.use +
+				    HPT_ENTRYSZ(nam_sz, val_sz));
+			EXPECT(ctx, LEN, hp->sz.use +
+			    HPT_ENTRYSZ(nam_sz, val_sz) <= hp->sz.mem);
+			nam = JUMP(HPT_TABLE(hp), hp->sz.use);
+		}
+
+		val = nam + nam_sz + 1;
+		CALL(hpt_restore_string, ctx, nam, nam_sz);
+		CALL(hpt_restore_string, ctx, val, val_sz);
+
+		hpt_layout(hp, nam, nam_sz, val, val_sz, &hl);
+		if (hp->flg & HPD_FLG_LZY)
+			CALL(hpt_grow, ctx, hp->sz.use + hl.len);
+		EXPECT(ctx, LEN, hp->sz.use + hl.len <= hp->sz.mem);
+
+		hpt_write(hp, MOVE(HPT_TABLE(hp), hp->sz.use), pre, &hl, nam,
+		    nam_sz, val, val_sz);
+		hp->sz.len += len;
+		hp->sz.use += hl.len;
+		hp->cnt++;
+		pre = hl.len;
+	}
+
+	return (0);
 }
@@ -0,0 +1,556 @@
+/*-
+ * License: BSD-2-Clause
+ * (c) 2026 Dridi Boukelmoune <dridi.boukelmoune@gmail.com>
+ *
+ * Benchmark harness shared by the hpack_* benchmark programs.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#  include <linux/perf_event.h>
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#endif
+
+#include "hpack.h"
+
+#include "bch.h"
+
+#define BCH_MAX_RUNS	1000
+
+/**********************************************************************
+ * Options
+ */
+
+void
+BCH_defaults(struct bch_options *opt)
+{
+
+	assert(opt != NULL);
+	(void)memset(opt, 0, sizeof *opt);
+	opt->fmt = BCH_FMT_TXT;
+	opt->runs = 5;
+	opt->wrm = 1;
+	opt->tgt = 5;
+}
+
+static unsigned
+bch_number(const char *arg, unsigned min, unsigned max)
+{
+	unsigned long ul;
+	char *end;
+
+	ul = strtoul(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || ul < min || ul > max)
+		return (0);
+	return ((unsigned)ul);
+}
+
+int
+BCH_option(struct bch_options *opt, int c, const char *arg)
+{
+
+	assert(opt != NULL);
+
+	switch (c) {
+	case 'f':
+		if (!strcmp(arg, "txt"))
+			opt->fmt = BCH_FMT_TXT;
+		else if (!strcmp(arg, "tsv"))
+			opt->fmt = BCH_FMT_TSV;
+		else if (!strcmp(arg, "json"))
+			opt->fmt = BCH_FMT_JSON;
+		else
+			return (-1);
+		break;
+	case 'p':
+		opt->prf = 1;
+		break;
+	case 'r':
+		opt->runs = bch_number(arg, 1, BCH_MAX_RUNS);
+		if (opt->runs == 0)
+			return (-1);
+		break;
+	case 't':
+		opt->tgt = bch_number(arg, 1, 60000);
+		if (opt->tgt == 0)
+			return (-1);
+		break;
+	case 'w':
+		opt->wrm = bch_number(arg, 0, BCH_MAX_RUNS);
+		if (opt->wrm == 0 && strcmp(arg, "0"))
+			return (-1);
+		break;
+	default:
+		return (-1);
+	}
+
+	return (0);
+}
+
+/**********************************************************************
+ * Memory accounting
+ *
+ * Allocations are prefixed with their size in order to keep track of the
+ * current and peak usage, including for allocators like nghttp2's that
+ * don't pass the size of the memory they free.
+ */
+
+union bch_header {
+	size_t		len;
+	long double	ld;
+	void		*ptr;
+	uint64_t	u64;
+};
+
+void
+BCH_memory_init(struct bch_memory *bm)
+{
+
+	assert(bm != NULL);
+	(void)memset(bm, 0, sizeof *bm);
+	bm->alc.malloc = BCH_memory_malloc;
+	bm->alc.realloc = BCH_memory_realloc;
+	bm->alc.free = BCH_memory_free;
+	bm->alc.priv = bm;
+}
+
+void
+BCH_memory_reset(struct bch_memory *bm)
+{
+
+	assert(bm != NULL);
+	bm->max = bm->cur;
+	bm->cnt = 0;
+}
+
+void *
+BCH_memory_malloc(size_t len, void *priv)
+{
+
+	return (BCH_memory_realloc(NULL, len, priv));
+}
+
+void *
+BCH_memory_realloc(void *ptr, size_t len, void *priv)
+{
+	struct bch_memory *bm;
+	union bch_header *hdr;
+	size_t old;
+
+	assert(priv != NULL);
+	bm = priv;
+
+	hdr = NULL;
+	old = 0;
+	if (ptr != NULL) {
+		hdr = (union bch_header *)ptr - 1;
+		old = hdr->len;
+		assert(bm->cur >= old);
+	}
+
+	hdr = realloc(hdr, sizeof *hdr + len);
+	if (hdr == NULL)
+		return (NULL);
+
+	hdr->len = len;
+	bm->cur += len - old;
+	bm->cnt++;
+	if (bm->max < bm->cur)
+		bm->max = bm->cur;
+	return (hdr + 1);
+}
+
+void
+BCH_memory_free(void *ptr, void *priv)
+{
+	struct bch_memory *bm;
+	union bch_header *hdr;
+
+	assert(priv != NULL);
+	bm = priv;
+
+	if (ptr == NULL)
+		return;
+
+	hdr = (union bch_header *)ptr - 1;
+	assert(bm->cur >= hdr->len);
+	bm->cur -= hdr->len;
+	free(hdr);
+}
+
+/**********************************************************************
+ * Measurements
+ */
+
+uint64_t
+BCH_now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+		perror("clock_gettime");
+		abort();
+	}
+	return ((uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec);
+}
+
+static int
+bch_cmp(const void *a, const void *b)
+{
+	double da, db;
+
+	da = *(const double *)a;
+	db = *(const double *)b;
+	return ((da > db) - (da < db));
+}
+
+static double
+bch_rank(const double *smp, size_t cnt, unsigned pct)
+{
+	size_t rnk;
+
+	/* nearest rank */
+	rnk = (cnt * pct + 99) / 100;
+	if (rnk > 0)
+		rnk--;
+	return (smp[rnk]);
+}
+
+void
+BCH_stats(double *smp, size_t cnt, struct bch_stats *st)
+{
+
+	assert(smp != NULL);
+	assert(cnt > 0);
+	assert(st != NULL);
+
+	qsort(smp, cnt, sizeof *smp, bch_cmp);
+	st->min = smp[0];
+	st->max = smp[cnt - 1];
+	st->p90 = bch_rank(smp, cnt, 90);
+	st->p99 = bch_rank(smp, cnt, 99);
+	if (cnt & 1)
+		st->med = smp[cnt / 2];
+	else
+		st->med = (smp[cnt / 2 - 1] + smp[cnt / 2]) / 2;
+}
+
+/**********************************************************************
+ * Hardware counters
+ *
+ * NB: perf events are optional, a kernel without them, a restrictive
+ * perf_event_paranoid setting or a virtual machine without a PMU will
+ * simply leave the columns empty.
+ */
+
+struct bch_perf {
+	int	cyc;
+	int	ins;
+};
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+static int
+bch_perf_event(uint64_t cfg, int grp)
+{
+	struct perf_event_attr pea;
+
+	(void)memset(&pea, 0, sizeof pea);
+	pea.type = PERF_TYPE_HARDWARE;
+	pea.size = sizeof pea;
+	pea.config = cfg;
+	pea.disabled = grp == -1;
+	pea.exclude_kernel = 1;
+	pea.exclude_hv = 1;
+	return ((int)syscall(SYS_perf_event_open, &pea, 0, -1, grp, 0));
+}
+
+static int
+bch_perf_open(struct bch_perf *bp)
+{
+
+	bp->cyc = bch_perf_event(PERF_COUNT_HW_CPU_CYCLES, -1);
+	if (bp->cyc < 0)
+		return (-1);
+	bp->ins = bch_perf_event(PERF_COUNT_HW_INSTRUCTIONS, bp->cyc);
+	if (bp->ins < 0) {
+		(void)close(bp->cyc);
+		return (-1);
+	}
+	return (0);
+}
+
+static void
+bch_perf_start(const struct bch_perf *bp)
+{
+
+	(void)ioctl(bp->cyc, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	(void)ioctl(bp->cyc, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static void
+bch_perf_stop(const struct bch_perf *bp, double *cyc, double *ins)
+{
+	uint64_t val;
+
+	(void)ioctl(bp->cyc, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+	*cyc = 0;
+	*ins = 0;
+	if (read(bp->cyc, &val, sizeof val) == sizeof val)
+		*cyc = (double)val;
+	if (read(bp->ins, &val, sizeof val) == sizeof val)
+		*ins = (double)val;
+}
+
+static void
+bch_perf_close(const struct bch_perf *bp)
+{
+
+	(void)close(bp->cyc);
+	(void)close(bp->ins);
+}
+#else
+static int
+bch_perf_open(struct bch_perf *bp)
+{
+
+	(void)bp;
+	return (-1);
+}
+
+#define bch_perf_start(bp)		(void)(bp)
+#define bch_perf_stop(bp, cyc, ins)	(void)(bp)
+#define bch_perf_close(bp)		(void)(bp)
+#endif
+
+/**********************************************************************
+ * Runner
+ */
+
+static uint64_t
+bch_iterate(const struct bch_scenario *scn, void *priv, uint64_t itr,
+    struct bch_count *cnt)
+{
+	uint64_t ns;
+
+	(void)memset(cnt, 0, sizeof *cnt);
+	ns = BCH_now();
+	while (itr-- > 0)
+		scn->run(priv, cnt);
+	return (BCH_now() - ns);
+}
+
+static uint64_t
+bch_calibrate(const struct bch_options *opt, const struct bch_scenario *scn,
+    void *priv)
+{
+	struct bch_count cnt;
+	uint64_t itr, ns, tgt;
+
+	tgt = (uint64_t)opt->tgt * 1000000;
+	itr = 1;
+	while ((ns = bch_iterate(scn, priv, itr, &cnt)) < tgt / 8)
+		itr *= 2;
+
+	if (ns == 0)
+		return (itr);
+	itr = itr * tgt / ns;
+	return (itr > 0 ? itr : 1);
+}
+
+void
+BCH_run(const struct bch_options *opt, const struct bch_scenario *scn,
+    struct bch_result *res)
+{
+	static int perf_warned = 0;
+	struct bch_count cnt;
+	struct bch_perf bp;
+	double ns[BCH_MAX_RUNS], cyc[BCH_MAX_RUNS], ins[BCH_MAX_RUNS];
+	double itm;
+	void *priv;
+	unsigned u;
+	int prf;
+
+	assert(opt != NULL);
+	assert(scn != NULL);
+	assert(res != NULL);
+	assert(opt->runs > 0 && opt->runs <= BCH_MAX_RUNS);
+
+	(void)memset(res, 0, sizeof *res);
+	(void)memset(&bp, 0, sizeof bp);
+
+	prf = 0;
+	if (opt->prf) {
+		prf = bch_perf_open(&bp) == 0;
+		if (!prf && !perf_warned) {
+			(void)fprintf(stderr, "perf counters unavailable\n");
+			perf_warned = 1;
+		}
+	}
+
+	priv = scn->init != NULL ? scn->init() : NULL;
+	res->itr = bch_calibrate(opt, scn, priv);
+
+	for (u = 0; u < opt->wrm; u++)
+		(void)bch_iterate(scn, priv, res->itr, &cnt);
+
+	for (u = 0; u < opt->runs; u++) {
+		cyc[u] = 0;
+		ins[u] = 0;
+		if (prf)
+			bch_perf_start(&bp);
+		ns[u] = (double)bch_iterate(scn, priv, res->itr, &cnt);
+		if (prf)
+			bch_perf_stop(&bp, &cyc[u], &ins[u]);
+
+		itm = (double)(cnt.itm > 0 ? cnt.itm : res->itr);
+		ns[u] /= itm;
+		cyc[u] /= itm;
+		ins[u] /= itm;
+	}
+
+	if (scn->fini != NULL)
+		scn->fini(priv);
+	if (prf)
+		bch_perf_close(&bp);
+
+	res->cnt.itm = cnt.itm / res->itr;
+	res->cnt.len = cnt.len / res->itr;
+
+	BCH_stats(ns, opt->runs, &res->ns);
+	if (prf) {
+		qsort(cyc, opt->runs, sizeof *cyc, bch_cmp);
+		qsort(ins, opt->runs, sizeof *ins, bch_cmp);
+		res->cyc = cyc[opt->runs / 2];
+		res->ins = ins[opt->runs / 2];
+	}
+}
+
+/**********************************************************************
+ * Reports
+ */
+
+void
+BCH_header(const struct bch_options *opt, const struct bch_column *col,
+    size_t col_cnt)
+{
+	size_t n;
+
+	assert(opt != NULL);
+	assert(col != NULL);
+
+	switch (opt->fmt) {
+	case BCH_FMT_TXT:
+		(void)printf("%-16s", "scenario");
+		for (n = 0; n < col_cnt; n++)
+			(void)printf(" %*s", col[n].wdt, col[n].nam);
+		(void)printf("\n");
+		break;
+	case BCH_FMT_TSV:
+		(void)printf("scenario");
+		for (n = 0; n < col_cnt; n++)
+			(void)printf("\t%s", col[n].nam);
+		(void)printf("\n");
+		break;
+	case BCH_FMT_JSON:
+		/* one object per row, see BCH_row() */
+		break;
+	default:
+		abort();
+	}
+}
+
+void
+BCH_row(const struct bch_options *opt, const struct bch_column *col,
+    size_t col_cnt, const char *lbl, const double *val)
+{
+	size_t n;
+
+	assert(opt != NULL);
+	assert(col != NULL);
+	assert(lbl != NULL);
+	assert(val != NULL);
+
+	switch (opt->fmt) {
+	case BCH_FMT_TXT:
+		(void)printf("%-16s", lbl);
+		for (n = 0; n < col_cnt; n++)
+			(void)printf(" %*.*f", col[n].wdt, col[n].prc, val[n]);
+		(void)printf("\n");
+		break;
+	case BCH_FMT_TSV:
+		(void)printf("%s", lbl);
+		for (n = 0; n < col_cnt; n++)
+			(void)printf("\t%.*f", col[n].prc, val[n]);
+		(void)printf("\n");
+		break;
+	case BCH_FMT_JSON:
+		(void)printf("{\"scenario\": \"%s\"", lbl);
+		for (n = 0; n < col_cnt; n++)
+			(void)printf(", \"%s\": %.*f", col[n].nam,
+			    col[n].prc, val[n]);
+		(void)printf("}\n");
+		break;
+	default:
+		abort();
+	}
+	(void)fflush(stdout);
+}
+
+static const struct bch_column bch_result_columns[] = {
+	{ "iter",	0, 9 },
+	{ "fields",	0, 7 },
+	{ "octets",	0, 7 },
+	{ "ns/fld",	1, 8 },
+	{ "p90",	1, 8 },
+	{ "p99",	1, 8 },
+	{ "min",	1, 8 },
+	{ "max",	1, 8 },
+	{ "Mfld/s",	2, 7 },
+	{ "MB/s",	1, 8 },
+	{ "cyc/fld",	1, 8 },
+	{ "ipc",	2, 5 },
+};
+
+#define BCH_RESULT_COLUMNS \
+	(sizeof bch_result_columns / sizeof *bch_result_columns)
+
+void
+BCH_result_header(const struct bch_options *opt)
+{
+
+	BCH_header(opt, bch_result_columns, BCH_RESULT_COLUMNS);
+}
+
+void
+BCH_result(const struct bch_options *opt, const char *lbl,
+    const struct bch_result *res)
+{
+	double val[BCH_RESULT_COLUMNS], itm;
+
+	assert(res != NULL);
+
+	itm = res->cnt.itm > 0 ? (double)res->cnt.itm : 1.0;
+	val[0] = (double)res->itr;
+	val[1] = (double)res->cnt.itm;
+	val[2] = (double)res->cnt.len;
+	val[3] = res->ns.med;
+	val[4] = res->ns.p90;
+	val[5] = res->ns.p99;
+	val[6] = res->ns.min;
+	val[7] = res->ns.max;
+	val[8] = res->ns.med > 0 ? 1e3 / res->ns.med : 0;
+	val[9] = res->ns.med > 0 ?
+	    (double)res->cnt.len / itm * 1e3 / res->ns.med : 0;
+	val[10] = res->cyc;
+	val[11] = res->cyc > 0 ? res->ins / res->cyc : 0;
+
+	BCH_row(opt, bch_result_columns, BCH_RESULT_COLUMNS, lbl, val);
+}
@@ -0,0 +1,96 @@
+/*-
+ * License: BSD-2-Clause
+ * (c) 2026 Dridi Boukelmoune <dridi.boukelmoune@gmail.com>
+ */
+
+#define BCH_OPTIONS	"f:pr:t:w:"
+
+#define BCH_USAGE							\
+	"  -f <fmt>  output format: txt (default), tsv or json\n"	\
+	"  -p        collect CPU cycles and instructions\n"		\
+	"  -r <n>    number of measured runs (default: 5)\n"		\
+	"  -t <ms>   target duration of a single run (default: 5)\n"	\
+	"  -w <n>    number of warmup runs (default: 1)\n"
+
+enum bch_format_e {
+	BCH_FMT_TXT,
+	BCH_FMT_TSV,
+	BCH_FMT_JSON,
+};
+
+struct bch_options {
+	enum bch_format_e	fmt;
+	unsigned		prf;
+	unsigned		runs;
+	unsigned		wrm;
+	unsigned		tgt; /* milliseconds */
+};
+
+struct bch_count {
+	uint64_t	itm; /* items processed, usually fields */
+	uint64_t	len; /* octets processed */
+};
+
+typedef void *bch_init_f(void);
+typedef void bch_run_f(void *, struct bch_count *);
+typedef void bch_fini_f(void *);
+
+struct bch_scenario {
+	const char	*nam;
+	const char	*dsc;
+	bch_init_f	*init;
+	bch_run_f	*run;
+	bch_fini_f	*fini;
+};
+
+struct bch_stats {
+	double	min;
+	double	med;
+	double	p90;
+	double	p99;
+	double	max;
+};
+
+struct bch_result {
+	struct bch_count	cnt; /* per iteration */
+	uint64_t		itr; /* iterations per run */
+	struct bch_stats	ns;  /* per item */
+	double			cyc; /* per item, median */
+	double			ins; /* per item, median */
+};
+
+struct bch_column {
+	const char	*nam;
+	int		prc; /* decimal precision */
+	int		wdt; /* text width */
+};
+
+/* NB: requires hpack.h */
+
+struct bch_memory {
+	struct hpack_alloc	alc;
+	size_t			cur;
+	size_t			max;
+	size_t			cnt; /* calls to malloc or realloc */
+};
+
+void BCH_memory_init(struct bch_memory *);
+void BCH_memory_reset(struct bch_memory *);
+void *BCH_memory_malloc(size_t, void *);
+void *BCH_memory_realloc(void *, size_t, void *);
+void BCH_memory_free(void *, void *);
+
+void     BCH_defaults(struct bch_options *);
+int      BCH_option(struct bch_options *, int, const char *);
+uint64_t BCH_now(void);
+void     BCH_stats(double *, size_t, struct bch_stats *);
+void     BCH_run(const struct bch_options *, const struct bch_scenario *,
+    struct bch_result *);
+
+void BCH_header(const struct bch_options *, const struct bch_column *,
+    size_t);
+void BCH_row(const struct bch_options *, const struct bch_column *, size_t,
+    const char *, const double *);
+void BCH_result_header(const struct bch_options *);
+void BCH_result(const struct bch_options *, const char *,
+    const struct bch_result *);
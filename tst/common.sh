@@ -24,6 +24,7 @@ trap 'rm -fr "$TEST_TMP"' EXIT
 # Test conditionals
 
 HDECODE="hdecode fdecode"
+HENCODE="hencode iencode"
 HIGNORE=
 NOTABLE=godecode
 
@@ -33,6 +34,7 @@ do
 done
 
 readonly HDECODE
+readonly HENCODE
 readonly NOTABLE
 
 # Valgrind setup
@@ -227,14 +229,18 @@ tst_monitor() {
 }
 
 tst_encode() {
-	hpack_encode ./hencode "$@"
+	for enc in $HENCODE
+	do
+		hpack_encode "./$enc" "$@"
 
-	skip_diff "$@" && return
+		skip_diff "$@" && continue
 
-	"$TEST_DIR/hex_encode" <"$TEST_TMP/enc_bin" >"$TEST_TMP/enc_hex"
+		"$TEST_DIR/hex_encode" <"$TEST_TMP/enc_bin" \
+			>"$TEST_TMP/enc_hex"
 
-	diff -u "$TEST_TMP/hex" "$TEST_TMP/enc_hex"
-	diff -u "$TEST_TMP/tbl" "$TEST_TMP/enc_tbl"
+		diff -u "$TEST_TMP/hex" "$TEST_TMP/enc_hex"
+		diff -u "$TEST_TMP/tbl" "$TEST_TMP/enc_tbl"
+	done
 }
 
 err_decode() {
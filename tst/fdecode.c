@@ -211,8 +211,13 @@ main(int argc, char **argv)
 
 	ctx.blk = blk;
 
-	hp = hpack_decoder(tbl_sz, -1, hpack_default_alloc);
+	/* NB: hdecode covers regular decoders, let's cover lazy ones here,
+	 * with a dynamic table holding Huffman-coded strings.
+	 */
+	hp = hpack_decoder_lazy(tbl_sz, -1, hpack_default_alloc);
 	assert(hp != NULL);
+	res = hpack_compress(hp);
+	assert(res == HPACK_RES_OK);
 
 	priv.hp = hp;
 	res = TST_decode(&ctx);
@@ -265,6 +265,9 @@ int
 main(int argc, char **argv)
 {
 	enum hpack_result_e exp;
+#ifdef HENCODE_INTERN
+	struct hpack_intern *itn;
+#endif
 	struct enc_ctx ctx;
 	int tbl_sz, tbl_mem, retval;
 
@@ -331,6 +334,14 @@ main(int argc, char **argv)
 	hp = hpack_encoder(tbl_sz, tbl_mem, hpack_default_alloc);
 	assert(hp != NULL);
 
+#ifdef HENCODE_INTERN
+	/* NB: iencode is hencode built with an encoder sharing a pool */
+	itn = hpack_intern_new(hpack_default_alloc, NULL, NULL, NULL);
+	assert(itn != NULL);
+	retval = hpack_share(hp, itn);
+	assert(retval == HPACK_RES_OK);
+#endif
+
 	ctx.res = HPACK_RES_OK;
 
 	do {
@@ -356,6 +367,9 @@ main(int argc, char **argv)
 	(void)close(3);
 
 	hpack_free(&hp);
+#ifdef HENCODE_INTERN
+	hpack_intern_free(&itn);
+#endif
 
 	if (ctx.res != exp)
 		ERR("hpack error: expected '%s' (%d) got '%s' (%d)",
@@ -0,0 +1,415 @@
+/*-
+ * License: BSD-2-Clause
+ * (c) 2026 Dridi Boukelmoune <dridi.boukelmoune@gmail.com>
+ *
+ * Compare encoder indexing policies with an offline oracle knowing every
+ * header list of a connection in advance.
+ *
+ * The oracle decides for each field line whether it is inserted in the
+ * dynamic table or sent as a literal, and lets the encoder index whatever
+ * is already in the table. It starts from the fields that are seen again
+ * later in the connection, or from inserting everything when this is
+ * smaller, and then flips one decision at a time, keeping every flip that
+ * reduces the size of the encoded connection. This is a local search, so
+ * the oracle is the best result found rather than a proven optimum, and a
+ * policy inserting the same field twice may occasionally beat it.
+ *
+ * Traces are read like hreplay does, and all policies share the same
+ * Huffman coding so that only indexing decisions are compared.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hpack.h"
+
+#include "bch.h"
+#include "trc.h"
+
+#define ORC_PASSES	2
+
+typedef enum hpack_result_e orc_setup_f(struct hpack *);
+
+struct orc_policy {
+	const char	*nam;
+	unsigned	typ; /* forced field type, if any */
+	orc_setup_f	*setup;
+};
+
+static const struct orc_policy orc_policies[] = {
+	{ "literal",	HPACK_FLG_TYP_LIT,	NULL },
+	{ "aut_idx",	0,			NULL },
+	{ "adapt",	0,			hpack_adapt },
+	{ "admit",	0,			hpack_admit },
+	{ "refresh",	0,			hpack_refresh },
+	{ "lookahead",	0,			hpack_lookahead },
+	{ NULL,		0,			NULL }
+};
+
+struct orc_corpus {
+	struct trc_corpus		trc[1];
+	size_t				tbl_sz;
+	unsigned			passes;
+	const struct hpack_field	**all; /* fields of a connection */
+	uint8_t				*ins; /* oracle insertions */
+	uint8_t				*alt;
+	uint8_t				*cnd; /* decisions worth flipping */
+	struct hpack_field		*fld; /* scratch copy for the encoder */
+	uint8_t				*buf;
+	size_t				buf_len;
+};
+
+static struct orc_corpus orc[1];
+
+/**********************************************************************
+ * Encoding
+ */
+
+struct orc_sink {
+	uint8_t	*ptr;
+	size_t	len;
+	size_t	tot;
+	int	keep;
+};
+
+static void
+orc_sink_cb(enum hpack_event_e evt, const char *buf, size_t len, void *priv)
+{
+	struct orc_sink *snk;
+
+	if (evt != HPACK_EVT_DATA)
+		return;
+
+	snk = priv;
+	snk->tot += len;
+	if (!snk->keep)
+		return;
+
+	snk->ptr = realloc(snk->ptr, snk->len + len);
+	if (snk->ptr == NULL)
+		WRONG("realloc");
+	(void)memcpy(snk->ptr + snk->len, buf, len);
+	snk->len += len;
+}
+
+static void
+orc_field_cb(enum hpack_event_e evt, const char *buf, size_t len, void *priv)
+{
+	size_t *cnt;
+
+	(void)buf;
+	(void)len;
+	cnt = priv;
+	if (evt == HPACK_EVT_FIELD)
+		(*cnt)++;
+}
+
+static void
+orc_check(struct hpack *hp, const struct orc_sink *snk, size_t fld_cnt)
+{
+	struct hpack_decoding hd;
+	enum hpack_result_e res;
+	size_t cnt;
+
+	cnt = 0;
+	hd.blk = snk->ptr;
+	hd.blk_len = snk->len;
+	hd.buf = orc->buf;
+	hd.buf_len = orc->buf_len;
+	hd.cb = orc_field_cb;
+	hd.priv = &cnt;
+	hd.cut = 0;
+
+	res = hpack_decode(hp, &hd);
+	if (res != HPACK_RES_OK)
+		FAIL("hpack_decode: %s", hpack_strerror(res));
+	if (cnt != fld_cnt)
+		FAIL("field count mismatch");
+}
+
+/* NB: either a policy or the oracle's insertions drive the encoder, and
+ * the blocks are only decoded when checked.
+ */
+static size_t
+orc_encode_conn(const struct trc_conn *conn, const struct orc_policy *pol,
+    const uint8_t *ins, int chk)
+{
+	struct hpack_encoding he;
+	enum hpack_result_e res;
+	struct orc_sink snk;
+	struct trc_list *lst;
+	struct hpack *enc, *dec;
+	size_t l, f, n;
+	unsigned typ;
+
+	assert((pol == NULL) != (ins == NULL));
+
+	enc = hpack_encoder(orc->tbl_sz, -1, hpack_default_alloc);
+	if (enc == NULL)
+		WRONG("hpack_encoder");
+	if (pol != NULL && pol->setup != NULL) {
+		res = pol->setup(enc);
+		if (res != HPACK_RES_OK)
+			FAIL("%s: %s", pol->nam, hpack_strerror(res));
+	}
+
+	dec = NULL;
+	if (chk) {
+		dec = hpack_decoder(orc->tbl_sz, -1, hpack_default_alloc);
+		if (dec == NULL)
+			WRONG("hpack_decoder");
+	}
+
+	(void)memset(&snk, 0, sizeof snk);
+	snk.keep = chk;
+
+	for (l = 0, n = 0; l < conn->lst_cnt; l++) {
+		lst = &conn->lst[l];
+		for (f = 0; f < lst->fld_cnt; f++, n++) {
+			orc->fld[f] = lst->fld[f];
+			if (pol != NULL)
+				typ = pol->typ;
+			else
+				typ = ins[n] ? HPACK_FLG_TYP_DYN :
+				    HPACK_FLG_TYP_LIT;
+			if (typ == 0)
+				continue;
+			orc->fld[f].flg &= ~(unsigned)HPACK_FLG_TYP_MSK;
+			orc->fld[f].flg |= typ;
+		}
+
+		he.fld = orc->fld;
+		he.fld_cnt = lst->fld_cnt;
+		he.buf = orc->buf;
+		he.buf_len = orc->buf_len;
+		he.cb = orc_sink_cb;
+		he.priv = &snk;
+		he.cut = 0;
+
+		res = hpack_encode(enc, &he);
+		if (res != HPACK_RES_OK)
+			FAIL("hpack_encode: %s", hpack_strerror(res));
+
+		if (dec != NULL) {
+			orc_check(dec, &snk, lst->fld_cnt);
+			snk.len = 0;
+		}
+	}
+
+	free(snk.ptr);
+	hpack_free(&enc);
+	hpack_free(&dec);
+	return (snk.tot);
+}
+
+/**********************************************************************
+ * Oracle
+ */
+
+static size_t
+orc_prepare(const struct trc_conn *conn)
+{
+	const struct hpack_field *hf;
+	size_t l, f, i, j, n;
+
+	for (l = 0, n = 0; l < conn->lst_cnt; l++)
+		for (f = 0; f < conn->lst[l].fld_cnt; f++)
+			orc->all[n++] = &conn->lst[l].fld[f];
+
+	/* NB: a field seen again is worth inserting, and a field whose name
+	 * is seen again is worth a second opinion.
+	 */
+	for (i = 0; i < n; i++) {
+		hf = orc->all[i];
+		orc->ins[i] = 0;
+		orc->cnd[i] = 0;
+		for (j = i + 1; j < n && !orc->ins[i]; j++) {
+			if (strcmp(hf->nam, orc->all[j]->nam))
+				continue;
+			orc->cnd[i] = 1;
+			if (!strcmp(hf->val, orc->all[j]->val))
+				orc->ins[i] = 1;
+		}
+	}
+
+	return (n);
+}
+
+static size_t
+orc_search(const struct trc_conn *conn)
+{
+	size_t n, i, len, best;
+	unsigned pass;
+	int imp;
+
+	n = orc_prepare(conn);
+	best = orc_encode_conn(conn, NULL, orc->ins, 0);
+
+	(void)memset(orc->alt, 1, n);
+	len = orc_encode_conn(conn, NULL, orc->alt, 0);
+	if (len < best) {
+		(void)memcpy(orc->ins, orc->alt, n);
+		best = len;
+	}
+
+	for (pass = 0; pass < orc->passes; pass++) {
+		imp = 0;
+		for (i = 0; i < n; i++) {
+			if (!orc->cnd[i])
+				continue;
+			orc->ins[i] = !orc->ins[i];
+			len = orc_encode_conn(conn, NULL, orc->ins, 0);
+			if (len < best) {
+				best = len;
+				imp = 1;
+			}
+			else
+				orc->ins[i] = !orc->ins[i];
+		}
+		if (!imp)
+			break;
+	}
+
+	return (best);
+}
+
+/**********************************************************************
+ * Main
+ */
+
+static const struct bch_column orc_columns[] = {
+	{ "lists",	0, 7 },
+	{ "fields",	0, 8 },
+	{ "wire",	0, 10 },
+	{ "per_list",	1, 9 },
+	{ "gap",	2, 7 },
+};
+
+#define ORC_COLUMNS (sizeof orc_columns / sizeof *orc_columns)
+
+static void
+orc_report(const struct bch_options *opt, const char *nam, size_t len,
+    size_t best)
+{
+	double val[ORC_COLUMNS];
+
+	val[0] = (double)orc->trc->lst_cnt;
+	val[1] = (double)orc->trc->fld_cnt;
+	val[2] = (double)len;
+	val[3] = (double)len / (double)orc->trc->lst_cnt;
+	val[4] = best > 0 ? 100.0 * ((double)len - (double)best) /
+	    (double)best : 0;
+	BCH_row(opt, orc_columns, ORC_COLUMNS, nam, val);
+}
+
+static int
+orc_usage(const char *prg)
+{
+
+	(void)fprintf(stderr,
+	    "Usage: %s [-s <size>] [-i <n>] [-f <fmt>] <file>...\n\n"
+	    "  -s <size> dynamic table size (default: 4096)\n"
+	    "  -i <n>    improvement passes of the oracle (default: %u)\n"
+	    "  -f <fmt>  output format: txt (default), tsv or json\n"
+	    "\nFiles ending with .json are read as hpack-test-case stories,\n"
+	    "other files as plain text traces. The gap is the percentage of\n"
+	    "wire octets above the oracle.\n",
+	    prg, ORC_PASSES);
+	return (EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv)
+{
+	const struct orc_policy *pol;
+	struct bch_options opt;
+	const struct trc_conn *conn;
+	size_t c, best, len;
+	unsigned long n;
+	const char *prg;
+	char *end;
+	int o;
+
+	BCH_defaults(&opt);
+	prg = *argv;
+	orc->tbl_sz = 4096;
+	orc->passes = ORC_PASSES;
+
+	while ((o = getopt(argc, argv, "f:i:s:")) != -1) {
+		switch (o) {
+		case 'f':
+			if (BCH_option(&opt, o, optarg) != 0)
+				return (orc_usage(prg));
+			break;
+		case 'i':
+		case 's':
+			n = strtoul(optarg, &end, 10);
+			if (*optarg == '\0' || *end != '\0' || n > UINT16_MAX)
+				return (orc_usage(prg));
+			if (o == 'i')
+				orc->passes = (unsigned)n;
+			else
+				orc->tbl_sz = n;
+			break;
+		default:
+			return (orc_usage(prg));
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc == 0)
+		return (orc_usage(prg));
+
+	while (argc-- > 0)
+		TRC_load(orc->trc, *argv++);
+
+	if (orc->trc->fld_cnt == 0)
+		FAIL("empty corpus");
+
+	/* large enough for any header list, plus some slack */
+	orc->buf_len = 2 * (orc->trc->raw_len + orc->trc->fld_cnt) + 4096;
+	orc->buf = malloc(orc->buf_len);
+	orc->fld = calloc(orc->trc->fld_max, sizeof *orc->fld);
+	orc->all = calloc(orc->trc->fld_cnt, sizeof *orc->all);
+	orc->ins = malloc(orc->trc->fld_cnt);
+	orc->alt = malloc(orc->trc->fld_cnt);
+	orc->cnd = malloc(orc->trc->fld_cnt);
+	if (orc->buf == NULL || orc->fld == NULL || orc->all == NULL ||
+	    orc->ins == NULL || orc->alt == NULL || orc->cnd == NULL)
+		WRONG("malloc");
+
+	best = 0;
+	for (c = 0; c < orc->trc->conn_cnt; c++) {
+		conn = &orc->trc->conn[c];
+		len = orc_search(conn);
+		if (orc_encode_conn(conn, NULL, orc->ins, 1) != len)
+			FAIL("oracle: inconsistent encoding");
+		best += len;
+	}
+
+	BCH_header(&opt, orc_columns, ORC_COLUMNS);
+	orc_report(&opt, "oracle", best, best);
+
+	for (pol = orc_policies; pol->nam != NULL; pol++) {
+		len = 0;
+		for (c = 0; c < orc->trc->conn_cnt; c++)
+			len += orc_encode_conn(&orc->trc->conn[c], pol, NULL,
+			    1);
+		orc_report(&opt, pol->nam, len, best);
+	}
+
+	TRC_free(orc->trc);
+	free(orc->all);
+	free(orc->ins);
+	free(orc->alt);
+	free(orc->cnd);
+	free(orc->fld);
+	free(orc->buf);
+	return (EXIT_SUCCESS);
+}
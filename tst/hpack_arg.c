@@ -174,6 +174,20 @@ static const struct hpack_alloc oom_alloc = {
 	NULL
 };
 
+/**********************************************************************
+ * Slab-measuring allocator
+ */
+
+static void *
+slab_malloc(size_t size, void *priv)
+{
+	size_t *len;
+
+	len = priv;
+	*len = size;
+	return (malloc(size));
+}
+
 /**********************************************************************
  * Test cases sharing a bunch of global variables
  */
@@ -193,6 +207,7 @@ static const struct hpack_decoding nam##_decoding = {	\
 	.priv = NULL,					\
 	.cut = 0,					\
 }
+DECODING(basic);
 DECODING(update);
 DECODING(junk);
 DECODING(double);
@@ -519,6 +534,47 @@ test_search_null_args(void)
 	hpack_free(&hp);
 }
 
+static struct hpack_field search_field[] = {
+	{
+		.flg = HPACK_FLG_TYP_DYN,
+		.nam = ":method",
+		.val = "PUT",
+	},
+	{
+		.flg = HPACK_FLG_TYP_DYN | HPACK_FLG_NAM_IDX,
+		.nam_idx = 3,
+		.val = "PATCH",
+	},
+};
+
+static void
+test_search_static_name(void)
+{
+	struct hpack_encoding enc;
+	const char *nam, *val;
+	uint16_t idx;
+
+	hp = make_encoder(4096, -1, hpack_default_alloc);
+
+	enc = basic_encoding;
+	enc.fld = search_field;
+	enc.fld_cnt = 2;
+	CHECK_RES(retval, OK, hpack_encode, hp, &enc);
+
+	/* a static name shared by several entries matches either way */
+	CHECK_RES(retval, OK, hpack_search, hp, &idx, ":method", "PUT");
+	assert(idx == 63);
+	CHECK_RES(retval, OK, hpack_search, hp, &idx, ":method", "PATCH");
+	assert(idx == 62);
+	CHECK_RES(retval, NAM, hpack_search, hp, &idx, ":method", "DELETE");
+	assert(idx == 63);
+
+	CHECK_RES(retval, OK, hpack_entry, hp, 62, &nam, &val);
+	assert(!strcmp(nam, ":method"));
+	assert(!strcmp(val, "PATCH"));
+	hpack_free(&hp);
+}
+
 static void
 test_use_defunct_decoder(void)
 {
@@ -617,6 +673,52 @@ test_limit_between_two_resizes(void)
 	hpack_free(&hp);
 }
 
+static void
+table_cb(enum hpack_event_e evt, const char *buf, size_t len, void *priv)
+{
+	ssize_t *tbl;
+
+	(void)buf;
+	tbl = priv;
+	if (evt == HPACK_EVT_TABLE)
+		*tbl = (ssize_t)len;
+}
+
+static void
+test_limit_again(void)
+{
+	struct hpack_encoding enc;
+	ssize_t tbl;
+
+	enc = basic_encoding;
+	enc.cb = table_cb;
+	enc.priv = &tbl;
+
+	hp = make_encoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, OK, hpack_limit, &hp, 1024);
+	tbl = -1;
+	CHECK_RES(retval, OK, hpack_encode, hp, &enc);
+	assert(tbl == 1024);
+
+	/* lower an applied limit */
+	CHECK_RES(retval, OK, hpack_limit, &hp, 512);
+	tbl = -1;
+	CHECK_RES(retval, OK, hpack_encode, hp, &enc);
+	assert(tbl == 512);
+	CHECK_RES(retval, OK, hpack_resize, &hp, 2048);
+	CHECK_RES(retval, OK, hpack_encode, hp, &enc);
+
+	/* lift it */
+	CHECK_RES(retval, OK, hpack_limit, &hp, 4096);
+	tbl = -1;
+	CHECK_RES(retval, OK, hpack_encode, hp, &enc);
+	assert(tbl == 2048);
+	tbl = -1;
+	CHECK_RES(retval, OK, hpack_encode, hp, &enc);
+	assert(tbl == -1);
+	hpack_free(&hp);
+}
+
 static void
 test_use_defunct_encoder(void)
 {
@@ -710,6 +812,55 @@ test_auto_index_invalid_field(void)
 	hpack_free(&hp);
 }
 
+static char bcat_buf[64];
+
+static void
+bcat_cb(enum hpack_event_e evt, const char *buf, size_t len, void *priv)
+{
+	size_t *off;
+
+	if (evt != HPACK_EVT_DATA)
+		return;
+
+	off = priv;
+	assert(*off + len <= sizeof bcat_buf);
+	(void)memcpy(bcat_buf + *off, buf, len);
+	*off += len;
+}
+
+static void
+test_encode_small_buffer(void)
+{
+	static const char exp[] =
+	    "\x00\x04name\x10" "0123456789abcdef";
+	struct hpack_encoding enc;
+	uint8_t buf[4];
+	size_t off;
+
+	hp = make_encoder(0, -1, hpack_default_alloc);
+
+	/* strings are flushed in the middle of their copy */
+	(void)memset(&fld, 0, sizeof fld);
+	fld.flg = HPACK_FLG_TYP_LIT;
+	fld.nam = "name";
+	fld.val = "0123456789abcdef";
+
+	(void)memset(&enc, 0, sizeof enc);
+	enc.fld = &fld;
+	enc.fld_cnt = 1;
+	enc.buf = buf;
+	enc.buf_len = sizeof buf;
+	enc.cb = bcat_cb;
+	enc.priv = &off;
+
+	off = 0;
+	CHECK_RES(retval, OK, hpack_encode, hp, &enc);
+	assert(off == sizeof exp - 1);
+	assert(!memcmp(bcat_buf, exp, off));
+
+	hpack_free(&hp);
+}
+
 static void
 test_resize_null_codec(void)
 {
@@ -745,142 +896,1861 @@ test_resize_realloc_failure(void)
 }
 
 static void
-test_clean_null_field(void)
+test_init_null_args(void)
 {
-	CHECK_RES(retval, ARG, hpack_clean_field, NULL);
+	uint64_t mem[64];
+
+	assert(hpack_sizeof(UINT16_MAX + 1) == 0);
+	assert(hpack_sizeof(256) > 256);
+
+	CHECK_NULL(hp, hpack_decoder_init, NULL, sizeof mem, 0);
+	CHECK_NULL(hp, hpack_decoder_init, mem, sizeof mem, UINT16_MAX + 1);
+	CHECK_NULL(hp, hpack_encoder_init, mem, hpack_sizeof(256) - 1, 256);
+	CHECK_NULL(hp, hpack_encoder_init, (uint8_t *)mem + 1,
+	    sizeof mem - 1, 0);
 }
 
 static void
-test_clean_unknown_field(void)
+test_init_decoder(void)
 {
-	fld = *unknown_field;
-	CHECK_RES(retval, ARG, hpack_clean_field, &fld);
+	uint64_t mem[1024];
+
+	CHECK_NOTNULL(hp, hpack_decoder_init, mem, sizeof mem, 256);
+	assert((void *)hp == (void *)mem);
+	CHECK_RES(retval, OK, hpack_decode, hp, &basic_decoding);
+
+	/* the table can grow within the memory given at construction */
+	CHECK_RES(retval, OK, hpack_resize, &hp, 512);
+	CHECK_RES(retval, ARG, hpack_trim, &hp);
+	CHECK_RES(retval, LEN, hpack_reset, &hp, sizeof mem);
+	CHECK_RES(retval, OK, hpack_reset, &hp, 1024);
+	CHECK_RES(retval, LEN, hpack_resize, &hp, sizeof mem);
+	hpack_free(&hp);
 }
 
 static void
-test_clean_indexed_field_with_name(void)
+test_init_encoder(void)
 {
-	(void)memset(&fld, 0, sizeof fld);
-	fld.flg = HPACK_FLG_TYP_IDX;
-	fld.nam = "";
-	CHECK_RES(retval, ARG, hpack_clean_field, &fld);
+	uint64_t mem[128];
+
+	CHECK_NOTNULL(hp, hpack_encoder_init, mem, sizeof mem, 0);
+	CHECK_RES(retval, OK, hpack_encode, hp, &basic_encoding);
+	CHECK_RES(retval, LEN, hpack_resize, &hp, 4096);
+	CHECK_RES(retval, ARG, hpack_encode, hp, &basic_encoding);
+	CHECK_RES(retval, OK, hpack_reset, &hp, 0);
+	CHECK_RES(retval, OK, hpack_encode, hp, &basic_encoding);
+	hpack_free(&hp);
 }
 
 static void
-test_clean_indexed_field_with_value(void)
+test_init_move(void)
 {
-	(void)memset(&fld, 0, sizeof fld);
-	fld.flg = HPACK_FLG_TYP_IDX;
-	fld.val = "";
-	CHECK_RES(retval, ARG, hpack_clean_field, &fld);
+	struct hpack_decoding dec;
+	uint64_t mem[2][80];
+	static const uint8_t blk[] = {
+		/* :authority: www.example.com (Huffman) */
+		0x41, 0x8c, 0xf1, 0xe3, 0xc2, 0xe5, 0xf2, 0x3a,
+		0x6b, 0xa0, 0xab, 0x90, 0xf4, 0xff,
+		/* :authority: www.example.com (indexed) */
+		0xbe,
+	};
+
+	CHECK_NOTNULL(hp, hpack_decoder_init, mem[0], sizeof mem[0], 256);
+
+	/* move the decoder in the middle of a Huffman string */
+	dec = basic_decoding;
+	dec.blk = blk;
+	dec.blk_len = 6;
+	dec.cut = 1;
+	CHECK_RES(retval, BLK, hpack_decode, hp, &dec);
+
+	(void)memcpy(mem[1], mem[0], sizeof mem[1]);
+	(void)memset(mem[0], 0xa5, sizeof mem[0]);
+	hp = (struct hpack *)mem[1];
+
+	dec.blk = blk + 6;
+	dec.blk_len = sizeof blk - 6;
+	dec.cut = 0;
+	CHECK_RES(retval, OK, hpack_decode, hp, &dec);
+	CHECK_RES(retval, OK, hpack_decode, hp, &double_decoding);
+	hpack_free(&hp);
 }
 
 static void
-test_clean_indexed_field_with_indexed_name(void)
+test_reset_null_codec(void)
 {
-	(void)memset(&fld, 0, sizeof fld);
-	fld.flg = HPACK_FLG_TYP_IDX | HPACK_FLG_NAM_IDX;
-	CHECK_RES(retval, ARG, hpack_clean_field, &fld);
+	hp = NULL;
+	CHECK_RES(retval, ARG, hpack_reset, NULL, 0);
+	CHECK_RES(retval, ARG, hpack_reset, &hp, 0);
 }
 
 static void
-test_strerror(void)
+test_reset_defunct_decoder(void)
 {
-	const char *str;
+	hp = make_decoder(0, -1, &static_alloc);
+	CHECK_RES(retval, IDX, hpack_decode, hp, &junk_decoding);
+	CHECK_RES(retval, ARG, hpack_decode, hp, &basic_decoding);
 
-	CHECK_NOTNULL(str, hpack_strerror, HPACK_RES_OK);
-	CHECK_NOTNULL(str, hpack_strerror, HPACK_RES_OOM);
-	CHECK_NULL(str, hpack_strerror, UINT16_MAX);
+	CHECK_RES(retval, LEN, hpack_reset, &hp, UINT16_MAX + 1);
+	CHECK_RES(retval, LEN, hpack_reset, &hp, 4096);
+	CHECK_RES(retval, ARG, hpack_decode, hp, &basic_decoding);
+
+	CHECK_RES(retval, OK, hpack_reset, &hp, 0);
+	CHECK_RES(retval, OK, hpack_decode, hp, &basic_decoding);
+	hpack_free(&hp);
 }
 
 static void
-test_dump_unknown(void)
+test_reset_busy_encoder(void)
 {
-	unsigned magic;
+	struct hpack_encoding enc;
 
-	hp = make_decoder(0, -1, &static_alloc);
+	hp = make_encoder(4096, 256, hpack_default_alloc);
 
-	/* save the magic number */
-	(void)memcpy(&magic, hp, sizeof magic);
+	enc = basic_encoding;
+	enc.cut = 1;
+	CHECK_RES(retval, BLK, hpack_encode, hp, &enc);
+	CHECK_RES(retval, BSY, hpack_resize, &hp, 0);
 
-	/* dump a corrupted codec */
-	(void)memset(hp, 0, sizeof magic);
-	test_dump(hp);
+	CHECK_RES(retval, OK, hpack_reset, &hp, 4096);
+	CHECK_RES(retval, OK, hpack_encode, hp, &basic_encoding);
+	hpack_free(&hp);
+}
 
-	/* omit the dump callback */
-	hpack_dump(hp, NULL, NULL);
+static void
+test_reset_realloc_failure(void)
+{
+	hp = make_decoder(0, -1, &oom_alloc);
+	CHECK_RES(retval, OOM, hpack_reset, &hp, 4096);
+	CHECK_RES(retval, OK, hpack_decode, hp, &basic_decoding);
+	hpack_free(&hp);
+}
 
-	/* restore and free */
-	(void)memcpy(hp, &magic, sizeof magic);
+struct save_buffer {
+	uint8_t	buf[4096];
+	size_t	len;
+};
+
+static void
+save_cb(enum hpack_event_e evt, const char *buf, size_t len, void *priv)
+{
+	struct save_buffer *sb;
+
+	assert(evt == HPACK_EVT_DATA);
+	sb = priv;
+	assert(sb->len + len <= sizeof sb->buf);
+	(void)memcpy(sb->buf + sb->len, buf, len);
+	sb->len += len;
+}
+
+static struct hpack_field save_field[] = {
+	{
+		.flg = HPACK_FLG_TYP_DYN,
+		.nam = "user-agent",
+		.val = "cashpack",
+	},
+	{
+		.flg = HPACK_FLG_TYP_DYN,
+		.nam = "x-empty",
+		.val = "",
+	},
+};
+
+static void
+test_save_null_args(void)
+{
+	struct save_buffer sb;
+
+	CHECK_RES(retval, ARG, hpack_save, NULL, save_cb, &sb, 0);
+
+	hp = make_decoder(0, -1, hpack_default_alloc);
+	CHECK_RES(retval, ARG, hpack_save, hp, NULL, &sb, 0);
 	hpack_free(&hp);
+
+	CHECK_NULL(hp, hpack_restore, NULL, 0, hpack_default_alloc);
 }
 
 static void
-test_event_id(void)
+test_save_defunct_decoder(void)
 {
-	const char *str;
+	struct save_buffer sb;
 
-#define HPE(e, v, d, l)						\
-	CHECK_NOTNULL(str, hpack_event_id, HPACK_EVT_ ## e);
-#include "tbl/hpack_tbl.h"
-#undef HPE
-	CHECK_NULL(str, hpack_event_id, UINT16_MAX);
+	hp = make_decoder(0, -1, hpack_default_alloc);
+	CHECK_RES(retval, IDX, hpack_decode, hp, &junk_decoding);
+	CHECK_RES(retval, ARG, hpack_save, hp, save_cb, &sb, 0);
+	hpack_free(&hp);
 }
 
-/**********************************************************************
- */
+static void
+test_save_busy_encoder(void)
+{
+	struct hpack_encoding enc;
+	struct save_buffer sb;
 
-int
-main(void)
+	hp = make_encoder(4096, -1, hpack_default_alloc);
+
+	enc = basic_encoding;
+	enc.cut = 1;
+	CHECK_RES(retval, BLK, hpack_encode, hp, &enc);
+	CHECK_RES(retval, BSY, hpack_save, hp, save_cb, &sb, 0);
+	hpack_free(&hp);
+}
+
+static void
+test_save_restore(unsigned huf)
 {
+	struct hpack_encoding enc;
+	struct save_buffer sb, tmp;
+	uint16_t idx;
 
-	test_null_alloc();
-	test_null_malloc();
-	test_null_free();
-	test_alloc_overflow();
-	test_alloc_underflow();
-	test_malloc_failure();
-	test_free_null_codec();
-	test_double_free();
+	hp = make_encoder(4096, -1, hpack_default_alloc);
 
-	test_index();
-	test_index_null_args();
-	test_index_invalid_entry();
-	test_decode_null_args();
-	test_decode_fields_null_args();
-	test_encode_null_args();
+	enc = basic_encoding;
+	enc.fld = save_field;
+	enc.fld_cnt = 2;
+	CHECK_RES(retval, OK, hpack_encode, hp, &enc);
+	CHECK_RES(retval, OK, hpack_resize, &hp, 1024);
+	CHECK_RES(retval, OK, hpack_limit, &hp, 256);
 
-	test_resize_overflow();
-	test_limit_null_realloc();
-	test_limit_realloc_failure();
-	test_trim_null_realloc();
-	test_trim_realloc_failure();
+	sb.len = 0;
+	CHECK_RES(retval, OK, hpack_save, hp, save_cb, &sb, huf);
+	hpack_free(&hp);
 
-	test_skip_decoder();
-	test_skip_null_decoder();
+	CHECK_NOTNULL(hp, hpack_restore, sb.buf, sb.len, hpack_default_alloc);
+	CHECK_RES(retval, OK, hpack_search, hp, &idx, "user-agent",
+	    "cashpack");
+	assert(idx == 63);
+	CHECK_RES(retval, OK, hpack_search, hp, &idx, "x-empty", "");
+	assert(idx == 62);
 
-	test_search_null_args();
+	/* the restored encoder saves the exact same state */
+	tmp.len = 0;
+	CHECK_RES(retval, OK, hpack_save, hp, save_cb, &tmp, huf);
+	assert(tmp.len == sb.len);
+	assert(!memcmp(tmp.buf, sb.buf, sb.len));
 
-	test_use_defunct_decoder();
-	test_use_busy_decoder();
-	test_use_different_buffer();
+	CHECK_RES(retval, OK, hpack_encode, hp, &basic_encoding);
+	hpack_free(&hp);
 
-	test_limit_null_encoder();
-	test_limit_decoder();
-	test_limit_overflow();
-	test_limit_overflow_no_realloc();
-	test_limit_between_two_resizes();
+	/* truncated states are rejected */
+	while (sb.len > 0) {
+		sb.len--;
+		CHECK_NULL(hp, hpack_restore, sb.buf, sb.len,
+		    hpack_default_alloc);
+	}
+}
 
-	test_use_defunct_encoder();
-	test_use_busy_encoder();
+static void
+test_save_restore_decoder(void)
+{
+	struct save_buffer sb;
+	struct hpack_decoding dec;
+	static const uint8_t blk[] = {
+		0x40, 0x01, 'a', 0x01, 'b', /* a: b */
+		0x40, 0x01, 'c', 0x81, 0x1f, /* c: a (Huffman) */
+	};
+	size_t i;
 
-	test_auto_index_invalid_field();
+	hp = make_decoder(256, -1, hpack_default_alloc);
 
-	test_resize_null_codec();
-	test_trim_null_codec();
-	test_trim_to_limit();
+	dec = basic_decoding;
+	dec.blk = blk;
+	dec.blk_len = sizeof blk;
+	CHECK_RES(retval, OK, hpack_decode, hp, &dec);
 
-	test_resize_realloc_failure();
+	sb.len = 0;
+	CHECK_RES(retval, OK, hpack_save, hp, save_cb, &sb, 1);
+	hpack_free(&hp);
+
+	CHECK_NOTNULL(hp, hpack_restore, sb.buf, sb.len, &static_alloc);
+	CHECK_RES(retval, OK, hpack_decode, hp, &double_decoding);
+	hpack_free(&hp);
+
+	/* flip every bit of the state, without crashing */
+	for (i = 0; i < sb.len * 8; i++) {
+		sb.buf[i / 8] ^= 1 << (i % 8);
+		hp = hpack_restore(sb.buf, sb.len, hpack_default_alloc);
+		hpack_free(&hp);
+		sb.buf[i / 8] ^= 1 << (i % 8);
+	}
+
+	/* states bigger than the allocator are rejected */
+	hp = make_decoder(4096, -1, hpack_default_alloc);
+	sb.len = 0;
+	CHECK_RES(retval, OK, hpack_save, hp, save_cb, &sb, 0);
+	hpack_free(&hp);
+	CHECK_NULL(hp, hpack_restore, sb.buf, sb.len, &static_alloc);
+}
+
+static void
+test_lazy_null_args(void)
+{
+
+	CHECK_NULL(hp, hpack_decoder_lazy, 0, -1, NULL);
+	CHECK_NULL(hp, hpack_decoder_lazy, 0, -1, &null_alloc);
+	CHECK_NULL(hp, hpack_decoder_lazy, 0, -1, &static_alloc);
+	CHECK_NULL(hp, hpack_decoder_lazy, UINT16_MAX + 1, -1,
+	    hpack_default_alloc);
+}
+
+static void
+lazy_check_entry(size_t idx, int exp)
+{
+	const char *nam, *val;
+
+	retval = hpack_entry(hp, idx, &nam, &val);
+	assert(retval == exp);
+	if (retval == HPACK_RES_OK) {
+		assert(!strcmp(nam, "k"));
+		assert(strlen(val) == 1000);
+		assert(strspn(val, "x") == 1000);
+	}
+}
+
+static void
+test_lazy_decoder(void)
+{
+	struct hpack_decoding dec;
+	struct save_buffer sb;
+	uint8_t blk[6 + 1000];
+	char buf[2048];
+	unsigned i;
+
+	/* k: <1000 x's> */
+	(void)memset(blk, 'x', sizeof blk);
+	blk[0] = 0x40;
+	blk[1] = 0x01;
+	blk[2] = 'k';
+	blk[3] = 0x7f;
+	blk[4] = 0xe9;
+	blk[5] = 0x06;
+
+	CHECK_NOTNULL(hp, hpack_decoder_lazy, 4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, OK, hpack_decode, hp, &basic_decoding);
+	CHECK_RES(retval, OK, hpack_trim, &hp);
+
+	/* grow the table three times */
+	dec = basic_decoding;
+	dec.blk = blk;
+	dec.blk_len = sizeof blk;
+	dec.buf = buf;
+	dec.buf_len = sizeof buf;
+	CHECK_RES(retval, OK, hpack_decode, hp, &dec);
+	CHECK_RES(retval, OK, hpack_decode, hp, &dec);
+	CHECK_RES(retval, OK, hpack_decode, hp, &dec);
+	lazy_check_entry(62, HPACK_RES_OK);
+	lazy_check_entry(64, HPACK_RES_OK);
+
+	/* a lazy decoder survives hibernation */
+	sb.len = 0;
+	CHECK_RES(retval, OK, hpack_save, hp, save_cb, &sb, 1);
+	hpack_free(&hp);
+	CHECK_NOTNULL(hp, hpack_restore, sb.buf, sb.len, hpack_default_alloc);
+	lazy_check_entry(62, HPACK_RES_OK);
+	lazy_check_entry(64, HPACK_RES_OK);
+	lazy_check_entry(65, HPACK_RES_IDX);
+
+	/* evict everything and release the table */
+	CHECK_RES(retval, OK, hpack_resize, &hp, 0);
+	CHECK_RES(retval, OK, hpack_decode, hp, &update_decoding);
+	lazy_check_entry(62, HPACK_RES_IDX);
+
+	/* a quiet decoder eventually shrinks its table */
+	for (i = 0; i < 256; i++)
+		CHECK_RES(retval, OK, hpack_decode, hp, &basic_decoding);
+	CHECK_RES(retval, OK, hpack_trim, &hp);
+
+	CHECK_RES(retval, OK, hpack_reset, &hp, 4096);
+	CHECK_RES(retval, OK, hpack_decode, hp, &dec);
+	lazy_check_entry(62, HPACK_RES_OK);
+	hpack_free(&hp);
+}
+
+static void
+test_lazy_realloc_failure(void)
+{
+	static const uint8_t blk[] = {
+		0x40, 0x01, 'a', 0x01, 'b', /* a: b */
+		0x40, 0x01, 'c', 0x7f, 0x81, 0x01, /* c: <256 octets> */
+	};
+	struct hpack_decoding dec;
+	uint8_t val[128];
+	char buf[512];
+
+	(void)memset(val, 'v', sizeof val);
+	CHECK_NOTNULL(hp, hpack_decoder_lazy, 4096, -1, &oom_alloc);
+
+	/* the first allocation goes through malloc */
+	dec = basic_decoding;
+	dec.buf = buf;
+	dec.buf_len = sizeof buf;
+	dec.blk = blk;
+	dec.blk_len = 5;
+	CHECK_RES(retval, OK, hpack_decode, hp, &dec);
+
+	/* growing the table requires a realloc */
+	dec.blk = blk + 5;
+	dec.blk_len = sizeof blk - 5;
+	dec.cut = 1;
+	CHECK_RES(retval, BLK, hpack_decode, hp, &dec);
+	dec.blk = val;
+	dec.blk_len = sizeof val;
+	CHECK_RES(retval, BLK, hpack_decode, hp, &dec);
+	dec.cut = 0;
+	CHECK_RES(retval, OOM, hpack_decode, hp, &dec);
+	CHECK_RES(retval, ARG, hpack_decode, hp, &basic_decoding);
+	hpack_free(&hp);
+}
+
+static void
+test_compress_null_args(void)
+{
+	struct hpack_decoding dec;
+	uint64_t mem[80];
+	static const uint8_t blk[] = {
+		0x40, 0x01, 'a', 0x01, 'b', /* a: b */
+	};
+
+	CHECK_RES(retval, ARG, hpack_compress, NULL);
+
+	hp = make_encoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, ARG, hpack_compress, hp);
+	hpack_free(&hp);
+
+	CHECK_NOTNULL(hp, hpack_decoder_init, mem, sizeof mem, 256);
+	CHECK_RES(retval, ARG, hpack_compress, hp);
+	hpack_free(&hp);
+
+	/* too late for an existing entry */
+	hp = make_decoder(4096, -1, hpack_default_alloc);
+	dec = basic_decoding;
+	dec.blk = blk;
+	dec.blk_len = sizeof blk;
+	CHECK_RES(retval, OK, hpack_decode, hp, &dec);
+	CHECK_RES(retval, ARG, hpack_compress, hp);
+
+	/* too late for a busy decoder */
+	CHECK_RES(retval, OK, hpack_reset, &hp, 4096);
+	dec.blk_len = 3;
+	dec.cut = 1;
+	CHECK_RES(retval, BLK, hpack_decode, hp, &dec);
+	CHECK_RES(retval, BSY, hpack_compress, hp);
+	hpack_free(&hp);
+}
+
+static void
+compress_check_entry(size_t idx, const char *exp, size_t len)
+{
+	const char *nam, *val;
+
+	CHECK_RES(retval, OK, hpack_entry, hp, idx, &nam, &val);
+	assert(!strcmp(nam, exp));
+	assert(strlen(val) == len);
+	assert(strspn(val, "x") == len);
+}
+
+static void
+test_compress_decoder(void)
+{
+	struct hpack_decoding dec;
+	struct save_buffer sb;
+	uint8_t blk[4 + 1000 + 7];
+	char buf[2048], val[1001];
+	uint16_t idx;
+
+	/* user-agent: <1000 x's> */
+	(void)memset(blk, 'x', sizeof blk);
+	blk[0] = 0x7a;
+	blk[1] = 0x7f;
+	blk[2] = 0xe9;
+	blk[3] = 0x06;
+
+	/* k: xxx */
+	blk[1004] = 0x40;
+	blk[1005] = 0x01;
+	blk[1006] = 'k';
+	blk[1007] = 0x03;
+
+	(void)memset(val, 'x', sizeof val - 1);
+	val[sizeof val - 1] = '\0';
+
+	CHECK_NOTNULL(hp, hpack_decoder_lazy, 4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, OK, hpack_compress, hp);
+
+	/* fields are still decoded in the caller's buffer */
+	dec = basic_decoding;
+	dec.blk = blk;
+	dec.blk_len = 1004;
+	dec.buf = buf;
+	dec.buf_len = sizeof buf;
+	dec.cut = 1;
+	CHECK_RES(retval, BLK, hpack_decode, hp, &dec);
+	dec.blk = blk + 1004;
+	dec.blk_len = sizeof blk - 1004;
+	dec.cut = 0;
+	CHECK_RES(retval, OK, hpack_decode, hp, &dec);
+
+	compress_check_entry(62, "k", 3);
+	compress_check_entry(63, "user-agent", 1000);
+
+	CHECK_RES(retval, OK, hpack_search, hp, &idx, "user-agent", val);
+	assert(idx == 63);
+	CHECK_RES(retval, OK, hpack_search, hp, &idx, "k", "xxx");
+	assert(idx == 62);
+	CHECK_RES(retval, NAM, hpack_search, hp, &idx, "k", "xx");
+	assert(idx == 62);
+	CHECK_RES(retval, OK, hpack_dynamic, hp, noop_cb, NULL);
+
+	/* coded strings are saved as-is */
+	sb.len = 0;
+	CHECK_RES(retval, OK, hpack_save, hp, save_cb, &sb, 0);
+	assert(sb.len < 1000);
+	hpack_free(&hp);
+	CHECK_NOTNULL(hp, hpack_restore, sb.buf, sb.len, hpack_default_alloc);
+	compress_check_entry(62, "k", 3);
+	compress_check_entry(63, "user-agent", 1000);
+	CHECK_RES(retval, OK, hpack_trim, &hp);
+
+	/* a reset decoder still compresses its entries */
+	CHECK_RES(retval, OK, hpack_reset, &hp, 4096);
+	dec.blk = blk;
+	dec.blk_len = sizeof blk;
+	CHECK_RES(retval, OK, hpack_decode, hp, &dec);
+	sb.len = 0;
+	CHECK_RES(retval, OK, hpack_save, hp, save_cb, &sb, 0);
+	assert(sb.len < 1000);
+	hpack_free(&hp);
+}
+
+static void
+test_compress_realloc_failure(void)
+{
+	struct hpack_decoding dec;
+	const char *nam, *val;
+	uint8_t blk[14 + 300];
+	char buf[512];
+
+	/* user-agent: xxxxxxxx */
+	(void)memset(blk, 'x', sizeof blk);
+	blk[0] = 0x7a;
+	blk[1] = 0x08;
+
+	/* user-agent: <300 x's> */
+	blk[10] = 0x7a;
+	blk[11] = 0x7f;
+	blk[12] = 0xad;
+	blk[13] = 0x01;
+
+	hp = make_decoder(4096, -1, &oom_alloc);
+	CHECK_RES(retval, OK, hpack_compress, hp);
+
+	/* the first scratch buffer goes through malloc */
+	dec = basic_decoding;
+	dec.blk = blk;
+	dec.blk_len = 10;
+	dec.buf = buf;
+	dec.buf_len = sizeof buf;
+	CHECK_RES(retval, OK, hpack_decode, hp, &dec);
+	compress_check_entry(62, "user-agent", 8);
+
+	/* growing it requires a realloc */
+	dec.blk = blk + 10;
+	dec.blk_len = sizeof blk - 10;
+	CHECK_RES(retval, OK, hpack_decode, hp, &dec);
+	CHECK_RES(retval, OOM, hpack_entry, hp, 62, &nam, &val);
+	CHECK_RES(retval, OOM, hpack_dynamic, hp, noop_cb, NULL);
+
+	/* the decoder remains usable */
+	CHECK_RES(retval, OK, hpack_decode, hp, &basic_decoding);
+	compress_check_entry(63, "user-agent", 8);
+	hpack_free(&hp);
+}
+
+static void
+intern_lock(void *priv)
+{
+	unsigned *lck;
+
+	lck = priv;
+	assert(*lck % 2 == 0);
+	(*lck)++;
+}
+
+static void
+intern_unlock(void *priv)
+{
+	unsigned *lck;
+
+	lck = priv;
+	assert(*lck % 2 == 1);
+	(*lck)++;
+}
+
+static void *
+intern_malloc(size_t size, void *priv)
+{
+	unsigned *budget;
+
+	budget = priv;
+	if (*budget == 0)
+		return (NULL);
+	(*budget)--;
+	return (malloc(size));
+}
+
+static const uint8_t intern_block[] = {
+	0x7a, 0x08, 'c', 'a', 's', 'h', 'p', 'a', 'c', 'k',
+	0x40, 0x01, 'x', 0x01, 'y',
+};
+
+static void
+test_intern_null_args(void)
+{
+	struct hpack_intern *itn;
+	struct hpack_decoding dec;
+	unsigned lck;
+
+	CHECK_NULL(itn, hpack_intern_new, NULL, NULL, NULL, NULL);
+	CHECK_NULL(itn, hpack_intern_new, &null_alloc, NULL, NULL, NULL);
+	CHECK_NULL(itn, hpack_intern_new, &static_alloc, NULL, NULL, NULL);
+	CHECK_NULL(itn, hpack_intern_new, hpack_default_alloc, intern_lock,
+	    NULL, &lck);
+	CHECK_NULL(itn, hpack_intern_new, hpack_default_alloc, NULL,
+	    intern_unlock, &lck);
+
+	hpack_intern_free(NULL);
+	itn = NULL;
+	hpack_intern_free(&itn);
+
+	CHECK_NOTNULL(itn, hpack_intern_new, hpack_default_alloc, NULL,
+	    NULL, NULL);
+	CHECK_RES(retval, ARG, hpack_share, NULL, itn);
+
+	hp = make_decoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, ARG, hpack_share, hp, NULL);
+
+	/* interned and Huffman-coded tables are mutually exclusive */
+	CHECK_RES(retval, OK, hpack_compress, hp);
+	CHECK_RES(retval, ARG, hpack_share, hp, itn);
+	hpack_free(&hp);
+
+	hp = make_decoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, OK, hpack_share, hp, itn);
+	CHECK_RES(retval, ARG, hpack_compress, hp);
+
+	/* too late for a busy codec */
+	dec = basic_decoding;
+	dec.blk = intern_block;
+	dec.blk_len = 4;
+	dec.cut = 1;
+	CHECK_RES(retval, BLK, hpack_decode, hp, &dec);
+	CHECK_RES(retval, BSY, hpack_share, hp, itn);
+
+	/* too late for existing entries */
+	dec.blk = intern_block + 4;
+	dec.blk_len = sizeof intern_block - 4;
+	dec.cut = 0;
+	CHECK_RES(retval, OK, hpack_decode, hp, &dec);
+	CHECK_RES(retval, ARG, hpack_share, hp, itn);
+	hpack_free(&hp);
+
+	hpack_intern_free(&itn);
+	assert(itn == NULL);
+}
+
+static void
+test_intern_codecs(void)
+{
+	struct hpack_intern *itn;
+	struct hpack_decoding dec;
+	struct hpack_encoding enc;
+	struct hpack_field ifl[2];
+	struct hpack *hp2, *tmp;
+	const char *nam[2], *val[2];
+	unsigned lck;
+
+	lck = 0;
+	CHECK_NOTNULL(itn, hpack_intern_new, hpack_default_alloc,
+	    intern_lock, intern_unlock, &lck);
+
+	hp = make_decoder(4096, -1, hpack_default_alloc);
+	hp2 = make_decoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, OK, hpack_share, hp, itn);
+	CHECK_RES(retval, OK, hpack_share, hp2, itn);
+
+	dec = basic_decoding;
+	dec.blk = intern_block;
+	dec.blk_len = sizeof intern_block;
+	CHECK_RES(retval, OK, hpack_decode, hp, &dec);
+	CHECK_RES(retval, OK, hpack_decode, hp2, &dec);
+	assert(lck > 0);
+
+	/* both decoders reference the same strings */
+	CHECK_RES(retval, OK, hpack_entry, hp, 62, &nam[0], &val[0]);
+	CHECK_RES(retval, OK, hpack_entry, hp2, 62, &nam[1], &val[1]);
+	assert(!strcmp(nam[0], "x"));
+	assert(!strcmp(val[0], "y"));
+	assert(nam[0] == nam[1]);
+	assert(val[0] == val[1]);
+
+	CHECK_RES(retval, OK, hpack_entry, hp, 63, &nam[0], &val[0]);
+	CHECK_RES(retval, OK, hpack_entry, hp2, 63, &nam[1], &val[1]);
+	assert(!strcmp(nam[0], "user-agent"));
+	assert(!strcmp(val[0], "cashpack"));
+	assert(val[0] == val[1]);
+
+	/* and so does an encoder */
+	(void)memset(ifl, 0, sizeof ifl);
+	ifl[0].flg = HPACK_FLG_TYP_DYN;
+	ifl[0].nam = "x";
+	ifl[0].val = "y";
+	tmp = make_encoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, OK, hpack_share, tmp, itn);
+	enc = basic_encoding;
+	enc.fld = ifl;
+	CHECK_RES(retval, OK, hpack_encode, tmp, &enc);
+	CHECK_RES(retval, OK, hpack_entry, tmp, 62, &nam[1], &val[1]);
+	assert(val[0] != val[1]);
+	CHECK_RES(retval, OK, hpack_entry, hp, 62, &nam[0], &val[0]);
+	assert(nam[0] == nam[1]);
+	assert(val[0] == val[1]);
+	hpack_free(&tmp);
+
+	/* evictions release strings still referenced elsewhere */
+	CHECK_RES(retval, OK, hpack_resize, &hp, 0);
+	CHECK_RES(retval, OK, hpack_decode, hp, &update_decoding);
+	CHECK_RES(retval, OK, hpack_entry, hp2, 62, &nam[1], &val[1]);
+	assert(!strcmp(nam[1], "x"));
+	assert(!strcmp(val[1], "y"));
+
+	/* a reset codec remains shared */
+	CHECK_RES(retval, OK, hpack_reset, &hp2, 4096);
+	CHECK_RES(retval, OK, hpack_decode, hp2, &dec);
+	CHECK_RES(retval, OK, hpack_reset, &hp, 4096);
+	dec.blk_len = 10;
+	CHECK_RES(retval, OK, hpack_decode, hp, &dec);
+	CHECK_RES(retval, OK, hpack_entry, hp, 62, &nam[0], &val[0]);
+	CHECK_RES(retval, OK, hpack_entry, hp2, 63, &nam[1], &val[1]);
+	assert(val[0] == val[1]);
+
+	hpack_free(&hp);
+	hpack_free(&hp2);
+	hpack_intern_free(&itn);
+	assert(lck % 2 == 0);
+}
+
+static void
+test_intern_malloc_failure(void)
+{
+	struct hpack_intern *itn;
+	struct hpack_decoding dec;
+	struct hpack_alloc ha;
+	unsigned budget;
+
+	ha.malloc = intern_malloc;
+	ha.realloc = NULL;
+	ha.free = oom_free;
+	ha.priv = &budget;
+
+	dec = basic_decoding;
+	dec.blk = intern_block + 10;
+	dec.blk_len = sizeof intern_block - 10;
+
+	/* no buckets */
+	budget = 1;
+	CHECK_NOTNULL(itn, hpack_intern_new, &ha, NULL, NULL, NULL);
+	hp = make_decoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, OK, hpack_share, hp, itn);
+	CHECK_RES(retval, OOM, hpack_decode, hp, &dec);
+	hpack_free(&hp);
+	hpack_intern_free(&itn);
+
+	/* no value */
+	budget = 3;
+	CHECK_NOTNULL(itn, hpack_intern_new, &ha, NULL, NULL, NULL);
+	hp = make_decoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, OK, hpack_share, hp, itn);
+	CHECK_RES(retval, OOM, hpack_decode, hp, &dec);
+	hpack_free(&hp);
+
+	/* the name was released */
+	budget = 1;
+	hp = make_decoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, OK, hpack_share, hp, itn);
+	CHECK_RES(retval, OOM, hpack_decode, hp, &dec);
+	hpack_free(&hp);
+
+	budget = 2;
+	hp = make_decoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, OK, hpack_share, hp, itn);
+	CHECK_RES(retval, OK, hpack_decode, hp, &dec);
+	hpack_free(&hp);
+	hpack_intern_free(&itn);
+}
+
+static void
+test_adapt_null_args(void)
+{
+	struct hpack_encoding enc;
+
+	CHECK_RES(retval, ARG, hpack_adapt, NULL);
+
+	hp = make_decoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, ARG, hpack_adapt, hp);
+	hpack_free(&hp);
+
+	hp = make_encoder(4096, -1, hpack_default_alloc);
+	enc = basic_encoding;
+	enc.cut = 1;
+	CHECK_RES(retval, BLK, hpack_encode, hp, &enc);
+	CHECK_RES(retval, BSY, hpack_adapt, hp);
+	hpack_free(&hp);
+}
+
+static ssize_t
+adapt_encode(struct hpack_field *afl, unsigned n)
+{
+	struct hpack_encoding enc;
+	ssize_t tbl;
+
+	enc = basic_encoding;
+	enc.fld = afl;
+	enc.cb = table_cb;
+	enc.priv = &tbl;
+
+	tbl = -1;
+	while (n-- > 0)
+		CHECK_RES(retval, OK, hpack_encode, hp, &enc);
+	return (tbl);
+}
+
+static void
+test_adapt_encoder(void)
+{
+	struct hpack_governor *gov;
+	struct hpack *dec[2];
+	struct hpack_field afl;
+	char big[201];
+	size_t lim;
+
+	hp = make_encoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, OK, hpack_adapt, hp);
+
+	/* no reuse, the limit goes down to the minimum */
+	(void)memset(&afl, 0, sizeof afl);
+	afl.flg = HPACK_FLG_TYP_LIT;
+	afl.nam = "x";
+	afl.val = "y";
+	assert(adapt_encode(&afl, 32) == -1);
+	for (lim = 2048; lim >= 256; lim /= 2) {
+		assert(adapt_encode(&afl, 1) == (ssize_t)lim);
+		assert(adapt_encode(&afl, 31) == -1);
+	}
+	assert(adapt_encode(&afl, 1) == -1);
+	CHECK_RES(retval, OK, hpack_trim, &hp);
+
+	/* reuse with evictions, the limit goes up */
+	(void)memset(big, 'a', sizeof big - 1);
+	big[sizeof big - 1] = '\0';
+	afl.flg = HPACK_FLG_TYP_DYN;
+	afl.val = big;
+	assert(adapt_encode(&afl, 1) == -1);
+	afl.flg = HPACK_FLG_TYP_IDX;
+	afl.idx = 62;
+	assert(adapt_encode(&afl, 29) == -1);
+	afl.flg = HPACK_FLG_TYP_DYN;
+	afl.idx = 0;
+	afl.nam = "y";
+	assert(adapt_encode(&afl, 1) == -1);
+
+	/* but not past its memory until it is trimmed */
+	assert(adapt_encode(&afl, 1) == -1);
+	CHECK_RES(retval, OK, hpack_trim, &hp);
+	assert(adapt_encode(&afl, 1) == 512);
+
+	/* an explicit limit takes over */
+	CHECK_RES(retval, OK, hpack_limit, &hp, 1024);
+	assert(adapt_encode(&afl, 1) == 1024);
+	hpack_free(&hp);
+
+	/* an adaptive limit never outlives a smaller maximum */
+	hp = make_encoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, OK, hpack_adapt, hp);
+	afl.flg = HPACK_FLG_TYP_LIT;
+	afl.nam = "x";
+	afl.val = "y";
+	assert(adapt_encode(&afl, 32) == -1);
+	assert(adapt_encode(&afl, 1) == 2048);
+	CHECK_RES(retval, OK, hpack_resize, &hp, 1000);
+	assert(adapt_encode(&afl, 1) == 1000);
+	assert(adapt_encode(&afl, 1) == -1);
+	hpack_free(&hp);
+
+	/* nor a governed share under pressure */
+	CHECK_NOTNULL(gov, hpack_governor_new, hpack_default_alloc, 4096,
+	    NULL, NULL, NULL);
+	hp = make_encoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, OK, hpack_adapt, hp);
+	CHECK_RES(retval, OK, hpack_govern, hp, gov);
+	assert(adapt_encode(&afl, 32) == -1);
+	assert(adapt_encode(&afl, 1) == 2048);
+	for (lim = 0; lim < 2; lim++) {
+		dec[lim] = make_decoder(4096, -1, hpack_default_alloc);
+		CHECK_RES(retval, OK, hpack_govern, dec[lim], gov);
+	}
+	assert(adapt_encode(&afl, 1) == 1365);
+	assert(adapt_encode(&afl, 1) == -1);
+	hpack_free(&dec[0]);
+	hpack_free(&dec[1]);
+	assert(adapt_encode(&afl, 1) == 2048);
+	hpack_free(&hp);
+	hpack_governor_free(&gov);
+}
+
+static void
+test_lookahead_null_args(void)
+{
+	struct hpack_encoding enc;
+
+	CHECK_RES(retval, ARG, hpack_lookahead, NULL);
+
+	hp = make_decoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, ARG, hpack_lookahead, hp);
+	hpack_free(&hp);
+
+	hp = make_encoder(4096, -1, hpack_default_alloc);
+	enc = basic_encoding;
+	enc.cut = 1;
+	CHECK_RES(retval, BLK, hpack_encode, hp, &enc);
+	CHECK_RES(retval, BSY, hpack_lookahead, hp);
+	hpack_free(&hp);
+}
+
+/* NB: returns whether the last field referenced the entry inserted first,
+ * despite the insertion of a large field in between.
+ */
+static int
+lookahead_encode(void)
+{
+	struct hpack_encoding enc;
+	struct hpack_field lfl[2];
+
+	(void)memset(lfl, 0, sizeof lfl);
+	lfl[0].flg = HPACK_FLG_TYP_DYN;
+	lfl[0].nam = "x-a";
+	lfl[0].val = "aaaa";
+	lfl[1].flg = HPACK_FLG_TYP_DYN;
+	lfl[1].nam = "x-b";
+	lfl[1].val = "bbbb";
+
+	enc = basic_encoding;
+	enc.fld = lfl;
+	enc.fld_cnt = 2;
+	CHECK_RES(retval, OK, hpack_encode, hp, &enc);
+
+	(void)memset(lfl, 0, sizeof lfl);
+	lfl[0].flg = HPACK_FLG_TYP_DYN | HPACK_FLG_AUT_IDX;
+	lfl[0].nam = "x-large";
+	lfl[0].val = "llllllllllllllllllll";
+	lfl[1].flg = HPACK_FLG_TYP_DYN | HPACK_FLG_AUT_IDX;
+	lfl[1].nam = "x-a";
+	lfl[1].val = "aaaa";
+
+	CHECK_RES(retval, OK, hpack_encode, hp, &enc);
+	if (!(lfl[1].flg & HPACK_FLG_TYP_IDX))
+		return (0);
+	assert(lfl[0].flg & HPACK_FLG_TYP_LIT);
+	assert(lfl[1].idx == 63);
+	return (1);
+}
+
+static void
+test_lookahead_encoder(void)
+{
+	struct hpack_encoding enc;
+	struct hpack_field lfl[3];
+	struct save_buffer sb;
+
+	/* the large field evicts x-a before it is referenced */
+	hp = make_encoder(128, -1, hpack_default_alloc);
+	assert(!lookahead_encode());
+	hpack_free(&hp);
+
+	/* unless the encoder looks ahead */
+	hp = make_encoder(128, -1, hpack_default_alloc);
+	CHECK_RES(retval, OK, hpack_lookahead, hp);
+	CHECK_RES(retval, OK, hpack_lookahead, hp);
+	assert(lookahead_encode());
+
+	/* and keeps doing so once reset */
+	CHECK_RES(retval, OK, hpack_reset, &hp, 128);
+	assert(lookahead_encode());
+
+	/* or restored */
+	CHECK_RES(retval, OK, hpack_reset, &hp, 128);
+	sb.len = 0;
+	CHECK_RES(retval, OK, hpack_save, hp, save_cb, &sb, 0);
+	hpack_free(&hp);
+	CHECK_NOTNULL(hp, hpack_restore, sb.buf, sb.len, hpack_default_alloc);
+	assert(lookahead_encode());
+	hpack_free(&hp);
+
+	/* a field appearing again may still cost more than it saves */
+	hp = make_encoder(128, -1, hpack_default_alloc);
+	CHECK_RES(retval, OK, hpack_lookahead, hp);
+	(void)memset(lfl, 0, sizeof lfl);
+	lfl[0].flg = HPACK_FLG_TYP_DYN;
+	lfl[0].nam = "x-a";
+	lfl[0].val = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
+	lfl[1].flg = HPACK_FLG_TYP_DYN;
+	lfl[1].nam = "x-b";
+	lfl[1].val = "bbbb";
+	enc = basic_encoding;
+	enc.fld = lfl;
+	enc.fld_cnt = 2;
+	CHECK_RES(retval, OK, hpack_encode, hp, &enc);
+
+	(void)memset(lfl, 0, sizeof lfl);
+	lfl[0].flg = HPACK_FLG_TYP_DYN | HPACK_FLG_AUT_IDX;
+	lfl[0].nam = "x-s";
+	lfl[0].val = "s";
+	lfl[1] = lfl[0];
+	lfl[2].flg = HPACK_FLG_TYP_DYN | HPACK_FLG_AUT_IDX;
+	lfl[2].nam = "x-a";
+	lfl[2].val = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
+	enc.fld_cnt = 3;
+	CHECK_RES(retval, OK, hpack_encode, hp, &enc);
+	assert(lfl[0].flg & HPACK_FLG_TYP_LIT);
+	assert(lfl[1].flg & HPACK_FLG_TYP_LIT);
+	assert(lfl[2].flg & HPACK_FLG_TYP_IDX);
+	assert(lfl[2].idx == 63);
+	hpack_free(&hp);
+}
+
+static void
+test_admit_null_args(void)
+{
+	struct hpack_encoding enc;
+	struct hpack_alloc ha;
+	uint64_t mem[80];
+	unsigned budget;
+
+	CHECK_RES(retval, ARG, hpack_admit, NULL);
+
+	hp = make_decoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, ARG, hpack_admit, hp);
+	hpack_free(&hp);
+
+	CHECK_NOTNULL(hp, hpack_encoder_init, mem, sizeof mem, 256);
+	CHECK_RES(retval, ARG, hpack_admit, hp);
+	hpack_free(&hp);
+
+	hp = make_encoder(4096, -1, hpack_default_alloc);
+	enc = basic_encoding;
+	enc.cut = 1;
+	CHECK_RES(retval, BLK, hpack_encode, hp, &enc);
+	CHECK_RES(retval, BSY, hpack_admit, hp);
+	hpack_free(&hp);
+
+	ha.malloc = intern_malloc;
+	ha.realloc = NULL;
+	ha.free = oom_free;
+	ha.priv = &budget;
+	budget = 1;
+	hp = make_encoder(4096, -1, &ha);
+	CHECK_RES(retval, OOM, hpack_admit, hp);
+	hpack_free(&hp);
+}
+
+static int
+admit_encode(const char *nam, const char *val)
+{
+	struct hpack_encoding enc;
+	struct hpack_field afl;
+	const char *dyn_nam, *dyn_val;
+
+	(void)memset(&afl, 0, sizeof afl);
+	afl.flg = HPACK_FLG_TYP_DYN | HPACK_FLG_AUT_IDX;
+	afl.nam = nam;
+	afl.val = val;
+
+	enc = basic_encoding;
+	enc.fld = &afl;
+	CHECK_RES(retval, OK, hpack_encode, hp, &enc);
+
+	/* was it inserted? */
+	if (hpack_entry(hp, 62, &dyn_nam, &dyn_val) != HPACK_RES_OK)
+		return (0);
+	return (!strcmp(dyn_nam, nam) && !strcmp(dyn_val, val));
+}
+
+static void
+test_admit_encoder(void)
+{
+	struct save_buffer sb;
+
+	hp = make_encoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, OK, hpack_admit, hp);
+	CHECK_RES(retval, OK, hpack_admit, hp);
+
+	/* a field line is admitted once seen again */
+	assert(!admit_encode("x-stable", "a"));
+	assert(admit_encode("x-stable", "a"));
+	assert(admit_encode("x-stable", "a"));
+
+	/* then its name is known to repeat */
+	assert(admit_encode("x-stable", "b"));
+
+	/* and a name with unique values is not */
+	assert(!admit_encode("x-request-id", "1"));
+	assert(!admit_encode("x-request-id", "2"));
+	assert(!admit_encode("x-request-id", "3"));
+
+	/* a reset encoder starts over */
+	CHECK_RES(retval, OK, hpack_reset, &hp, 4096);
+	assert(!admit_encode("x-stable", "b"));
+	assert(admit_encode("x-stable", "b"));
+
+	/* and so does a restored encoder */
+	sb.len = 0;
+	CHECK_RES(retval, OK, hpack_save, hp, save_cb, &sb, 0);
+	hpack_free(&hp);
+	CHECK_NOTNULL(hp, hpack_restore, sb.buf, sb.len, hpack_default_alloc);
+	assert(!admit_encode("x-stable", "c"));
+	assert(admit_encode("x-stable", "c"));
+	hpack_free(&hp);
+}
+
+static void
+test_profile_null_args(void)
+{
+	struct hpack_profile *prf;
+	struct hpack_encoding enc;
+	struct save_buffer sb;
+	uint64_t mem[80];
+	unsigned lck;
+
+	CHECK_NULL(prf, hpack_profile_new, NULL, NULL, NULL, NULL);
+	CHECK_NULL(prf, hpack_profile_new, &null_alloc, NULL, NULL, NULL);
+	CHECK_NULL(prf, hpack_profile_new, hpack_default_alloc, intern_lock,
+	    NULL, &lck);
+	CHECK_NULL(prf, hpack_profile_new, hpack_default_alloc, NULL,
+	    intern_unlock, &lck);
+
+	hpack_profile_free(NULL);
+	prf = NULL;
+	hpack_profile_free(&prf);
+
+	CHECK_NOTNULL(prf, hpack_profile_new, hpack_default_alloc, NULL, NULL,
+	    NULL);
+	CHECK_RES(retval, ARG, hpack_learn, NULL, prf);
+
+	hp = make_decoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, ARG, hpack_learn, hp, prf);
+	hpack_free(&hp);
+
+	CHECK_NOTNULL(hp, hpack_encoder_init, mem, sizeof mem, 256);
+	CHECK_RES(retval, ARG, hpack_learn, hp, prf);
+	hpack_free(&hp);
+
+	hp = make_encoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, ARG, hpack_learn, hp, NULL);
+
+	/* too late for a busy encoder */
+	enc = basic_encoding;
+	enc.cut = 1;
+	CHECK_RES(retval, BLK, hpack_encode, hp, &enc);
+	CHECK_RES(retval, BSY, hpack_learn, hp, prf);
+
+	/* only one profile per encoder */
+	CHECK_RES(retval, OK, hpack_reset, &hp, 4096);
+	CHECK_RES(retval, OK, hpack_learn, hp, prf);
+	CHECK_RES(retval, ARG, hpack_learn, hp, prf);
+	hpack_free(&hp);
+
+	CHECK_RES(retval, ARG, hpack_profile_save, NULL, save_cb, &sb);
+	CHECK_RES(retval, ARG, hpack_profile_save, prf, NULL, &sb);
+	CHECK_RES(retval, ARG, hpack_profile_load, NULL, "hpf 1\n", 6);
+	CHECK_RES(retval, ARG, hpack_profile_load, prf, NULL, 0);
+
+	/* an empty profile */
+	sb.len = 0;
+	CHECK_RES(retval, OK, hpack_profile_save, prf, save_cb, &sb);
+	assert(sb.len == 6);
+	assert(!memcmp(sb.buf, "hpf 1\n", 6));
+	CHECK_RES(retval, OK, hpack_profile_load, prf, sb.buf, sb.len);
+
+	/* invalid profiles */
+#define LOAD_ERROR(str) \
+	CHECK_RES(retval, ARG, hpack_profile_load, prf, str, sizeof str - 1)
+	LOAD_ERROR("");
+	LOAD_ERROR("hpf 1");
+	LOAD_ERROR("hpf 2\n");
+	LOAD_ERROR("hpf 1\nx-name 1 2 3 4\n");
+	LOAD_ERROR("hpf 1\nx-name 1 2 3 4 5");
+	LOAD_ERROR("hpf 1\nx-name 1 2 3 4 5 6\n");
+	LOAD_ERROR("hpf 1\nx-name 1 2 3 4 x\n");
+	LOAD_ERROR("hpf 1\nx-name 1 2 3 4 4294967296\n");
+	LOAD_ERROR("hpf 1\n 1 2 3 4 5\n");
+	LOAD_ERROR("hpf 1\nx-name  1 2 3 4 5\n");
+	LOAD_ERROR("hpf 1\nx-name 1 2 3 4 5\nx-name 1 2 3 4\n");
+#undef LOAD_ERROR
+
+	/* nothing was merged */
+	sb.len = 0;
+	CHECK_RES(retval, OK, hpack_profile_save, prf, save_cb, &sb);
+	assert(sb.len == 6);
+
+	hpack_profile_free(&prf);
+	assert(prf == NULL);
+}
+
+static uint32_t
+profile_encode(struct hpack *enc_hp, const char *nam, const char *val)
+{
+	struct hpack_encoding enc;
+	struct hpack_field pfl;
+
+	(void)memset(&pfl, 0, sizeof pfl);
+	pfl.flg = HPACK_FLG_TYP_DYN | HPACK_FLG_AUT_IDX;
+	pfl.nam = nam;
+	pfl.val = val;
+
+	enc = basic_encoding;
+	enc.fld = &pfl;
+	CHECK_RES(retval, OK, hpack_encode, enc_hp, &enc);
+	return (pfl.flg);
+}
+
+static void
+profile_save_cb(enum hpack_event_e evt, const char *buf, size_t len,
+    void *priv)
+{
+
+	/* NB: the profile is not locked during the callback */
+	save_cb(evt, buf, len, priv);
+	(void)profile_encode(hp, "x-saved", "");
+}
+
+static void
+test_profile_encoders(void)
+{
+	struct hpack_profile *prf, *prf2;
+	struct save_buffer sb;
+	struct hpack *hp2;
+	uint32_t flg;
+	unsigned lck, u;
+	char val[16];
+
+	lck = 0;
+	CHECK_NOTNULL(prf, hpack_profile_new, hpack_default_alloc,
+	    intern_lock, intern_unlock, &lck);
+
+	hp = make_encoder(4096, -1, hpack_default_alloc);
+	hp2 = make_encoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, OK, hpack_learn, hp, prf);
+	CHECK_RES(retval, OK, hpack_learn, hp2, prf);
+
+	/* values that never repeat are inserted until the name is known */
+	for (u = 1; u <= 17; u++) {
+		(void)snprintf(val, sizeof val, "%08u", u);
+		flg = profile_encode(hp, "x-request-id", val);
+		assert(flg & HPACK_FLG_TYP_DYN);
+		assert(flg & HPACK_FLG_VAL_HUF);
+		if (u == 1)
+			assert(flg & HPACK_FLG_NAM_HUF);
+		else
+			assert(flg & HPACK_FLG_NAM_IDX);
+	}
+
+	/* then literals are preferred */
+	flg = profile_encode(hp, "x-request-id", "18");
+	assert(flg & HPACK_FLG_TYP_LIT);
+
+	/* by all encoders, once observations are merged */
+	flg = profile_encode(hp2, "x-request-id", "19");
+	assert(flg & HPACK_FLG_TYP_DYN);
+	hpack_free(&hp2);
+	hp2 = make_encoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, OK, hpack_learn, hp2, prf);
+	flg = profile_encode(hp2, "x-request-id", "20");
+	assert(flg & HPACK_FLG_TYP_LIT);
+
+	/* values that repeat keep their indexing */
+	for (u = 0; u < 32; u++) {
+		flg = profile_encode(hp, "x-stable", "~~~~");
+		if (u == 0)
+			assert(flg & HPACK_FLG_TYP_DYN);
+		else
+			assert(flg & HPACK_FLG_TYP_IDX);
+	}
+	flg = profile_encode(hp2, "x-stable", "~~~~~");
+	assert(flg & HPACK_FLG_TYP_DYN);
+	assert(!(flg & HPACK_FLG_VAL_HUF));
+
+	/* a reset encoder keeps learning */
+	CHECK_RES(retval, OK, hpack_reset, &hp, 4096);
+	flg = profile_encode(hp, "x-request-id", "21");
+	assert(flg & HPACK_FLG_TYP_LIT);
+
+	/* a learner full of names starts over */
+	for (u = 0; u < 64; u++) {
+		(void)snprintf(val, sizeof val, "x-name-%u", u);
+		(void)profile_encode(hp, val, "");
+	}
+	flg = profile_encode(hp, "x-request-id", "22");
+	assert(flg & HPACK_FLG_TYP_LIT);
+
+	/* the profile outlives its encoders */
+	sb.len = 0;
+	CHECK_RES(retval, OK, hpack_profile_save, prf, profile_save_cb, &sb);
+	hpack_free(&hp);
+	hpack_free(&hp2);
+	hpack_profile_free(&prf);
+	assert(lck % 2 == 0);
+
+	CHECK_NOTNULL(prf2, hpack_profile_new, hpack_default_alloc, NULL,
+	    NULL, NULL);
+	CHECK_RES(retval, OK, hpack_profile_load, prf2, sb.buf, sb.len);
+	hp = make_encoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, OK, hpack_learn, hp, prf2);
+	flg = profile_encode(hp, "x-request-id", "23");
+	assert(flg & HPACK_FLG_TYP_LIT);
+	flg = profile_encode(hp, "x-stable", "~~~~");
+	assert(flg & HPACK_FLG_TYP_DYN);
+	hpack_free(&hp);
+	hpack_profile_free(&prf2);
+}
+
+static void
+test_refresh_null_args(void)
+{
+	struct hpack_encoding enc;
+	struct hpack_alloc ha;
+	uint64_t mem[80];
+	unsigned budget;
+
+	CHECK_RES(retval, ARG, hpack_refresh, NULL);
+
+	hp = make_decoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, ARG, hpack_refresh, hp);
+	hpack_free(&hp);
+
+	CHECK_NOTNULL(hp, hpack_encoder_init, mem, sizeof mem, 256);
+	CHECK_RES(retval, ARG, hpack_refresh, hp);
+	hpack_free(&hp);
+
+	hp = make_encoder(4096, -1, hpack_default_alloc);
+	enc = basic_encoding;
+	enc.cut = 1;
+	CHECK_RES(retval, BLK, hpack_encode, hp, &enc);
+	CHECK_RES(retval, BSY, hpack_refresh, hp);
+	hpack_free(&hp);
+
+	ha.malloc = intern_malloc;
+	ha.realloc = NULL;
+	ha.free = oom_free;
+	ha.priv = &budget;
+	budget = 1;
+	hp = make_encoder(4096, -1, &ha);
+	CHECK_RES(retval, OOM, hpack_refresh, hp);
+	hpack_free(&hp);
+}
+
+/* NB: returns the number of times the hot field was inserted with its
+ * static name index, either for the first time or after it was evicted.
+ */
+static unsigned
+refresh_encode(unsigned n, unsigned *rfr)
+{
+	struct hpack_encoding enc;
+	struct hpack_field rfl[2];
+	unsigned ins, u;
+	char val[16];
+
+	ins = 0;
+	for (u = 0; u < n; u++) {
+		(void)memset(rfl, 0, sizeof rfl);
+		rfl[0].flg = HPACK_FLG_TYP_DYN | HPACK_FLG_AUT_IDX;
+		rfl[0].nam = "server";
+		rfl[0].val = "our-edge";
+		(void)snprintf(val, sizeof val, "%04u", u);
+		rfl[1].flg = HPACK_FLG_TYP_DYN;
+		rfl[1].nam = "x-id";
+		rfl[1].val = val;
+
+		enc = basic_encoding;
+		enc.fld = rfl;
+		enc.fld_cnt = 2;
+		CHECK_RES(retval, OK, hpack_encode, hp, &enc);
+
+		if (rfl[0].flg & HPACK_FLG_TYP_IDX)
+			continue;
+		assert(rfl[0].flg & HPACK_FLG_TYP_DYN);
+		assert(rfl[0].flg & HPACK_FLG_NAM_IDX);
+		if (rfl[0].nam_idx > 61)
+			(*rfr)++;
+		else
+			ins++;
+	}
+	return (ins);
+}
+
+static void
+test_refresh_encoder(void)
+{
+	struct save_buffer sb;
+	unsigned rfr;
+
+	/* a hot entry eventually falls off the table */
+	rfr = 0;
+	hp = make_encoder(256, -1, hpack_default_alloc);
+	assert(refresh_encode(32, &rfr) > 1);
+	assert(rfr == 0);
+	hpack_free(&hp);
+
+	/* unless it is refreshed */
+	hp = make_encoder(256, -1, hpack_default_alloc);
+	CHECK_RES(retval, OK, hpack_refresh, hp);
+	CHECK_RES(retval, OK, hpack_refresh, hp);
+	assert(refresh_encode(32, &rfr) == 1);
+	assert(rfr > 0);
+
+	/* a reset encoder starts over */
+	CHECK_RES(retval, OK, hpack_reset, &hp, 256);
+	rfr = 0;
+	assert(refresh_encode(32, &rfr) == 1);
+	assert(rfr > 0);
+
+	/* and so does a restored encoder */
+	sb.len = 0;
+	CHECK_RES(retval, OK, hpack_save, hp, save_cb, &sb, 0);
+	hpack_free(&hp);
+	CHECK_NOTNULL(hp, hpack_restore, sb.buf, sb.len, hpack_default_alloc);
+	rfr = 0;
+	(void)refresh_encode(32, &rfr);
+	assert(rfr > 0);
+	hpack_free(&hp);
+}
+
+static void
+test_governor_null_args(void)
+{
+	struct hpack_governor *gov;
+	struct hpack_decoding dec;
+	unsigned lck;
+
+	CHECK_NULL(gov, hpack_governor_new, NULL, 0, NULL, NULL, NULL);
+	CHECK_NULL(gov, hpack_governor_new, &null_alloc, 0, NULL, NULL, NULL);
+	CHECK_NULL(gov, hpack_governor_new, hpack_default_alloc, 0,
+	    intern_lock, NULL, &lck);
+	CHECK_NULL(gov, hpack_governor_new, hpack_default_alloc, 0, NULL,
+	    intern_unlock, &lck);
+
+	hpack_governor_free(NULL);
+	gov = NULL;
+	hpack_governor_free(&gov);
+
+	CHECK_NOTNULL(gov, hpack_governor_new, hpack_default_alloc, 4096,
+	    NULL, NULL, NULL);
+	CHECK_RES(retval, ARG, hpack_govern, NULL, gov);
+
+	hp = make_decoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, ARG, hpack_govern, hp, NULL);
+
+	/* too late for a busy codec */
+	dec = basic_decoding;
+	dec.blk = intern_block;
+	dec.blk_len = 4;
+	dec.cut = 1;
+	CHECK_RES(retval, BLK, hpack_decode, hp, &dec);
+	CHECK_RES(retval, BSY, hpack_govern, hp, gov);
+
+	/* only one governor per codec */
+	CHECK_RES(retval, OK, hpack_reset, &hp, 4096);
+	CHECK_RES(retval, OK, hpack_govern, hp, gov);
+	CHECK_RES(retval, ARG, hpack_govern, hp, gov);
+	hpack_free(&hp);
+
+	hpack_governor_free(&gov);
+	assert(gov == NULL);
+}
+
+static void
+test_governor_pressure(void)
+{
+	struct hpack_governor *gov;
+	struct hpack_encoding enc;
+	struct hpack *hp2;
+	ssize_t tbl;
+	unsigned lck;
+
+	lck = 0;
+	CHECK_NOTNULL(gov, hpack_governor_new, hpack_default_alloc, 6144,
+	    intern_lock, intern_unlock, &lck);
+
+	enc = basic_encoding;
+	enc.cb = table_cb;
+	enc.priv = &tbl;
+
+	/* within budget */
+	hp = make_encoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, OK, hpack_govern, hp, gov);
+	tbl = -1;
+	CHECK_RES(retval, OK, hpack_encode, hp, &enc);
+	assert(tbl == -1);
+
+	/* over budget, encoders get a third of it */
+	hp2 = make_decoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, OK, hpack_govern, hp2, gov);
+	hpack_free(&hp2);
+	hp2 = make_encoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, OK, hpack_govern, hp2, gov);
+	tbl = -1;
+	CHECK_RES(retval, OK, hpack_encode, hp, &enc);
+	assert(tbl == 3072);
+	CHECK_RES(retval, OK, hpack_trim, &hp);
+
+	/* still over budget until the second encoder is trimmed */
+	tbl = -1;
+	CHECK_RES(retval, OK, hpack_encode, hp2, &enc);
+	assert(tbl == 3072);
+	CHECK_RES(retval, OK, hpack_trim, &hp2);
+
+	/* the peer may lower the maximum below the governed limit */
+	CHECK_RES(retval, OK, hpack_resize, &hp2, 1024);
+	tbl = -1;
+	CHECK_RES(retval, OK, hpack_encode, hp2, &enc);
+	assert(tbl == 1024);
+
+	/* a lifted limit is lowered again under pressure */
+	CHECK_RES(retval, OK, hpack_limit, &hp, 4096);
+	tbl = -1;
+	CHECK_RES(retval, OK, hpack_encode, hp, &enc);
+	assert(tbl == 3072);
+	CHECK_RES(retval, OK, hpack_trim, &hp);
+
+	/* back under budget, the limit is restored once trimmed */
+	hpack_free(&hp2);
+	tbl = -1;
+	CHECK_RES(retval, OK, hpack_encode, hp, &enc);
+	assert(tbl == -1);
+	CHECK_RES(retval, OK, hpack_trim, &hp);
+	tbl = -1;
+	CHECK_RES(retval, OK, hpack_encode, hp, &enc);
+	assert(tbl == 4096);
+
+	/* and right away when the memory was kept */
+	hp2 = make_encoder(4096, -1, hpack_default_alloc);
+	CHECK_RES(retval, OK, hpack_govern, hp2, gov);
+	tbl = -1;
+	CHECK_RES(retval, OK, hpack_encode, hp, &enc);
+	assert(tbl == 3072);
+	hpack_free(&hp2);
+	tbl = -1;
+	CHECK_RES(retval, OK, hpack_encode, hp, &enc);
+	assert(tbl == 4096);
+	tbl = -1;
+	CHECK_RES(retval, OK, hpack_encode, hp, &enc);
+	assert(tbl == -1);
+
+	/* a reset codec remains governed */
+	CHECK_RES(retval, OK, hpack_reset, &hp, 4096);
+	CHECK_RES(retval, ARG, hpack_govern, hp, gov);
+	hpack_free(&hp);
+
+	hpack_governor_free(&gov);
+	assert(lck > 0);
+	assert(lck % 2 == 0);
+}
+
+static void
+test_pool_null_args(void)
+{
+	struct hpack_pool *pool;
+	const struct hpack_alloc *ha;
+
+	CHECK_NULL(pool, hpack_pool_new, NULL, 0);
+	CHECK_NULL(pool, hpack_pool_new, &null_alloc, 0);
+	CHECK_NULL(ha, hpack_pool_alloc, NULL);
+
+	hpack_pool_free(NULL);
+	hpack_pool_free(&pool);
+}
+
+static void
+test_pool_malloc_failure(void)
+{
+	struct hpack_pool *pool;
+	const struct hpack_alloc *ha;
+
+	CHECK_NOTNULL(pool, hpack_pool_new, &static_alloc, 0);
+	CHECK_NOTNULL(ha, hpack_pool_alloc, pool);
+	CHECK_NULL(hp, hpack_decoder, 4096, -1, ha);
+	hpack_pool_free(&pool);
+	assert(pool == NULL);
+}
+
+static void
+test_pool_resize(void)
+{
+	struct hpack_pool *pool;
+	const struct hpack_alloc *ha;
+	struct hpack *tmp;
+	void *ptr;
+
+	/* one block per slab */
+	CHECK_NOTNULL(pool, hpack_pool_new, hpack_default_alloc, 1);
+	CHECK_NOTNULL(ha, hpack_pool_alloc, pool);
+
+	hp = make_decoder(4096, -1, ha);
+	CHECK_RES(retval, OK, hpack_resize, &hp, 16384);
+	CHECK_RES(retval, OK, hpack_resize, &hp, UINT16_MAX);
+	CHECK_RES(retval, OK, hpack_resize, &hp, 0);
+	CHECK_RES(retval, OK, hpack_decode, hp, &update_decoding);
+	CHECK_RES(retval, OK, hpack_trim, &hp);
+
+	/* reuse a block from the free list */
+	tmp = make_encoder(4096, -1, ha);
+	hpack_free(&tmp);
+	hpack_free(&hp);
+
+	/* allocations too large for the buckets */
+	CHECK_NOTNULL(ptr, ha->malloc, 1024 * 1024, ha->priv);
+	CHECK_NOTNULL(ptr, ha->realloc, ptr, 512 * 1024, ha->priv);
+	CHECK_NOTNULL(ptr, ha->realloc, ptr, 2048 * 1024, ha->priv);
+	CHECK_NOTNULL(ptr, ha->realloc, ptr, 64, ha->priv);
+	ha->free(ptr, ha->priv);
+
+	hpack_pool_free(&pool);
+	assert(pool == NULL);
+}
+
+static void
+test_pool_small_blocks(void)
+{
+	struct hpack_pool *pool;
+	struct hpack_alloc back;
+	const struct hpack_alloc *ha;
+	size_t len;
+	void *ptr;
+
+	/* one block per slab */
+	back = oom_alloc;
+	back.malloc = slab_malloc;
+	back.priv = &len;
+	CHECK_NOTNULL(pool, hpack_pool_new, &back, 1);
+	CHECK_NOTNULL(ha, hpack_pool_alloc, pool);
+
+	len = 0;
+	CHECK_NOTNULL(ptr, ha->malloc, 200, ha->priv);
+	assert(len > 200 && len < 512);
+	ha->free(ptr, ha->priv);
+
+	/* reuse a small block, then move to a larger one */
+	len = 0;
+	CHECK_NOTNULL(ptr, ha->malloc, 200, ha->priv);
+	assert(len == 0);
+	CHECK_NOTNULL(ptr, ha->realloc, ptr, 1000, ha->priv);
+	assert(len > 1000 && len < 2048);
+	ha->free(ptr, ha->priv);
+
+	hpack_pool_free(&pool);
+	assert(pool == NULL);
+}
+
+static void
+test_clean_null_field(void)
+{
+	CHECK_RES(retval, ARG, hpack_clean_field, NULL);
+}
+
+static void
+test_clean_unknown_field(void)
+{
+	fld = *unknown_field;
+	CHECK_RES(retval, ARG, hpack_clean_field, &fld);
+}
+
+static void
+test_clean_indexed_field_with_name(void)
+{
+	(void)memset(&fld, 0, sizeof fld);
+	fld.flg = HPACK_FLG_TYP_IDX;
+	fld.nam = "";
+	CHECK_RES(retval, ARG, hpack_clean_field, &fld);
+}
+
+static void
+test_clean_indexed_field_with_value(void)
+{
+	(void)memset(&fld, 0, sizeof fld);
+	fld.flg = HPACK_FLG_TYP_IDX;
+	fld.val = "";
+	CHECK_RES(retval, ARG, hpack_clean_field, &fld);
+}
+
+static void
+test_clean_indexed_field_with_indexed_name(void)
+{
+	(void)memset(&fld, 0, sizeof fld);
+	fld.flg = HPACK_FLG_TYP_IDX | HPACK_FLG_NAM_IDX;
+	CHECK_RES(retval, ARG, hpack_clean_field, &fld);
+}
+
+static void
+test_strerror(void)
+{
+	const char *str;
+
+	CHECK_NOTNULL(str, hpack_strerror, HPACK_RES_OK);
+	CHECK_NOTNULL(str, hpack_strerror, HPACK_RES_OOM);
+	CHECK_NULL(str, hpack_strerror, UINT16_MAX);
+}
+
+static void
+test_dump_unknown(void)
+{
+	unsigned magic;
+
+	hp = make_decoder(0, -1, &static_alloc);
+
+	/* save the magic number */
+	(void)memcpy(&magic, hp, sizeof magic);
+
+	/* dump a corrupted codec */
+	(void)memset(hp, 0, sizeof magic);
+	test_dump(hp);
+
+	/* omit the dump callback */
+	hpack_dump(hp, NULL, NULL);
+
+	/* restore and free */
+	(void)memcpy(hp, &magic, sizeof magic);
+	hpack_free(&hp);
+}
+
+static void
+test_event_id(void)
+{
+	const char *str;
+
+#define HPE(e, v, d, l)						\
+	CHECK_NOTNULL(str, hpack_event_id, HPACK_EVT_ ## e);
+#include "tbl/hpack_tbl.h"
+#undef HPE
+	CHECK_NULL(str, hpack_event_id, UINT16_MAX);
+}
+
+/**********************************************************************
+ */
+
+int
+main(void)
+{
+
+	test_null_alloc();
+	test_null_malloc();
+	test_null_free();
+	test_alloc_overflow();
+	test_alloc_underflow();
+	test_malloc_failure();
+	test_free_null_codec();
+	test_double_free();
+
+	test_index();
+	test_index_null_args();
+	test_index_invalid_entry();
+	test_decode_null_args();
+	test_decode_fields_null_args();
+	test_encode_null_args();
+
+	test_resize_overflow();
+	test_limit_null_realloc();
+	test_limit_realloc_failure();
+	test_trim_null_realloc();
+	test_trim_realloc_failure();
+
+	test_skip_decoder();
+	test_skip_null_decoder();
+
+	test_search_null_args();
+	test_search_static_name();
+
+	test_use_defunct_decoder();
+	test_use_busy_decoder();
+	test_use_different_buffer();
+
+	test_limit_null_encoder();
+	test_limit_decoder();
+	test_limit_overflow();
+	test_limit_overflow_no_realloc();
+	test_limit_between_two_resizes();
+	test_limit_again();
+
+	test_use_defunct_encoder();
+	test_use_busy_encoder();
+
+	test_auto_index_invalid_field();
+	test_encode_small_buffer();
+
+	test_resize_null_codec();
+	test_trim_null_codec();
+	test_trim_to_limit();
+
+	test_resize_realloc_failure();
+
+	test_init_null_args();
+	test_init_decoder();
+	test_init_encoder();
+	test_init_move();
+
+	test_reset_null_codec();
+	test_reset_defunct_decoder();
+	test_reset_busy_encoder();
+	test_reset_realloc_failure();
+
+	test_save_null_args();
+	test_save_defunct_decoder();
+	test_save_busy_encoder();
+	test_save_restore(0);
+	test_save_restore(1);
+	test_save_restore_decoder();
+
+	test_lazy_null_args();
+	test_lazy_decoder();
+	test_lazy_realloc_failure();
+
+	test_compress_null_args();
+	test_compress_decoder();
+	test_compress_realloc_failure();
+
+	test_intern_null_args();
+	test_intern_codecs();
+	test_intern_malloc_failure();
+
+	test_adapt_null_args();
+	test_adapt_encoder();
+
+	test_lookahead_null_args();
+	test_lookahead_encoder();
+
+	test_admit_null_args();
+	test_admit_encoder();
+
+	test_profile_null_args();
+	test_profile_encoders();
+
+	test_refresh_null_args();
+	test_refresh_encoder();
+
+	test_governor_null_args();
+	test_governor_pressure();
+
+	test_pool_null_args();
+	test_pool_malloc_failure();
+	test_pool_resize();
+	test_pool_small_blocks();
 
 	test_clean_null_field();
 	test_clean_unknown_field();
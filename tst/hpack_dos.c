@@ -0,0 +1,493 @@
+/*-
+ * License: BSD-2-Clause
+ * (c) 2026 Dridi Boukelmoune <dridi.boukelmoune@gmail.com>
+ *
+ * Adversarial benchmarks.
+ *
+ * Several code paths are linear in the number of dynamic table entries or
+ * in the size of a field, and a hostile peer can maximize them with 33-octet
+ * entries, insertions that evict the entry they reference, or references to
+ * the oldest entry. Each scenario runs for increasing sizes and reports the
+ * order of growth of the cost per field, optionally failing when it exceeds
+ * a given budget. When executed without arguments as part of the test suite,
+ * all scenarios run briefly and the program merely checks that they succeed.
+ */
+
+#include <assert.h>
+#include <fnmatch.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hpack.h"
+
+#include "bch.h"
+
+#define WRONG(str)		\
+	do {			\
+		perror(str);	\
+		abort();	\
+	} while (0)
+
+#define DOS_STATIC	61
+#define DOS_ENTRY	33	/* smallest possible entry */
+#define DOS_FIELDS	256
+#define DOS_SIZES	8
+
+static size_t dos_size;
+
+struct dos_data {
+	struct hpack		*enc;
+	struct hpack		*dec;
+	struct hpack_field	*fld;
+	struct hpack_field	*tpl;
+	size_t			fld_cnt;
+	uint8_t			*blk;
+	size_t			blk_len;
+	char			*buf;
+	size_t			buf_len;
+	char			*val;
+	unsigned		skp;
+};
+
+/**********************************************************************
+ * Data sets
+ */
+
+static void
+dos_noop_cb(enum hpack_event_e evt, const char *buf, size_t len, void *priv)
+{
+
+	(void)evt;
+	(void)buf;
+	(void)len;
+	(void)priv;
+}
+
+static void
+dos_collect_cb(enum hpack_event_e evt, const char *buf, size_t len,
+    void *priv)
+{
+	struct dos_data *dd;
+
+	if (evt != HPACK_EVT_DATA)
+		return;
+
+	dd = priv;
+	dd->blk = realloc(dd->blk, dd->blk_len + len);
+	if (dd->blk == NULL)
+		WRONG("realloc");
+	(void)memcpy(dd->blk + dd->blk_len, buf, len);
+	dd->blk_len += len;
+}
+
+static struct dos_data *
+dos_data_new(size_t fld_cnt, size_t buf_len)
+{
+	struct dos_data *dd;
+
+	dd = calloc(1, sizeof *dd);
+	if (dd == NULL)
+		WRONG("calloc");
+	dd->fld = calloc(fld_cnt, sizeof *dd->fld);
+	dd->tpl = calloc(fld_cnt, sizeof *dd->tpl);
+	dd->buf = malloc(buf_len);
+	if (dd->fld == NULL || dd->tpl == NULL || dd->buf == NULL)
+		WRONG("malloc");
+	dd->fld_cnt = fld_cnt;
+	dd->buf_len = buf_len;
+	return (dd);
+}
+
+static void
+dos_data_free(void *priv)
+{
+	struct dos_data *dd;
+
+	dd = priv;
+	hpack_free(&dd->enc);
+	hpack_free(&dd->dec);
+	free(dd->fld);
+	free(dd->tpl);
+	free(dd->blk);
+	free(dd->buf);
+	free(dd->val);
+	free(dd);
+}
+
+static void
+dos_encode(struct dos_data *dd, hpack_event_f *cb)
+{
+	struct hpack_encoding he;
+
+	(void)memcpy(dd->fld, dd->tpl, dd->fld_cnt * sizeof *dd->fld);
+	he.fld = dd->fld;
+	he.fld_cnt = dd->fld_cnt;
+	he.buf = dd->buf;
+	he.buf_len = dd->buf_len;
+	he.cb = cb;
+	he.priv = dd;
+	he.cut = 0;
+	if (hpack_encode(dd->enc, &he) != HPACK_RES_OK)
+		WRONG("hpack_encode");
+}
+
+static void
+dos_decode(struct dos_data *dd)
+{
+	struct hpack_decoding hd;
+	enum hpack_result_e res;
+
+	hd.blk = dd->blk;
+	hd.blk_len = dd->blk_len;
+	hd.buf = dd->buf;
+	hd.buf_len = dd->buf_len;
+	hd.cb = dos_noop_cb;
+	hd.priv = NULL;
+	hd.cut = 0;
+	res = hpack_decode(dd->dec, &hd);
+	if (dd->skp && res == HPACK_RES_SKP)
+		res = hpack_skip(dd->dec);
+	if (res != HPACK_RES_OK)
+		WRONG("hpack_decode");
+}
+
+/* Fill both tables with the smallest entries, all with the same name */
+
+static size_t
+dos_fill(struct dos_data *dd)
+{
+	struct dos_data *tmp;
+	size_t n, cnt;
+
+	dd->enc = hpack_encoder(dos_size, -1, hpack_default_alloc);
+	dd->dec = hpack_decoder(dos_size, -1, hpack_default_alloc);
+	if (dd->enc == NULL || dd->dec == NULL)
+		WRONG("hpack_new");
+
+	cnt = dos_size / DOS_ENTRY;
+	tmp = dos_data_new(cnt, 4 * cnt + 4096);
+	for (n = 0; n < cnt; n++) {
+		tmp->tpl[n].flg = HPACK_FLG_TYP_DYN;
+		tmp->tpl[n].nam = "a";
+		tmp->tpl[n].val = "";
+	}
+
+	tmp->enc = dd->enc;
+	tmp->dec = dd->dec;
+	dos_encode(tmp, dos_collect_cb);
+	dos_decode(tmp);
+	tmp->enc = NULL;
+	tmp->dec = NULL;
+	dos_data_free(tmp);
+	return (cnt);
+}
+
+static void
+dos_decode_run(void *priv, struct bch_count *cnt)
+{
+	struct dos_data *dd;
+
+	dd = priv;
+	dos_decode(dd);
+	cnt->itm += dd->fld_cnt;
+	cnt->len += dd->blk_len;
+}
+
+/**********************************************************************
+ * Walk: references to the oldest entry of a full table
+ */
+
+static void *
+dos_walk_new(void)
+{
+	struct dos_data *dd;
+	size_t n, cnt;
+
+	dd = dos_data_new(DOS_FIELDS, 4096);
+	cnt = dos_fill(dd);
+	for (n = 0; n < dd->fld_cnt; n++) {
+		dd->tpl[n].flg = HPACK_FLG_TYP_IDX;
+		dd->tpl[n].idx = DOS_STATIC + cnt;
+	}
+	dos_encode(dd, dos_collect_cb);
+	return (dd);
+}
+
+/**********************************************************************
+ * Churn: insertions evicting the entry they take their name from
+ */
+
+static void *
+dos_churn_new(void)
+{
+	struct dos_data *dd;
+	size_t n, cnt;
+
+	dd = dos_data_new(DOS_FIELDS, 4096);
+	cnt = dos_fill(dd);
+	for (n = 0; n < dd->fld_cnt; n++) {
+		dd->tpl[n].flg = HPACK_FLG_TYP_DYN | HPACK_FLG_NAM_IDX;
+		dd->tpl[n].nam_idx = DOS_STATIC + cnt;
+		dd->tpl[n].val = "";
+	}
+	dos_encode(dd, dos_collect_cb);
+	return (dd);
+}
+
+/**********************************************************************
+ * Search: every entry matches the name but not the value
+ */
+
+static void *
+dos_search_new(void)
+{
+	struct dos_data *dd;
+	size_t n;
+
+	dd = dos_data_new(DOS_FIELDS, 4096);
+	(void)dos_fill(dd);
+	for (n = 0; n < dd->fld_cnt; n++) {
+		dd->tpl[n].flg = HPACK_FLG_TYP_LIT | HPACK_FLG_AUT_IDX;
+		dd->tpl[n].nam = "a";
+		dd->tpl[n].val = "x";
+	}
+	dos_encode(dd, dos_collect_cb);
+	return (dd);
+}
+
+static void
+dos_search_run(void *priv, struct bch_count *cnt)
+{
+	struct dos_data *dd;
+
+	dd = priv;
+	dos_encode(dd, dos_noop_cb);
+	cnt->itm += dd->fld_cnt;
+	cnt->len += dd->blk_len;
+}
+
+/**********************************************************************
+ * Skip: fields barely fitting in the decoding buffer are moved around
+ * until the message is skipped.
+ */
+
+static void *
+dos_skip_new(void)
+{
+	struct dos_data *dd;
+	size_t n, len;
+
+	len = dos_size / 4;
+	dd = dos_data_new(DOS_FIELDS / 4, len + len / 2 + 8);
+	dd->val = malloc(len + 1);
+	if (dd->val == NULL)
+		WRONG("malloc");
+	(void)memset(dd->val, 'x', len);
+	dd->val[len] = '\0';
+	dd->skp = 1;
+
+	dd->enc = hpack_encoder(4096, -1, hpack_default_alloc);
+	dd->dec = hpack_decoder(4096, -1, hpack_default_alloc);
+	if (dd->enc == NULL || dd->dec == NULL)
+		WRONG("hpack_new");
+
+	for (n = 0; n < dd->fld_cnt; n++) {
+		dd->tpl[n].flg = HPACK_FLG_TYP_NVR;
+		dd->tpl[n].nam = "a";
+		dd->tpl[n].val = dd->val;
+	}
+	dos_encode(dd, dos_collect_cb);
+	return (dd);
+}
+
+/**********************************************************************
+ * Main
+ */
+
+static const struct bch_scenario dos_scenarios[] = {
+	{ "walk", "index the oldest entry of a full table",
+	    dos_walk_new, dos_decode_run, dos_data_free },
+	{ "churn", "insert entries named after the evicted one",
+	    dos_churn_new, dos_decode_run, dos_data_free },
+	{ "search", "search names matching every entry",
+	    dos_search_new, dos_search_run, dos_data_free },
+	{ "skip", "decode fields barely fitting in the buffer",
+	    dos_skip_new, dos_decode_run, dos_data_free },
+	{ NULL, NULL, NULL, NULL, NULL }
+};
+
+static const struct bch_column dos_columns[] = {
+	{ "size",	0, 6 },
+	{ "fields",	0, 6 },
+	{ "octets",	0, 8 },
+	{ "ns/fld",	1, 9 },
+	{ "max",	1, 9 },
+	{ "ns/B",	2, 7 },
+	{ "order",	2, 5 },
+};
+
+#define DOS_COLUMNS (sizeof dos_columns / sizeof *dos_columns)
+
+static int
+dos_usage(const char *prg)
+{
+
+	(void)fprintf(stderr,
+	    "Usage: %s [-l] [-s <size>...] [-b <ns>] [-k <order>] [options]"
+	    " [<scenario>...]\n\n"
+	    "  -b <ns>     maximum nanoseconds per field\n"
+	    "  -k <order>  maximum order of growth per field\n"
+	    "  -l          list scenarios and exit\n"
+	    "  -s <size>   table size, can be repeated (default: 4096,\n"
+	    "              16384 and 65535)\n"
+	    BCH_USAGE
+	    "\nScenarios are shell patterns, all of them run by default.\n",
+	    prg);
+	return (EXIT_FAILURE);
+}
+
+static int
+dos_match(const struct bch_scenario *scn, int argc, char * const *argv)
+{
+	int i;
+
+	if (argc == 0)
+		return (1);
+	for (i = 0; i < argc; i++)
+		if (fnmatch(argv[i], scn->nam, 0) == 0)
+			return (1);
+	return (0);
+}
+
+static double
+dos_double(const char *arg)
+{
+	double d;
+	char *end;
+
+	d = strtod(arg, &end);
+	if (*arg == '\0' || *end != '\0' || d <= 0)
+		return (0);
+	return (d);
+}
+
+int
+main(int argc, char **argv)
+{
+	const struct bch_scenario *scn;
+	struct bch_options opt;
+	struct bch_result res;
+	size_t sz[DOS_SIZES], sz_cnt, n;
+	double val[DOS_COLUMNS], bgt, ord, ns0;
+	const char *prg;
+	char *end;
+	int c, lst, cnt, ret;
+
+	BCH_defaults(&opt);
+	prg = *argv;
+	lst = 0;
+	bgt = 0;
+	ord = 0;
+	sz_cnt = 0;
+
+	while ((c = getopt(argc, argv, "b:k:ls:" BCH_OPTIONS)) != -1) {
+		switch (c) {
+		case 'b':
+			bgt = dos_double(optarg);
+			if (bgt == 0)
+				return (dos_usage(prg));
+			break;
+		case 'k':
+			ord = dos_double(optarg);
+			if (ord == 0)
+				return (dos_usage(prg));
+			break;
+		case 'l':
+			lst = 1;
+			break;
+		case 's':
+			if (sz_cnt == DOS_SIZES)
+				return (dos_usage(prg));
+			sz[sz_cnt] = strtoul(optarg, &end, 10);
+			if (*optarg == '\0' || *end != '\0' ||
+			    sz[sz_cnt] < 4 * DOS_ENTRY ||
+			    sz[sz_cnt] > UINT16_MAX)
+				return (dos_usage(prg));
+			sz_cnt++;
+			break;
+		default:
+			if (BCH_option(&opt, c, optarg) != 0)
+				return (dos_usage(prg));
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (lst) {
+		for (scn = dos_scenarios; scn->nam != NULL; scn++)
+			(void)printf("%-16s %s\n", scn->nam, scn->dsc);
+		return (EXIT_SUCCESS);
+	}
+
+	if (sz_cnt == 0) {
+		sz[sz_cnt++] = 4096;
+		sz[sz_cnt++] = 16384;
+		sz[sz_cnt++] = 65535;
+	}
+
+	cnt = 0;
+	ret = EXIT_SUCCESS;
+	for (scn = dos_scenarios; scn->nam != NULL; scn++) {
+		if (!dos_match(scn, argc, argv))
+			continue;
+		if (cnt++ == 0)
+			BCH_header(&opt, dos_columns, DOS_COLUMNS);
+
+		ns0 = 0;
+		for (n = 0; n < sz_cnt; n++) {
+			dos_size = sz[n];
+			BCH_run(&opt, scn, &res);
+
+			val[0] = (double)dos_size;
+			val[1] = (double)res.cnt.itm;
+			val[2] = (double)res.cnt.len;
+			val[3] = res.ns.med;
+			val[4] = res.ns.max;
+			val[5] = res.cnt.len > 0 ? res.ns.med *
+			    (double)res.cnt.itm / (double)res.cnt.len : 0;
+			val[6] = 0;
+			if (n == 0)
+				ns0 = res.ns.med;
+			else if (sz[n] != sz[0] && ns0 > 0)
+				val[6] = log(res.ns.med / ns0) /
+				    log((double)sz[n] / (double)sz[0]);
+			BCH_row(&opt, dos_columns, DOS_COLUMNS, scn->nam,
+			    val);
+
+			if (bgt > 0 && res.ns.max > bgt) {
+				(void)fprintf(stderr, "%s: %.1f ns per field "
+				    "exceeds %.1f at size %zu\n", scn->nam,
+				    res.ns.max, bgt, dos_size);
+				ret = EXIT_FAILURE;
+			}
+			if (ord > 0 && val[6] > ord) {
+				(void)fprintf(stderr, "%s: order %.2f exceeds "
+				    "%.2f at size %zu\n", scn->nam, val[6],
+				    ord, dos_size);
+				ret = EXIT_FAILURE;
+			}
+		}
+	}
+
+	if (cnt == 0) {
+		(void)fprintf(stderr, "No matching scenario\n");
+		return (EXIT_FAILURE);
+	}
+
+	return (ret);
+}
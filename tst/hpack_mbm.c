@@ -2,21 +2,26 @@
  * License: BSD-2-Clause
  * (c) 2017-2020 Dridi Boukelmoune <dridi.boukelmoune@gmail.com>
  *
- * Poor man's micro benchmark.
+ * Micro benchmarks.
+ *
+ * Every scenario runs a calibrated number of iterations per run, after a
+ * number of warmup runs, and reports per-field statistics across runs. When
+ * executed without arguments as part of the test suite, all scenarios run
+ * briefly and the program merely checks that they succeed.
  */
 
-#include <sys/resource.h>
-#include <sys/time.h>
-#include <sys/types.h>
-#include <sys/wait.h>
-
-#include <stdio.h>
+#include <assert.h>
+#include <fnmatch.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "hpack.h"
 
+#include "bch.h"
+
 #define WRONG(str)		\
 	do {			\
 		perror(str);	\
@@ -27,8 +32,6 @@
 #define FIELD_ENTRY(n, v) { HPACK_FLG_TYP_DYN|HPACK_FLG_AUT_IDX, 0, 0, n, v }
 #define FIELD_LOOP(it, tbl) for (it = tbl; it->nam != NULL; it++)
 
-static struct hpack *hp;
-
 static struct hpack_field static_entries[] = {
 #define HPS(i, n, v) { 0, 0, 0, n, v },
 #include "tbl/hpack_static.h"
@@ -83,6 +86,38 @@ static struct hpack_field unknown_entries[] = {
 	FIELD_MARKER
 };
 
+#define STATIC_ENTRIES	(sizeof static_entries / sizeof *static_entries - 1)
+#define DYNAMIC_ENTRIES	(sizeof dynamic_entries / sizeof *dynamic_entries - 1)
+
+
+/**********************************************************************
+ * Data sets
+ */
+
+#define MBM_REQUESTS	32
+#define MBM_BUFSIZE	4096
+
+struct mbm_block {
+	uint8_t	*ptr;
+	size_t	len;
+	size_t	fld_cnt;
+};
+
+struct mbm_data {
+	struct hpack_field	*fld;
+	struct hpack_field	*tpl; /* AUT_IDX fields are modified */
+	size_t			fld_cnt;
+	struct mbm_block	blk[MBM_REQUESTS];
+	size_t			blk_cnt;
+	size_t			blk_len;
+	struct hpack		*enc;
+	struct hpack		*dec;
+	size_t			tbl_sz;
+	size_t			cut;
+	char			str[MBM_REQUESTS][64];
+	char			buf[MBM_BUFSIZE];
+};
+
 static void
 mbm_noop_cb(enum hpack_event_e evt, const char *buf, size_t size, void *priv)
 {
@@ -94,106 +129,545 @@ mbm_noop_cb(enum hpack_event_e evt, const char *buf, size_t size, void *priv)
 }
 
 static void
-mbm_setup(void)
+mbm_collect_cb(enum hpack_event_e evt, const char *buf, size_t size,
+    void *priv)
+{
+	struct mbm_block *blk;
+
+	if (evt != HPACK_EVT_DATA)
+		return;
+
+	blk = priv;
+	blk->ptr = realloc(blk->ptr, blk->len + size);
+	if (blk->ptr == NULL)
+		WRONG("realloc");
+	(void)memcpy(blk->ptr + blk->len, buf, size);
+	blk->len += size;
+}
+
+static struct mbm_data *
+mbm_data_new(size_t fld_cnt, size_t tbl_sz)
+{
+	struct mbm_data *md;
+
+	md = calloc(1, sizeof *md);
+	if (md == NULL)
+		WRONG("calloc");
+	md->fld = calloc(fld_cnt, sizeof *md->fld);
+	md->tpl = calloc(fld_cnt, sizeof *md->tpl);
+	if (md->fld == NULL || md->tpl == NULL)
+		WRONG("calloc");
+	md->fld_cnt = fld_cnt;
+	md->tbl_sz = tbl_sz;
+	md->enc = hpack_encoder(tbl_sz, -1, hpack_default_alloc);
+	if (md->enc == NULL)
+		WRONG("hpack_encoder");
+	md->dec = hpack_decoder(tbl_sz, -1, hpack_default_alloc);
+	if (md->dec == NULL)
+		WRONG("hpack_decoder");
+	return (md);
+}
+
+static void
+mbm_data_free(void *priv)
+{
+	struct mbm_data *md;
+	size_t n;
+
+	md = priv;
+	for (n = 0; n < md->blk_cnt; n++)
+		free(md->blk[n].ptr);
+	hpack_free(&md->enc);
+	hpack_free(&md->dec);
+	free(md->fld);
+	free(md->tpl);
+	free(md);
+}
+
+static void
+mbm_data_encode(struct mbm_data *md, size_t blk_cnt)
+{
+	struct hpack_encoding he;
+	struct mbm_block *blk;
+	size_t n, lst;
+
+	assert(blk_cnt <= MBM_REQUESTS);
+	assert(md->fld_cnt % blk_cnt == 0);
+
+	lst = md->fld_cnt / blk_cnt;
+	(void)memcpy(md->fld, md->tpl, md->fld_cnt * sizeof *md->fld);
+
+	for (n = 0; n < blk_cnt; n++) {
+		blk = &md->blk[n];
+		he.fld = md->fld + n * lst;
+		he.fld_cnt = lst;
+		he.buf = md->buf;
+		he.buf_len = sizeof md->buf;
+		he.cb = mbm_collect_cb;
+		he.priv = blk;
+		he.cut = 0;
+		if (hpack_encode(md->enc, &he) != HPACK_RES_OK)
+			WRONG("hpack_encode");
+		blk->fld_cnt = lst;
+		md->blk_len += blk->len;
+	}
+
+	md->blk_cnt = blk_cnt;
+}
+
+static void
+mbm_data_decode(struct mbm_data *md, struct hpack *dec,
+    struct bch_count *cnt)
+{
+	struct hpack_decoding hd;
+	const struct mbm_block *blk;
+	size_t n, off, len;
+
+	hd.buf = md->buf;
+	hd.buf_len = sizeof md->buf;
+	hd.cb = mbm_noop_cb;
+	hd.priv = NULL;
+
+	for (n = 0; n < md->blk_cnt; n++) {
+		blk = &md->blk[n];
+		len = md->cut > 0 ? md->cut : blk->len;
+		for (off = 0; off < blk->len; off += len) {
+			hd.blk = blk->ptr + off;
+			hd.blk_len = blk->len - off;
+			if (hd.blk_len > len)
+				hd.blk_len = len;
+			hd.cut = off + hd.blk_len < blk->len;
+			if (hpack_decode(dec, &hd) !=
+			    (hd.cut ? HPACK_RES_BLK : HPACK_RES_OK))
+				WRONG("hpack_decode");
+		}
+		cnt->itm += blk->fld_cnt;
+		cnt->len += blk->len;
+	}
+}
+
+/* Scenarios reusing the same codecs between iterations */
+
+static void
+mbm_encode_run(void *priv, struct bch_count *cnt)
+{
+	struct hpack_encoding he;
+	struct mbm_data *md;
+
+	md = priv;
+	he.fld = md->tpl;
+	he.fld_cnt = md->fld_cnt;
+	he.buf = md->buf;
+	he.buf_len = sizeof md->buf;
+	he.cb = mbm_noop_cb;
+	he.priv = NULL;
+	he.cut = 0;
+	if (hpack_encode(md->enc, &he) != HPACK_RES_OK)
+		WRONG("hpack_encode");
+
+	cnt->itm += md->fld_cnt;
+	cnt->len += md->blk_len;
+}
+
+static void
+mbm_decode_run(void *priv, struct bch_count *cnt)
+{
+	struct mbm_data *md;
+
+	md = priv;
+	mbm_data_decode(md, md->dec, cnt);
+}
+
+/**********************************************************************
+ * Connection: similar requests, typical of HTTP/2 browser traffic, with
+ * fresh codecs for every iteration.
+ */
+
+static void *
+mbm_connection_new(void)
+{
+	struct mbm_data *md;
+	struct hpack_field *hf;
+	size_t n;
+
+	md = mbm_data_new(MBM_REQUESTS * (DYNAMIC_ENTRIES + 1), 4096);
+	hf = md->tpl;
+
+	for (n = 0; n < MBM_REQUESTS; n++) {
+		(void)memcpy(hf, dynamic_entries,
+		    DYNAMIC_ENTRIES * sizeof *hf);
+		hf += DYNAMIC_ENTRIES;
+		(void)snprintf(md->str[n], sizeof md->str[n],
+		    "/cashpack/resource/%zu?v=%zu", n, n * 7919 % 1000);
+		hf->flg = HPACK_FLG_TYP_DYN | HPACK_FLG_AUT_IDX |
+		    HPACK_FLG_VAL_HUF;
+		hf->nam = ":path";
+		hf->val = md->str[n];
+		hf++;
+	}
+
+	mbm_data_encode(md, MBM_REQUESTS);
+	return (md);
+}
+
+static void
+mbm_connection_decode(void *priv, struct bch_count *cnt)
+{
+	struct mbm_data *md;
+	struct hpack *dec;
+
+	md = priv;
+	dec = hpack_decoder(md->tbl_sz, -1, hpack_default_alloc);
+	if (dec == NULL)
+		WRONG("hpack_decoder");
+	mbm_data_decode(md, dec, cnt);
+	hpack_free(&dec);
+}
+
+static void
+mbm_connection_encode(void *priv, struct bch_count *cnt)
 {
-	const struct hpack_field *hf;
 	struct hpack_encoding he;
-	char buf[64];
+	struct mbm_data *md;
+	struct hpack *enc;
+	size_t n, lst;
 
-	hp = hpack_encoder(4096, -1, hpack_default_alloc);
-	if (hp == NULL)
+	md = priv;
+	enc = hpack_encoder(md->tbl_sz, -1, hpack_default_alloc);
+	if (enc == NULL)
 		WRONG("hpack_encoder");
 
-	he.fld = dynamic_entries;
-	he.fld_cnt = 0;
-	he.buf = buf;
-	he.buf_len = sizeof buf;
+	(void)memcpy(md->fld, md->tpl, md->fld_cnt * sizeof *md->fld);
+	lst = md->fld_cnt / md->blk_cnt;
+
+	he.buf = md->buf;
+	he.buf_len = sizeof md->buf;
 	he.cb = mbm_noop_cb;
 	he.priv = NULL;
 	he.cut = 0;
-	FIELD_LOOP(hf, dynamic_entries)
-		he.fld_cnt++;
 
-	if (hpack_encode(hp, &he) < 0)
-		WRONG("hpack_encode");
+	for (n = 0; n < md->blk_cnt; n++) {
+		he.fld = md->fld + n * lst;
+		he.fld_cnt = lst;
+		if (hpack_encode(enc, &he) != HPACK_RES_OK)
+			WRONG("hpack_encode");
+	}
+
+	cnt->itm += md->fld_cnt;
+	cnt->len += md->blk_len;
+	hpack_free(&enc);
 }
 
-static int
-mbm_usage(void)
+#define MBM_CUT(n)				\
+static void *					\
+mbm_cut_##n(void)				\
+{						\
+	struct mbm_data *md;			\
+						\
+	md = mbm_connection_new();		\
+	md->cut = n;				\
+	return (md);				\
+}
+
+MBM_CUT(1)
+MBM_CUT(16)
+MBM_CUT(64)
+MBM_CUT(256)
+
+#undef MBM_CUT
+
+/**********************************************************************
+ * Huffman: never-indexed literals with long strings
+ */
+
+static const char *huffman_values[] = {
+	"text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8",
+	"Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox",
+	"session=7a0c5fd1-93be-4a5b-8d1e-3a6f5c2e9b41; theme=dark; lang=en",
+	"max-age=31536000; includeSubDomains; preload; report-uri=/hsts",
+	"W/\"5e15153d-120f\", W/\"5e15153d-1210\", W/\"5e15153d-1211\"",
+	"https://www.example.com/cashpack/search?q=hpack+huffman&page=42",
+	"0123456789abcdef0123456789ABCDEF0123456789abcdef0123456789ABCDEF",
+	"{\"jsonrpc\":\"2.0\",\"method\":\"subtract\",\"params\":[42,23]}",
+};
+
+#define HUFFMAN_VALUES	(sizeof huffman_values / sizeof *huffman_values)
+
+static void *
+mbm_huffman_new(void)
 {
+	struct mbm_data *md;
 	struct hpack_field *hf;
-	struct rusage ru;
-	int status;
-
-	if (wait(&status) == -1)
-		WRONG("wait");
-
-	if (getrusage(RUSAGE_CHILDREN, &ru) == -1)
-		WRONG("rusage");
-
-#ifndef __APPLE__
-#define PRINT_RUSAGE_LONG(fld)	(void)printf(#fld "\t%ld\n", ru.ru_##fld)
-#define PRINT_RUSAGE_TIME(fld) \
-	(void)printf(#fld "\t%ld.%ld\n", \
-	    ru.ru_##fld.tv_sec, ru.ru_##fld.tv_usec)
-	PRINT_RUSAGE_TIME(utime);
-	PRINT_RUSAGE_TIME(stime);
-	PRINT_RUSAGE_LONG(maxrss);
-	PRINT_RUSAGE_LONG(minflt);
-	PRINT_RUSAGE_LONG(majflt);
-	PRINT_RUSAGE_LONG(nvcsw);
-	PRINT_RUSAGE_LONG(nivcsw);
-#undef PRINT_RUSAGE_TIME
-#undef PRINT_RUSAGE_LONG
-#endif
+	size_t n;
+
+	md = mbm_data_new(HUFFMAN_VALUES * 2, 4096);
+	for (n = 0; n < md->fld_cnt; n++) {
+		hf = &md->tpl[n];
+		hf->flg = HPACK_FLG_TYP_NVR | HPACK_FLG_NAM_HUF |
+		    HPACK_FLG_VAL_HUF;
+		hf->nam = n & 1 ? "x-cashpack-huffman-benchmark" :
+		    "content-security-policy-report-only";
+		hf->val = huffman_values[n % HUFFMAN_VALUES];
+	}
+
+	mbm_data_encode(md, 1);
+	return (md);
+}
+
+/**********************************************************************
+ * Integers: indexed fields only, multi-octet indices for the encoder
+ */
+
+#define INTEGER_ENTRIES	200
+
+static void *
+mbm_integer_encode_new(void)
+{
+	struct mbm_data *md;
+	size_t n;
+
+	md = mbm_data_new(INTEGER_ENTRIES, 16384);
+	for (n = 0; n < INTEGER_ENTRIES; n++) {
+		md->tpl[n].flg = HPACK_FLG_TYP_DYN;
+		md->tpl[n].nam = "x-integer";
+		md->tpl[n].val = md->str[n % MBM_REQUESTS];
+		(void)snprintf(md->str[n % MBM_REQUESTS], sizeof *md->str,
+		    "%zu", n % MBM_REQUESTS);
+	}
+	mbm_data_encode(md, 1);
+	free(md->blk->ptr);
+	(void)memset(md->blk, 0, sizeof md->blk);
+	md->blk_len = 0;
+
+	/* NB: the encoder only checks that the index is in the table */
+	for (n = 0; n < INTEGER_ENTRIES; n++) {
+		md->tpl[n].flg = HPACK_FLG_TYP_IDX;
+		md->tpl[n].idx = STATIC_ENTRIES + INTEGER_ENTRIES - n;
+	}
+	mbm_data_encode(md, 1);
+	return (md);
+}
+
+static void *
+mbm_integer_decode_new(void)
+{
+	struct mbm_data *md;
+	size_t n;
+
+	md = mbm_data_new(4 * STATIC_ENTRIES, 4096);
+	for (n = 0; n < md->fld_cnt; n++) {
+		md->tpl[n].flg = HPACK_FLG_TYP_IDX;
+		md->tpl[n].idx = 1 + n % STATIC_ENTRIES;
+	}
+	mbm_data_encode(md, 1);
+	return (md);
+}
+
+/**********************************************************************
+ * Churn: every field inserted in a small table evicts an older one
+ */
+
+static void *
+mbm_churn_new(void)
+{
+	struct mbm_data *md;
+	size_t n;
+
+	md = mbm_data_new(64, 256);
+	for (n = 0; n < MBM_REQUESTS; n++)
+		(void)snprintf(md->str[n], sizeof *md->str,
+		    "churn-%034zu", n * 2654435761U % 1000000007);
+	for (n = 0; n < md->fld_cnt; n++) {
+		md->tpl[n].flg = HPACK_FLG_TYP_DYN;
+		md->tpl[n].nam = "x-churn";
+		md->tpl[n].val = md->str[n % MBM_REQUESTS];
+	}
+	mbm_data_encode(md, 1);
+	return (md);
+}
+
+/**********************************************************************
+ * Search: lookups in a table filled with a typical request
+ */
+
+static void *
+mbm_search_new(void)
+{
+	struct mbm_data *md;
+
+	md = mbm_data_new(DYNAMIC_ENTRIES, 4096);
+	(void)memcpy(md->tpl, dynamic_entries, DYNAMIC_ENTRIES *
+	    sizeof *md->tpl);
+	mbm_data_encode(md, 1);
+	return (md);
+}
+
+static void
+mbm_search_free(void *priv)
+{
+	struct mbm_data *md;
+	size_t n;
+
+	md = priv;
 
 	/* additional coverage */
-	FIELD_LOOP(hf, dynamic_entries)
-		if (hpack_clean_field(hf) < 0)
+	for (n = 0; n < md->fld_cnt; n++)
+		if (hpack_clean_field(&md->fld[n]) < 0)
 			WRONG("hpack_clean_field");
 
-	return (status);
+	mbm_data_free(md);
 }
 
 static void
-mbm_bench(void)
+mbm_search_hit(void *priv, struct bch_count *cnt)
 {
 	const struct hpack_field *hf;
+	struct mbm_data *md;
 	uint16_t idx = 0;
 
+	md = priv;
+
 	FIELD_LOOP(hf, static_entries)
-		if (hpack_search(hp, &idx, hf->nam, hf->val) < 0 || idx == 0)
+		if (hpack_search(md->enc, &idx, hf->nam, hf->val) < 0 ||
+		    idx == 0)
 			WRONG("static_entries");
 
 	FIELD_LOOP(hf, dynamic_entries)
-		if (hpack_search(hp, &idx, hf->nam, hf->val) < 0 || idx == 0)
+		if (hpack_search(md->enc, &idx, hf->nam, hf->val) < 0 ||
+		    idx == 0)
 			WRONG("dynamic_entries");
 
 	FIELD_LOOP(hf, dynamic_entries)
-		if (hpack_search(hp, &idx, hf->nam, NULL) < 0 || idx == 0)
+		if (hpack_search(md->enc, &idx, hf->nam, NULL) < 0 ||
+		    idx == 0)
 			WRONG("dynamic_names");
 
-	FIELD_LOOP(hf, unknown_entries)
-		if (hpack_search(hp, &idx, hf->nam, hf->val) >= 0 || idx != 0)
+	cnt->itm += STATIC_ENTRIES + 2 * DYNAMIC_ENTRIES;
+}
+
+static void
+mbm_search_miss(void *priv, struct bch_count *cnt)
+{
+	const struct hpack_field *hf;
+	struct mbm_data *md;
+	uint16_t idx = 0;
+
+	md = priv;
+
+	FIELD_LOOP(hf, unknown_entries) {
+		if (hpack_search(md->enc, &idx, hf->nam, hf->val) >= 0 ||
+		    idx != 0)
 			WRONG("unknown_entries");
+		cnt->itm++;
+	}
 }
 
-int
-main(void)
+/**********************************************************************
+ * Main
+ */
+
+static const struct bch_scenario mbm_scenarios[] = {
+#define MBM_SCENARIO(nam, dsc, init, run, fini) \
+	{ #nam, dsc, init, run, fini },
+	MBM_SCENARIO(decode, "decode a connection with a fresh decoder",
+	    mbm_connection_new, mbm_connection_decode, mbm_data_free)
+	MBM_SCENARIO(encode, "encode a connection with a fresh encoder",
+	    mbm_connection_new, mbm_connection_encode, mbm_data_free)
+	MBM_SCENARIO(cut_1, "decode a connection one octet at a time",
+	    mbm_cut_1, mbm_connection_decode, mbm_data_free)
+	MBM_SCENARIO(cut_16, "decode a connection in 16-octet chunks",
+	    mbm_cut_16, mbm_connection_decode, mbm_data_free)
+	MBM_SCENARIO(cut_64, "decode a connection in 64-octet chunks",
+	    mbm_cut_64, mbm_connection_decode, mbm_data_free)
+	MBM_SCENARIO(cut_256, "decode a connection in 256-octet chunks",
+	    mbm_cut_256, mbm_connection_decode, mbm_data_free)
+	MBM_SCENARIO(huffman_encode, "encode long Huffman literals",
+	    mbm_huffman_new, mbm_encode_run, mbm_data_free)
+	MBM_SCENARIO(huffman_decode, "decode long Huffman literals",
+	    mbm_huffman_new, mbm_decode_run, mbm_data_free)
+	MBM_SCENARIO(integer_encode, "encode multi-octet indices",
+	    mbm_integer_encode_new, mbm_encode_run, mbm_data_free)
+	MBM_SCENARIO(integer_decode, "decode static table indices",
+	    mbm_integer_decode_new, mbm_decode_run, mbm_data_free)
+	MBM_SCENARIO(churn_encode, "encode insertions and evictions",
+	    mbm_churn_new, mbm_encode_run, mbm_data_free)
+	MBM_SCENARIO(churn_decode, "decode insertions and evictions",
+	    mbm_churn_new, mbm_decode_run, mbm_data_free)
+	MBM_SCENARIO(search_hit, "search existing fields and names",
+	    mbm_search_new, mbm_search_hit, mbm_search_free)
+	MBM_SCENARIO(search_miss, "search unknown fields",
+	    mbm_search_new, mbm_search_miss, mbm_search_free)
+#undef MBM_SCENARIO
+	{ NULL, NULL, NULL, NULL, NULL }
+};
+
+static int
+mbm_usage(const char *prg)
+{
+
+	(void)fprintf(stderr,
+	    "Usage: %s [-l] [options] [<scenario>...]\n\n"
+	    "  -l        list scenarios and exit\n"
+	    BCH_USAGE
+	    "\nScenarios are shell patterns, all of them run by default.\n",
+	    prg);
+	return (EXIT_FAILURE);
+}
+
+static int
+mbm_match(const struct bch_scenario *scn, int argc, char * const *argv)
 {
-	pid_t pid;
 	int i;
 
-	mbm_setup();
+	if (argc == 0)
+		return (1);
+	for (i = 0; i < argc; i++)
+		if (fnmatch(argv[i], scn->nam, 0) == 0)
+			return (1);
+	return (0);
+}
+
+int
+main(int argc, char **argv)
+{
+	const struct bch_scenario *scn;
+	struct bch_options opt;
+	struct bch_result res;
+	int c, lst, cnt;
+
+	BCH_defaults(&opt);
+	lst = 0;
+
+	while ((c = getopt(argc, argv, "l" BCH_OPTIONS)) != -1) {
+		if (c == 'l')
+			lst = 1;
+		else if (BCH_option(&opt, c, optarg) != 0)
+			return (mbm_usage(*argv));
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (lst) {
+		for (scn = mbm_scenarios; scn->nam != NULL; scn++)
+			(void)printf("%-16s %s\n", scn->nam, scn->dsc);
+		return (EXIT_SUCCESS);
+	}
 
-	pid = fork();
-	if (pid == -1)
-		WRONG("fork");
+	cnt = 0;
+	for (scn = mbm_scenarios; scn->nam != NULL; scn++) {
+		if (!mbm_match(scn, argc, argv))
+			continue;
+		if (cnt++ == 0)
+			BCH_result_header(&opt);
+		BCH_run(&opt, scn, &res);
+		BCH_result(&opt, scn->nam, &res);
+	}
 
-	if (pid > 0)
-		return(mbm_usage());
+	if (cnt == 0) {
+		(void)fprintf(stderr, "No matching scenario\n");
+		return (EXIT_FAILURE);
+	}
 
-	for (i = 0; i < 1000000; i++)
-		mbm_bench();
 	return (EXIT_SUCCESS);
 }
@@ -0,0 +1,404 @@
+/*-
+ * License: BSD-2-Clause
+ * (c) 2026 Dridi Boukelmoune <dridi.boukelmoune@gmail.com>
+ *
+ * Memory footprint benchmark.
+ *
+ * Every connection needs an encoder and a decoder, and both allocate their
+ * whole dynamic table up front. This program creates a large number of
+ * connections and reports their cost in bytes per connection: the memory
+ * requested from the allocator, the part of it actually used by dynamic
+ * table entries, the resident set size and the allocator overhead. It does
+ * so for idle connections, and again once a few requests went through them.
+ *
+ * Each measurement runs in a separate process to start from a clean heap.
+ * When executed without arguments as part of the test suite, a thousand
+ * connections are created and the program merely checks that it succeeds.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "hpack.h"
+
+#include "bch.h"
+
+#define WRONG(str)		\
+	do {			\
+		perror(str);	\
+		abort();	\
+	} while (0)
+
+#define MEM_COUNTS	8
+#define MEM_REQUESTS	4
+
+#define FIELD_ENTRY(n, v) { HPACK_FLG_TYP_DYN|HPACK_FLG_AUT_IDX, 0, 0, n, v }
+
+static const struct hpack_field mem_fields[] = {
+	FIELD_ENTRY(":method", "GET"),
+	FIELD_ENTRY(":scheme", "https"),
+	FIELD_ENTRY(":authority", "www.example.com"),
+	FIELD_ENTRY(":path", NULL), /* per request */
+	FIELD_ENTRY("user-agent", "cashpack/" PACKAGE_VERSION),
+	FIELD_ENTRY("accept", "text/html,application/xml;q=0.9,*/*;q=0.8"),
+	FIELD_ENTRY("accept-language", "en-US,en;q=0.5"),
+	FIELD_ENTRY("accept-encoding", "gzip, deflate, br"),
+	FIELD_ENTRY("cookie", NULL), /* per connection */
+	FIELD_ENTRY("cache-control", "no-cache"),
+};
+
+#define MEM_FIELDS	(sizeof mem_fields / sizeof *mem_fields)
+
+static int mem_lazy;
+
+enum mem_state_e {
+	MEM_IDLE,
+	MEM_ACTIVE,
+	MEM_STATES,
+};
+
+struct mem_conn {
+	struct hpack	*enc;
+	struct hpack	*dec;
+};
+
+struct mem_result {
+	size_t	alc[MEM_STATES]; /* requested from the allocator */
+	size_t	use[MEM_STATES]; /* used by dynamic table entries */
+	size_t	rss[MEM_STATES];
+	size_t	cnt[MEM_STATES]; /* allocations */
+};
+
+struct mem_block {
+	uint8_t		buf[4096];
+	size_t		len;
+};
+
+/**********************************************************************
+ * Connections
+ */
+
+static size_t
+mem_rss(void)
+{
+	struct rusage ru;
+	unsigned long sz, res;
+	FILE *f;
+	long pg;
+	int n;
+
+	f = fopen("/proc/self/statm", "r");
+	if (f != NULL) {
+		n = fscanf(f, "%lu %lu", &sz, &res);
+		(void)fclose(f);
+		pg = sysconf(_SC_PAGESIZE);
+		if (n == 2 && pg > 0)
+			return (res * (unsigned long)pg);
+	}
+
+	/* NB: the peak is good enough since a measurement only grows */
+	if (getrusage(RUSAGE_SELF, &ru) != 0)
+		WRONG("getrusage");
+	return ((size_t)ru.ru_maxrss * 1024);
+}
+
+static void
+mem_noop_cb(enum hpack_event_e evt, const char *buf, size_t len, void *priv)
+{
+
+	(void)evt;
+	(void)buf;
+	(void)len;
+	(void)priv;
+}
+
+static void
+mem_collect_cb(enum hpack_event_e evt, const char *buf, size_t len,
+    void *priv)
+{
+	struct mem_block *blk;
+
+	if (evt != HPACK_EVT_DATA)
+		return;
+
+	blk = priv;
+	assert(blk->len + len <= sizeof blk->buf);
+	(void)memcpy(blk->buf + blk->len, buf, len);
+	blk->len += len;
+}
+
+static void
+mem_count_cb(enum hpack_event_e evt, const char *buf, size_t len, void *priv)
+{
+	size_t *cnt;
+
+	(void)buf;
+	cnt = priv;
+	if (evt == HPACK_EVT_FIELD)
+		*cnt += len;
+}
+
+static void
+mem_activate(struct mem_conn *conn, size_t id)
+{
+	struct hpack_field fld[MEM_FIELDS];
+	struct hpack_encoding he;
+	struct hpack_decoding hd;
+	struct mem_block blk;
+	char path[32], cookie[32], buf[4096];
+	unsigned r;
+
+	(void)snprintf(cookie, sizeof cookie, "session=%zu", id);
+
+	for (r = 0; r < MEM_REQUESTS; r++) {
+		(void)snprintf(path, sizeof path, "/resource/%zu/%u", id, r);
+		(void)memcpy(fld, mem_fields, sizeof fld);
+		fld[3].val = path;
+		fld[8].val = cookie;
+		blk.len = 0;
+
+		he.fld = fld;
+		he.fld_cnt = MEM_FIELDS;
+		he.buf = buf;
+		he.buf_len = sizeof buf;
+		he.cb = mem_collect_cb;
+		he.priv = &blk;
+		he.cut = 0;
+		if (hpack_encode(conn->enc, &he) != HPACK_RES_OK)
+			WRONG("hpack_encode");
+
+		hd.blk = blk.buf;
+		hd.blk_len = blk.len;
+		hd.buf = buf;
+		hd.buf_len = sizeof buf;
+		hd.cb = mem_noop_cb;
+		hd.priv = NULL;
+		hd.cut = 0;
+		if (hpack_decode(conn->dec, &hd) != HPACK_RES_OK)
+			WRONG("hpack_decode");
+	}
+}
+
+static size_t
+mem_used(const struct mem_conn *conn, size_t conn_cnt)
+{
+	size_t n, len;
+
+	len = 0;
+	for (n = 0; n < conn_cnt; n++) {
+		if (hpack_dynamic(conn[n].enc, mem_count_cb, &len) !=
+		    HPACK_RES_OK ||
+		    hpack_dynamic(conn[n].dec, mem_count_cb, &len) !=
+		    HPACK_RES_OK)
+			WRONG("hpack_dynamic");
+	}
+	return (len);
+}
+
+/* NB: called in a child process, the parent only reads the results */
+
+static void
+mem_measure(size_t conn_cnt, size_t tbl_sz, int count,
+    struct mem_result *res)
+{
+	const struct hpack_alloc *alc;
+	struct bch_memory bm;
+	struct mem_conn *conn;
+	size_t n, rss;
+	int st;
+
+	BCH_memory_init(&bm);
+	alc = count ? &bm.alc : hpack_default_alloc;
+
+	conn = calloc(conn_cnt, sizeof *conn);
+	if (conn == NULL)
+		WRONG("calloc");
+
+	/* NB: fault the connections array in before the baseline */
+	(void)memset(conn, 0, conn_cnt * sizeof *conn);
+	rss = mem_rss();
+
+	for (n = 0; n < conn_cnt; n++) {
+		conn[n].enc = hpack_encoder(tbl_sz, -1, alc);
+		if (mem_lazy)
+			conn[n].dec = hpack_decoder_lazy(tbl_sz, -1, alc);
+		else
+			conn[n].dec = hpack_decoder(tbl_sz, -1, alc);
+		if (conn[n].enc == NULL || conn[n].dec == NULL)
+			WRONG("hpack_new");
+	}
+
+	for (st = MEM_IDLE; st < MEM_STATES; st++) {
+		if (st == MEM_ACTIVE)
+			for (n = 0; n < conn_cnt; n++)
+				mem_activate(&conn[n], n);
+		res->alc[st] = bm.cur;
+		res->cnt[st] = bm.cnt;
+		res->use[st] = mem_used(conn, conn_cnt);
+		res->rss[st] = mem_rss() - rss;
+	}
+
+	for (n = 0; n < conn_cnt; n++) {
+		hpack_free(&conn[n].enc);
+		hpack_free(&conn[n].dec);
+	}
+	free(conn);
+}
+
+static void
+mem_fork(size_t conn_cnt, size_t tbl_sz, int count, struct mem_result *res)
+{
+	ssize_t len;
+	pid_t pid;
+	int fd[2], st;
+
+	if (pipe(fd) != 0)
+		WRONG("pipe");
+
+	pid = fork();
+	if (pid < 0)
+		WRONG("fork");
+
+	if (pid == 0) {
+		(void)close(fd[0]);
+		(void)memset(res, 0, sizeof *res);
+		mem_measure(conn_cnt, tbl_sz, count, res);
+		len = write(fd[1], res, sizeof *res);
+		_exit(len == (ssize_t)sizeof *res ?
+		    EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	(void)close(fd[1]);
+	len = read(fd[0], res, sizeof *res);
+	(void)close(fd[0]);
+
+	if (waitpid(pid, &st, 0) != pid)
+		WRONG("waitpid");
+	if (!WIFEXITED(st) || WEXITSTATUS(st) != EXIT_SUCCESS ||
+	    len != (ssize_t)sizeof *res) {
+		(void)fprintf(stderr, "measurement of %zu connections failed\n",
+		    conn_cnt);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**********************************************************************
+ * Main
+ */
+
+static const struct bch_column mem_columns[] = {
+	{ "conns",	0, 8 },
+	{ "tbl_sz",	0, 6 },
+	{ "alloc",	0, 7 },
+	{ "used",	0, 7 },
+	{ "rss",	0, 7 },
+	{ "overhead",	0, 8 },
+	{ "allocs",	1, 6 },
+	{ "rss_MiB",	1, 9 },
+};
+
+#define MEM_COLUMNS (sizeof mem_columns / sizeof *mem_columns)
+
+static const char * const mem_states[MEM_STATES] = {
+	[MEM_IDLE] = "idle",
+	[MEM_ACTIVE] = "active",
+};
+
+static int
+mem_usage(const char *prg)
+{
+
+	(void)fprintf(stderr,
+	    "Usage: %s [-l] [-n <connections>...] [-s <size>] [-f <format>]\n\n"
+	    "  -l        use lazy decoders\n"
+	    "  -n <n>    number of connections, can be repeated\n"
+	    "            (default: 1000)\n"
+	    "  -s <n>    dynamic table size (default: 4096)\n"
+	    "  -f <fmt>  output format: txt, tsv or json (default: txt)\n"
+	    "\nSizes are reported in bytes per connection, an encoder and\n"
+	    "a decoder, except for the total resident set size.\n",
+	    prg);
+	return (EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct bch_options opt;
+	struct mem_result alc, rss;
+	size_t conn[MEM_COUNTS], conn_cnt, tbl_sz, n;
+	double val[MEM_COLUMNS];
+	unsigned long ul;
+	const char *prg;
+	char *end;
+	int c, st;
+
+	BCH_defaults(&opt);
+	prg = *argv;
+	conn_cnt = 0;
+	tbl_sz = 4096;
+
+	while ((c = getopt(argc, argv, "f:ln:s:")) != -1) {
+		switch (c) {
+		case 'l':
+			mem_lazy = 1;
+			break;
+		case 'n':
+			ul = strtoul(optarg, &end, 10);
+			if (*optarg == '\0' || *end != '\0' || ul == 0 ||
+			    ul > 100000000 || conn_cnt == MEM_COUNTS)
+				return (mem_usage(prg));
+			conn[conn_cnt++] = ul;
+			break;
+		case 's':
+			ul = strtoul(optarg, &end, 10);
+			if (*optarg == '\0' || *end != '\0' ||
+			    ul > UINT16_MAX)
+				return (mem_usage(prg));
+			tbl_sz = ul;
+			break;
+		case 'f':
+			if (BCH_option(&opt, c, optarg) != 0)
+				return (mem_usage(prg));
+			break;
+		default:
+			return (mem_usage(prg));
+		}
+	}
+
+	if (optind != argc)
+		return (mem_usage(prg));
+
+	if (conn_cnt == 0)
+		conn[conn_cnt++] = 1000;
+
+	BCH_header(&opt, mem_columns, MEM_COLUMNS);
+
+	for (n = 0; n < conn_cnt; n++) {
+		mem_fork(conn[n], tbl_sz, 1, &alc);
+		mem_fork(conn[n], tbl_sz, 0, &rss);
+
+		for (st = MEM_IDLE; st < MEM_STATES; st++) {
+			val[0] = (double)conn[n];
+			val[1] = (double)tbl_sz;
+			val[2] = (double)alc.alc[st] / conn[n];
+			val[3] = (double)alc.use[st] / conn[n];
+			val[4] = (double)rss.rss[st] / conn[n];
+			val[5] = val[4] - val[2];
+			val[6] = (double)alc.cnt[st] / conn[n];
+			val[7] = rss.rss[st] / 1048576.0;
+			BCH_row(&opt, mem_columns, MEM_COLUMNS, mem_states[st],
+			    val);
+		}
+	}
+
+	return (EXIT_SUCCESS);
+}
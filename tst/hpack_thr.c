@@ -0,0 +1,450 @@
+/*-
+ * License: BSD-2-Clause
+ * (c) 2026 Dridi Boukelmoune <dridi.boukelmoune@gmail.com>
+ *
+ * Multi-core scaling benchmark.
+ *
+ * Every thread owns a number of encoder and decoder pairs, one per
+ * simulated connection, and drives encode-to-decode round trips through
+ * them in a round-robin fashion. Throughput is measured for an increasing
+ * number of threads and codecs per thread, and compared to a single thread
+ * to expose allocator contention, false sharing or cache footprint cliffs.
+ * When executed without arguments as part of the test suite, a couple of
+ * threads run briefly and the program merely checks that they succeed.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hpack.h"
+
+#include "bch.h"
+
+#define WRONG(str)		\
+	do {			\
+		perror(str);	\
+		abort();	\
+	} while (0)
+
+#define PTOK(call)				\
+	do {					\
+		if ((call) != 0)		\
+			WRONG(#call);		\
+	} while (0)
+
+#define THR_REQUESTS	8
+#define THR_CODECS	8
+#define THR_BATCH	16
+
+#define FIELD_ENTRY(n, v) { HPACK_FLG_TYP_DYN|HPACK_FLG_AUT_IDX, 0, 0, n, v }
+
+static const struct hpack_field thr_fields[] = {
+	FIELD_ENTRY(":method", "GET"),
+	FIELD_ENTRY(":scheme", "https"),
+	FIELD_ENTRY(":authority", "www.example.com"),
+	FIELD_ENTRY(":path", NULL), /* per request */
+	FIELD_ENTRY("user-agent", "cashpack/" PACKAGE_VERSION),
+	FIELD_ENTRY("accept", "text/html,application/xml;q=0.9,*/*;q=0.8"),
+	FIELD_ENTRY("accept-language", "en-US,en;q=0.5"),
+	FIELD_ENTRY("accept-encoding", "gzip, deflate, br"),
+	FIELD_ENTRY("cookie", "session=7a0c5fd1-93be-4a5b-8d1e-3a6f5c2e9b41"),
+	FIELD_ENTRY("cache-control", "no-cache"),
+};
+
+#define THR_FIELDS	(sizeof thr_fields / sizeof *thr_fields)
+
+static int thr_pool;
+static int thr_reset;
+
+struct thr_shared {
+	pthread_mutex_t	mtx;
+	pthread_cond_t	cnd;
+	unsigned	rdy;
+	unsigned	go;
+	uint64_t	ddl;
+	size_t		cdc_cnt;
+	unsigned	rqs; /* round trips per connection */
+};
+
+struct thr_pair {
+	struct hpack	*enc;
+	struct hpack	*dec;
+	unsigned	rqs;
+};
+
+struct thr_worker {
+	pthread_t		thr;
+	struct thr_shared	*shr;
+	unsigned		id;
+	struct hpack_pool	*pool;
+	const struct hpack_alloc *alc;
+	uint64_t		fld;
+	uint64_t		ns;
+	struct thr_pair		*pair;
+	struct hpack_field	fld_tpl[THR_REQUESTS][THR_FIELDS];
+	struct hpack_field	fld_tmp[THR_FIELDS];
+	char			path[THR_REQUESTS][32];
+	uint8_t			blk[4096];
+	size_t			blk_len;
+	char			buf[4096];
+};
+
+/**********************************************************************
+ * Round trips
+ */
+
+static void
+thr_noop_cb(enum hpack_event_e evt, const char *buf, size_t len, void *priv)
+{
+
+	(void)evt;
+	(void)buf;
+	(void)len;
+	(void)priv;
+}
+
+static void
+thr_collect_cb(enum hpack_event_e evt, const char *buf, size_t len,
+    void *priv)
+{
+	struct thr_worker *wrk;
+
+	if (evt != HPACK_EVT_DATA)
+		return;
+
+	wrk = priv;
+	assert(wrk->blk_len + len <= sizeof wrk->blk);
+	(void)memcpy(wrk->blk + wrk->blk_len, buf, len);
+	wrk->blk_len += len;
+}
+
+static void
+thr_pair_init(struct thr_pair *pair, const struct hpack_alloc *alc)
+{
+
+	pair->enc = hpack_encoder(4096, -1, alc);
+	pair->dec = hpack_decoder(4096, -1, alc);
+	if (pair->enc == NULL || pair->dec == NULL)
+		WRONG("hpack_new");
+	pair->rqs = 0;
+}
+
+static void
+thr_pair_fini(struct thr_pair *pair)
+{
+
+	hpack_free(&pair->enc);
+	hpack_free(&pair->dec);
+}
+
+static void
+thr_round_trip(struct thr_worker *wrk, struct thr_pair *pair, unsigned req)
+{
+	struct hpack_encoding he;
+	struct hpack_decoding hd;
+
+	(void)memcpy(wrk->fld_tmp, wrk->fld_tpl[req], sizeof wrk->fld_tmp);
+	wrk->blk_len = 0;
+
+	he.fld = wrk->fld_tmp;
+	he.fld_cnt = THR_FIELDS;
+	he.buf = wrk->buf;
+	he.buf_len = sizeof wrk->buf;
+	he.cb = thr_collect_cb;
+	he.priv = wrk;
+	he.cut = 0;
+	if (hpack_encode(pair->enc, &he) != HPACK_RES_OK)
+		WRONG("hpack_encode");
+
+	hd.blk = wrk->blk;
+	hd.blk_len = wrk->blk_len;
+	hd.buf = wrk->buf;
+	hd.buf_len = sizeof wrk->buf;
+	hd.cb = thr_noop_cb;
+	hd.priv = NULL;
+	hd.cut = 0;
+	if (hpack_decode(pair->dec, &hd) != HPACK_RES_OK)
+		WRONG("hpack_decode");
+
+	/* NB: connection churn, when enabled, goes through the allocator */
+	if (wrk->shr->rqs > 0 && ++pair->rqs == wrk->shr->rqs) {
+		if (thr_reset) {
+			if (hpack_reset(&pair->enc, 4096) != HPACK_RES_OK ||
+			    hpack_reset(&pair->dec, 4096) != HPACK_RES_OK)
+				WRONG("hpack_reset");
+			pair->rqs = 0;
+			return;
+		}
+		thr_pair_fini(pair);
+		thr_pair_init(pair, wrk->alc);
+	}
+}
+
+static void *
+thr_work(void *priv)
+{
+	struct thr_worker *wrk;
+	struct thr_shared *shr;
+	uint64_t fld, t0, t1;
+	size_t n, cdc;
+	unsigned r, b;
+
+	wrk = priv;
+	shr = wrk->shr;
+
+	for (r = 0; r < THR_REQUESTS; r++) {
+		(void)snprintf(wrk->path[r], sizeof wrk->path[r],
+		    "/thread/%u/resource/%u", wrk->id, r);
+		(void)memcpy(wrk->fld_tpl[r], thr_fields, sizeof thr_fields);
+		wrk->fld_tpl[r][3].val = wrk->path[r];
+	}
+
+	/* NB: one pool per thread, pools are not thread-safe */
+	wrk->alc = hpack_default_alloc;
+	if (thr_pool) {
+		wrk->pool = hpack_pool_new(hpack_default_alloc, 0);
+		if (wrk->pool == NULL)
+			WRONG("hpack_pool_new");
+		wrk->alc = hpack_pool_alloc(wrk->pool);
+	}
+
+	wrk->pair = calloc(shr->cdc_cnt, sizeof *wrk->pair);
+	if (wrk->pair == NULL)
+		WRONG("calloc");
+	for (n = 0; n < shr->cdc_cnt; n++)
+		thr_pair_init(&wrk->pair[n], wrk->alc);
+
+	PTOK(pthread_mutex_lock(&shr->mtx));
+	shr->rdy++;
+	PTOK(pthread_cond_broadcast(&shr->cnd));
+	while (!shr->go)
+		PTOK(pthread_cond_wait(&shr->cnd, &shr->mtx));
+	PTOK(pthread_mutex_unlock(&shr->mtx));
+
+	fld = 0;
+	cdc = 0;
+	r = 0;
+	t0 = BCH_now();
+	do {
+		for (b = 0; b < THR_BATCH; b++) {
+			thr_round_trip(wrk, &wrk->pair[cdc], r);
+			if (++cdc == shr->cdc_cnt) {
+				cdc = 0;
+				r = (r + 1) % THR_REQUESTS;
+			}
+		}
+		fld += THR_BATCH * THR_FIELDS;
+		t1 = BCH_now();
+	} while (t1 < shr->ddl);
+
+	wrk->fld = fld;
+	wrk->ns = t1 - t0;
+
+	for (n = 0; n < shr->cdc_cnt; n++)
+		thr_pair_fini(&wrk->pair[n]);
+	free(wrk->pair);
+	hpack_pool_free(&wrk->pool);
+	return (NULL);
+}
+
+/* Returns the throughput in fields per second */
+
+static double
+thr_run(const struct bch_options *opt, unsigned thr_cnt, size_t cdc_cnt,
+    unsigned rqs)
+{
+	struct thr_shared shr;
+	struct thr_worker *wrk;
+	double fps;
+	unsigned u;
+
+	(void)memset(&shr, 0, sizeof shr);
+	PTOK(pthread_mutex_init(&shr.mtx, NULL));
+	PTOK(pthread_cond_init(&shr.cnd, NULL));
+	shr.cdc_cnt = cdc_cnt;
+	shr.rqs = rqs;
+
+	/* NB: workers are allocated separately to avoid false sharing */
+	wrk = calloc(thr_cnt, sizeof *wrk);
+	if (wrk == NULL)
+		WRONG("calloc");
+
+	for (u = 0; u < thr_cnt; u++) {
+		wrk[u].shr = &shr;
+		wrk[u].id = u;
+		PTOK(pthread_create(&wrk[u].thr, NULL, thr_work, &wrk[u]));
+	}
+
+	PTOK(pthread_mutex_lock(&shr.mtx));
+	while (shr.rdy < thr_cnt)
+		PTOK(pthread_cond_wait(&shr.cnd, &shr.mtx));
+	shr.ddl = BCH_now() + (uint64_t)opt->tgt * 1000000;
+	shr.go = 1;
+	PTOK(pthread_cond_broadcast(&shr.cnd));
+	PTOK(pthread_mutex_unlock(&shr.mtx));
+
+	fps = 0;
+	for (u = 0; u < thr_cnt; u++) {
+		PTOK(pthread_join(wrk[u].thr, NULL));
+		fps += (double)wrk[u].fld * 1e9 / (double)wrk[u].ns;
+	}
+
+	free(wrk);
+	PTOK(pthread_cond_destroy(&shr.cnd));
+	PTOK(pthread_mutex_destroy(&shr.mtx));
+	return (fps);
+}
+
+/**********************************************************************
+ * Main
+ */
+
+static const struct bch_column thr_columns[] = {
+	{ "threads",	0, 7 },
+	{ "codecs",	0, 7 },
+	{ "Mfld/s",	2, 8 },
+	{ "min",	2, 8 },
+	{ "max",	2, 8 },
+	{ "per_thr",	2, 8 },
+	{ "speedup",	2, 7 },
+	{ "effic",	2, 5 },
+};
+
+#define THR_COLUMNS (sizeof thr_columns / sizeof *thr_columns)
+
+static int
+thr_usage(const char *prg)
+{
+
+	(void)fprintf(stderr,
+	    "Usage: %s [-c <codecs>...] [-j <threads>] [-q <requests>] [-P|-R] "
+	    "[options]\n\n"
+	    "  -c <n>    codec pairs per thread, can be repeated (default: 1\n"
+	    "            and 16)\n"
+	    "  -j <n>    maximum number of threads, 0 for the number of\n"
+	    "            online processors (default: 2)\n"
+	    "  -q <n>    requests per connection before the codecs are\n"
+	    "            replaced, 0 to never replace them (default: 0)\n"
+	    "  -P        allocate codecs from a pool per thread\n"
+	    "  -R        reset codecs instead of replacing them\n"
+	    BCH_USAGE,
+	    prg);
+	return (EXIT_FAILURE);
+}
+
+static unsigned long
+thr_number(const char *arg, unsigned long max)
+{
+	unsigned long ul;
+	char *end;
+
+	ul = strtoul(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || ul > max)
+		return (ULONG_MAX);
+	return (ul);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct bch_options opt;
+	struct bch_stats st;
+	size_t cdc[THR_CODECS], cdc_cnt, n;
+	double val[THR_COLUMNS], smp[1000], ref;
+	unsigned long ul;
+	unsigned thr, thr_max, rqs, u;
+	const char *prg;
+	long ncpu;
+	int c;
+
+	BCH_defaults(&opt);
+	prg = *argv;
+	cdc_cnt = 0;
+	thr_max = 2;
+	rqs = 0;
+
+	while ((c = getopt(argc, argv, "c:j:q:PR" BCH_OPTIONS)) != -1) {
+		switch (c) {
+		case 'c':
+			ul = thr_number(optarg, 1000000);
+			if (ul == 0 || ul == ULONG_MAX ||
+			    cdc_cnt == THR_CODECS)
+				return (thr_usage(prg));
+			cdc[cdc_cnt++] = ul;
+			break;
+		case 'j':
+			ul = thr_number(optarg, 1024);
+			if (ul == ULONG_MAX)
+				return (thr_usage(prg));
+			thr_max = (unsigned)ul;
+			break;
+		case 'q':
+			ul = thr_number(optarg, UINT_MAX);
+			if (ul == ULONG_MAX)
+				return (thr_usage(prg));
+			rqs = (unsigned)ul;
+			break;
+		case 'P':
+			thr_pool = 1;
+			break;
+		case 'R':
+			thr_reset = 1;
+			break;
+		default:
+			if (BCH_option(&opt, c, optarg) != 0)
+				return (thr_usage(prg));
+		}
+	}
+
+	if (optind != argc)
+		return (thr_usage(prg));
+
+	if (thr_max == 0) {
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		thr_max = ncpu > 0 ? (unsigned)ncpu : 1;
+	}
+
+	if (cdc_cnt == 0) {
+		cdc[cdc_cnt++] = 1;
+		cdc[cdc_cnt++] = 16;
+	}
+
+	assert(opt.runs <= sizeof smp / sizeof *smp);
+	BCH_header(&opt, thr_columns, THR_COLUMNS);
+
+	for (n = 0; n < cdc_cnt; n++) {
+		ref = 0;
+		for (thr = 1; ; thr = thr * 2 < thr_max ? thr * 2 : thr_max) {
+			for (u = 0; u < opt.wrm; u++)
+				(void)thr_run(&opt, thr, cdc[n], rqs);
+			for (u = 0; u < opt.runs; u++)
+				smp[u] = thr_run(&opt, thr, cdc[n], rqs);
+			BCH_stats(smp, opt.runs, &st);
+
+			if (thr == 1)
+				ref = st.med;
+
+			val[0] = thr;
+			val[1] = (double)cdc[n];
+			val[2] = st.med / 1e6;
+			val[3] = st.min / 1e6;
+			val[4] = st.max / 1e6;
+			val[5] = st.med / 1e6 / thr;
+			val[6] = ref > 0 ? st.med / ref : 0;
+			val[7] = val[6] / thr;
+			BCH_row(&opt, thr_columns, THR_COLUMNS, "round_trip",
+			    val);
+
+			if (thr == thr_max)
+				break;
+		}
+	}
+
+	return (EXIT_SUCCESS);
+}
@@ -0,0 +1,386 @@
+/*-
+ * License: BSD-2-Clause
+ * (c) 2026 Dridi Boukelmoune <dridi.boukelmoune@gmail.com>
+ *
+ * Encode header traces with every combination of indexing strategy, string
+ * coding and dynamic table size to compare compression ratios.
+ *
+ * Indexing strategies:
+ *
+ *     literal  literals only, with static table references
+ *     always   every field inserted, without searching the table
+ *     aut_idx  fields searched, and inserted when missing
+ *
+ * String coding is either off, on (Huffman) or auto. The auto coding picks
+ * the shorter of the two for each name and value before encoding, so its
+ * cost is not part of the measured encoding time.
+ *
+ * Traces are read like hreplay does.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hpack.h"
+
+#include "bch.h"
+#include "trc.h"
+
+#define RTO_SIZES	8
+
+enum rto_coding_e {
+	RTO_HUF_OFF,
+	RTO_HUF_ON,
+	RTO_HUF_AUTO,
+};
+
+struct rto_indexing {
+	const char	*nam;
+	unsigned	flg;
+};
+
+static const struct rto_indexing rto_indexings[] = {
+	{ "literal",	HPACK_FLG_TYP_LIT | HPACK_FLG_AUT_IDX },
+	{ "always",	HPACK_FLG_TYP_DYN },
+	{ "aut_idx",	HPACK_FLG_TYP_DYN | HPACK_FLG_AUT_IDX },
+	{ NULL,		0 }
+};
+
+static const char * const rto_codings[] = { "off", "on", "auto", NULL };
+
+struct rto_stats {
+	size_t	wire;
+	size_t	ins; /* insertions */
+	size_t	evi; /* evictions */
+};
+
+struct rto_corpus {
+	struct trc_corpus		trc[1];
+	size_t				tbl_sz[RTO_SIZES];
+	unsigned			tbl_cnt;
+	const struct rto_indexing	*idx;
+	enum rto_coding_e		huf;
+	size_t				tbl;
+	struct hpack_field		*fld; /* scratch copy for the encoder */
+	uint8_t				*buf;
+	size_t				buf_len;
+};
+
+static struct rto_corpus rto[1];
+
+/**********************************************************************
+ * Encoding
+ */
+
+static void
+rto_stats_cb(enum hpack_event_e evt, const char *buf, size_t len, void *priv)
+{
+	struct rto_stats *st;
+
+	(void)buf;
+	st = priv;
+	if (evt == HPACK_EVT_DATA)
+		st->wire += len;
+	else if (evt == HPACK_EVT_INDEX)
+		st->ins++;
+	else if (evt == HPACK_EVT_EVICT)
+		st->evi += len;
+}
+
+static unsigned
+rto_field_flags(const struct trc_list *lst, size_t f)
+{
+	const unsigned *huf;
+	unsigned flg;
+
+	flg = rto->idx->flg;
+	switch (rto->huf) {
+	case RTO_HUF_OFF:
+		break;
+	case RTO_HUF_ON:
+		flg |= HPACK_FLG_NAM_HUF | HPACK_FLG_VAL_HUF;
+		break;
+	case RTO_HUF_AUTO:
+		huf = lst->priv;
+		flg |= huf[f];
+		break;
+	default:
+		abort();
+	}
+	return (flg);
+}
+
+static void
+rto_encode_list(struct hpack *hp, const struct trc_list *lst,
+    struct rto_stats *st)
+{
+	struct hpack_encoding he;
+	enum hpack_result_e res;
+	size_t f;
+
+	for (f = 0; f < lst->fld_cnt; f++) {
+		rto->fld[f] = lst->fld[f];
+		rto->fld[f].flg = rto_field_flags(lst, f);
+	}
+
+	he.fld = rto->fld;
+	he.fld_cnt = lst->fld_cnt;
+	he.buf = rto->buf;
+	he.buf_len = rto->buf_len;
+	he.cb = rto_stats_cb;
+	he.priv = st;
+	he.cut = 0;
+
+	res = hpack_encode(hp, &he);
+	if (res != HPACK_RES_OK)
+		FAIL("hpack_encode: %s", hpack_strerror(res));
+}
+
+static void
+rto_encode(struct rto_stats *st)
+{
+	const struct trc_conn *conn;
+	struct hpack *hp;
+	size_t c, l;
+
+	for (c = 0; c < rto->trc->conn_cnt; c++) {
+		conn = &rto->trc->conn[c];
+		hp = hpack_encoder(rto->tbl, -1, hpack_default_alloc);
+		if (hp == NULL)
+			WRONG("hpack_encoder");
+		for (l = 0; l < conn->lst_cnt; l++)
+			rto_encode_list(hp, &conn->lst[l], st);
+		hpack_free(&hp);
+	}
+}
+
+static void
+rto_run(void *priv, struct bch_count *cnt)
+{
+	struct rto_stats st;
+
+	(void)priv;
+	(void)memset(&st, 0, sizeof st);
+	rto_encode(&st);
+	cnt->itm += rto->trc->lst_cnt;
+	cnt->len += st.wire;
+}
+
+/**********************************************************************
+ * Auto coding
+ */
+
+static size_t
+rto_literal_size(struct hpack *hp, const struct hpack_field *hf, unsigned huf)
+{
+	struct rto_stats st;
+	struct hpack_field fld;
+	struct hpack_encoding he;
+	enum hpack_result_e res;
+
+	fld = *hf;
+	fld.flg = HPACK_FLG_TYP_LIT | huf;
+
+	(void)memset(&st, 0, sizeof st);
+	he.fld = &fld;
+	he.fld_cnt = 1;
+	he.buf = rto->buf;
+	he.buf_len = rto->buf_len;
+	he.cb = rto_stats_cb;
+	he.priv = &st;
+	he.cut = 0;
+
+	res = hpack_encode(hp, &he);
+	if (res != HPACK_RES_OK)
+		FAIL("hpack_encode: %s", hpack_strerror(res));
+	return (st.wire);
+}
+
+static void
+rto_auto_init(void)
+{
+	struct trc_conn *conn;
+	struct trc_list *lst;
+	struct hpack *hp;
+	unsigned *huf;
+	size_t c, l, f, len;
+
+	/* NB: literals without indexing leave the table empty */
+	hp = hpack_encoder(0, -1, hpack_default_alloc);
+	if (hp == NULL)
+		WRONG("hpack_encoder");
+
+	for (c = 0; c < rto->trc->conn_cnt; c++) {
+		conn = &rto->trc->conn[c];
+		for (l = 0; l < conn->lst_cnt; l++) {
+			lst = &conn->lst[l];
+			huf = calloc(lst->fld_cnt, sizeof *huf);
+			if (huf == NULL)
+				WRONG("calloc");
+			for (f = 0; f < lst->fld_cnt; f++) {
+				len = rto_literal_size(hp, &lst->fld[f], 0);
+				if (rto_literal_size(hp, &lst->fld[f],
+				    HPACK_FLG_NAM_HUF) < len)
+					huf[f] |= HPACK_FLG_NAM_HUF;
+				if (rto_literal_size(hp, &lst->fld[f],
+				    HPACK_FLG_VAL_HUF) < len)
+					huf[f] |= HPACK_FLG_VAL_HUF;
+			}
+			lst->priv = huf;
+		}
+	}
+
+	hpack_free(&hp);
+}
+
+static void
+rto_auto_free(void)
+{
+	struct trc_conn *conn;
+	size_t c, l;
+
+	for (c = 0; c < rto->trc->conn_cnt; c++) {
+		conn = &rto->trc->conn[c];
+		for (l = 0; l < conn->lst_cnt; l++)
+			free(conn->lst[l].priv);
+	}
+}
+
+/**********************************************************************
+ * Main
+ */
+
+static const struct bch_scenario rto_scenario = {
+	"encode", NULL, NULL, rto_run, NULL
+};
+
+static const struct bch_column rto_columns[] = {
+	{ "table",	0, 6 },
+	{ "lists",	0, 7 },
+	{ "raw",	0, 10 },
+	{ "wire",	0, 10 },
+	{ "ratio",	3, 6 },
+	{ "ins_list",	2, 9 },
+	{ "evi_list",	2, 9 },
+	{ "ns_list",	1, 9 },
+};
+
+#define RTO_COLUMNS (sizeof rto_columns / sizeof *rto_columns)
+
+static void
+rto_report(const struct bch_options *opt, const struct rto_stats *st,
+    const struct bch_result *res)
+{
+	double val[RTO_COLUMNS], lst;
+	char lbl[32];
+
+	lst = (double)rto->trc->lst_cnt;
+	val[0] = (double)rto->tbl;
+	val[1] = lst;
+	val[2] = (double)rto->trc->raw_len;
+	val[3] = (double)st->wire;
+	val[4] = rto->trc->raw_len > 0 ?
+	    (double)st->wire / (double)rto->trc->raw_len : 0;
+	val[5] = (double)st->ins / lst;
+	val[6] = (double)st->evi / lst;
+	val[7] = res->ns.med;
+
+	(void)snprintf(lbl, sizeof lbl, "%s/%s", rto->idx->nam,
+	    rto_codings[rto->huf]);
+	BCH_row(opt, rto_columns, RTO_COLUMNS, lbl, val);
+}
+
+static int
+rto_usage(const char *prg)
+{
+
+	(void)fprintf(stderr,
+	    "Usage: %s [-s <size>]... [options] <file>...\n\n"
+	    "  -s <size> dynamic table size (default: 256, 4096 and 16384)\n"
+	    BCH_USAGE
+	    "\nFiles ending with .json are read as hpack-test-case stories,\n"
+	    "other files as plain text traces.\n",
+	    prg);
+	return (EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct bch_options opt;
+	struct bch_result res;
+	struct rto_stats st;
+	const char *prg;
+	unsigned t, h;
+	char *end;
+	int c;
+
+	BCH_defaults(&opt);
+	prg = *argv;
+
+	while ((c = getopt(argc, argv, "s:" BCH_OPTIONS)) != -1) {
+		if (c == 's') {
+			if (rto->tbl_cnt == RTO_SIZES)
+				return (rto_usage(prg));
+			rto->tbl_sz[rto->tbl_cnt] = strtoul(optarg, &end, 10);
+			if (*optarg == '\0' || *end != '\0' ||
+			    rto->tbl_sz[rto->tbl_cnt] > UINT16_MAX)
+				return (rto_usage(prg));
+			rto->tbl_cnt++;
+		}
+		else if (BCH_option(&opt, c, optarg) != 0)
+			return (rto_usage(prg));
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc == 0)
+		return (rto_usage(prg));
+
+	if (rto->tbl_cnt == 0) {
+		rto->tbl_sz[rto->tbl_cnt++] = 256;
+		rto->tbl_sz[rto->tbl_cnt++] = 4096;
+		rto->tbl_sz[rto->tbl_cnt++] = 16384;
+	}
+
+	while (argc-- > 0)
+		TRC_load(rto->trc, *argv++);
+
+	if (rto->trc->fld_cnt == 0)
+		FAIL("empty corpus");
+
+	/* large enough for any header list, plus some slack */
+	rto->buf_len = 2 * (rto->trc->raw_len + rto->trc->fld_cnt) + 4096;
+	rto->buf = malloc(rto->buf_len);
+	rto->fld = calloc(rto->trc->fld_max, sizeof *rto->fld);
+	if (rto->buf == NULL || rto->fld == NULL)
+		WRONG("malloc");
+
+	rto_auto_init();
+	BCH_header(&opt, rto_columns, RTO_COLUMNS);
+
+	for (t = 0; t < rto->tbl_cnt; t++) {
+		rto->tbl = rto->tbl_sz[t];
+		for (rto->idx = rto_indexings; rto->idx->nam != NULL;
+		    rto->idx++) {
+			for (h = 0; rto_codings[h] != NULL; h++) {
+				rto->huf = (enum rto_coding_e)h;
+				(void)memset(&st, 0, sizeof st);
+				rto_encode(&st);
+				BCH_run(&opt, &rto_scenario, &res);
+				rto_report(&opt, &st, &res);
+			}
+		}
+	}
+
+	rto_auto_free();
+	TRC_free(rto->trc);
+	free(rto->fld);
+	free(rto->buf);
+	return (EXIT_SUCCESS);
+}
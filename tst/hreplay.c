@@ -0,0 +1,699 @@
+/*-
+ * License: BSD-2-Clause
+ * (c) 2026 Dridi Boukelmoune <dridi.boukelmoune@gmail.com>
+ *
+ * Replay header traces through cashpack, and optionally nghttp2, to compare
+ * throughput, compression ratio and memory usage.
+ *
+ * Files ending with .json are read as hpack-test-case stories, other files
+ * as plain text traces:
+ *
+ *     # comment
+ *     :method: GET
+ *     :path: /
+ *
+ *     :method: GET
+ *     :path: /favicon.ico
+ *     --
+ *     :method: HEAD
+ *
+ * A blank line ends a header list, and a -- line ends a connection. Each
+ * story file is a connection of its own.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_NGHTTP2
+#  include <nghttp2/nghttp2.h>
+#endif
+
+#include "hpack.h"
+
+#include "bch.h"
+#include "trc.h"
+
+/**********************************************************************
+ * Corpus
+ */
+
+struct rpl_block {
+	uint8_t	*ptr;
+	size_t	len;
+};
+
+struct rpl_list {
+	struct rpl_block	blk[2]; /* cashpack, nghttp2 */
+#ifdef HAVE_NGHTTP2
+	nghttp2_nv		*nva;
+#endif
+};
+
+struct rpl_corpus {
+	struct trc_corpus	trc[1];
+	struct rpl_list		*lst;
+	size_t			tbl_sz;
+	struct hpack_field	*fld;	/* scratch copy for the encoder */
+	uint8_t			*buf;
+	size_t			buf_len;
+};
+
+static struct rpl_corpus rpl[1];
+
+static void
+rpl_corpus_init(void)
+{
+	struct trc_conn *conn;
+	size_t c, l, n;
+
+	rpl->lst = calloc(rpl->trc->lst_cnt, sizeof *rpl->lst);
+	if (rpl->lst == NULL)
+		WRONG("calloc");
+
+	n = 0;
+	for (c = 0; c < rpl->trc->conn_cnt; c++) {
+		conn = &rpl->trc->conn[c];
+		for (l = 0; l < conn->lst_cnt; l++)
+			conn->lst[l].priv = &rpl->lst[n++];
+	}
+	assert(n == rpl->trc->lst_cnt);
+}
+
+static struct rpl_block *
+rpl_block(const struct trc_list *lst, unsigned i)
+{
+	struct rpl_list *rl;
+
+	assert(i < 2);
+	rl = lst->priv;
+	return (&rl->blk[i]);
+}
+
+static void
+rpl_corpus_free(void)
+{
+	size_t l;
+
+	for (l = 0; l < rpl->trc->lst_cnt; l++) {
+		free(rpl->lst[l].blk[0].ptr);
+		free(rpl->lst[l].blk[1].ptr);
+#ifdef HAVE_NGHTTP2
+		free(rpl->lst[l].nva);
+#endif
+	}
+	free(rpl->lst);
+	TRC_free(rpl->trc);
+	free(rpl->fld);
+	free(rpl->buf);
+}
+
+/**********************************************************************
+ * cashpack
+ */
+
+struct rpl_stats {
+	const char	*nam;
+	size_t		fld_cnt;
+	size_t		blk_len;
+	size_t		tbl_max;
+	size_t		enc_mem;
+	size_t		dec_mem;
+};
+
+static void
+rpl_noop_cb(enum hpack_event_e evt, const char *buf, size_t len, void *priv)
+{
+
+	(void)evt;
+	(void)buf;
+	(void)len;
+	(void)priv;
+}
+
+static void
+rpl_collect_cb(enum hpack_event_e evt, const char *buf, size_t len,
+    void *priv)
+{
+	struct rpl_block *blk;
+
+	if (evt != HPACK_EVT_DATA)
+		return;
+
+	blk = priv;
+	blk->ptr = realloc(blk->ptr, blk->len + len);
+	if (blk->ptr == NULL)
+		WRONG("realloc");
+	(void)memcpy(blk->ptr + blk->len, buf, len);
+	blk->len += len;
+}
+
+static void
+rpl_count_cb(enum hpack_event_e evt, const char *buf, size_t len, void *priv)
+{
+	size_t *cnt;
+
+	(void)buf;
+	cnt = priv;
+	if (evt == HPACK_EVT_FIELD)
+		*cnt += len;
+}
+
+static size_t
+rpl_cashpack_table(struct hpack *hp)
+{
+	size_t len;
+
+	len = 0;
+	if (hpack_dynamic(hp, rpl_count_cb, &len) != HPACK_RES_OK)
+		WRONG("hpack_dynamic");
+	return (len);
+}
+
+static void
+rpl_cashpack_encode_list(struct hpack *hp, const struct trc_list *lst,
+    hpack_event_f *cb, void *priv)
+{
+	struct hpack_encoding he;
+	enum hpack_result_e res;
+
+	(void)memcpy(rpl->fld, lst->fld, lst->fld_cnt * sizeof *rpl->fld);
+	he.fld = rpl->fld;
+	he.fld_cnt = lst->fld_cnt;
+	he.buf = rpl->buf;
+	he.buf_len = rpl->buf_len;
+	he.cb = cb;
+	he.priv = priv;
+	he.cut = 0;
+
+	res = hpack_encode(hp, &he);
+	if (res != HPACK_RES_OK)
+		FAIL("hpack_encode: %s", hpack_strerror(res));
+}
+
+static void
+rpl_field_cb(enum hpack_event_e evt, const char *buf, size_t len, void *priv)
+{
+	size_t *cnt;
+
+	(void)buf;
+	(void)len;
+	cnt = priv;
+	if (evt == HPACK_EVT_FIELD)
+		(*cnt)++;
+}
+
+static size_t
+rpl_cashpack_decode_block(struct hpack *hp, const struct rpl_block *blk)
+{
+	struct hpack_decoding hd;
+	enum hpack_result_e res;
+	size_t cnt;
+
+	cnt = 0;
+	hd.blk = blk->ptr;
+	hd.blk_len = blk->len;
+	hd.buf = rpl->buf;
+	hd.buf_len = rpl->buf_len;
+	hd.cb = rpl_field_cb;
+	hd.priv = &cnt;
+	hd.cut = 0;
+
+	res = hpack_decode(hp, &hd);
+	if (res != HPACK_RES_OK)
+		FAIL("hpack_decode: %s", hpack_strerror(res));
+	return (cnt);
+}
+
+static void
+rpl_cashpack_prepare(struct rpl_stats *st)
+{
+	struct bch_memory bm;
+	struct trc_conn *conn;
+	struct trc_list *lst;
+	struct hpack *hp;
+	size_t c, l, len;
+
+	BCH_memory_init(&bm);
+	st->nam = "cashpack";
+
+	for (c = 0; c < rpl->trc->conn_cnt; c++) {
+		conn = &rpl->trc->conn[c];
+		hp = hpack_encoder(rpl->tbl_sz, -1, &bm.alc);
+		if (hp == NULL)
+			WRONG("hpack_encoder");
+		for (l = 0; l < conn->lst_cnt; l++) {
+			lst = &conn->lst[l];
+			rpl_cashpack_encode_list(hp, lst, rpl_collect_cb,
+			    rpl_block(lst, 0));
+			st->fld_cnt += lst->fld_cnt;
+			st->blk_len += rpl_block(lst, 0)->len;
+			len = rpl_cashpack_table(hp);
+			if (st->tbl_max < len)
+				st->tbl_max = len;
+		}
+		if (st->enc_mem < bm.max)
+			st->enc_mem = bm.max;
+		hpack_free(&hp);
+		BCH_memory_reset(&bm);
+	}
+
+	for (c = 0; c < rpl->trc->conn_cnt; c++) {
+		conn = &rpl->trc->conn[c];
+		hp = hpack_decoder(rpl->tbl_sz, -1, &bm.alc);
+		if (hp == NULL)
+			WRONG("hpack_decoder");
+		for (l = 0; l < conn->lst_cnt; l++) {
+			lst = &conn->lst[l];
+			if (rpl_cashpack_decode_block(hp, rpl_block(lst, 0)) !=
+			    lst->fld_cnt)
+				FAIL("cashpack: field count mismatch");
+		}
+		if (st->dec_mem < bm.max)
+			st->dec_mem = bm.max;
+		hpack_free(&hp);
+		BCH_memory_reset(&bm);
+	}
+}
+
+static void
+rpl_cashpack_encode(void *priv, struct bch_count *cnt)
+{
+	struct trc_conn *conn;
+	struct hpack *hp;
+	size_t c, l;
+
+	(void)priv;
+	for (c = 0; c < rpl->trc->conn_cnt; c++) {
+		conn = &rpl->trc->conn[c];
+		hp = hpack_encoder(rpl->tbl_sz, -1, hpack_default_alloc);
+		if (hp == NULL)
+			WRONG("hpack_encoder");
+		for (l = 0; l < conn->lst_cnt; l++) {
+			rpl_cashpack_encode_list(hp, &conn->lst[l],
+			    rpl_noop_cb, NULL);
+			cnt->itm += conn->lst[l].fld_cnt;
+			cnt->len += rpl_block(&conn->lst[l], 0)->len;
+		}
+		hpack_free(&hp);
+	}
+}
+
+static void
+rpl_cashpack_decode(void *priv, struct bch_count *cnt)
+{
+	struct trc_conn *conn;
+	struct hpack *hp;
+	size_t c, l;
+
+	(void)priv;
+	for (c = 0; c < rpl->trc->conn_cnt; c++) {
+		conn = &rpl->trc->conn[c];
+		hp = hpack_decoder(rpl->tbl_sz, -1, hpack_default_alloc);
+		if (hp == NULL)
+			WRONG("hpack_decoder");
+		for (l = 0; l < conn->lst_cnt; l++) {
+			cnt->itm += rpl_cashpack_decode_block(hp,
+			    rpl_block(&conn->lst[l], 0));
+			cnt->len += rpl_block(&conn->lst[l], 0)->len;
+		}
+		hpack_free(&hp);
+	}
+}
+
+/**********************************************************************
+ * nghttp2
+ */
+
+#ifdef HAVE_NGHTTP2
+static void *
+rpl_ng_malloc(size_t len, void *priv)
+{
+
+	return (BCH_memory_malloc(len, priv));
+}
+
+static void
+rpl_ng_free(void *ptr, void *priv)
+{
+
+	BCH_memory_free(ptr, priv);
+}
+
+static void *
+rpl_ng_calloc(size_t cnt, size_t len, void *priv)
+{
+	void *ptr;
+
+	ptr = BCH_memory_malloc(cnt * len, priv);
+	if (ptr != NULL)
+		(void)memset(ptr, 0, cnt * len);
+	return (ptr);
+}
+
+static void *
+rpl_ng_realloc(void *ptr, size_t len, void *priv)
+{
+
+	return (BCH_memory_realloc(ptr, len, priv));
+}
+
+static void
+rpl_ng_memory(nghttp2_mem *mem, struct bch_memory *bm)
+{
+
+	BCH_memory_init(bm);
+	mem->mem_user_data = bm;
+	mem->malloc = rpl_ng_malloc;
+	mem->free = rpl_ng_free;
+	mem->calloc = rpl_ng_calloc;
+	mem->realloc = rpl_ng_realloc;
+}
+
+static size_t
+rpl_ng_encode_list(nghttp2_hd_deflater *dfl, const struct trc_list *lst)
+{
+	struct rpl_list *rl;
+	ssize_t len;
+
+	rl = lst->priv;
+	len = nghttp2_hd_deflate_hd(dfl, rpl->buf, rpl->buf_len, rl->nva,
+	    lst->fld_cnt);
+	if (len < 0)
+		FAIL("nghttp2_hd_deflate_hd: %s", nghttp2_strerror((int)len));
+	return ((size_t)len);
+}
+
+static size_t
+rpl_ng_decode_block(nghttp2_hd_inflater *ifl, const struct rpl_block *blk)
+{
+	const uint8_t *ptr;
+	nghttp2_nv nv;
+	size_t len, cnt;
+	ssize_t rv;
+	int flg;
+
+	ptr = blk->ptr;
+	len = blk->len;
+	cnt = 0;
+
+	do {
+		flg = 0;
+		rv = nghttp2_hd_inflate_hd2(ifl, &nv, &flg, ptr, len, 1);
+		if (rv < 0)
+			FAIL("nghttp2_hd_inflate_hd2: %s",
+			    nghttp2_strerror((int)rv));
+		ptr += rv;
+		len -= (size_t)rv;
+		if (flg & NGHTTP2_HD_INFLATE_EMIT)
+			cnt++;
+	} while (!(flg & NGHTTP2_HD_INFLATE_FINAL));
+
+	(void)nghttp2_hd_inflate_end_headers(ifl);
+	return (cnt);
+}
+
+static void
+rpl_ng_prepare(struct rpl_stats *st)
+{
+	struct bch_memory bm;
+	struct trc_conn *conn;
+	struct trc_list *lst;
+	struct rpl_block *blk;
+	struct rpl_list *rl;
+	nghttp2_hd_deflater *dfl;
+	nghttp2_hd_inflater *ifl;
+	nghttp2_mem mem;
+	size_t c, l, f, len;
+
+	rpl_ng_memory(&mem, &bm);
+	st->nam = "nghttp2";
+
+	for (c = 0; c < rpl->trc->conn_cnt; c++) {
+		conn = &rpl->trc->conn[c];
+		for (l = 0; l < conn->lst_cnt; l++) {
+			lst = &conn->lst[l];
+			rl = lst->priv;
+			rl->nva = calloc(lst->fld_cnt, sizeof *rl->nva);
+			if (rl->nva == NULL)
+				WRONG("calloc");
+			for (f = 0; f < lst->fld_cnt; f++) {
+				rl->nva[f].name = (uint8_t *)(uintptr_t)
+				    lst->fld[f].nam;
+				rl->nva[f].value = (uint8_t *)(uintptr_t)
+				    lst->fld[f].val;
+				rl->nva[f].namelen = strlen(lst->fld[f].nam);
+				rl->nva[f].valuelen = strlen(lst->fld[f].val);
+				rl->nva[f].flags = NGHTTP2_NV_FLAG_NONE;
+			}
+		}
+	}
+
+	for (c = 0; c < rpl->trc->conn_cnt; c++) {
+		conn = &rpl->trc->conn[c];
+		if (nghttp2_hd_deflate_new2(&dfl, rpl->tbl_sz, &mem) != 0)
+			WRONG("nghttp2_hd_deflate_new2");
+		for (l = 0; l < conn->lst_cnt; l++) {
+			lst = &conn->lst[l];
+			len = rpl_ng_encode_list(dfl, lst);
+			blk = rpl_block(lst, 1);
+			blk->ptr = malloc(len);
+			if (blk->ptr == NULL)
+				WRONG("malloc");
+			(void)memcpy(blk->ptr, rpl->buf, len);
+			blk->len = len;
+			st->fld_cnt += lst->fld_cnt;
+			st->blk_len += len;
+			len = nghttp2_hd_deflate_get_dynamic_table_size(dfl);
+			if (st->tbl_max < len)
+				st->tbl_max = len;
+		}
+		if (st->enc_mem < bm.max)
+			st->enc_mem = bm.max;
+		nghttp2_hd_deflate_del(dfl);
+		BCH_memory_reset(&bm);
+	}
+
+	for (c = 0; c < rpl->trc->conn_cnt; c++) {
+		conn = &rpl->trc->conn[c];
+		if (nghttp2_hd_inflate_new2(&ifl, &mem) != 0)
+			WRONG("nghttp2_hd_inflate_new2");
+		for (l = 0; l < conn->lst_cnt; l++) {
+			lst = &conn->lst[l];
+			if (rpl_ng_decode_block(ifl, rpl_block(lst, 1)) !=
+			    lst->fld_cnt)
+				FAIL("nghttp2: field count mismatch");
+		}
+		if (st->dec_mem < bm.max)
+			st->dec_mem = bm.max;
+		nghttp2_hd_inflate_del(ifl);
+		BCH_memory_reset(&bm);
+	}
+}
+
+static void
+rpl_ng_cross_check(void)
+{
+	struct trc_conn *conn;
+	struct trc_list *lst;
+	nghttp2_hd_inflater *ifl;
+	struct hpack *hp;
+	size_t c, l;
+
+	/* each implementation decodes the other's blocks */
+	for (c = 0; c < rpl->trc->conn_cnt; c++) {
+		conn = &rpl->trc->conn[c];
+		hp = hpack_decoder(rpl->tbl_sz, -1, hpack_default_alloc);
+		if (hp == NULL)
+			WRONG("hpack_decoder");
+		if (nghttp2_hd_inflate_new(&ifl) != 0)
+			WRONG("nghttp2_hd_inflate_new");
+		for (l = 0; l < conn->lst_cnt; l++) {
+			lst = &conn->lst[l];
+			if (rpl_cashpack_decode_block(hp, rpl_block(lst, 1)) !=
+			    lst->fld_cnt)
+				FAIL("cashpack: nghttp2 field count mismatch");
+			if (rpl_ng_decode_block(ifl, rpl_block(lst, 0)) !=
+			    lst->fld_cnt)
+				FAIL("nghttp2: cashpack field count mismatch");
+		}
+		nghttp2_hd_inflate_del(ifl);
+		hpack_free(&hp);
+	}
+}
+
+static void
+rpl_ng_encode(void *priv, struct bch_count *cnt)
+{
+	nghttp2_hd_deflater *dfl;
+	struct trc_conn *conn;
+	size_t c, l;
+
+	(void)priv;
+	for (c = 0; c < rpl->trc->conn_cnt; c++) {
+		conn = &rpl->trc->conn[c];
+		if (nghttp2_hd_deflate_new(&dfl, rpl->tbl_sz) != 0)
+			WRONG("nghttp2_hd_deflate_new");
+		for (l = 0; l < conn->lst_cnt; l++) {
+			cnt->itm += conn->lst[l].fld_cnt;
+			cnt->len += rpl_ng_encode_list(dfl, &conn->lst[l]);
+		}
+		nghttp2_hd_deflate_del(dfl);
+	}
+}
+
+static void
+rpl_ng_decode(void *priv, struct bch_count *cnt)
+{
+	nghttp2_hd_inflater *ifl;
+	struct trc_conn *conn;
+	size_t c, l;
+
+	(void)priv;
+	for (c = 0; c < rpl->trc->conn_cnt; c++) {
+		conn = &rpl->trc->conn[c];
+		if (nghttp2_hd_inflate_new(&ifl) != 0)
+			WRONG("nghttp2_hd_inflate_new");
+		for (l = 0; l < conn->lst_cnt; l++) {
+			cnt->itm += rpl_ng_decode_block(ifl,
+			    rpl_block(&conn->lst[l], 1));
+			cnt->len += rpl_block(&conn->lst[l], 1)->len;
+		}
+		nghttp2_hd_inflate_del(ifl);
+	}
+}
+#endif
+
+/**********************************************************************
+ * Main
+ */
+
+static const struct bch_scenario rpl_scenarios[] = {
+	{ "cashpack_encode", NULL, NULL, rpl_cashpack_encode, NULL },
+	{ "cashpack_decode", NULL, NULL, rpl_cashpack_decode, NULL },
+#ifdef HAVE_NGHTTP2
+	{ "nghttp2_encode", NULL, NULL, rpl_ng_encode, NULL },
+	{ "nghttp2_decode", NULL, NULL, rpl_ng_decode, NULL },
+#endif
+	{ NULL, NULL, NULL, NULL, NULL }
+};
+
+static const struct bch_column rpl_columns[] = {
+	{ "conns",	0, 7 },
+	{ "fields",	0, 8 },
+	{ "raw",	0, 10 },
+	{ "wire",	0, 10 },
+	{ "ratio",	3, 6 },
+	{ "tbl_max",	0, 8 },
+	{ "enc_mem",	0, 8 },
+	{ "dec_mem",	0, 8 },
+};
+
+#define RPL_COLUMNS (sizeof rpl_columns / sizeof *rpl_columns)
+
+static void
+rpl_report(const struct bch_options *opt, const struct rpl_stats *st)
+{
+	double val[RPL_COLUMNS];
+
+	val[0] = (double)rpl->trc->conn_cnt;
+	val[1] = (double)st->fld_cnt;
+	val[2] = (double)rpl->trc->raw_len;
+	val[3] = (double)st->blk_len;
+	val[4] = rpl->trc->raw_len > 0 ?
+	    (double)st->blk_len / (double)rpl->trc->raw_len : 0;
+	val[5] = (double)st->tbl_max;
+	val[6] = (double)st->enc_mem;
+	val[7] = (double)st->dec_mem;
+	BCH_row(opt, rpl_columns, RPL_COLUMNS, st->nam, val);
+}
+
+static int
+rpl_usage(const char *prg)
+{
+
+	(void)fprintf(stderr,
+	    "Usage: %s [-s <size>] [options] <file>...\n\n"
+	    "  -s <size> dynamic table size (default: 4096)\n"
+	    BCH_USAGE
+	    "\nFiles ending with .json are read as hpack-test-case stories,\n"
+	    "other files as plain text traces.\n",
+	    prg);
+	return (EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv)
+{
+	const struct bch_scenario *scn;
+	struct bch_options opt;
+	struct bch_result res;
+	struct rpl_stats st;
+	const char *prg;
+	char *end;
+	int c;
+
+	BCH_defaults(&opt);
+	prg = *argv;
+	rpl->tbl_sz = 4096;
+
+	while ((c = getopt(argc, argv, "s:" BCH_OPTIONS)) != -1) {
+		if (c == 's') {
+			rpl->tbl_sz = strtoul(optarg, &end, 10);
+			if (*optarg == '\0' || *end != '\0' ||
+			    rpl->tbl_sz > UINT16_MAX)
+				return (rpl_usage(prg));
+		}
+		else if (BCH_option(&opt, c, optarg) != 0)
+			return (rpl_usage(prg));
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc == 0)
+		return (rpl_usage(prg));
+
+	while (argc-- > 0)
+		TRC_load(rpl->trc, *argv++);
+
+	if (rpl->trc->fld_cnt == 0)
+		FAIL("empty corpus");
+
+	rpl_corpus_init();
+
+	/* large enough for any header list, plus some slack */
+	rpl->buf_len = 2 * (rpl->trc->raw_len + rpl->trc->fld_cnt) + 4096;
+	rpl->buf = malloc(rpl->buf_len);
+	rpl->fld = calloc(rpl->trc->fld_max, sizeof *rpl->fld);
+	if (rpl->buf == NULL || rpl->fld == NULL)
+		WRONG("malloc");
+
+	BCH_header(&opt, rpl_columns, RPL_COLUMNS);
+
+	(void)memset(&st, 0, sizeof st);
+	rpl_cashpack_prepare(&st);
+	rpl_report(&opt, &st);
+
+#ifdef HAVE_NGHTTP2
+	(void)memset(&st, 0, sizeof st);
+	rpl_ng_prepare(&st);
+	rpl_report(&opt, &st);
+	rpl_ng_cross_check();
+#endif
+
+	if (opt.fmt == BCH_FMT_TXT)
+		(void)printf("\n");
+
+	BCH_result_header(&opt);
+	for (scn = rpl_scenarios; scn->nam != NULL; scn++) {
+		BCH_run(&opt, scn, &res);
+		BCH_result(&opt, scn->nam, &res);
+	}
+
+	rpl_corpus_free();
+	return (EXIT_SUCCESS);
+}
@@ -0,0 +1,808 @@
+/*-
+ * License: BSD-2-Clause
+ * (c) 2026 Dridi Boukelmoune <dridi.boukelmoune@gmail.com>
+ *
+ * Synthetic header workloads.
+ *
+ * Generate header lists for browsers, gRPC clients or API clients, either
+ * requests or responses, as a trace for hreplay and its siblings or as
+ * commands for hencode. The output only depends on the options, the same
+ * seed always produces the same workload.
+ *
+ * Methods, statuses, paths, content types and extension fields are picked
+ * with a Zipf distribution, and the length of generated values follows a
+ * configurable distribution. Each connection has its own authority, user
+ * agent, credentials and cookies, and its cookies drift from one request
+ * to the next.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define WRONG(str)		\
+	do {			\
+		perror(str);	\
+		abort();	\
+	} while (0)
+
+#define SYN_FIELDS	64	/* fields per list */
+#define SYN_NAMESZ	64
+#define SYN_VALUESZ	1024
+#define SYN_LENGTH	512	/* longest generated value */
+#define SYN_COOKIES	12	/* crumbs per connection */
+#define SYN_PATHS	256
+#define SYN_EXTENSIONS	64	/* extension names */
+#define SYN_VARIANTS	16	/* values per extension name */
+
+#define SYN_ARRAY_LEN(a) (sizeof a / sizeof *a)
+
+static const char syn_b64[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+static const char syn_hex[] = "0123456789abcdef";
+
+/**********************************************************************
+ * Random numbers
+ */
+
+struct syn_rng {
+	uint64_t	s;
+};
+
+static uint64_t
+syn_next(struct syn_rng *rng)
+{
+	uint64_t z;
+
+	/* NB: SplitMix64, portable and good enough for workloads */
+	rng->s += 0x9e3779b97f4a7c15;
+	z = rng->s;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+	return (z ^ (z >> 31));
+}
+
+static void
+syn_seed(struct syn_rng *rng, uint64_t seed, uint64_t salt)
+{
+
+	rng->s = seed;
+	rng->s ^= syn_next(rng) + salt;
+}
+
+static double
+syn_unit(struct syn_rng *rng)
+{
+
+	return ((double)(syn_next(rng) >> 11) * (1.0 / 9007199254740992.0));
+}
+
+static unsigned
+syn_below(struct syn_rng *rng, unsigned n)
+{
+
+	assert(n > 0);
+	return ((unsigned)(syn_next(rng) % n));
+}
+
+static int
+syn_chance(struct syn_rng *rng, unsigned pct)
+{
+
+	return (syn_below(rng, 100) < pct);
+}
+
+/**********************************************************************
+ * Distributions
+ */
+
+struct syn_zipf {
+	double	*cdf;
+	size_t	n;
+};
+
+static double syn_exponent = 1.0;
+
+static void
+syn_zipf_init(struct syn_zipf *zpf, size_t n)
+{
+	double sum;
+	size_t i;
+
+	assert(n > 0);
+	zpf->cdf = malloc(n * sizeof *zpf->cdf);
+	if (zpf->cdf == NULL)
+		WRONG("malloc");
+	zpf->n = n;
+
+	sum = 0;
+	for (i = 0; i < n; i++) {
+		sum += 1.0 / pow((double)(i + 1), syn_exponent);
+		zpf->cdf[i] = sum;
+	}
+	for (i = 0; i < n; i++)
+		zpf->cdf[i] /= sum;
+}
+
+static unsigned
+syn_zipf_pick(const struct syn_zipf *zpf, struct syn_rng *rng)
+{
+	size_t lo, hi, mid;
+	double u;
+
+	u = syn_unit(rng);
+	lo = 0;
+	hi = zpf->n - 1;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (zpf->cdf[mid] < u)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return ((unsigned)lo);
+}
+
+static void
+syn_zipf_fini(struct syn_zipf *zpf)
+{
+
+	free(zpf->cdf);
+	zpf->cdf = NULL;
+}
+
+enum syn_dist_e {
+	SYN_FIXED,
+	SYN_UNIFORM,
+	SYN_EXP,
+};
+
+struct syn_length {
+	enum syn_dist_e	dist;
+	unsigned	a;
+	unsigned	b;
+};
+
+static struct syn_length syn_len = { SYN_EXP, 16, 0 };
+
+static int
+syn_length_parse(const char *spec)
+{
+	unsigned a, b;
+	int n;
+
+	n = 0;
+	if (sscanf(spec, "fixed:%u%n", &a, &n) == 1 && spec[n] == '\0') {
+		syn_len.dist = SYN_FIXED;
+		b = a;
+	}
+	else if (sscanf(spec, "uniform:%u:%u%n", &a, &b, &n) == 2 &&
+	    spec[n] == '\0') {
+		syn_len.dist = SYN_UNIFORM;
+	}
+	else if (sscanf(spec, "exp:%u%n", &a, &n) == 1 && spec[n] == '\0') {
+		syn_len.dist = SYN_EXP;
+		b = a;
+	}
+	else
+		return (-1);
+
+	if (a == 0 || a > b || b > SYN_LENGTH)
+		return (-1);
+
+	syn_len.a = a;
+	syn_len.b = b;
+	return (0);
+}
+
+static size_t
+syn_length_pick(struct syn_rng *rng)
+{
+	double len;
+
+	switch (syn_len.dist) {
+	case SYN_FIXED:
+		return (syn_len.a);
+	case SYN_UNIFORM:
+		return (syn_len.a + syn_below(rng, syn_len.b - syn_len.a + 1));
+	case SYN_EXP:
+		len = ceil(-log(1.0 - syn_unit(rng)) * syn_len.a);
+		if (len < 1)
+			return (1);
+		if (len > SYN_LENGTH)
+			return (SYN_LENGTH);
+		return ((size_t)len);
+	default:
+		abort();
+	}
+}
+
+static void
+syn_token(struct syn_rng *rng, char *buf, size_t len, const char *alpha)
+{
+	size_t n;
+
+	assert(len < SYN_VALUESZ);
+	n = strlen(alpha);
+	while (len-- > 0)
+		*buf++ = alpha[syn_below(rng, (unsigned)n)];
+	*buf = '\0';
+}
+
+/**********************************************************************
+ * Header lists
+ */
+
+enum syn_format_e {
+	SYN_FMT_TRACE,
+	SYN_FMT_HENCODE,
+};
+
+struct syn_field {
+	char	nam[SYN_NAMESZ];
+	char	val[SYN_VALUESZ];
+};
+
+static struct syn_field syn_lst[SYN_FIELDS];
+static size_t syn_cnt;
+static enum syn_format_e syn_fmt = SYN_FMT_TRACE;
+
+static void
+syn_add(const char *nam, const char *fmt, ...)
+{
+	struct syn_field *sf;
+	va_list ap;
+	int len;
+
+	assert(syn_cnt < SYN_FIELDS);
+	sf = &syn_lst[syn_cnt++];
+
+	len = snprintf(sf->nam, sizeof sf->nam, "%s", nam);
+	assert(len > 0 && (size_t)len < sizeof sf->nam);
+
+	va_start(ap, fmt);
+	len = vsnprintf(sf->val, sizeof sf->val, fmt, ap);
+	va_end(ap);
+	assert(len > 0 && (size_t)len < sizeof sf->val);
+}
+
+static void
+syn_emit(void)
+{
+	struct syn_field *sf;
+	size_t n;
+
+	for (n = 0, sf = syn_lst; n < syn_cnt; n++, sf++) {
+		if (syn_fmt == SYN_FMT_TRACE)
+			(void)printf("%s: %s\n", sf->nam, sf->val);
+		else
+			(void)printf("dynamic huf %s huf %s\n", sf->nam,
+			    sf->val);
+	}
+	(void)printf(syn_fmt == SYN_FMT_TRACE ? "\n" : "send\n");
+	syn_cnt = 0;
+}
+
+/**********************************************************************
+ * Workloads
+ */
+
+static const char * const syn_methods[] = {
+	"GET", "POST", "PUT", "DELETE", "HEAD", "OPTIONS", "PATCH",
+};
+
+static const char * const syn_statuses[] = {
+	"200", "304", "204", "404", "301", "302", "206", "500", "403", "503",
+};
+
+static const char * const syn_authorities[] = {
+	"www.example.com", "static.example.com", "api.example.com",
+	"cdn.example.net", "img.example.org", "login.example.com",
+	"ads.example.net", "fonts.example.org",
+};
+
+static const char * const syn_agents[] = {
+	"Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 "
+	    "Firefox/128.0",
+	"Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 "
+	    "(KHTML, like Gecko) Chrome/126.0.0.0 Safari/537.36",
+	"Mozilla/5.0 (Macintosh; Intel Mac OS X 14_5) AppleWebKit/605.1.15 "
+	    "(KHTML, like Gecko) Version/17.5 Safari/605.1.15",
+	"Mozilla/5.0 (iPhone; CPU iPhone OS 17_5 like Mac OS X) "
+	    "AppleWebKit/605.1.15 (KHTML, like Gecko) Mobile/15E148",
+};
+
+static const char * const syn_stubs[] = {
+	"grpc-go/1.64.0", "grpc-java-netty/1.65.0",
+	"grpc-c++/1.64.2 grpc-c/41.0.0 (linux; chttp2)",
+	"grpc-python/1.64.1 grpc-c/41.0.0 (linux; chttp2)",
+};
+
+static const char * const syn_clients[] = {
+	"okhttp/4.12.0", "python-requests/2.32.3", "curl/8.8.0",
+	"Go-http-client/2.0",
+};
+
+static const char * const syn_accepts[] = {
+	"*/*",
+	"text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8",
+	"text/css,*/*;q=0.1",
+	"image/avif,image/webp,image/png,image/svg+xml,image/*;q=0.8,*/*;q=0.5",
+	"application/json, text/plain, */*",
+};
+
+static const char * const syn_types[] = {
+	"text/html; charset=utf-8", "application/javascript", "text/css",
+	"image/webp", "application/json", "image/png", "font/woff2",
+	"image/svg+xml",
+};
+
+static const char * const syn_caches[] = {
+	"max-age=31536000, immutable", "no-cache", "private, max-age=0",
+	"public, max-age=3600", "no-store",
+};
+
+enum syn_workload_e {
+	SYN_BROWSER,
+	SYN_GRPC,
+	SYN_API,
+};
+
+static const char * const syn_workloads[] = { "browser", "grpc", "api" };
+
+struct syn_cookie {
+	char	nam[SYN_NAMESZ];
+	char	val[SYN_VALUESZ];
+};
+
+struct syn_conn {
+	struct syn_rng		rng;
+	const char		*authority;
+	const char		*agent;
+	char			token[SYN_VALUESZ];
+	struct syn_cookie	jar[SYN_COOKIES];
+	unsigned		jar_cnt;
+	unsigned		req;
+	unsigned		quota;
+};
+
+struct syn_config {
+	uint64_t		seed;
+	enum syn_workload_e	wkl;
+	unsigned		conns;
+	unsigned		lists;
+	unsigned		drift; /* percent */
+	unsigned		extra;
+	int			resp;
+	struct syn_zipf		z_method;
+	struct syn_zipf		z_status;
+	struct syn_zipf		z_path;
+	struct syn_zipf		z_type;
+	struct syn_zipf		z_cache;
+	struct syn_zipf		z_accept;
+	struct syn_zipf		z_ext;
+	struct syn_zipf		z_var;
+};
+
+static struct syn_config syn[1];
+
+static void
+syn_path(unsigned rank, char *buf, size_t len)
+{
+	static const char * const ext[] = { "html", "js", "css", "png",
+	    "webp", "svg", "woff2", "json" };
+	struct syn_rng rng;
+	char seg[16];
+	int n;
+
+	/* NB: a path only depends on its rank */
+	syn_seed(&rng, syn->seed, 0x70617468 + rank);
+	syn_token(&rng, seg, 4 + syn_below(&rng, 8), syn_b64);
+
+	if (syn->wkl == SYN_GRPC)
+		n = snprintf(buf, len, "/example.v1.Service%u/%s", rank % 7,
+		    seg);
+	else if (syn->wkl == SYN_API)
+		n = snprintf(buf, len, "/v1/resource%u/%s", rank % 13, seg);
+	else if (rank == 0)
+		n = snprintf(buf, len, "/");
+	else
+		n = snprintf(buf, len, "/assets/%u/%s.%s", rank % 17, seg,
+		    ext[rank % SYN_ARRAY_LEN(ext)]);
+	assert(n > 0 && (size_t)n < len);
+}
+
+static void
+syn_date(struct syn_conn *sc, char *buf, size_t len)
+{
+	unsigned sec;
+	int n;
+
+	/* NB: one request every second or so */
+	sec = sc->req + syn_below(&sc->rng, 2);
+	n = snprintf(buf, len, "Mon, 19 Oct 2026 %02u:%02u:%02u GMT",
+	    (sec / 3600) % 24, (sec / 60) % 60, sec % 60);
+	assert(n > 0 && (size_t)n < len);
+}
+
+static void
+syn_extensions(struct syn_conn *sc)
+{
+	struct syn_rng rng;
+	char val[SYN_VALUESZ];
+	char nam[SYN_NAMESZ];
+	unsigned cnt, ext, var;
+
+	cnt = syn->extra > 0 ? syn_below(&sc->rng, syn->extra + 1) : 0;
+	while (cnt-- > 0) {
+		ext = syn_zipf_pick(&syn->z_ext, &sc->rng);
+		var = syn_zipf_pick(&syn->z_var, &sc->rng);
+		/* NB: a value only depends on its name and rank */
+		syn_seed(&rng, syn->seed, (uint64_t)ext << 32 | var);
+		syn_token(&rng, val, syn_length_pick(&rng), syn_b64);
+		if (syn->wkl == SYN_GRPC && ext % 4 == 3)
+			(void)snprintf(nam, sizeof nam, "x-meta-%02u-bin", ext);
+		else
+			(void)snprintf(nam, sizeof nam, "x-ext-%02u", ext);
+		syn_add(nam, "%s", val);
+	}
+}
+
+static void
+syn_cookie_drift(struct syn_conn *sc)
+{
+	struct syn_cookie *ck;
+
+	if (!syn_chance(&sc->rng, syn->drift))
+		return;
+
+	if (sc->jar_cnt < SYN_COOKIES && syn_chance(&sc->rng, 25))
+		ck = &sc->jar[sc->jar_cnt++];
+	else
+		ck = &sc->jar[syn_below(&sc->rng, sc->jar_cnt)];
+
+	if (*ck->nam == '\0')
+		syn_token(&sc->rng, ck->nam, 2 + syn_below(&sc->rng, 8),
+		    syn_b64 + 26);
+	syn_token(&sc->rng, ck->val, syn_length_pick(&sc->rng), syn_b64);
+}
+
+static void
+syn_request_id(struct syn_conn *sc)
+{
+	char id[33];
+
+	syn_token(&sc->rng, id, 32, syn_hex);
+	syn_add("x-request-id", "%s", id);
+}
+
+static void
+syn_request(struct syn_conn *sc)
+{
+	char path[SYN_NAMESZ + 32], qry[SYN_VALUESZ];
+	const char *mth;
+	unsigned u;
+
+	mth = syn_methods[syn_zipf_pick(&syn->z_method, &sc->rng)];
+	syn_path(syn_zipf_pick(&syn->z_path, &sc->rng), path, sizeof path);
+
+	switch (syn->wkl) {
+	case SYN_BROWSER:
+		syn_add(":method", "%s", mth);
+		syn_add(":scheme", "https");
+		syn_add(":authority", "%s", sc->authority);
+		if (syn_chance(&sc->rng, 20)) {
+			syn_token(&sc->rng, qry, syn_length_pick(&sc->rng),
+			    syn_b64);
+			syn_add(":path", "%s?q=%s", path, qry);
+		}
+		else
+			syn_add(":path", "%s", path);
+		syn_add("user-agent", "%s", sc->agent);
+		syn_add("accept", "%s",
+		    syn_accepts[syn_zipf_pick(&syn->z_accept, &sc->rng)]);
+		syn_add("accept-language", "en-US,en;q=0.5");
+		syn_add("accept-encoding", "gzip, deflate, br, zstd");
+		if (sc->req > 0)
+			syn_add("referer", "https://%s/", sc->authority);
+		for (u = 0; u < sc->jar_cnt; u++)
+			syn_add("cookie", "%s=%s", sc->jar[u].nam,
+			    sc->jar[u].val);
+		break;
+	case SYN_GRPC:
+		syn_add(":method", "POST");
+		syn_add(":scheme", "http");
+		syn_add(":path", "%s", path);
+		syn_add(":authority", "%s", sc->authority);
+		syn_add("content-type", "application/grpc");
+		syn_add("user-agent", "%s", sc->agent);
+		syn_add("te", "trailers");
+		syn_add("grpc-accept-encoding", "identity, deflate, gzip");
+		syn_add("grpc-timeout", "%uS", 1 + syn_below(&sc->rng, 30));
+		syn_add("authorization", "Bearer %s", sc->token);
+		syn_request_id(sc);
+		break;
+	case SYN_API:
+		syn_add(":method", "%s", mth);
+		syn_add(":scheme", "https");
+		syn_add(":authority", "%s", sc->authority);
+		syn_add(":path", "%s/%u", path, syn_below(&sc->rng, 100000));
+		syn_add("accept", "application/json");
+		if (*mth == 'P')
+			syn_add("content-type", "application/json");
+		syn_add("authorization", "Bearer %s", sc->token);
+		syn_add("user-agent", "%s", sc->agent);
+		syn_request_id(sc);
+		break;
+	default:
+		abort();
+	}
+
+	syn_extensions(sc);
+	syn_emit();
+	syn_cookie_drift(sc);
+}
+
+static void
+syn_response(struct syn_conn *sc)
+{
+	char date[64], tag[SYN_VALUESZ];
+	const char *sts;
+
+	sts = syn_statuses[syn_zipf_pick(&syn->z_status, &sc->rng)];
+	syn_date(sc, date, sizeof date);
+
+	switch (syn->wkl) {
+	case SYN_BROWSER:
+		syn_add(":status", "%s", sts);
+		syn_add("date", "%s", date);
+		syn_add("server", "nginx");
+		syn_add("content-type", "%s",
+		    syn_types[syn_zipf_pick(&syn->z_type, &sc->rng)]);
+		syn_add("content-length", "%u",
+		    syn_below(&sc->rng, 1 << syn_below(&sc->rng, 20)));
+		syn_add("cache-control", "%s",
+		    syn_caches[syn_zipf_pick(&syn->z_cache, &sc->rng)]);
+		syn_token(&sc->rng, tag, 16, syn_hex);
+		syn_add("etag", "\"%s\"", tag);
+		syn_add("vary", "Accept-Encoding");
+		if (syn_chance(&sc->rng, syn->drift / 2 + 1)) {
+			syn_token(&sc->rng, tag, syn_length_pick(&sc->rng),
+			    syn_b64);
+			syn_add("set-cookie", "%s=%s; Path=/; Secure; HttpOnly",
+			    sc->jar[0].nam, tag);
+		}
+		break;
+	case SYN_GRPC:
+		syn_add(":status", "200");
+		syn_add("content-type", "application/grpc");
+		syn_add("grpc-encoding", "identity");
+		syn_add("grpc-accept-encoding", "identity, deflate, gzip");
+		syn_extensions(sc);
+		syn_emit();
+		/* NB: trailers go through the same encoder */
+		if (syn_chance(&sc->rng, 95))
+			syn_add("grpc-status", "0");
+		else {
+			syn_add("grpc-status", "%u",
+			    1 + syn_below(&sc->rng, 16));
+			syn_add("grpc-message", "request failed");
+		}
+		break;
+	case SYN_API:
+		syn_add(":status", "%s", sts);
+		syn_add("date", "%s", date);
+		syn_add("content-type", "application/json; charset=utf-8");
+		syn_add("content-length", "%u", syn_below(&sc->rng, 65536));
+		syn_add("cache-control", "no-store");
+		syn_request_id(sc);
+		syn_add("x-ratelimit-remaining", "%u", sc->quota);
+		if (sc->quota > 0)
+			sc->quota--;
+		break;
+	default:
+		abort();
+	}
+
+	if (syn->wkl != SYN_GRPC)
+		syn_extensions(sc);
+	syn_emit();
+}
+
+static void
+syn_connection(unsigned c)
+{
+	struct syn_conn sc[1];
+	unsigned u;
+
+	(void)memset(sc, 0, sizeof sc);
+	syn_seed(&sc->rng, syn->seed, 0x636f6e6e00000000 | c);
+
+	sc->authority = syn_authorities[syn_below(&sc->rng,
+	    SYN_ARRAY_LEN(syn_authorities))];
+	if (syn->wkl == SYN_BROWSER)
+		sc->agent = syn_agents[syn_below(&sc->rng,
+		    SYN_ARRAY_LEN(syn_agents))];
+	else if (syn->wkl == SYN_GRPC)
+		sc->agent = syn_stubs[syn_below(&sc->rng,
+		    SYN_ARRAY_LEN(syn_stubs))];
+	else
+		sc->agent = syn_clients[syn_below(&sc->rng,
+		    SYN_ARRAY_LEN(syn_clients))];
+	syn_token(&sc->rng, sc->token, syn_length_pick(&sc->rng), syn_b64);
+	sc->quota = 1000;
+
+	sc->jar_cnt = 3 + syn_below(&sc->rng, 4);
+	for (u = 0; u < sc->jar_cnt; u++) {
+		syn_token(&sc->rng, sc->jar[u].nam,
+		    2 + syn_below(&sc->rng, 8), syn_b64 + 26);
+		syn_token(&sc->rng, sc->jar[u].val,
+		    syn_length_pick(&sc->rng), syn_b64);
+	}
+
+	for (sc->req = 0; sc->req < syn->lists; sc->req++) {
+		if (syn->resp)
+			syn_response(sc);
+		else
+			syn_request(sc);
+	}
+}
+
+/**********************************************************************
+ * Main
+ */
+
+static int
+syn_usage(const char *prg)
+{
+
+	(void)fprintf(stderr,
+	    "Usage: %s [options]\n\n"
+	    "  -S <seed>    random seed (default: 1)\n"
+	    "  -w <name>    workload: browser (default), grpc or api\n"
+	    "  -R           generate responses instead of requests\n"
+	    "  -c <n>       number of connections (default: 1)\n"
+	    "  -n <n>       messages per connection (default: 16)\n"
+	    "  -z <s>       Zipf exponent of popularities (default: 1.0)\n"
+	    "  -l <dist>    length of generated values: fixed:<n>,\n"
+	    "               uniform:<min>:<max> or exp:<mean> (default: exp:16)\n"
+	    "  -d <pct>     cookie drift per request (default: 10)\n"
+	    "  -e <n>       extension fields per list, at most (default: 2)\n"
+	    "  -F <fmt>     output format: trace (default) or hencode\n"
+	    "\nA gRPC response is made of two header lists, the headers and\n"
+	    "the trailers. The hencode format describes a single connection.\n",
+	    prg);
+	return (EXIT_FAILURE);
+}
+
+static int
+syn_number(const char *arg, unsigned long max, unsigned *val)
+{
+	unsigned long n;
+	char *end;
+
+	n = strtoul(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || n > max)
+		return (-1);
+	*val = (unsigned)n;
+	return (0);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *prg;
+	char *end;
+	unsigned c, u;
+	int o;
+
+	prg = *argv;
+	syn->seed = 1;
+	syn->conns = 1;
+	syn->lists = 16;
+	syn->drift = 10;
+	syn->extra = 2;
+
+	while ((o = getopt(argc, argv, "F:RS:c:d:e:l:n:w:z:")) != -1) {
+		switch (o) {
+		case 'F':
+			if (!strcmp(optarg, "trace"))
+				syn_fmt = SYN_FMT_TRACE;
+			else if (!strcmp(optarg, "hencode"))
+				syn_fmt = SYN_FMT_HENCODE;
+			else
+				return (syn_usage(prg));
+			break;
+		case 'R':
+			syn->resp = 1;
+			break;
+		case 'S':
+			syn->seed = strtoull(optarg, &end, 10);
+			if (*optarg == '\0' || *end != '\0')
+				return (syn_usage(prg));
+			break;
+		case 'c':
+			if (syn_number(optarg, 1000000, &syn->conns) != 0 ||
+			    syn->conns == 0)
+				return (syn_usage(prg));
+			break;
+		case 'd':
+			if (syn_number(optarg, 100, &syn->drift) != 0)
+				return (syn_usage(prg));
+			break;
+		case 'e':
+			if (syn_number(optarg, 16, &syn->extra) != 0)
+				return (syn_usage(prg));
+			break;
+		case 'l':
+			if (syn_length_parse(optarg) != 0)
+				return (syn_usage(prg));
+			break;
+		case 'n':
+			if (syn_number(optarg, 1000000, &syn->lists) != 0 ||
+			    syn->lists == 0)
+				return (syn_usage(prg));
+			break;
+		case 'w':
+			for (u = 0; u < SYN_ARRAY_LEN(syn_workloads); u++)
+				if (!strcmp(optarg, syn_workloads[u]))
+					break;
+			if (u == SYN_ARRAY_LEN(syn_workloads))
+				return (syn_usage(prg));
+			syn->wkl = (enum syn_workload_e)u;
+			break;
+		case 'z':
+			syn_exponent = strtod(optarg, &end);
+			if (*optarg == '\0' || *end != '\0' ||
+			    !(syn_exponent >= 0 && syn_exponent <= 4))
+				return (syn_usage(prg));
+			break;
+		default:
+			return (syn_usage(prg));
+		}
+	}
+
+	if (optind != argc)
+		return (syn_usage(prg));
+	if (syn_fmt == SYN_FMT_HENCODE && syn->conns > 1)
+		return (syn_usage(prg));
+
+	syn_zipf_init(&syn->z_method, SYN_ARRAY_LEN(syn_methods));
+	syn_zipf_init(&syn->z_status, SYN_ARRAY_LEN(syn_statuses));
+	syn_zipf_init(&syn->z_path, SYN_PATHS);
+	syn_zipf_init(&syn->z_type, SYN_ARRAY_LEN(syn_types));
+	syn_zipf_init(&syn->z_cache, SYN_ARRAY_LEN(syn_caches));
+	syn_zipf_init(&syn->z_accept, SYN_ARRAY_LEN(syn_accepts));
+	syn_zipf_init(&syn->z_ext, SYN_EXTENSIONS);
+	syn_zipf_init(&syn->z_var, SYN_VARIANTS);
+
+	if (syn_fmt == SYN_FMT_TRACE)
+		(void)printf("# hsynth -S %ju -w %s%s -c %u -n %u\n",
+		    (uintmax_t)syn->seed, syn_workloads[syn->wkl],
+		    syn->resp ? " -R" : "", syn->conns, syn->lists);
+
+	for (c = 0; c < syn->conns; c++) {
+		if (c > 0 && syn_fmt == SYN_FMT_TRACE)
+			(void)printf("--\n");
+		syn_connection(c);
+	}
+
+	syn_zipf_fini(&syn->z_method);
+	syn_zipf_fini(&syn->z_status);
+	syn_zipf_fini(&syn->z_path);
+	syn_zipf_fini(&syn->z_type);
+	syn_zipf_fini(&syn->z_cache);
+	syn_zipf_fini(&syn->z_accept);
+	syn_zipf_fini(&syn->z_ext);
+	syn_zipf_fini(&syn->z_var);
+
+	if (fflush(stdout) != 0 || ferror(stdout))
+		WRONG("stdout");
+	return (EXIT_SUCCESS);
+}
@@ -0,0 +1,403 @@
+/*-
+ * License: BSD-2-Clause
+ * (c) 2026 Dridi Boukelmoune <dridi.boukelmoune@gmail.com>
+ *
+ * Header list traces shared by the programs replaying them.
+ *
+ * Files ending with .json are read as hpack-test-case stories, other files
+ * as plain text traces with one "name: value" field per line, a blank line
+ * between header lists and a -- line between connections. Lines starting
+ * with # are comments. Each story file is a connection of its own.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hpack.h"
+
+#include "trc.h"
+
+/**********************************************************************
+ * Corpus
+ */
+
+void *
+TRC_grow(void *ptr, size_t cnt, size_t len)
+{
+
+	ptr = realloc(ptr, (cnt + 1) * len);
+	if (ptr == NULL)
+		WRONG("realloc");
+	(void)memset((char *)ptr + cnt * len, 0, len);
+	return (ptr);
+}
+
+static struct trc_conn *
+trc_conn_new(struct trc_corpus *trc)
+{
+
+	trc->conn = TRC_grow(trc->conn, trc->conn_cnt, sizeof *trc->conn);
+	return (&trc->conn[trc->conn_cnt++]);
+}
+
+static struct trc_list *
+trc_list_new(struct trc_corpus *trc, struct trc_conn *conn)
+{
+
+	trc->lst_cnt++;
+	conn->lst = TRC_grow(conn->lst, conn->lst_cnt, sizeof *conn->lst);
+	return (&conn->lst[conn->lst_cnt++]);
+}
+
+static void
+trc_field_add(struct trc_corpus *trc, struct trc_list *lst, char *nam,
+    char *val)
+{
+	struct hpack_field *hf;
+
+	lst->fld = TRC_grow(lst->fld, lst->fld_cnt, sizeof *lst->fld);
+	hf = &lst->fld[lst->fld_cnt++];
+	hf->flg = TRC_FLAGS;
+	hf->nam = nam;
+	hf->val = val;
+
+	trc->fld_cnt++;
+	trc->raw_len += strlen(nam) + strlen(val);
+	if (trc->fld_max < lst->fld_cnt)
+		trc->fld_max = lst->fld_cnt;
+}
+
+static char *
+trc_strndup(const char *str, size_t len)
+{
+	char *dup;
+
+	dup = malloc(len + 1);
+	if (dup == NULL)
+		WRONG("malloc");
+	(void)memcpy(dup, str, len);
+	dup[len] = '\0';
+	return (dup);
+}
+
+void
+TRC_free(struct trc_corpus *trc)
+{
+	struct trc_conn *conn;
+	struct trc_list *lst;
+	size_t c, l, f;
+
+	for (c = 0; c < trc->conn_cnt; c++) {
+		conn = &trc->conn[c];
+		for (l = 0; l < conn->lst_cnt; l++) {
+			lst = &conn->lst[l];
+			for (f = 0; f < lst->fld_cnt; f++) {
+				free((char *)(uintptr_t)lst->fld[f].nam);
+				free((char *)(uintptr_t)lst->fld[f].val);
+			}
+			free(lst->fld);
+		}
+		free(conn->lst);
+	}
+	free(trc->conn);
+	(void)memset(trc, 0, sizeof *trc);
+}
+
+/**********************************************************************
+ * Text traces
+ */
+
+static void
+trc_load_trace(struct trc_corpus *trc, const char *fil, const char *txt,
+    size_t len)
+{
+	struct trc_conn *conn;
+	struct trc_list *lst;
+	const char *end, *eol, *sep;
+	size_t lin;
+
+	conn = NULL;
+	lst = NULL;
+	end = txt + len;
+
+	for (lin = 1; txt < end; lin++, txt = eol + 1) {
+		eol = memchr(txt, '\n', end - txt);
+		if (eol == NULL)
+			eol = end;
+
+		if (*txt == '#')
+			continue;
+
+		if (txt == eol) {
+			lst = NULL;
+			continue;
+		}
+
+		if (eol - txt == 2 && txt[0] == '-' && txt[1] == '-') {
+			conn = NULL;
+			lst = NULL;
+			continue;
+		}
+
+		/* NB: skip the first character for pseudo-headers */
+		sep = memchr(txt + 1, ':', eol - txt - 1);
+		if (sep == NULL || sep + 1 == eol || sep[1] != ' ')
+			FAIL("%s:%zu: invalid field", fil, lin);
+
+		if (conn == NULL)
+			conn = trc_conn_new(trc);
+		if (lst == NULL)
+			lst = trc_list_new(trc, conn);
+		trc_field_add(trc, lst, trc_strndup(txt, sep - txt),
+		    trc_strndup(sep + 2, eol - sep - 2));
+	}
+}
+
+/**********************************************************************
+ * hpack-test-case stories
+ *
+ * Only the cases and their headers are read, and only enough of JSON is
+ * understood to skip everything else.
+ */
+
+struct trc_json {
+	struct trc_corpus	*trc;
+	const char		*fil;
+	const char		*ptr;
+	const char		*end;
+};
+
+static int
+trc_json_peek(struct trc_json *js)
+{
+
+	while (js->ptr < js->end && strchr(" \t\r\n", *js->ptr) != NULL)
+		js->ptr++;
+	if (js->ptr == js->end)
+		FAIL("%s: unexpected end of file", js->fil);
+	return (*js->ptr);
+}
+
+static void
+trc_json_expect(struct trc_json *js, int c)
+{
+
+	if (trc_json_peek(js) != c)
+		FAIL("%s: expected '%c' instead of '%c'", js->fil, c,
+		    *js->ptr);
+	js->ptr++;
+}
+
+static int
+trc_json_next(struct trc_json *js, int c)
+{
+
+	if (trc_json_peek(js) == c) {
+		js->ptr++;
+		return (0);
+	}
+	if (*js->ptr != ',')
+		FAIL("%s: expected ',' or '%c'", js->fil, c);
+	js->ptr++;
+	return (1);
+}
+
+static char *
+trc_json_string(struct trc_json *js)
+{
+	char *str, *s;
+	unsigned u;
+	int n;
+
+	trc_json_expect(js, '"');
+
+	/* escape sequences never expand */
+	str = malloc(js->end - js->ptr + 1);
+	if (str == NULL)
+		WRONG("malloc");
+
+	for (s = str; js->ptr < js->end && *js->ptr != '"'; js->ptr++) {
+		if (*js->ptr != '\\') {
+			*s++ = *js->ptr;
+			continue;
+		}
+		if (++js->ptr == js->end)
+			break;
+		switch (*js->ptr) {
+		case 'b': *s++ = '\b'; break;
+		case 'f': *s++ = '\f'; break;
+		case 'n': *s++ = '\n'; break;
+		case 'r': *s++ = '\r'; break;
+		case 't': *s++ = '\t'; break;
+		case 'u':
+			if (js->end - js->ptr < 5 ||
+			    sscanf(js->ptr + 1, "%4x%n", &u, &n) != 1 ||
+			    n != 4)
+				FAIL("%s: invalid escape sequence", js->fil);
+			js->ptr += 4;
+			/* UTF-8 without surrogate pairs */
+			if (u < 0x80)
+				*s++ = (char)u;
+			else if (u < 0x800) {
+				*s++ = (char)(0xc0 | u >> 6);
+				*s++ = (char)(0x80 | (u & 0x3f));
+			} else {
+				*s++ = (char)(0xe0 | u >> 12);
+				*s++ = (char)(0x80 | (u >> 6 & 0x3f));
+				*s++ = (char)(0x80 | (u & 0x3f));
+			}
+			break;
+		default:
+			*s++ = *js->ptr;
+		}
+	}
+
+	if (js->ptr == js->end)
+		FAIL("%s: unterminated string", js->fil);
+	js->ptr++;
+	*s = '\0';
+	return (str);
+}
+
+static void
+trc_json_skip(struct trc_json *js)
+{
+
+	switch (trc_json_peek(js)) {
+	case '"':
+		free(trc_json_string(js));
+		break;
+	case '{':
+		js->ptr++;
+		if (trc_json_peek(js) == '}') {
+			js->ptr++;
+			break;
+		}
+		do {
+			free(trc_json_string(js));
+			trc_json_expect(js, ':');
+			trc_json_skip(js);
+		} while (trc_json_next(js, '}'));
+		break;
+	case '[':
+		js->ptr++;
+		if (trc_json_peek(js) == ']') {
+			js->ptr++;
+			break;
+		}
+		do
+			trc_json_skip(js);
+		while (trc_json_next(js, ']'));
+		break;
+	default:
+		/* numbers, booleans and null */
+		while (js->ptr < js->end &&
+		    strchr(",}] \t\r\n", *js->ptr) == NULL)
+			js->ptr++;
+	}
+}
+
+static void
+trc_json_headers(struct trc_json *js, struct trc_conn *conn)
+{
+	struct trc_list *lst;
+	char *nam;
+
+	lst = trc_list_new(js->trc, conn);
+	trc_json_expect(js, '[');
+	if (trc_json_peek(js) == ']') {
+		js->ptr++;
+		return;
+	}
+	do {
+		trc_json_expect(js, '{');
+		nam = trc_json_string(js);
+		trc_json_expect(js, ':');
+		trc_field_add(js->trc, lst, nam, trc_json_string(js));
+		trc_json_expect(js, '}');
+	} while (trc_json_next(js, ']'));
+}
+
+static void
+trc_json_case(struct trc_json *js, struct trc_conn *conn)
+{
+	char *key;
+
+	trc_json_expect(js, '{');
+	do {
+		key = trc_json_string(js);
+		trc_json_expect(js, ':');
+		if (!strcmp(key, "headers"))
+			trc_json_headers(js, conn);
+		else
+			trc_json_skip(js);
+		free(key);
+	} while (trc_json_next(js, '}'));
+}
+
+static void
+trc_load_story(struct trc_corpus *trc, const char *fil, const char *txt,
+    size_t len)
+{
+	struct trc_json js[1];
+	struct trc_conn *conn;
+	char *key;
+
+	js->trc = trc;
+	js->fil = fil;
+	js->ptr = txt;
+	js->end = txt + len;
+	conn = trc_conn_new(trc);
+
+	trc_json_expect(js, '{');
+	do {
+		key = trc_json_string(js);
+		trc_json_expect(js, ':');
+		if (strcmp(key, "cases")) {
+			trc_json_skip(js);
+			free(key);
+			continue;
+		}
+		free(key);
+		trc_json_expect(js, '[');
+		if (trc_json_peek(js) == ']') {
+			js->ptr++;
+			continue;
+		}
+		do
+			trc_json_case(js, conn);
+		while (trc_json_next(js, ']'));
+	} while (trc_json_next(js, '}'));
+}
+
+void
+TRC_load(struct trc_corpus *trc, const char *fil)
+{
+	FILE *fp;
+	char *txt;
+	size_t len, sfx;
+
+	fp = fopen(fil, "r");
+	if (fp == NULL)
+		WRONG(fil);
+
+	txt = NULL;
+	len = 0;
+	do {
+		txt = TRC_grow(txt, len, BUFSIZ);
+		len += fread(txt + len, 1, BUFSIZ, fp);
+	} while (!feof(fp) && !ferror(fp));
+
+	if (ferror(fp))
+		WRONG(fil);
+	(void)fclose(fp);
+
+	sfx = strlen(fil);
+	if (sfx > 5 && !strcmp(fil + sfx - 5, ".json"))
+		trc_load_story(trc, fil, txt, len);
+	else
+		trc_load_trace(trc, fil, txt, len);
+	free(txt);
+}
@@ -0,0 +1,47 @@
+/*-
+ * License: BSD-2-Clause
+ * (c) 2026 Dridi Boukelmoune <dridi.boukelmoune@gmail.com>
+ */
+
+#define WRONG(str)		\
+	do {			\
+		perror(str);	\
+		abort();	\
+	} while (0)
+
+#define FAIL(...)						\
+	do {							\
+		(void)fprintf(stderr, __VA_ARGS__);		\
+		(void)fprintf(stderr, "\n");			\
+		exit(EXIT_FAILURE);				\
+	} while (0)
+
+#define TRC_FLAGS						\
+	(HPACK_FLG_TYP_DYN | HPACK_FLG_AUT_IDX |		\
+	 HPACK_FLG_NAM_HUF | HPACK_FLG_VAL_HUF)
+
+/* NB: requires hpack.h */
+
+struct trc_list {
+	struct hpack_field	*fld;
+	size_t			fld_cnt;
+	void			*priv; /* owned by the program */
+};
+
+struct trc_conn {
+	struct trc_list	*lst;
+	size_t		lst_cnt;
+};
+
+struct trc_corpus {
+	struct trc_conn		*conn;
+	size_t			conn_cnt;
+	size_t			lst_cnt;
+	size_t			fld_cnt;
+	size_t			fld_max;
+	size_t			raw_len;
+};
+
+void *TRC_grow(void *, size_t, size_t);
+void  TRC_load(struct trc_corpus *, const char *);
+void  TRC_free(struct trc_corpus *);